@@ -0,0 +1,1467 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "bench_workload.h"
+#include "kvs.h"
+
+/**
+ * `bench` measures the cache layer in isolation. Each mode prints one table
+ * row per configuration so runs can be compared across commits.
+ */
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * `bench_hit` fills each cache with `capacity` keys and then times GETs of
+ * random resident keys, so every lookup is a hit and the disk is never read.
+ */
+static int bench_hit(const char* directory, int max_capacity) {
+  const kvs_replacement_policy policies[] = {
+      KVS_CACHE_FIFO, KVS_CACHE_CLOCK, KVS_CACHE_LRU,
+      KVS_CACHE_ARC,  KVS_CACHE_2Q,    KVS_CACHE_TINYLFU};
+  const int lookups = 1000000;
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+
+  printf("%-7s %10s %12s\n", "POLICY", "CAPACITY", "NS/HIT");
+  for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); ++p) {
+    for (int capacity = 16; capacity <= max_capacity; capacity *= 4) {
+      kvs_t* kvs = kvs_new(directory, policies[p], capacity);
+      if (kvs == NULL) {
+        fprintf(stderr, "kvs_new failed\n");
+        return 1;
+      }
+      for (int i = 0; i < capacity; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        kvs_set(kvs, key, "value");
+      }
+
+      srand(42);
+      double start = now_ns();
+      for (int i = 0; i < lookups; ++i) {
+        snprintf(key, sizeof(key), "key%d", rand() % capacity);
+        kvs_get(kvs, key, value);
+      }
+      double elapsed = now_ns() - start;
+
+      printf("%-7s %10d %12.1f\n", kvs_policy_name(policies[p]), capacity,
+             elapsed / lookups);
+      // dropped without a flush so nothing is written to `directory`
+      kvs_free(&kvs);
+    }
+  }
+  return 0;
+}
+
+/**
+ * `bench_memory` fills each cache with small entries (a 10-byte key and a
+ * 20-byte value) and compares the bytes it holds against what fixed
+ * `KVS_KEY_MAX` + `KVS_VALUE_MAX` slots would take for the same entries.
+ */
+static int bench_memory(const char* directory, int capacity) {
+  const kvs_replacement_policy policies[] = {
+      KVS_CACHE_FIFO, KVS_CACHE_CLOCK, KVS_CACHE_LRU,
+      KVS_CACHE_ARC,  KVS_CACHE_2Q,    KVS_CACHE_TINYLFU};
+  // a fixed slot also carries its flags and list links
+  const double fixed_slot = KVS_KEY_MAX + KVS_VALUE_MAX + 16;
+  char key[KVS_KEY_MAX];
+
+  printf("%-7s %10s %12s %12s %14s %8s\n", "POLICY", "ENTRIES", "BYTES/ENTRY",
+         "FIXED/ENTRY", "ENTRIES/GB", "SAVING");
+  for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); ++p) {
+    kvs_t* kvs = kvs_new(directory, policies[p], capacity);
+    if (kvs == NULL) {
+      fprintf(stderr, "kvs_new failed\n");
+      return 1;
+    }
+    for (int i = 0; i < capacity; ++i) {
+      snprintf(key, sizeof(key), "key%07d", i);
+      kvs_set(kvs, key, "value-of-20-bytes-xx");
+    }
+
+    double per_entry = (double)kvs_memory(kvs) / capacity;
+    printf("%-7s %10d %12.1f %12.1f %14.0f %7.1fx\n",
+           kvs_policy_name(policies[p]), capacity, per_entry, fixed_slot,
+           (1 << 30) / per_entry, fixed_slot / per_entry);
+    kvs_free(&kvs);
+  }
+  return 0;
+}
+
+/**
+ * `bench_backend` compares the storage backends without a cache: it SETs
+ * `keys` keys, GETs them back in random order and then reopens the store,
+ * which for the LOG backend means rebuilding its index from the segments.
+ * Each backend gets its own subdirectory of `directory`.
+ */
+static int bench_backend(const char* directory, int keys) {
+  const kvs_base_backend backends[] = {KVS_BASE_FILE, KVS_BASE_LOG};
+  const char* names[] = {"FILE", "LOG"};
+  char path[PATH_MAX];
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+
+  mkdir(directory, S_IRWXU | S_IRWXG | S_IRWXO);
+  printf("%-7s %10s %12s %12s %12s\n", "BACKEND", "KEYS", "SET/S", "GET/S",
+         "OPEN MS");
+  for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); ++b) {
+    if (snprintf(path, sizeof(path), "%s/%s", directory, names[b]) >=
+        (int)sizeof(path)) {
+      return 1;
+    }
+    kvs_base_t* kvs_base = kvs_base_new_backend(path, backends[b]);
+    if (kvs_base == NULL) {
+      fprintf(stderr, "kvs_base_new_backend failed\n");
+      return 1;
+    }
+
+    double start = now_ns();
+    for (int i = 0; i < keys; ++i) {
+      snprintf(key, sizeof(key), "key%d", i);
+      kvs_base_set(kvs_base, key, "value-of-20-bytes-xx");
+    }
+    double set_ns = now_ns() - start;
+
+    srand(42);
+    start = now_ns();
+    for (int i = 0; i < keys; ++i) {
+      snprintf(key, sizeof(key), "key%d", rand() % keys);
+      kvs_base_get(kvs_base, key, value);
+    }
+    double get_ns = now_ns() - start;
+    kvs_base_free(&kvs_base);
+
+    start = now_ns();
+    kvs_base = kvs_base_new_backend(path, backends[b]);
+    double open_ns = now_ns() - start;
+    kvs_base_free(&kvs_base);
+
+    printf("%-7s %10d %12.0f %12.0f %12.1f\n", names[b], keys,
+           keys / (set_ns / 1e9), keys / (get_ns / 1e9), open_ns / 1e6);
+  }
+  return 0;
+}
+
+/**
+ * `bench_layout` compares the flat and the fan-out directory layouts of the
+ * FILE backend at `keys` keys, each in its own subdirectory of `directory`.
+ * It SETs every key, reporting the rate over all of them and over the last
+ * tenth, when the directory is at its largest; then GETs a million random
+ * present keys and a hundred thousand absent ones, and times the directory
+ * walk that builds the negative-lookup filter. If `only` is set, just that
+ * layout runs, for disks without room for two stores of `keys` files.
+ */
+static int bench_layout(const char* directory, int keys, const char* only) {
+  const kvs_dir_layout layouts[] = {KVS_DIR_FLAT, KVS_DIR_FANOUT};
+  const char* names[] = {"FLAT", "FANOUT"};
+  const int gets = keys < 1000000 ? keys : 1000000;
+  const int misses = 100000;
+  char path[PATH_MAX];
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+
+  mkdir(directory, S_IRWXU | S_IRWXG | S_IRWXO);
+  printf("%-7s %10s %10s %12s %10s %10s %10s %7s\n", "LAYOUT", "KEYS",
+         "SET/S", "LAST SET/S", "GET/S", "MISS/S", "SCAN MS", "FAILED");
+  for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); ++l) {
+    if (only && strcmp(only, names[l]) != 0) {
+      continue;
+    }
+    if (snprintf(path, sizeof(path), "%s/%s", directory, names[l]) >=
+        (int)sizeof(path)) {
+      return 1;
+    }
+    kvs_base_t* kvs_base = kvs_base_new_layout(path, KVS_BASE_FILE,
+                                               layouts[l]);
+    if (kvs_base == NULL) {
+      fprintf(stderr, "kvs_base_new_layout failed\n");
+      return 1;
+    }
+
+    int failed = 0;
+    int last = keys - keys / 10;
+    double start = now_ns();
+    double last_start = start;
+    for (int i = 0; i < keys; ++i) {
+      if (i == last) {
+        last_start = now_ns();
+      }
+      snprintf(key, sizeof(key), "key%d", i);
+      failed += kvs_base_set(kvs_base, key, "value-of-20-bytes-xx") != 0;
+    }
+    double end = now_ns();
+    double set_ns = end - start;
+    double last_ns = end - last_start;
+
+    srand(42);
+    start = now_ns();
+    for (int i = 0; i < gets; ++i) {
+      snprintf(key, sizeof(key), "key%d", rand() % keys);
+      kvs_base_get(kvs_base, key, value);
+    }
+    double get_ns = now_ns() - start;
+
+    start = now_ns();
+    for (int i = 0; i < misses; ++i) {
+      snprintf(key, sizeof(key), "absent%d", i);
+      kvs_base_get(kvs_base, key, value);
+    }
+    double miss_ns = now_ns() - start;
+
+    start = now_ns();
+    kvs_base_enable_filter(kvs_base);
+    double scan_ns = now_ns() - start;
+    kvs_base_free(&kvs_base);
+
+    printf("%-7s %10d %10.0f %12.0f %10.0f %10.0f %10.0f %7d\n", names[l],
+           keys, keys / (set_ns / 1e9), (keys - last) / (last_ns / 1e9),
+           gets / (get_ns / 1e9), misses / (miss_ns / 1e9), scan_ns / 1e6,
+           failed);
+  }
+  return 0;
+}
+
+typedef struct bench_worker {
+  kvs_t* kvs;
+  int keys;
+  int operations;
+  uint64_t seed;
+} bench_worker_t;
+
+static void* bench_threads_worker(void* arg) {
+  bench_worker_t* worker = arg;
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+  uint64_t x = worker->seed;
+  for (int i = 0; i < worker->operations; ++i) {
+    // xorshift64, so the workers do not contend on `rand`
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    snprintf(key, sizeof(key), "key%d", (int)(x % worker->keys));
+    if (x % 10 == 0) {
+      kvs_set(worker->kvs, key, "value");
+    } else {
+      kvs_get(worker->kvs, key, value);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * `bench_threads` runs `threads` workers against one shared cache, each doing
+ * 90% GETs and 10% SETs of random resident keys, and reports the combined
+ * throughput. It compares a single shard (one lock for the whole cache, like
+ * wrapping every call in a global mutex) with one shard per 4096 entries,
+ * for LRU, where every hit takes the lock, and CLOCK, where hits do not.
+ */
+static int bench_threads(const char* directory, int capacity) {
+  const int operations = 200000;
+  const int max_threads = 32;
+  int shard_counts[] = {1, capacity / 4096 > 1 ? capacity / 4096 : 1};
+  int shard_options = sizeof(shard_counts) / sizeof(shard_counts[0]);
+  kvs_replacement_policy policies[] = {KVS_CACHE_LRU, KVS_CACHE_CLOCK};
+  pthread_t tids[32];
+  bench_worker_t workers[32];
+  char key[KVS_KEY_MAX];
+
+  printf("%-6s %8s %8s %14s\n", "POLICY", "SHARDS", "THREADS", "OPS/S");
+  for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); ++p) {
+    for (int s = 0; s < shard_options; ++s) {
+      for (int threads = 1; threads <= max_threads; threads *= 2) {
+        kvs_config_t config;
+        kvs_config_init(&config, directory, policies[p], capacity);
+        config.shards = shard_counts[s];
+        kvs_t* kvs = kvs_new_config(&config);
+        if (kvs == NULL) {
+          fprintf(stderr, "kvs_new failed\n");
+          return 1;
+        }
+        for (int i = 0; i < capacity; ++i) {
+          snprintf(key, sizeof(key), "key%d", i);
+          kvs_set(kvs, key, "value");
+        }
+
+        double start = now_ns();
+        for (int t = 0; t < threads; ++t) {
+          workers[t] = (bench_worker_t){kvs, capacity, operations,
+                                        0x9e3779b97f4a7c15ULL * (t + 1)};
+          pthread_create(&tids[t], NULL, bench_threads_worker, &workers[t]);
+        }
+        for (int t = 0; t < threads; ++t) {
+          pthread_join(tids[t], NULL);
+        }
+        double elapsed = now_ns() - start;
+
+        printf("%-6s %8d %8d %14.0f\n", kvs_policy_name(policies[p]),
+               kvs->shard_count, threads,
+               (double)threads * operations / (elapsed / 1e9));
+        // dropped without a flush so nothing is written to `directory`
+        kvs_free(&kvs);
+      }
+    }
+  }
+  return 0;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * `bench_write_back` runs a write-heavy mix (half SETs, half GETs over four
+ * times as many keys as the cache holds) with dirty entries written back on
+ * eviction and again with the background flusher, and prints the latency
+ * percentiles of each operation. Each run gets its own subdirectory of
+ * `directory`.
+ */
+static int bench_write_back(const char* directory, int capacity) {
+  const kvs_replacement_policy policies[] = {KVS_CACHE_FIFO, KVS_CACHE_CLOCK,
+                                             KVS_CACHE_LRU};
+  const int operations = 200000;
+  const int keys = capacity * 4;
+  double* latencies = malloc(operations * sizeof(double));
+  char path[PATH_MAX];
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+  if (latencies == NULL) {
+    return 1;
+  }
+
+  mkdir(directory, S_IRWXU | S_IRWXG | S_IRWXO);
+  printf("%-6s %-10s %10s %10s %10s %10s\n", "POLICY", "WRITE-BACK", "P50 NS",
+         "P99 NS", "P999 NS", "MAX NS");
+  for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); ++p) {
+    for (int background = 0; background <= 1; ++background) {
+      if (snprintf(path, sizeof(path), "%s/%s-%d", directory,
+                   kvs_policy_name(policies[p]),
+                   background) >= (int)sizeof(path)) {
+        free(latencies);
+        return 1;
+      }
+      kvs_config_t config;
+      kvs_config_init(&config, path, policies[p], capacity);
+      config.write_back = background;
+      kvs_t* kvs = kvs_new_config(&config);
+      if (kvs == NULL) {
+        fprintf(stderr, "kvs_new failed\n");
+        free(latencies);
+        return 1;
+      }
+
+      srand(42);
+      for (int i = 0; i < operations; ++i) {
+        snprintf(key, sizeof(key), "key%d", rand() % keys);
+        double start = now_ns();
+        if (i % 2 == 0) {
+          kvs_set(kvs, key, "value-of-20-bytes-xx");
+        } else {
+          kvs_get(kvs, key, value);
+        }
+        latencies[i] = now_ns() - start;
+      }
+      kvs_free(&kvs);
+
+      qsort(latencies, operations, sizeof(double), compare_doubles);
+      printf("%-6s %-10s %10.0f %10.0f %10.0f %10.0f\n",
+             kvs_policy_name(policies[p]),
+             background ? "BACKGROUND" : "EVICTION",
+             latencies[operations / 2], latencies[operations * 99 / 100],
+             latencies[operations * 999 / 1000], latencies[operations - 1]);
+    }
+  }
+  free(latencies);
+  return 0;
+}
+
+static void* bench_wal_worker(void* arg) {
+  bench_worker_t* worker = arg;
+  char key[KVS_KEY_MAX];
+  uint64_t x = worker->seed;
+  for (int i = 0; i < worker->operations; ++i) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    snprintf(key, sizeof(key), "key%d", (int)(x % worker->keys));
+    kvs_set(worker->kvs, key, "value-of-20-bytes-xx");
+  }
+  return NULL;
+}
+
+/**
+ * `bench_wal` runs 1 to 16 threads of SETs against a write-back LRU cache
+ * that holds every key, without a write-ahead log and with each durability
+ * level, and prints the combined throughput and how many records each sync
+ * of the log covered. Each run gets its own subdirectory of `directory`,
+ * and its log is left there.
+ */
+static int bench_wal(const char* directory, int operations) {
+  const char* names[] = {"OFF", "NONE", "BATCH", "ALWAYS"};
+  const kvs_wal_durability durabilities[] = {KVS_WAL_NONE, KVS_WAL_NONE,
+                                             KVS_WAL_BATCH, KVS_WAL_ALWAYS};
+  const int keys = 1000;
+  pthread_t tids[16];
+  bench_worker_t workers[16];
+  char path[PATH_MAX];
+
+  mkdir(directory, S_IRWXU | S_IRWXG | S_IRWXO);
+  printf("%-6s %8s %12s %14s\n", "WAL", "THREADS", "SET/S", "RECORDS/SYNC");
+  for (int m = 0; m < 4; ++m) {
+    for (int threads = 1; threads <= 16; threads *= 4) {
+      if (snprintf(path, sizeof(path), "%s/%s-%d", directory, names[m],
+                   threads) >= (int)sizeof(path)) {
+        return 1;
+      }
+      kvs_config_t config;
+      kvs_config_init(&config, path, KVS_CACHE_LRU, keys);
+      config.shards = 16;
+      config.wal = m > 0;
+      config.wal_durability = durabilities[m];
+      kvs_t* kvs = kvs_new_config(&config);
+      if (kvs == NULL) {
+        fprintf(stderr, "kvs_new_config failed\n");
+        return 1;
+      }
+
+      double start = now_ns();
+      for (int t = 0; t < threads; ++t) {
+        workers[t] = (bench_worker_t){kvs, keys, operations,
+                                      0x9e3779b97f4a7c15ULL * (t + 1)};
+        pthread_create(&tids[t], NULL, bench_wal_worker, &workers[t]);
+      }
+      for (int t = 0; t < threads; ++t) {
+        pthread_join(tids[t], NULL);
+      }
+      double elapsed = now_ns() - start;
+
+      kvs_stats_t stats;
+      kvs_stats(kvs, &stats);
+      printf("%-6s %8d %12.0f %14.1f\n", names[m], threads,
+             (double)threads * operations / (elapsed / 1e9),
+             stats.wal_syncs ? (double)stats.wal_records / stats.wal_syncs
+                             : 0.0);
+      kvs_free(&kvs);
+    }
+  }
+  return 0;
+}
+
+/**
+ * `bench_flush` times writing `entries` dirty entries back: one
+ * `kvs_base_set` at a time, as `kvs_flush` used to, and through `kvs_flush`
+ * of an LRU cache holding them all, which hands them over as one batch. Each
+ * run gets its own subdirectory of `directory`.
+ */
+static int bench_flush(const char* directory, int entries) {
+  const char* names[] = {"SEQUENTIAL", "BATCH"};
+  char path[PATH_MAX];
+  char key[KVS_KEY_MAX];
+
+  mkdir(directory, S_IRWXU | S_IRWXG | S_IRWXO);
+  printf("%-10s %10s %12s %14s\n", "FLUSH", "ENTRIES", "MS", "WRITES/S");
+  for (int batched = 0; batched <= 1; ++batched) {
+    if (snprintf(path, sizeof(path), "%s/%s", directory, names[batched]) >=
+        (int)sizeof(path)) {
+      return 1;
+    }
+    kvs_t* kvs = kvs_new(path, KVS_CACHE_LRU, entries);
+    if (kvs == NULL) {
+      fprintf(stderr, "kvs_new failed\n");
+      return 1;
+    }
+    for (int i = 0; i < entries; ++i) {
+      snprintf(key, sizeof(key), "key%d", i);
+      kvs_set(kvs, key, "value-of-20-bytes-xx");
+    }
+
+    double start = now_ns();
+    if (batched) {
+      kvs_flush(kvs);
+    } else {
+      for (int i = 0; i < entries; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        kvs_base_set(kvs->kvs_base, key, "value-of-20-bytes-xx");
+      }
+    }
+    double elapsed = now_ns() - start;
+
+    printf("%-10s %10d %12.1f %14.0f\n", names[batched], entries,
+           elapsed / 1e6, entries / (elapsed / 1e9));
+    kvs_free(&kvs);
+  }
+  return 0;
+}
+
+/**
+ * `bench_absent` stores `keys` keys with the FILE backend and then GETs keys
+ * that were never stored, each one twice, without a cache, first with plain
+ * lookups and then with the negative-lookup filter. It reports the GET rate
+ * and how many of the GETs still reached the disk.
+ */
+static int bench_absent(const char* directory, int keys) {
+  const int lookups = 100000;
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+
+  printf("%-6s %10s %12s %12s\n", "FILTER", "KEYS", "GET/S", "DISK GETS");
+  for (int filter = 0; filter <= 1; ++filter) {
+    kvs_config_t config;
+    kvs_config_init(&config, directory, KVS_CACHE_NONE, 0);
+    config.filter = filter;
+    kvs_t* kvs = kvs_new_config(&config);
+    if (kvs == NULL) {
+      fprintf(stderr, "kvs_new failed\n");
+      return 1;
+    }
+    if (!filter) {
+      for (int i = 0; i < keys; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        kvs_set(kvs, key, "value-of-20-bytes-xx");
+      }
+    }
+
+    int disk_before = atomic_load(&kvs->kvs_base->get_count);
+    double start = now_ns();
+    for (int i = 0; i < lookups; ++i) {
+      snprintf(key, sizeof(key), "absent%d", i / 2);
+      kvs_get(kvs, key, value);
+    }
+    double elapsed = now_ns() - start;
+
+    printf("%-6s %10d %12.0f %12d\n", filter ? "ON" : "OFF", keys,
+           lookups / (elapsed / 1e9),
+           atomic_load(&kvs->kvs_base->get_count) - disk_before);
+    kvs_free(&kvs);
+  }
+  return 0;
+}
+
+/**
+ * `bench_mget` stores `keys` keys and then reads them back in random groups
+ * of 32 through a small LRU cache, so nearly every GET misses: once with 32
+ * `kvs_get` calls per group and once with a single `kvs_mget`. It reports
+ * the GET rate and the mean time to answer a group.
+ */
+static int bench_mget(const char* directory, int keys) {
+  enum { GROUP = 32 };
+  const int groups = 2000;
+  char key_buffers[GROUP][KVS_KEY_MAX];
+  char value_buffers[GROUP][KVS_VALUE_MAX];
+  const char* group_keys[GROUP];
+  char* group_values[GROUP];
+  for (int i = 0; i < GROUP; ++i) {
+    group_keys[i] = key_buffers[i];
+    group_values[i] = value_buffers[i];
+  }
+
+  kvs_t* kvs = kvs_new(directory, KVS_CACHE_NONE, 0);
+  if (kvs == NULL) {
+    fprintf(stderr, "kvs_new failed\n");
+    return 1;
+  }
+  for (int i = 0; i < keys; ++i) {
+    snprintf(key_buffers[0], KVS_KEY_MAX, "key%d", i);
+    kvs_set(kvs, key_buffers[0], "value-of-20-bytes-xx");
+  }
+  kvs_free(&kvs);
+
+  printf("%-6s %10s %12s %14s\n", "READS", "KEYS", "GET/S", "US/GROUP");
+  for (int batched = 0; batched <= 1; ++batched) {
+    kvs = kvs_new(directory, KVS_CACHE_LRU, GROUP);
+    if (kvs == NULL) {
+      fprintf(stderr, "kvs_new failed\n");
+      return 1;
+    }
+    srand(1);
+    double start = now_ns();
+    for (int g = 0; g < groups; ++g) {
+      for (int i = 0; i < GROUP; ++i) {
+        snprintf(key_buffers[i], KVS_KEY_MAX, "key%d", rand() % keys);
+      }
+      if (batched) {
+        kvs_mget(kvs, GROUP, group_keys, group_values);
+      } else {
+        for (int i = 0; i < GROUP; ++i) {
+          kvs_get(kvs, group_keys[i], group_values[i]);
+        }
+      }
+    }
+    double elapsed = now_ns() - start;
+
+    printf("%-6s %10d %12.0f %14.1f\n", batched ? "MGET" : "GET", keys,
+           groups * GROUP / (elapsed / 1e9), elapsed / groups / 1e3);
+    kvs_free(&kvs);
+  }
+  return 0;
+}
+
+/**
+ * `bench_policies` compares the hit rates of the replacement policies on a
+ * hot set interrupted by scans: each round GETs random keys of a hot set
+ * (half or nine tenths of the capacity) and then scans cold keys that are
+ * seen once (half or twice the capacity of them). A hit is a GET the cache
+ * answered without reading the disk.
+ */
+static int bench_policies(const char* directory, int capacity) {
+  const kvs_replacement_policy policies[] = {
+      KVS_CACHE_FIFO, KVS_CACHE_CLOCK, KVS_CACHE_LRU,
+      KVS_CACHE_ARC,  KVS_CACHE_2Q,    KVS_CACHE_TINYLFU};
+  const int hot_percents[] = {50, 90};
+  const int scan_percents[] = {50, 200};
+  const int rounds = 20;
+  const int cold_keys = 10 * capacity;
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+
+  mkdir(directory, S_IRWXU | S_IRWXG | S_IRWXO);
+  kvs_base_t* kvs_base = kvs_base_new(directory);
+  if (kvs_base == NULL) {
+    fprintf(stderr, "kvs_base_new failed\n");
+    return 1;
+  }
+  for (int i = 0; i < capacity; ++i) {
+    snprintf(key, sizeof(key), "hot%d", i);
+    kvs_base_set(kvs_base, key, "value-of-20-bytes-xx");
+  }
+  for (int i = 0; i < cold_keys; ++i) {
+    snprintf(key, sizeof(key), "cold%d", i);
+    kvs_base_set(kvs_base, key, "value-of-20-bytes-xx");
+  }
+  kvs_base_free(&kvs_base);
+
+  printf("%-7s %10s %6s %6s %10s\n", "POLICY", "CAPACITY", "HOT%", "SCAN%",
+         "HIT RATE");
+  for (int w = 0; w < 4; ++w) {
+    int hot_percent = hot_percents[w / 2];
+    int scan_percent = scan_percents[w % 2];
+    int hot_keys = capacity * hot_percent / 100;
+    int scan_keys = capacity * scan_percent / 100;
+    for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); ++p) {
+      kvs_t* kvs = kvs_new(directory, policies[p], capacity);
+      if (kvs == NULL) {
+        fprintf(stderr, "kvs_new failed\n");
+        return 1;
+      }
+
+      srand(42);
+      int cold = 0;
+      for (int round = 0; round < rounds; ++round) {
+        for (int i = 0; i < 5 * capacity; ++i) {
+          snprintf(key, sizeof(key), "hot%d", rand() % hot_keys);
+          kvs_get(kvs, key, value);
+        }
+        for (int i = 0; i < scan_keys; ++i) {
+          snprintf(key, sizeof(key), "cold%d", cold++ % cold_keys);
+          kvs_get(kvs, key, value);
+        }
+      }
+
+      double gets = kvs_get_count(kvs);
+      double misses = atomic_load(&kvs->kvs_base->get_count);
+      printf("%-7s %10d %6d %6d %10.3f\n", kvs_policy_name(policies[p]),
+             capacity, hot_percent, scan_percent, 1 - misses / gets);
+      kvs_free(&kvs);
+    }
+  }
+  return 0;
+}
+
+/**
+ * `budget_run` runs `operations` requests of `workload` against a fresh cache
+ * bounded by `capacity` entries or, when `memory` is nonzero, by `memory`
+ * bytes. It prints one row and stores the final number of resident entries
+ * in `*resident`. Peak memory is sampled every 1000 requests.
+ */
+static int budget_run(const char* directory, bench_workload_t* workload,
+                      kvs_replacement_policy policy, int capacity,
+                      size_t memory, int operations, int* resident) {
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+  kvs_config_t config;
+  kvs_config_init(&config, directory, policy, memory ? 0 : capacity);
+  config.shards = 1;
+  config.memory = memory;
+  kvs_t* kvs = kvs_new_config(&config);
+  if (kvs == NULL) {
+    fprintf(stderr, "kvs_new_config failed\n");
+    return 1;
+  }
+
+  bench_workload_start(workload, workload->keys, 42);
+  int disk_gets = atomic_load(&kvs->kvs_base->get_count);
+  int gets = 0;
+  size_t peak = 0;
+  for (int i = 0; i < operations; ++i) {
+    bool write;
+    bench_workload_next(workload, key, value, &write);
+    if (write) {
+      kvs_set(kvs, key, value);
+    } else {
+      kvs_get(kvs, key, value);
+      gets++;
+    }
+    if (i % 1000 == 999) {
+      size_t used = kvs_memory(kvs);
+      peak = used > peak ? used : peak;
+    }
+  }
+  disk_gets = atomic_load(&kvs->kvs_base->get_count) - disk_gets;
+  kvs_stats_t stats;
+  kvs_stats(kvs, &stats);
+  *resident = stats.resident;
+  kvs_free(&kvs);
+
+  printf("%-13s %-7s %-7s %9d %10zu %10.3f\n", workload->name,
+         kvs_policy_name(policy), memory ? "bytes" : "entries", stats.resident,
+         peak, gets ? 1 - (double)disk_gets / gets : 0);
+  return 0;
+}
+
+/**
+ * `bench_budget` shows what bounding the cache by bytes buys over bounding it
+ * by entries. For each policy it first runs a byte budget of `memory` over
+ * mixed value sizes and takes the resident count it settles at as the entry
+ * capacity that matches the budget. It then runs both modes over small, large
+ * and mixed values: the entry bound wastes memory on small values and
+ * overshoots on large ones, while the byte bound holds its peak near `memory`
+ * and trades entries for hit rate as values grow.
+ */
+static int bench_budget(const char* directory, size_t memory) {
+  const kvs_replacement_policy policies[] = {
+      KVS_CACHE_FIFO, KVS_CACHE_CLOCK, KVS_CACHE_LRU,
+      KVS_CACHE_ARC,  KVS_CACHE_2Q,    KVS_CACHE_TINYLFU};
+  bench_workload_t workloads[] = {
+      {.name = "mixed-values", .distribution = BENCH_ZIPF, .skew = 0.99,
+       .write_percent = 5, .value_min = 1, .value_max = KVS_VALUE_MAX - 1},
+      {.name = "small-values", .distribution = BENCH_ZIPF, .skew = 0.99,
+       .write_percent = 5, .value_min = 1, .value_max = 64},
+      {.name = "large-values", .distribution = BENCH_ZIPF, .skew = 0.99,
+       .write_percent = 5, .value_min = 256, .value_max = KVS_VALUE_MAX - 1},
+  };
+  const int count = sizeof(workloads) / sizeof(workloads[0]);
+  const int keys = 20000;
+  const int operations = 200000;
+  char path[4096];
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+
+  // each workload gets its own store, filled at its value sizes
+  mkdir(directory, S_IRWXU | S_IRWXG | S_IRWXO);
+  for (int w = 0; w < count; ++w) {
+    snprintf(path, sizeof(path), "%s/%s", directory, workloads[w].name);
+    mkdir(path, S_IRWXU | S_IRWXG | S_IRWXO);
+    bench_workload_start(&workloads[w], keys, 7);
+    kvs_base_t* kvs_base = kvs_base_new(path);
+    if (kvs_base == NULL) {
+      fprintf(stderr, "kvs_base_new failed\n");
+      return 1;
+    }
+    for (int i = 0; i < keys; ++i) {
+      bench_workload_key(&workloads[w], i, key);
+      bench_workload_value(&workloads[w], value);
+      kvs_base_set(kvs_base, key, value);
+    }
+    kvs_base_free(&kvs_base);
+  }
+
+  printf("budget of %zu bytes\n", memory);
+  printf("%-13s %-7s %-7s %9s %10s %10s\n", "WORKLOAD", "POLICY", "MODE",
+         "RESIDENT", "PEAK", "HIT RATE");
+  for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); ++p) {
+    int capacity = 0;
+    for (int w = 0; w < count; ++w) {
+      int resident;
+      snprintf(path, sizeof(path), "%s/%s", directory, workloads[w].name);
+      if (budget_run(path, &workloads[w], policies[p], 0, memory, operations,
+                     &resident) != 0) {
+        return 1;
+      }
+      if (w == 0) {
+        capacity = resident > 0 ? resident : 1;
+      }
+      if (budget_run(path, &workloads[w], policies[p], capacity, 0,
+                     operations, &resident) != 0) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/**
+ * `bench_warm` measures what a cache snapshot buys after a restart. Each
+ * policy first runs a Zipfian read workload over `keys` keys with a capacity
+ * of a tenth of them, and saves a snapshot when it closes. The cache is then
+ * reopened cold, reloading the snapshot before `kvs_new_config` returns, and
+ * reloading it in the background, and runs the workload again with another
+ * seed. Each row gives the time to open the cache and the hit rates of the
+ * first two windows of `window` GETs and of the whole run.
+ */
+static int bench_warm(const char* directory, int keys) {
+  const kvs_replacement_policy policies[] = {KVS_CACHE_FIFO, KVS_CACHE_CLOCK,
+                                             KVS_CACHE_LRU};
+  const char* starts[] = {"cold", "sync", "background"};
+  const int window = 10000;
+  const int windows = 10;
+  const int capacity = keys / 10 > 0 ? keys / 10 : 1;
+  bench_workload_t workload = {.name = "zipf-0.99",
+                               .distribution = BENCH_ZIPF,
+                               .skew = 0.99,
+                               .value_min = 20,
+                               .value_max = 20};
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+
+  bench_workload_start(&workload, keys, 7);
+  kvs_base_t* kvs_base = kvs_base_new(directory);
+  if (kvs_base == NULL) {
+    fprintf(stderr, "kvs_base_new failed\n");
+    return 1;
+  }
+  for (int i = 0; i < keys; ++i) {
+    bench_workload_key(&workload, i, key);
+    bench_workload_value(&workload, value);
+    kvs_base_set(kvs_base, key, value);
+  }
+  kvs_base_free(&kvs_base);
+
+  printf("%-7s %-10s %9s %8s %8s %8s %8s\n", "POLICY", "START", "OPEN MS",
+         "WARMED", "HIT 1", "HIT 2", "HIT ALL");
+  for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); ++p) {
+    // the run that leaves the snapshot, then one per kind of start; the
+    // first may load the previous policy's snapshot, which only warms it
+    for (int s = -1; s < 3; ++s) {
+      kvs_config_t config;
+      kvs_config_init(&config, directory, policies[p], capacity);
+      config.snapshot = s != 0;
+      config.warm_background = s == 2;
+      double start = now_ns();
+      kvs_t* kvs = kvs_new_config(&config);
+      double open = now_ns() - start;
+      if (kvs == NULL) {
+        fprintf(stderr, "kvs_new_config failed\n");
+        return 1;
+      }
+
+      bench_workload_start(&workload, keys, s == -1 ? 11 : 13);
+      double hits[2] = {0, 0};
+      int misses = 0;
+      for (int w = 0; w < windows; ++w) {
+        int disk_gets = atomic_load(&kvs->kvs_base->get_count);
+        for (int i = 0; i < window; ++i) {
+          bool write;
+          bench_workload_next(&workload, key, value, &write);
+          kvs_get(kvs, key, value);
+        }
+        disk_gets = atomic_load(&kvs->kvs_base->get_count) - disk_gets;
+        misses += disk_gets;
+        if (w < 2) {
+          hits[w] = 1 - (double)disk_gets / window;
+        }
+      }
+      kvs_stats_t stats;
+      kvs_stats(kvs, &stats);
+      kvs_free(&kvs);
+      if (s >= 0) {
+        printf("%-7s %-10s %9.2f %8d %8.3f %8.3f %8.3f\n",
+               kvs_policy_name(policies[p]), starts[s], open / 1e6,
+               stats.warmed,
+               hits[0], hits[1], 1 - (double)misses / (window * windows));
+      }
+    }
+  }
+  return 0;
+}
+
+/**
+ * `bench_prefetch` reads every key in order, a page of `PAGE` keys at a time,
+ * as a client paging through a listing would. At the start of each page it
+ * passes the next page to `kvs_prefetch`, then GETs the page's keys and
+ * pauses for `think_us` microseconds before the next. The cache holds a tenth
+ * of the keys, so without prefetching every GET reads the disk.
+ */
+static int bench_prefetch(const char* directory, int keys) {
+  enum { PAGE = 32 };
+  const int think_us[] = {0, 100, 1000};
+  const int capacity = keys / 10 > PAGE * 2 ? keys / 10 : PAGE * 2;
+  const int pages = keys / PAGE;
+  char key_buffers[2][PAGE][KVS_KEY_MAX];
+  const char* page_keys[2][PAGE];
+  char value[KVS_VALUE_MAX];
+  double* latencies = malloc((size_t)pages * PAGE * sizeof(double));
+  if (latencies == NULL || pages == 0) {
+    fprintf(stderr, "need at least %d keys\n", PAGE);
+    free(latencies);
+    return 1;
+  }
+  for (int i = 0; i < PAGE; ++i) {
+    page_keys[0][i] = key_buffers[0][i];
+    page_keys[1][i] = key_buffers[1][i];
+  }
+
+  kvs_base_t* kvs_base = kvs_base_new(directory);
+  if (kvs_base == NULL) {
+    fprintf(stderr, "kvs_base_new failed\n");
+    free(latencies);
+    return 1;
+  }
+  for (int i = 0; i < keys; ++i) {
+    snprintf(value, KVS_KEY_MAX, "key%d", i);
+    kvs_base_set(kvs_base, value, "value-of-20-bytes-xx");
+  }
+  kvs_base_free(&kvs_base);
+
+  printf("%-8s %8s %10s %10s %10s %8s\n", "PREFETCH", "THINK US", "P50 NS",
+         "P99 NS", "MEAN NS", "HIT");
+  for (size_t t = 0; t < sizeof(think_us) / sizeof(think_us[0]); ++t) {
+    for (int prefetch = 0; prefetch <= 1; ++prefetch) {
+      kvs_config_t config;
+      kvs_config_init(&config, directory, KVS_CACHE_LRU, capacity);
+      config.prefetch_threads = prefetch ? 2 : 0;
+      kvs_t* kvs = kvs_new_config(&config);
+      if (kvs == NULL) {
+        fprintf(stderr, "kvs_new_config failed\n");
+        free(latencies);
+        return 1;
+      }
+      struct timespec think = {.tv_nsec = think_us[t] * 1000L};
+      int disk_gets = atomic_load(&kvs->kvs_base->get_count);
+      double total = 0;
+      for (int p = 0; p < pages; ++p) {
+        // the keys of page `p` are in buffer `p % 2`
+        for (int page = p == 0 ? 0 : p + 1; page <= p + 1; ++page) {
+          for (int i = 0; i < PAGE; ++i) {
+            snprintf(key_buffers[page % 2][i], KVS_KEY_MAX, "key%d",
+                     page * PAGE + i);
+          }
+        }
+        if (p + 1 < pages) {
+          kvs_prefetch(kvs, PAGE, page_keys[(p + 1) % 2]);
+        }
+        for (int i = 0; i < PAGE; ++i) {
+          double start = now_ns();
+          kvs_get(kvs, page_keys[p % 2][i], value);
+          double latency = now_ns() - start;
+          latencies[p * PAGE + i] = latency;
+          total += latency;
+        }
+        if (think_us[t] > 0) {
+          nanosleep(&think, NULL);
+        }
+      }
+      disk_gets = atomic_load(&kvs->kvs_base->get_count) - disk_gets;
+      kvs_free(&kvs);
+
+      int gets = pages * PAGE;
+      qsort(latencies, gets, sizeof(double), compare_doubles);
+      printf("%-8s %8d %10.0f %10.0f %10.0f %8.3f\n", prefetch ? "ON" : "OFF",
+             think_us[t], latencies[gets / 2],
+             latencies[(size_t)gets * 99 / 100], total / gets,
+             1 - (double)disk_gets / gets);
+    }
+  }
+  free(latencies);
+  return 0;
+}
+
+/**
+ * `json_value` writes the value of key `id` for `bench compress`: a JSON
+ * order of two to six line items. Like most JSON, it repeats its field
+ * names, so it compresses well.
+ */
+static void json_value(int id, char* value) {
+  static const char* cities[] = {"Berlin", "Lisbon", "Osaka", "Toronto"};
+  int length = snprintf(value, KVS_VALUE_MAX,
+                        "{\"order\":%d,\"customer\":\"c%05d\",\"city\":"
+                        "\"%s\",\"status\":\"shipped\",\"items\":[",
+                        id, id * 7 % 100000, cities[id % 4]);
+  int items = 2 + id % 5;
+  for (int i = 0; i < items; ++i) {
+    length += snprintf(value + length, KVS_VALUE_MAX - length,
+                       "%s{\"sku\":\"SKU-%04d\",\"qty\":%d,\"price\":%d.99}",
+                       i ? "," : "", (id + i * 31) % 10000, 1 + i % 3,
+                       (id + i) % 90 + 10);
+  }
+  snprintf(value + length, KVS_VALUE_MAX - length, "]}");
+}
+
+/**
+ * `bench_compress` runs Zipfian GETs over `keys` JSON values against caches
+ * bounded by `memory` bytes, storing their values as they are and
+ * compressed. Compression fits more entries in the budget, which raises the
+ * hit rate, while every hit pays to expand its value.
+ */
+static int bench_compress(const char* directory, int keys, size_t memory) {
+  const kvs_replacement_policy policies[] = {KVS_CACHE_LRU,
+                                             KVS_CACHE_TINYLFU};
+  const int operations = 500000;
+  bench_workload_t workload = {.distribution = BENCH_ZIPF, .skew = 0.99};
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+
+  bench_workload_start(&workload, keys, 7);
+  kvs_base_t* kvs_base = kvs_base_new(directory);
+  if (kvs_base == NULL) {
+    fprintf(stderr, "kvs_base_new failed\n");
+    return 1;
+  }
+  size_t value_bytes = 0;
+  for (int i = 0; i < keys; ++i) {
+    bench_workload_key(&workload, i, key);
+    json_value(i, value);
+    value_bytes += strlen(value);
+    kvs_base_set(kvs_base, key, value);
+  }
+  kvs_base_free(&kvs_base);
+
+  printf("%d values of %zu bytes on average, budget of %zu bytes\n", keys,
+         value_bytes / keys, memory);
+  printf("%-8s %-5s %6s %9s %8s %10s %10s %14s\n", "POLICY", "MODE", "RATIO",
+         "RESIDENT", "HIT", "GET/S", "HIT P50 NS", "EXPAND NS/HIT");
+  for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); ++p) {
+    for (int compress = 0; compress <= 1; ++compress) {
+      kvs_config_t config;
+      kvs_config_init(&config, directory, policies[p], 0);
+      config.memory = memory;
+      config.compress = compress;
+      kvs_t* kvs = kvs_new_config(&config);
+      if (kvs == NULL) {
+        fprintf(stderr, "kvs_new_config failed\n");
+        return 1;
+      }
+      bench_workload_start(&workload, keys, 11);
+      // a first pass fills the cache, the second is measured
+      for (int i = 0; i < operations; ++i) {
+        bool write;
+        bench_workload_next(&workload, key, value, &write);
+        kvs_get(kvs, key, value);
+      }
+      kvs_stats_t before;
+      kvs_stats(kvs, &before);
+      double start = now_ns();
+      for (int i = 0; i < operations; ++i) {
+        bool write;
+        bench_workload_next(&workload, key, value, &write);
+        kvs_get(kvs, key, value);
+      }
+      double elapsed = now_ns() - start;
+      kvs_stats_t stats;
+      kvs_stats(kvs, &stats);
+      kvs_free(&kvs);
+
+      printf("%-8s %-5s %6.2f %9d %8.3f %10.0f %10llu %14.0f\n",
+             kvs_policy_name(policies[p]), compress ? "LZ" : "RAW",
+             stats.compression_ratio, stats.resident,
+             1 - (double)(stats.disk_reads - before.disk_reads) / operations,
+             operations / (elapsed / 1e9),
+             (unsigned long long)stats.latencies[KVS_STATS_GET_HIT].p50,
+             stats.decompress_ns_per_hit);
+    }
+  }
+  return 0;
+}
+
+/**
+ * `mrc_run` runs `operations` requests of `workload` against a fresh store
+ * opened with `config` and returns it, storing in `*hit_rate` the share of
+ * GETs in the second half of the run the cache answered. The first half
+ * warms the cache up.
+ */
+static kvs_t* mrc_run(const kvs_config_t* config, bench_workload_t* workload,
+                      int operations, double* hit_rate) {
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+  kvs_t* kvs = kvs_new_config(config);
+  if (kvs == NULL) {
+    fprintf(stderr, "kvs_new_config failed\n");
+    return NULL;
+  }
+  bench_workload_start(workload, workload->keys, 11);
+  int gets = 0;
+  int disk_gets = 0;
+  for (int i = 0; i < operations; ++i) {
+    if (i == operations / 2) {
+      gets = 0;
+      disk_gets = atomic_load(&kvs->kvs_base->get_count);
+    }
+    bool write;
+    bench_workload_next(workload, key, value, &write);
+    if (write) {
+      kvs_set(kvs, key, value);
+    } else {
+      kvs_get(kvs, key, value);
+      gets++;
+    }
+  }
+  disk_gets = atomic_load(&kvs->kvs_base->get_count) - disk_gets;
+  *hit_rate = gets ? 1 - (double)disk_gets / gets : 0;
+  return kvs;
+}
+
+/**
+ * `bench_mrc` checks the miss-ratio curves of the shadow models against the
+ * real thing. A cache of a tenth of the keys runs a Zipfian workload while
+ * its models predict every policy at five capacities; each point is then
+ * run as a real cache over the same requests. Last, the
+ * cache starts out as FIFO in auto mode, to show what switching buys.
+ */
+static int bench_mrc(const char* directory, int keys, int operations) {
+  bench_workload_t workload = {.distribution = BENCH_ZIPF, .skew = 0.99,
+                               .write_percent = 5, .value_min = 20,
+                               .value_max = 20};
+  const int capacity = keys / 10 > 0 ? keys / 10 : 1;
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+
+  bench_workload_start(&workload, keys, 7);
+  kvs_base_t* kvs_base = kvs_base_new(directory);
+  if (kvs_base == NULL) {
+    fprintf(stderr, "kvs_base_new failed\n");
+    return 1;
+  }
+  for (int i = 0; i < keys; ++i) {
+    bench_workload_key(&workload, i, key);
+    bench_workload_value(&workload, value);
+    kvs_base_set(kvs_base, key, value);
+  }
+  kvs_base_free(&kvs_base);
+
+  kvs_config_t config;
+  kvs_config_init(&config, directory, KVS_CACHE_LRU, capacity);
+  config.mrc = true;
+  double hit_rate;
+  double start = now_ns();
+  kvs_t* kvs = mrc_run(&config, &workload, operations, &hit_rate);
+  if (kvs == NULL) {
+    return 1;
+  }
+  double with_models = now_ns() - start;
+  kvs_mrc_point_t points[KVS_MRC_POINTS];
+  int count = kvs_mrc(kvs, points, KVS_MRC_POINTS);
+  kvs_free(&kvs);
+  config.mrc = false;
+  start = now_ns();
+  kvs = mrc_run(&config, &workload, operations, &hit_rate);
+  if (kvs == NULL) {
+    return 1;
+  }
+  double without_models = now_ns() - start;
+  kvs_free(&kvs);
+
+  printf("%d keys, cache of %d entries, %d requests, models add %.0f ns per "
+         "request\n",
+         keys, capacity, operations,
+         (with_models - without_models) / operations);
+  printf("%-8s %9s %10s %10s %8s\n", "POLICY", "CAPACITY", "PREDICTED",
+         "ACTUAL", "ERROR");
+  for (int i = 0; i < count; ++i) {
+    kvs_config_init(&config, directory, points[i].policy,
+                    points[i].capacity);
+    kvs = mrc_run(&config, &workload, operations, &hit_rate);
+    if (kvs == NULL) {
+      return 1;
+    }
+    kvs_free(&kvs);
+    printf("%-8s %9d %10.3f %10.3f %+8.3f\n",
+           kvs_policy_name(points[i].policy), points[i].capacity,
+           points[i].hit_rate, hit_rate, points[i].hit_rate - hit_rate);
+  }
+
+  printf("%-8s %-10s %8s %8s\n", "START", "MODE", "HIT", "SWITCHES");
+  for (int automatic = 0; automatic <= 1; ++automatic) {
+    kvs_config_init(&config, directory, KVS_CACHE_FIFO, capacity);
+    config.mrc = automatic;
+    config.auto_policy = automatic;
+    kvs = mrc_run(&config, &workload, operations, &hit_rate);
+    if (kvs == NULL) {
+      return 1;
+    }
+    kvs_stats_t stats;
+    kvs_stats(kvs, &stats);
+    kvs_free(&kvs);
+    printf("%-8s %-10s %8.3f %8d -> %s\n", "FIFO",
+           automatic ? "AUTO" : "FIXED", hit_rate, stats.policy_switches,
+           stats.policy);
+  }
+  return 0;
+}
+
+/**
+ * `suite_workloads` is the grid of `bench suite`. Unless noted, keys follow
+ * a Zipfian distribution of skew 0.99, 5% of requests are SETs and values
+ * are 20 bytes.
+ */
+static const bench_workload_t suite_workloads[] = {
+    {.name = "uniform", .distribution = BENCH_UNIFORM, .write_percent = 5,
+     .value_min = 20, .value_max = 20},
+    {.name = "zipf-0.7", .distribution = BENCH_ZIPF, .skew = 0.7,
+     .write_percent = 5, .value_min = 20, .value_max = 20},
+    {.name = "zipf-0.9", .distribution = BENCH_ZIPF, .skew = 0.9,
+     .write_percent = 5, .value_min = 20, .value_max = 20},
+    {.name = "zipf-0.99", .distribution = BENCH_ZIPF, .skew = 0.99,
+     .write_percent = 5, .value_min = 20, .value_max = 20},
+    {.name = "scan-mixed", .distribution = BENCH_ZIPF, .skew = 0.99,
+     .write_percent = 5, .scan_percent = 20, .scan_length = 500,
+     .value_min = 20, .value_max = 20},
+    {.name = "write-0", .distribution = BENCH_ZIPF, .skew = 0.99,
+     .write_percent = 0, .value_min = 20, .value_max = 20},
+    {.name = "write-20", .distribution = BENCH_ZIPF, .skew = 0.99,
+     .write_percent = 20, .value_min = 20, .value_max = 20},
+    {.name = "write-50", .distribution = BENCH_ZIPF, .skew = 0.99,
+     .write_percent = 50, .value_min = 20, .value_max = 20},
+    {.name = "write-90", .distribution = BENCH_ZIPF, .skew = 0.99,
+     .write_percent = 90, .value_min = 20, .value_max = 20},
+    {.name = "small-values", .distribution = BENCH_ZIPF, .skew = 0.99,
+     .write_percent = 5, .value_min = 1, .value_max = 64},
+    {.name = "large-values", .distribution = BENCH_ZIPF, .skew = 0.99,
+     .write_percent = 5, .value_min = 256, .value_max = KVS_VALUE_MAX - 1},
+    {.name = "long-keys", .distribution = BENCH_ZIPF, .skew = 0.99,
+     .write_percent = 5, .key_min = 16, .key_max = KVS_KEY_MAX - 1,
+     .value_min = 20, .value_max = 20},
+};
+
+/**
+ * `suite_run` runs one cell of the grid: `operations` requests of
+ * `workload` against a fresh cache over the store in `directory`, followed by
+ * a `kvs_flush`. It prints one CSV row. Latencies are per request and leave
+ * out the final flush; disk operations count its writes.
+ */
+static int suite_run(const char* directory, bench_workload_t* workload,
+                     kvs_replacement_policy policy, int capacity,
+                     int operations, double* latencies) {
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+  kvs_t* kvs = kvs_new(directory, policy, capacity);
+  if (kvs == NULL) {
+    fprintf(stderr, "kvs_new failed\n");
+    return 1;
+  }
+
+  bench_workload_start(workload, workload->keys, 42);
+  int disk_gets = atomic_load(&kvs->kvs_base->get_count);
+  int disk_sets = atomic_load(&kvs->kvs_base->set_count);
+  int gets = 0;
+  double start = now_ns();
+  for (int i = 0; i < operations; ++i) {
+    bool write;
+    bench_workload_next(workload, key, value, &write);
+    double op_start = now_ns();
+    if (write) {
+      kvs_set(kvs, key, value);
+    } else {
+      kvs_get(kvs, key, value);
+      gets++;
+    }
+    latencies[i] = now_ns() - op_start;
+  }
+  double elapsed = now_ns() - start;
+  kvs_flush(kvs);
+  disk_gets = atomic_load(&kvs->kvs_base->get_count) - disk_gets;
+  disk_sets = atomic_load(&kvs->kvs_base->set_count) - disk_sets;
+  kvs_free(&kvs);
+
+  qsort(latencies, operations, sizeof(double), compare_doubles);
+  printf("%s,%s,%d,%.0f,%.0f,%.0f,%.0f,%.4f,%.4f\n", workload->name,
+         kvs_policy_name(policy), policy == KVS_CACHE_NONE ? 0 : capacity,
+         operations / (elapsed / 1e9), latencies[operations / 2],
+         latencies[operations * 99 / 100], latencies[operations * 999 / 1000],
+         gets ? 1 - (double)disk_gets / gets : 0,
+         (double)(disk_gets + disk_sets) / operations);
+  return 0;
+}
+
+/**
+ * `bench_suite` runs every policy over a grid of workloads and capacities (1%,
+ * 10% and 50% of `keys`) and prints CSV. Before each workload, the store in
+ * `directory` is filled with all `keys` keys at that workload's sizes. If
+ * `only` is set, just that workload runs; any `zipf-SKEW` is accepted.
+ */
+static int bench_suite(const char* directory, int keys, int operations,
+                       const char* only) {
+  const kvs_replacement_policy policies[] = {
+      KVS_CACHE_NONE, KVS_CACHE_FIFO, KVS_CACHE_CLOCK,  KVS_CACHE_LRU,
+      KVS_CACHE_ARC,  KVS_CACHE_2Q,   KVS_CACHE_TINYLFU};
+  const int capacity_percents[] = {1, 10, 50};
+  const size_t count = sizeof(suite_workloads) / sizeof(suite_workloads[0]);
+  bench_workload_t workloads[sizeof(suite_workloads) /
+                             sizeof(suite_workloads[0])];
+  size_t selected = 0;
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+
+  for (size_t w = 0; w < count; ++w) {
+    if (!only || strcmp(only, suite_workloads[w].name) == 0) {
+      workloads[selected++] = suite_workloads[w];
+    }
+  }
+  if (selected == 0 && only && strncmp(only, "zipf-", 5) == 0) {
+    workloads[0] = suite_workloads[3];
+    workloads[0].name = only;
+    workloads[0].skew = atof(only + 5);
+    selected = 1;
+  }
+  if (selected == 0) {
+    fprintf(stderr, "unknown workload %s\n", only);
+    return 1;
+  }
+  if (keys < 100) {
+    fprintf(stderr, "suite needs at least 100 keys\n");
+    return 1;
+  }
+  double* latencies = malloc(operations * sizeof(double));
+  if (latencies == NULL) {
+    return 1;
+  }
+
+  mkdir(directory, S_IRWXU | S_IRWXG | S_IRWXO);
+  printf("workload,policy,capacity,ops_per_sec,p50_ns,p99_ns,p999_ns,"
+         "hit_rate,disk_ops_per_request\n");
+  for (size_t w = 0; w < selected; ++w) {
+    bench_workload_t* workload = &workloads[w];
+    bench_workload_start(workload, keys, 7);
+    kvs_base_t* kvs_base = kvs_base_new(directory);
+    if (kvs_base == NULL) {
+      fprintf(stderr, "kvs_base_new failed\n");
+      free(latencies);
+      return 1;
+    }
+    for (int i = 0; i < keys; ++i) {
+      bench_workload_key(workload, i, key);
+      bench_workload_value(workload, value);
+      kvs_base_set(kvs_base, key, value);
+    }
+    kvs_base_free(&kvs_base);
+
+    for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); ++p) {
+      for (size_t c = 0;
+           c < sizeof(capacity_percents) / sizeof(capacity_percents[0]);
+           ++c) {
+        int capacity = keys * capacity_percents[c] / 100;
+        if (suite_run(directory, workload, policies[p], capacity, operations,
+                      latencies) != 0) {
+          free(latencies);
+          return 1;
+        }
+        // the capacity makes no difference without a cache
+        if (policies[p] == KVS_CACHE_NONE) {
+          break;
+        }
+      }
+    }
+  }
+  free(latencies);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr,
+            "Usage: %s hit DIRECTORY [MAX_CAPACITY]\n"
+            "       %s memory DIRECTORY [CAPACITY]\n"
+            "       %s backend DIRECTORY [KEYS]\n"
+            "       %s layout DIRECTORY [KEYS] [LAYOUT]\n"
+            "       %s threads DIRECTORY [CAPACITY]\n"
+            "       %s writeback DIRECTORY [CAPACITY]\n"
+            "       %s flush DIRECTORY [ENTRIES]\n"
+            "       %s wal DIRECTORY [OPERATIONS]\n"
+            "       %s absent DIRECTORY [KEYS]\n"
+            "       %s mget DIRECTORY [KEYS]\n"
+            "       %s policies DIRECTORY [CAPACITY]\n"
+            "       %s budget DIRECTORY [BYTES]\n"
+            "       %s warm DIRECTORY [KEYS]\n"
+            "       %s prefetch DIRECTORY [KEYS]\n"
+            "       %s compress DIRECTORY [KEYS] [BYTES]\n"
+            "       %s mrc DIRECTORY [KEYS] [OPERATIONS]\n"
+            "       %s suite DIRECTORY [KEYS] [OPERATIONS] [WORKLOAD]\n",
+            argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0],
+            argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0],
+            argv[0], argv[0], argv[0]);
+    return 1;
+  }
+  if (strcmp(argv[1], "hit") == 0) {
+    int max_capacity = argc > 3 ? atoi(argv[3]) : 1 << 20;
+    return bench_hit(argv[2], max_capacity);
+  }
+  if (strcmp(argv[1], "memory") == 0) {
+    int capacity = argc > 3 ? atoi(argv[3]) : 100000;
+    return bench_memory(argv[2], capacity);
+  }
+  if (strcmp(argv[1], "backend") == 0) {
+    int keys = argc > 3 ? atoi(argv[3]) : 100000;
+    return bench_backend(argv[2], keys);
+  }
+  if (strcmp(argv[1], "layout") == 0) {
+    int keys = argc > 3 ? atoi(argv[3]) : 10000000;
+    return bench_layout(argv[2], keys, argc > 4 ? argv[4] : NULL);
+  }
+  if (strcmp(argv[1], "threads") == 0) {
+    int capacity = argc > 3 ? atoi(argv[3]) : 1 << 16;
+    return bench_threads(argv[2], capacity);
+  }
+  if (strcmp(argv[1], "writeback") == 0) {
+    int capacity = argc > 3 ? atoi(argv[3]) : 10000;
+    return bench_write_back(argv[2], capacity);
+  }
+  if (strcmp(argv[1], "flush") == 0) {
+    int entries = argc > 3 ? atoi(argv[3]) : 100000;
+    return bench_flush(argv[2], entries);
+  }
+  if (strcmp(argv[1], "wal") == 0) {
+    int operations = argc > 3 ? atoi(argv[3]) : 2000;
+    return bench_wal(argv[2], operations);
+  }
+  if (strcmp(argv[1], "absent") == 0) {
+    int keys = argc > 3 ? atoi(argv[3]) : 100000;
+    return bench_absent(argv[2], keys);
+  }
+  if (strcmp(argv[1], "mget") == 0) {
+    int keys = argc > 3 ? atoi(argv[3]) : 100000;
+    return bench_mget(argv[2], keys);
+  }
+  if (strcmp(argv[1], "policies") == 0) {
+    int capacity = argc > 3 ? atoi(argv[3]) : 1000;
+    return bench_policies(argv[2], capacity);
+  }
+  if (strcmp(argv[1], "budget") == 0) {
+    size_t memory = argc > 3 ? strtoull(argv[3], NULL, 10) : 1 << 20;
+    return bench_budget(argv[2], memory);
+  }
+  if (strcmp(argv[1], "warm") == 0) {
+    int keys = argc > 3 ? atoi(argv[3]) : 100000;
+    return bench_warm(argv[2], keys);
+  }
+  if (strcmp(argv[1], "prefetch") == 0) {
+    int keys = argc > 3 ? atoi(argv[3]) : 100000;
+    return bench_prefetch(argv[2], keys);
+  }
+  if (strcmp(argv[1], "compress") == 0) {
+    int keys = argc > 3 ? atoi(argv[3]) : 50000;
+    size_t memory = argc > 4 ? strtoull(argv[4], NULL, 10) : 4 << 20;
+    return bench_compress(argv[2], keys, memory);
+  }
+  if (strcmp(argv[1], "mrc") == 0) {
+    int keys = argc > 3 ? atoi(argv[3]) : 100000;
+    int operations = argc > 4 ? atoi(argv[4]) : 1000000;
+    return bench_mrc(argv[2], keys, operations);
+  }
+  if (strcmp(argv[1], "suite") == 0) {
+    int keys = argc > 3 ? atoi(argv[3]) : 10000;
+    int operations = argc > 4 ? atoi(argv[4]) : 100000;
+    return bench_suite(argv[2], keys, operations, argc > 5 ? argv[5] : NULL);
+  }
+  fprintf(stderr, "unknown benchmark %s\n", argv[1]);
+  return 1;
+}
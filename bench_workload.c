@@ -0,0 +1,125 @@
+#include "bench_workload.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "constants.h"
+
+static uint64_t next_random(bench_workload_t* workload) {
+  // xorshift64
+  uint64_t x = workload->state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  workload->state = x;
+  return x;
+}
+
+static double next_uniform(bench_workload_t* workload) {
+  return (next_random(workload) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int in_range(bench_workload_t* workload, int min, int max) {
+  if (max <= min) {
+    return min;
+  }
+  return min + (int)(next_random(workload) % (uint64_t)(max - min + 1));
+}
+
+void bench_workload_start(bench_workload_t* workload, int keys,
+                          uint64_t seed) {
+  workload->keys = keys;
+  workload->state = seed ? seed : 1;
+  workload->scan_next = 0;
+  workload->scan_left = 0;
+  // a scan starts with the probability that puts `scan_percent` percent of
+  // the requests in scans
+  double f = workload->scan_percent / 100.0;
+  workload->scan_start =
+      workload->scan_length > 0 ? f / (f + workload->scan_length * (1 - f))
+                                : 0;
+  if (workload->distribution != BENCH_ZIPF) {
+    return;
+  }
+
+  // the generator of Gray et al., "Quickly Generating Billion-Record
+  // Synthetic Databases", as used by YCSB
+  double theta = workload->skew;
+  double zeta = 0;
+  for (int i = 1; i <= keys; ++i) {
+    zeta += 1 / pow(i, theta);
+  }
+  double zeta2 = 1 + 1 / pow(2, theta);
+  workload->zeta = zeta;
+  workload->alpha = 1 / (1 - theta);
+  workload->eta = (1 - pow(2.0 / keys, 1 - theta)) / (1 - zeta2 / zeta);
+}
+
+static int next_zipf(bench_workload_t* workload) {
+  double u = next_uniform(workload);
+  double uz = u * workload->zeta;
+  if (uz < 1) {
+    return 0;
+  }
+  if (uz < 1 + pow(0.5, workload->skew)) {
+    return 1;
+  }
+  int id = (int)(workload->keys *
+                 pow(workload->eta * u - workload->eta + 1, workload->alpha));
+  return id < workload->keys ? id : workload->keys - 1;
+}
+
+void bench_workload_key(bench_workload_t* workload, int id, char* key) {
+  int length = snprintf(key, KVS_KEY_MAX, "key%d", id);
+  if (workload->key_max <= workload->key_min) {
+    return;
+  }
+  // a fixed function of `id`, so every request for a key uses the same name
+  uint64_t h = (uint64_t)id * 0x9e3779b97f4a7c15ULL;
+  int span = workload->key_max - workload->key_min + 1;
+  int target = workload->key_min + (int)((h >> 32) % (uint64_t)span);
+  if (target > KVS_KEY_MAX - 1) {
+    target = KVS_KEY_MAX - 1;
+  }
+  if (length < target) {
+    memset(key + length, 'x', target - length);
+    key[target] = '\0';
+  }
+}
+
+void bench_workload_value(bench_workload_t* workload, char* value) {
+  int length = in_range(workload, workload->value_min, workload->value_max);
+  if (length > KVS_VALUE_MAX - 1) {
+    length = KVS_VALUE_MAX - 1;
+  }
+  for (int i = 0; i < length; ++i) {
+    value[i] = 'a' + i % 26;
+  }
+  value[length] = '\0';
+}
+
+void bench_workload_next(bench_workload_t* workload, char* key, char* value,
+                         bool* write) {
+  if (workload->scan_left == 0 && workload->scan_percent > 0 &&
+      next_uniform(workload) < workload->scan_start) {
+    workload->scan_next = (int)(next_random(workload) % workload->keys);
+    workload->scan_left = workload->scan_length;
+  }
+  if (workload->scan_left > 0) {
+    workload->scan_left--;
+    bench_workload_key(workload, workload->scan_next, key);
+    workload->scan_next = (workload->scan_next + 1) % workload->keys;
+    *write = false;
+    return;
+  }
+
+  int id = workload->distribution == BENCH_ZIPF
+               ? next_zipf(workload)
+               : (int)(next_random(workload) % workload->keys);
+  bench_workload_key(workload, id, key);
+  *write = next_random(workload) % 100 < (uint64_t)workload->write_percent;
+  if (*write) {
+    bench_workload_value(workload, value);
+  }
+}
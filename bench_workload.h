@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * `bench_distribution` is how a workload picks the keys it touches.
+ */
+typedef enum {
+  BENCH_UNIFORM,
+  // key `i` is drawn with probability proportional to 1 / (i + 1)^skew
+  BENCH_ZIPF,
+} bench_distribution;
+
+/**
+ * `bench_workload_t` generates a synthetic request stream over the keys
+ * `0 .. keys - 1`. The first block of fields describes the workload; fill it
+ * in and call `bench_workload_start` before drawing requests with
+ * `bench_workload_next`.
+ */
+typedef struct bench_workload {
+  const char* name;
+  bench_distribution distribution;
+  // skew of the Zipfian distribution, in (0, 1)
+  double skew;
+  // percentage of requests that are SETs
+  int write_percent;
+  // percentage of requests that belong to scans: runs of `scan_length` GETs
+  // of consecutive keys from a random start, interrupting the distribution
+  // above
+  int scan_percent;
+  int scan_length;
+  // key and value lengths are drawn uniformly from these ranges; keys shorter
+  // than their natural `key<N>` form keep it
+  int key_min;
+  int key_max;
+  int value_min;
+  int value_max;
+
+  int keys;
+  uint64_t state;
+  int scan_next;
+  int scan_left;
+  double scan_start;
+  double zeta;
+  double alpha;
+  double eta;
+} bench_workload_t;
+
+/**
+ * `bench_workload_start` prepares `workload` to draw from `keys` keys,
+ * seeding its generator with `seed`. A Zipfian workload sums its
+ * normalization constant here, which takes time linear in `keys`.
+ */
+void bench_workload_start(bench_workload_t* workload, int keys,
+                          uint64_t seed);
+
+/**
+ * `bench_workload_next` draws the next request. It writes the key to `key`
+ * (`KVS_KEY_MAX` bytes), sets `*write` for a SET and then also writes a
+ * value to `value` (`KVS_VALUE_MAX` bytes).
+ */
+void bench_workload_next(bench_workload_t* workload, char* key, char* value,
+                         bool* write);
+
+/**
+ * `bench_workload_key` writes the name of key `id` to `key`, padded to a
+ * length that depends only on `id`. `bench_workload_value` writes a value of
+ * a random length.
+ */
+void bench_workload_key(bench_workload_t* workload, int id, char* key);
+void bench_workload_value(bench_workload_t* workload, char* value);
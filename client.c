@@ -1,96 +1,393 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include <err.h>
+#include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "kvs.h"
+#include "kvs_cli.h"
+
+// the most words an input line can hold
+#define WORDS_MAX ((KVS_KEY_MAX + KVS_VALUE_MAX + 128) / 2)
+// the size of the line buffer: a longer line is read as several lines
+#define LINE_SIZE (WORDS_MAX * 2)
+// bytes read from stdin at a time in ingest mode, and bytes of answers
+// collected before they are written out
+#define INPUT_BLOCK (1 << 20)
+#define OUTPUT_BUFFER (1 << 20)
 
 /**
- * `get_replacement_policy` takes a string representation of the cache
- * replacement policy and returns the value of enum `kvs_replacement_policy`. If
- * the input is unknown, it falls back to the NONE policy and prints a warning
- * message.
+ * `output_t` collects the answers of ingest mode (`-i`), so that they reach
+ * stdout a megabyte at a time rather than one `printf` per value.
  */
-kvs_replacement_policy get_replacement_policy(const char* policy) {
-  if (strcmp(policy, "NONE") == 0) {
-    return KVS_CACHE_NONE;
+typedef struct output {
+  char* data;
+  size_t length;
+} output_t;
+
+static void output_flush(output_t* out) {
+  if (out && out->length > 0) {
+    fwrite(out->data, 1, out->length, stdout);
+    out->length = 0;
   }
-  if (strcmp(policy, "FIFO") == 0) {
-    return KVS_CACHE_FIFO;
+}
+
+/**
+ * `print_value` writes an answer line to `out`, or straight to stdout if
+ * `out` is NULL.
+ */
+static void print_value(output_t* out, const char* value) {
+  if (out == NULL) {
+    printf("%s\n", value);
+    return;
   }
-  if (strcmp(policy, "CLOCK") == 0) {
-    return KVS_CACHE_CLOCK;
+  size_t length = strlen(value);
+  if (out->length + length + 1 > OUTPUT_BUFFER) {
+    output_flush(out);
   }
-  if (strcmp(policy, "LRU") == 0) {
-    return KVS_CACHE_LRU;
+  memcpy(out->data + out->length, value, length);
+  out->data[out->length + length] = '\n';
+  out->length += length + 1;
+}
+
+/**
+ * `split_words` splits `line` in place at every space and stores up to `max`
+ * words in `words`, returning how many it found.
+ */
+static int split_words(char* line, char** words, int max) {
+  int count = 0;
+  for (char* word = strtok(line, " "); word != NULL && count < max;
+       word = strtok(NULL, " ")) {
+    words[count++] = word;
   }
-  warnx("invalid cache replacement policy %s: falling back to NONE", policy);
-  return KVS_CACHE_NONE;
+  return count;
 }
 
-int main(int argc, char** argv) {
-  if (argc != 4) {
-    fprintf(stderr, "Usage: %s DIRECTORY POLICY CAPACITY\n", argv[0]);
-    return 1;
+/**
+ * `run_mget` answers `MGET KEY...` with one value per line, in the order of
+ * the keys.
+ */
+static int run_mget(kvs_t* kvs, char* keys_line, output_t* out) {
+  char* keys[WORDS_MAX];
+  int count = split_words(keys_line, keys, WORDS_MAX);
+  if (count == 0) {
+    return SUCCESS;
+  }
+  char* values = malloc((size_t)count * KVS_VALUE_MAX);
+  char* value_ptrs[WORDS_MAX];
+  if (values == NULL) {
+    return FAILURE;
   }
-  int rc;
-  char line[KVS_KEY_MAX + KVS_VALUE_MAX + 128];
+  for (int i = 0; i < count; ++i) {
+    value_ptrs[i] = values + (size_t)i * KVS_VALUE_MAX;
+  }
+  int rc = kvs_mget(kvs, count, (const char**)keys, value_ptrs);
+  for (int i = 0; rc == SUCCESS && i < count; ++i) {
+    print_value(out, value_ptrs[i]);
+  }
+  free(values);
+  return rc;
+}
+
+/**
+ * `run_mset` stores the pairs of `MSET KEY VALUE...`. Unlike `SET`, the
+ * values cannot contain spaces.
+ */
+static int run_mset(kvs_t* kvs, char* pairs_line) {
+  char* words[WORDS_MAX];
+  int count = split_words(pairs_line, words, WORDS_MAX);
+  if (count % 2 != 0) {
+    return FAILURE;
+  }
+  const char* keys[WORDS_MAX / 2];
+  const char* values[WORDS_MAX / 2];
+  for (int i = 0; i < count / 2; ++i) {
+    keys[i] = words[2 * i];
+    values[i] = words[2 * i + 1];
+    if (strlen(keys[i]) >= KVS_KEY_MAX ||
+        strlen(values[i]) >= KVS_VALUE_MAX) {
+      return FAILURE;
+    }
+  }
+  return kvs_mset(kvs, count / 2, keys, values);
+}
+
+/**
+ * `print_entry` writes one key of `SCAN` or `RANGE` and its value as an
+ * answer line.
+ */
+static int print_entry(void* arg, const char* key, const char* value) {
+  char line[KVS_KEY_MAX + KVS_VALUE_MAX];
+  snprintf(line, sizeof(line), "%s %s", key, value);
+  print_value(arg, line);
+  return SUCCESS;
+}
+
+/**
+ * `run_command` carries out one input line, without its newline, and writes
+ * any answer to `out` (see `print_value`). Lines that are not commands are
+ * ignored. A failed command prints an error and returns FAILURE.
+ */
+static int run_command(kvs_t* kvs, char* line, output_t* out) {
   char value[KVS_VALUE_MAX];
+  if (strncmp(line, "GET ", 4) == 0 && line[4] != '\0') {
+    if (kvs_get(kvs, line + 4, value) != 0) {
+      fprintf(stderr, "GET ERROR\n");
+      return FAILURE;
+    }
+    print_value(out, value);
+    return SUCCESS;
+  }
+  if (strncmp(line, "SET ", 4) == 0 && line[4] != '\0') {
+    char* key = line + 4;
+    size_t key_length = strcspn(key, " ");
+    // a SET without a value stores the empty string
+    char* set_value = key[key_length] != '\0' ? key + key_length + 1 : "";
+    key[key_length] = '\0';
+    if (kvs_set(kvs, key, set_value) != 0) {
+      fprintf(stderr, "SET ERROR\n");
+      return FAILURE;
+    }
+    return SUCCESS;
+  }
+  if (strncmp(line, "MGET ", 5) == 0) {
+    if (run_mget(kvs, line + 5, out) != SUCCESS) {
+      fprintf(stderr, "MGET ERROR\n");
+      return FAILURE;
+    }
+    return SUCCESS;
+  }
+  if (strncmp(line, "MSET ", 5) == 0) {
+    if (run_mset(kvs, line + 5) != SUCCESS) {
+      fprintf(stderr, "MSET ERROR\n");
+      return FAILURE;
+    }
+    return SUCCESS;
+  }
+  bool range = strncmp(line, "RANGE ", 6) == 0;
+  if (range || strcmp(line, "SCAN") == 0 || strncmp(line, "SCAN ", 5) == 0) {
+    if (kvs_cli_scan(kvs, range, line + (range ? 6 : 4), print_entry, out) <
+        0) {
+      fprintf(stderr, "%s ERROR\n", range ? "RANGE" : "SCAN");
+      return FAILURE;
+    }
+    return SUCCESS;
+  }
+  if (strncmp(line, "PREFETCH ", 9) == 0) {
+    // a hint: keys that do not fit in the queue are dropped silently
+    char* keys[WORDS_MAX];
+    int count = split_words(line + 9, keys, WORDS_MAX);
+    kvs_prefetch(kvs, count, (const char**)keys);
+    return SUCCESS;
+  }
+  if (strcmp(line, "STATS") == 0) {
+    // answers collected so far go first
+    output_flush(out);
+    kvs_cli_print_stats(stdout, kvs);
+    fflush(stdout);
+  }
+  if (strcmp(line, "MRC") == 0) {
+    output_flush(out);
+    kvs_cli_print_mrc(stdout, kvs);
+    fflush(stdout);
+  }
+  return SUCCESS;
+}
+
+/**
+ * `run_lines` runs the lines in `[start, end)` and returns where the
+ * unfinished line at the end begins, or NULL if a command failed. It splits
+ * the input exactly as `fgets` into a `LINE_SIZE` buffer does, so a line
+ * longer than that runs as several. Unless `eof` is set, a last line that
+ * might still grow is left for the next call. The lines are terminated in
+ * place, and the byte at `end` must be writable.
+ */
+static char* run_lines(kvs_t* kvs, char* start, char* end, bool eof,
+                       output_t* out, unsigned long* commands) {
+  while (start < end) {
+    size_t available = end - start;
+    size_t span = available < LINE_SIZE - 1 ? available : LINE_SIZE - 1;
+    char* newline = memchr(start, '\n', span);
+    char* next;
+    char saved = '\0';
+    if (newline != NULL) {
+      next = newline + 1;
+      *newline = '\0';
+    } else if (available > span || eof) {
+      next = start + span;
+      saved = *next;
+      *next = '\0';
+    } else {
+      break;
+    }
+    *commands += 1;
+    if (run_command(kvs, start, out) != SUCCESS) {
+      return NULL;
+    }
+    if (newline == NULL) {
+      *next = saved;
+    }
+    start = next;
+  }
+  return start;
+}
 
-  const char* directory = argv[1];
-  kvs_replacement_policy replacement_policy = get_replacement_policy(argv[2]);
-  int capacity = atoi(argv[3]);
+/**
+ * `ingest` is the command loop of ingest mode. A regular file on stdin is
+ * mapped and its lines run where they lie; anything else is read in
+ * `INPUT_BLOCK` chunks. Answers are collected in an `output_t`. The output
+ * is the same as the line-at-a-time loop's, and the rate is reported on
+ * stderr.
+ */
+static int ingest(kvs_t* kvs) {
+  output_t out = {malloc(OUTPUT_BUFFER), 0};
+  unsigned long commands = 0;
+  int rc = SUCCESS;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (out.data == NULL) {
+    return FAILURE;
+  }
 
-  kvs_t* kvs = kvs_new(directory, replacement_policy, capacity);
+  struct stat st;
+  char* data = MAP_FAILED;
+  if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) &&
+      st.st_size > 0 && lseek(STDIN_FILENO, 0, SEEK_CUR) == 0) {
+    // private, so terminating lines in place never touches the file
+    data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                STDIN_FILENO, 0);
+  }
+  if (data != MAP_FAILED) {
+    posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+    char* rest = run_lines(kvs, data, data + st.st_size, false, &out,
+                           &commands);
+    // the last line is copied out: the mapping may have no byte after it
+    char line[LINE_SIZE];
+    size_t length = rest ? data + st.st_size - rest : 0;
+    if (rest) {
+      memcpy(line, rest, length);
+    }
+    if (rest == NULL ||
+        run_lines(kvs, line, line + length, true, &out, &commands) == NULL) {
+      rc = FAILURE;
+    }
+    munmap(data, st.st_size);
+  } else {
+    char* block = malloc(INPUT_BLOCK + 1);
+    size_t length = 0;
+    bool eof = block == NULL;
+    rc = eof ? FAILURE : SUCCESS;
+    while (!eof) {
+      ssize_t received =
+          read(STDIN_FILENO, block + length, INPUT_BLOCK - length);
+      if (received < 0 && errno == EINTR) {
+        continue;
+      }
+      // a read error ends the input, as it does for `fgets`
+      eof = received <= 0;
+      length += received > 0 ? received : 0;
+      char* rest =
+          run_lines(kvs, block, block + length, eof, &out, &commands);
+      if (rest == NULL) {
+        rc = FAILURE;
+        break;
+      }
+      length = block + length - rest;
+      memmove(block, rest, length);
+    }
+    free(block);
+  }
+  output_flush(&out);
+  free(out.data);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds =
+      (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  fprintf(stderr, "INGEST: %lu COMMANDS IN %.3f S (%.0f COMMANDS/S)\n",
+          commands, seconds, seconds > 0 ? commands / seconds : 0.0);
+  return rc;
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s " KVS_CLI_USAGE " [-i] DIRECTORY POLICY CAPACITY\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  kvs_config_t config;
+  kvs_config_init(&config, NULL, KVS_CACHE_NONE, 0);
+  bool fast = false;
+  int opt;
+  while ((opt = getopt(argc, argv, KVS_CLI_OPTIONS "i")) != -1) {
+    if (opt == 'i') {
+      fast = true;
+    } else if (kvs_cli_option(&config, opt, optarg) != SUCCESS) {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (argc - optind != 3) {
+    usage(argv[0]);
+    return 1;
+  }
+  char line[LINE_SIZE];
+
+  kvs_cli_store(&config, argv[optind], argv[optind + 1], argv[optind + 2]);
+  kvs_t* kvs = kvs_new_config(&config);
   if (kvs == NULL) {
     fprintf(stderr, "kvs_new failed\n");
     return 1;
   }
 
-  while (fgets(line, sizeof(line), stdin) != NULL) {
-    // if the line ends with a newline, remove it
-    int len = strlen(line);
-    if (line[len - 1] == '\n') {
-      line[len - 1] = '\0';
-    }
-    if (strncmp(line, "GET ", 4) == 0 && line[4] != '\0') {
-      rc = kvs_get(kvs, line + 4, value);
-      if (rc != 0) {
-        fprintf(stderr, "GET ERROR\n");
-        return 1;
-      }
-      printf("%s\n", value);
-      continue;
+  if (fast) {
+    if (ingest(kvs) != SUCCESS) {
+      return 1;
     }
-    if (strncmp(line, "SET ", 4) == 0 && line[4] != '\0') {
-      int key_length = 0;
-      while (line[4 + key_length] != ' ' && line[4 + key_length] != '\0') {
-        key_length += 1;
+  } else {
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+      // if the line ends with a newline, remove it
+      int len = strlen(line);
+      if (line[len - 1] == '\n') {
+        line[len - 1] = '\0';
       }
-      line[4 + key_length] = '\0';
-      rc = kvs_set(kvs, line + 4, line + 4 + key_length + 1);
-      if (rc != 0) {
-        fprintf(stderr, "SET ERROR\n");
+      if (run_command(kvs, line, NULL) != SUCCESS) {
         return 1;
       }
-      continue;
     }
   }
 
+  struct timespec flush_start, flush_end;
+  int flush_base = atomic_load(&kvs->kvs_base->set_count);
+  clock_gettime(CLOCK_MONOTONIC, &flush_start);
   kvs_flush(kvs);
+  clock_gettime(CLOCK_MONOTONIC, &flush_end);
+  double flush_seconds = (flush_end.tv_sec - flush_start.tv_sec) +
+                         (flush_end.tv_nsec - flush_start.tv_nsec) / 1e9;
 
-  printf("GET COUNT (CACHE): %d\n", kvs->get_count);
-  printf("GET COUNT (DISK): %d\n", kvs->kvs_base->get_count);
+  int get_count = kvs_get_count(kvs);
+  int set_count = kvs_set_count(kvs);
+  int base_get_count = atomic_load(&kvs->kvs_base->get_count);
+  int base_set_count = atomic_load(&kvs->kvs_base->set_count);
+  printf("GET COUNT (CACHE): %d\n", get_count);
+  printf("GET COUNT (DISK): %d\n", base_get_count);
   printf("GET CACHE HIT RATE: %.2f%%\n",
-         (kvs->get_count - kvs->kvs_base->get_count + 0.00) / kvs->get_count *
-             100);
-  printf("SET COUNT (CACHE): %d\n", kvs->set_count);
-  printf("SET COUNT (DISK): %d\n", kvs->kvs_base->set_count);
+         (get_count - base_get_count + 0.00) / get_count * 100);
+  printf("SET COUNT (CACHE): %d\n", set_count);
+  printf("SET COUNT (DISK): %d\n", base_set_count);
   printf("SET CACHE HIT RATE: %.2f%%\n",
-         (kvs->set_count - kvs->kvs_base->set_count + 0.00) / kvs->set_count *
-             100);
+         (set_count - base_set_count + 0.00) / set_count * 100);
+  int flush_count = base_set_count - flush_base;
+  printf("FLUSH COUNT: %d\n", flush_count);
+  printf("FLUSH THROUGHPUT: %.0f WRITES/S\n",
+         flush_count > 0 ? flush_count / flush_seconds : 0.0);
 
   kvs_free(&kvs);
 }
@@ -1,91 +1,1602 @@
 #include "kvs.h"
 
 #include <stdlib.h>
+#include <string.h>
+
+#include "kvs_btree.h"
+#include "kvs_index.h"
+#include "kvs_l2.h"
+#include "kvs_shadow.h"
+
+// how many snapshot keys `warm_start` reads at once
+#define KVS_WARM_CHUNK 64
+// keys `kvs_prefetch` can have waiting
+#define KVS_PREFETCH_QUEUE 4096
+// keys `kvs_scan` takes from the index at a time
+#define KVS_SCAN_CHUNK 64
+// how much better, as a fraction of GETs, the shadow models must predict
+// another policy to do before `auto_policy` switches to it, and the windows
+// of evidence it waits for first
+#define KVS_AUTO_MARGIN 0.02
+#define KVS_AUTO_WINDOWS 2
+
+const char* kvs_policy_name(kvs_replacement_policy policy) {
+  switch (policy) {
+    case KVS_CACHE_NONE:
+      return "NONE";
+    case KVS_CACHE_FIFO:
+      return "FIFO";
+    case KVS_CACHE_CLOCK:
+      return "CLOCK";
+    case KVS_CACHE_LRU:
+      return "LRU";
+    case KVS_CACHE_ARC:
+      return "ARC";
+    case KVS_CACHE_2Q:
+      return "2Q";
+    case KVS_CACHE_TINYLFU:
+      return "TINYLFU";
+  }
+  return "?";
+}
+
+void kvs_config_init(kvs_config_t* config, const char* directory,
+                     kvs_replacement_policy policy, int capacity) {
+  config->directory = directory;
+  config->policy = policy;
+  config->capacity = capacity;
+  config->backend = KVS_BASE_FILE;
+  config->layout = KVS_DIR_FLAT;
+  config->shards = 1;
+  config->write_back = false;
+  config->dirty_high = 25;
+  config->dirty_low = 10;
+  config->filter = false;
+  config->memory = 0;
+  config->snapshot = false;
+  config->warm_background = false;
+  config->wal = false;
+  config->wal_durability = KVS_WAL_ALWAYS;
+  config->wal_interval_ms = 10;
+  config->prefetch_threads = 2;
+  config->compress = false;
+  config->mrc = false;
+  config->auto_policy = false;
+  config->trace = NULL;
+  config->trace_keys = false;
+  config->l2_size = 0;
+  config->l2_path = ".kvs-l2";
+  config->scan = false;
+}
 
 kvs_t* kvs_new(const char* directory, kvs_replacement_policy policy,
                int capacity) {
-  kvs_t* instance = malloc(sizeof(kvs_t));
-  instance->kvs_base = kvs_base_new(directory);
-  instance->policy = policy;
-  instance->get_count = 0;
-  instance->set_count = 0;
-  switch (policy) {
+  kvs_config_t config;
+  kvs_config_init(&config, directory, policy, capacity);
+  return kvs_new_config(&config);
+}
+
+static void set_watermarks(kvs_t* kvs, kvs_shard_t* shard, int entries) {
+  shard->dirty_high = entries * kvs->dirty_high / 100;
+  if (shard->dirty_high < 1) {
+    shard->dirty_high = 1;
+  }
+  shard->dirty_low = entries * kvs->dirty_low / 100;
+}
+
+/**
+ * `shard_compress` makes the shard's cache store its values compressed.
+ */
+static void shard_compress(kvs_t* kvs, kvs_shard_t* shard) {
+  switch (kvs->policy) {
     case KVS_CACHE_NONE:
       break;
     case KVS_CACHE_FIFO:
-      instance->fifo = kvs_fifo_new(instance->kvs_base, capacity);
+      kvs_fifo_enable_compression(shard->fifo);
       break;
     case KVS_CACHE_CLOCK:
-      instance->clock = kvs_clock_new(instance->kvs_base, capacity);
+      kvs_clock_enable_compression(shard->clock);
       break;
     case KVS_CACHE_LRU:
-      instance->lru = kvs_lru_new(instance->kvs_base, capacity);
+      kvs_lru_enable_compression(shard->lru);
+      break;
+    case KVS_CACHE_ARC:
+      kvs_arc_enable_compression(shard->arc);
+      break;
+    case KVS_CACHE_2Q:
+      kvs_2q_enable_compression(shard->two_q);
+      break;
+    case KVS_CACHE_TINYLFU:
+      kvs_tinylfu_enable_compression(shard->tinylfu);
       break;
   }
-  return instance;
 }
 
-void kvs_free(kvs_t** ptr) {
-  kvs_t* instance = *ptr;
-  switch (instance->policy) {
+/**
+ * `shard_new_cache` creates the policy instance of a shard holding `capacity`
+ * entries, or if `budget` is nonzero, as many entries as fit in `budget`
+ * bytes.
+ */
+static void shard_new_cache(kvs_t* kvs, kvs_shard_t* shard, int capacity,
+                            size_t budget) {
+  switch (kvs->policy) {
     case KVS_CACHE_NONE:
       break;
     case KVS_CACHE_FIFO:
-      kvs_fifo_free(&instance->fifo);
+      shard->fifo = budget > 0 ? kvs_fifo_new_budget(kvs->kvs_base, budget)
+                               : kvs_fifo_new(kvs->kvs_base, capacity);
+      break;
+    case KVS_CACHE_CLOCK:
+      shard->clock = budget > 0 ? kvs_clock_new_budget(kvs->kvs_base, budget)
+                                : kvs_clock_new(kvs->kvs_base, capacity);
+      break;
+    case KVS_CACHE_LRU:
+      shard->lru = budget > 0 ? kvs_lru_new_budget(kvs->kvs_base, budget)
+                              : kvs_lru_new(kvs->kvs_base, capacity);
+      break;
+    case KVS_CACHE_ARC:
+      shard->arc = budget > 0 ? kvs_arc_new_budget(kvs->kvs_base, budget)
+                              : kvs_arc_new(kvs->kvs_base, capacity);
+      break;
+    case KVS_CACHE_2Q:
+      shard->two_q = budget > 0 ? kvs_2q_new_budget(kvs->kvs_base, budget)
+                                : kvs_2q_new(kvs->kvs_base, capacity);
+      break;
+    case KVS_CACHE_TINYLFU:
+      shard->tinylfu =
+          budget > 0 ? kvs_tinylfu_new_budget(kvs->kvs_base, budget)
+                     : kvs_tinylfu_new(kvs->kvs_base, capacity);
+      break;
+  }
+  if (kvs->compress) {
+    shard_compress(kvs, shard);
+  }
+}
+
+static void shard_init(kvs_t* kvs, kvs_shard_t* shard, int capacity,
+                       size_t budget) {
+  pthread_mutex_init(&shard->lock, NULL);
+  shard->get_count = 0;
+  shard->set_count = 0;
+  set_watermarks(kvs, shard, budget > 0 ? 0 : capacity);
+  shard->cleaning = false;
+  shard->writing_key = NULL;
+  pthread_cond_init(&shard->written, NULL);
+  shard->write_gen = 0;
+  shard->capacity = budget > 0 ? 0 : capacity;
+  shard_new_cache(kvs, shard, capacity, budget);
+}
+
+static void shard_free_cache(kvs_t* kvs, kvs_shard_t* shard) {
+  switch (kvs->policy) {
+    case KVS_CACHE_NONE:
+      break;
+    case KVS_CACHE_FIFO:
+      kvs_fifo_free(&shard->fifo);
+      break;
+    case KVS_CACHE_CLOCK:
+      kvs_clock_free(&shard->clock);
+      break;
+    case KVS_CACHE_LRU:
+      kvs_lru_free(&shard->lru);
+      break;
+    case KVS_CACHE_ARC:
+      kvs_arc_free(&shard->arc);
+      break;
+    case KVS_CACHE_2Q:
+      kvs_2q_free(&shard->two_q);
+      break;
+    case KVS_CACHE_TINYLFU:
+      kvs_tinylfu_free(&shard->tinylfu);
+      break;
+  }
+}
+
+static void shard_destroy(kvs_t* kvs, kvs_shard_t* shard) {
+  shard_free_cache(kvs, shard);
+  pthread_cond_destroy(&shard->written);
+  pthread_mutex_destroy(&shard->lock);
+}
+
+static int shard_dirty(kvs_t* kvs, kvs_shard_t* shard) {
+  switch (kvs->policy) {
+    case KVS_CACHE_NONE:
+      return 0;
+    case KVS_CACHE_FIFO:
+      return kvs_fifo_dirty(shard->fifo);
+    case KVS_CACHE_CLOCK:
+      return kvs_clock_dirty(shard->clock);
+    case KVS_CACHE_LRU:
+      return kvs_lru_dirty(shard->lru);
+    case KVS_CACHE_ARC:
+      return kvs_arc_dirty(shard->arc);
+    case KVS_CACHE_2Q:
+      return kvs_2q_dirty(shard->two_q);
+    case KVS_CACHE_TINYLFU:
+      return kvs_tinylfu_dirty(shard->tinylfu);
+  }
+  return 0;
+}
+
+static int shard_size(kvs_t* kvs, kvs_shard_t* shard) {
+  switch (kvs->policy) {
+    case KVS_CACHE_NONE:
+      return 0;
+    case KVS_CACHE_FIFO:
+      return kvs_fifo_size(shard->fifo);
+    case KVS_CACHE_CLOCK:
+      return kvs_clock_size(shard->clock);
+    case KVS_CACHE_LRU:
+      return kvs_lru_size(shard->lru);
+    case KVS_CACHE_ARC:
+      return kvs_arc_size(shard->arc);
+    case KVS_CACHE_2Q:
+      return kvs_2q_size(shard->two_q);
+    case KVS_CACHE_TINYLFU:
+      return kvs_tinylfu_size(shard->tinylfu);
+  }
+  return 0;
+}
+
+static int shard_take_dirty(kvs_t* kvs, kvs_shard_t* shard, char* key,
+                            char* value) {
+  switch (kvs->policy) {
+    case KVS_CACHE_NONE:
+      return FAILURE;
+    case KVS_CACHE_FIFO:
+      return kvs_fifo_take_dirty(shard->fifo, key, value);
+    case KVS_CACHE_CLOCK:
+      return kvs_clock_take_dirty(shard->clock, key, value);
+    case KVS_CACHE_LRU:
+      return kvs_lru_take_dirty(shard->lru, key, value);
+    case KVS_CACHE_ARC:
+      return kvs_arc_take_dirty(shard->arc, key, value);
+    case KVS_CACHE_2Q:
+      return kvs_2q_take_dirty(shard->two_q, key, value);
+    case KVS_CACHE_TINYLFU:
+      return kvs_tinylfu_take_dirty(shard->tinylfu, key, value);
+  }
+  return FAILURE;
+}
+
+static void shard_mark_dirty(kvs_t* kvs, kvs_shard_t* shard, const char* key) {
+  switch (kvs->policy) {
+    case KVS_CACHE_NONE:
+      break;
+    case KVS_CACHE_FIFO:
+      kvs_fifo_mark_dirty(shard->fifo, key);
+      break;
+    case KVS_CACHE_CLOCK:
+      kvs_clock_mark_dirty(shard->clock, key);
+      break;
+    case KVS_CACHE_LRU:
+      kvs_lru_mark_dirty(shard->lru, key);
+      break;
+    case KVS_CACHE_ARC:
+      kvs_arc_mark_dirty(shard->arc, key);
+      break;
+    case KVS_CACHE_2Q:
+      kvs_2q_mark_dirty(shard->two_q, key);
+      break;
+    case KVS_CACHE_TINYLFU:
+      kvs_tinylfu_mark_dirty(shard->tinylfu, key);
+      break;
+  }
+}
+
+/**
+ * `wait_for_write` blocks, with the shard locked, while the flusher is
+ * writing `key` back, so nobody reads the old file or races the write with a
+ * newer one. A NULL `key` waits for any write.
+ */
+static void wait_for_write(kvs_shard_t* shard, const char* key) {
+  while (shard->writing_key &&
+         (key == NULL || strcmp(shard->writing_key, key) == 0)) {
+    pthread_cond_wait(&shard->written, &shard->lock);
+  }
+}
+
+/**
+ * `clean_shard` writes back the oldest dirty entries of a shard that crossed
+ * its high watermark until it is down to its low watermark. Each entry is
+ * marked clean under the lock and written after the lock is dropped, so GETs
+ * and SETs of other keys never wait for the disk.
+ */
+static void clean_shard(kvs_t* kvs, kvs_shard_t* shard) {
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+  for (;;) {
+    pthread_mutex_lock(&shard->lock);
+    if (!shard->cleaning || shard_dirty(kvs, shard) <= shard->dirty_low ||
+        shard_take_dirty(kvs, shard, key, value) != SUCCESS) {
+      shard->cleaning = false;
+      pthread_mutex_unlock(&shard->lock);
+      return;
+    }
+    shard->writing_key = key;
+    shard->write_gen += 1;
+    pthread_mutex_unlock(&shard->lock);
+
+    int rc = kvs_base_set(kvs->kvs_base, key, value);
+
+    pthread_mutex_lock(&shard->lock);
+    shard->writing_key = NULL;
+    pthread_cond_broadcast(&shard->written);
+    if (rc != SUCCESS) {
+      // leave the entry to eviction and flush rather than retrying
+      shard_mark_dirty(kvs, shard, key);
+      shard->cleaning = false;
+      pthread_mutex_unlock(&shard->lock);
+      return;
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
+static void* flusher_loop(void* arg) {
+  kvs_t* kvs = arg;
+  pthread_mutex_lock(&kvs->flusher_lock);
+  while (!kvs->flusher_stop) {
+    if (!kvs->flusher_pending) {
+      pthread_cond_wait(&kvs->flusher_wake, &kvs->flusher_lock);
+      continue;
+    }
+    kvs->flusher_pending = false;
+    pthread_mutex_unlock(&kvs->flusher_lock);
+    for (int i = 0; i < kvs->shard_count; ++i) {
+      clean_shard(kvs, &kvs->shards[i]);
+    }
+    pthread_mutex_lock(&kvs->flusher_lock);
+  }
+  pthread_mutex_unlock(&kvs->flusher_lock);
+  return NULL;
+}
+
+static void wake_flusher(kvs_t* kvs) {
+  pthread_mutex_lock(&kvs->flusher_lock);
+  kvs->flusher_pending = true;
+  pthread_cond_signal(&kvs->flusher_wake);
+  pthread_mutex_unlock(&kvs->flusher_lock);
+}
+
+static int start_flusher(kvs_t* kvs) {
+  pthread_mutex_init(&kvs->flusher_lock, NULL);
+  pthread_cond_init(&kvs->flusher_wake, NULL);
+  kvs->flusher_pending = false;
+  kvs->flusher_stop = false;
+  if (pthread_create(&kvs->flusher, NULL, flusher_loop, kvs) != 0) {
+    pthread_cond_destroy(&kvs->flusher_wake);
+    pthread_mutex_destroy(&kvs->flusher_lock);
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+static void stop_flusher(kvs_t* kvs) {
+  pthread_mutex_lock(&kvs->flusher_lock);
+  kvs->flusher_stop = true;
+  pthread_cond_signal(&kvs->flusher_wake);
+  pthread_mutex_unlock(&kvs->flusher_lock);
+  pthread_join(kvs->flusher, NULL);
+  pthread_cond_destroy(&kvs->flusher_wake);
+  pthread_mutex_destroy(&kvs->flusher_lock);
+}
+
+static kvs_shard_t* shard_of(kvs_t* kvs, const char* key) {
+  if (kvs->shard_count == 1) {
+    return &kvs->shards[0];
+  }
+  // the low bits of the hash pick the slot inside each shard's index, so the
+  // shard is chosen from the high bits
+  return &kvs->shards[(kvs_hash(key) >> 32) % kvs->shard_count];
+}
+
+// the policies whose order a snapshot can rebuild
+static bool can_snapshot(kvs_replacement_policy policy) {
+  return policy == KVS_CACHE_FIFO || policy == KVS_CACHE_CLOCK ||
+         policy == KVS_CACHE_LRU;
+}
+
+static void shard_snapshot(kvs_t* kvs, kvs_shard_t* shard, kvs_snapshot_fn fn,
+                           void* arg) {
+  switch (kvs->policy) {
+    case KVS_CACHE_FIFO:
+      kvs_fifo_snapshot(shard->fifo, fn, arg);
       break;
     case KVS_CACHE_CLOCK:
-      kvs_clock_free(&instance->clock);
+      kvs_clock_snapshot(shard->clock, fn, arg);
       break;
     case KVS_CACHE_LRU:
-      kvs_lru_free(&instance->lru);
+      kvs_lru_snapshot(shard->lru, fn, arg);
       break;
+    default:
+      break;
+  }
+}
+
+static int shard_restore(kvs_t* kvs, kvs_shard_t* shard, const char* key,
+                         const char* value, bool referenced) {
+  switch (kvs->policy) {
+    case KVS_CACHE_FIFO:
+      return kvs_fifo_restore(shard->fifo, key, value, referenced);
+    case KVS_CACHE_CLOCK:
+      return kvs_clock_restore(shard->clock, key, value, referenced);
+    case KVS_CACHE_LRU:
+      return kvs_lru_restore(shard->lru, key, value, referenced);
+    default:
+      return FAILURE;
+  }
+}
+
+static void add_to_snapshot(void* arg, const char* key, bool referenced) {
+  kvs_snapshot_add(arg, key, referenced);
+}
+
+/**
+ * `save_snapshot` writes the resident keys of every shard to the snapshot.
+ * Shards are written one after another, each in its policy's order, so
+ * reloading one shard's keys in file order rebuilds it.
+ */
+static void save_snapshot(kvs_t* kvs) {
+  kvs_snapshot_t* snapshot = kvs_snapshot_create(kvs->kvs_base->dir.fd);
+  if (snapshot == NULL) {
+    return;
+  }
+  for (int i = 0; i < kvs->shard_count; ++i) {
+    kvs_shard_t* shard = &kvs->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    shard_snapshot(kvs, shard, add_to_snapshot, snapshot);
+    pthread_mutex_unlock(&shard->lock);
+  }
+  kvs_snapshot_commit(&snapshot);
+}
+
+/**
+ * `warm_start` reloads the keys of the snapshot, reading their values from
+ * the store `KVS_WARM_CHUNK` at a time with the reads running concurrently.
+ * It may run while the store is in use: like `kvs_mget`, it only admits a
+ * value if its shard wrote nothing since the read, and a key the workload has
+ * loaded first is left alone. A shard stops taking keys once it is full, and
+ * the reload stops when every shard is.
+ */
+static void warm_start(kvs_t* kvs) {
+  kvs_snapshot_t* snapshot = kvs_snapshot_open(kvs->kvs_base->dir.fd);
+  char(*keys)[KVS_KEY_MAX] = malloc(KVS_WARM_CHUNK * sizeof(*keys));
+  char(*values)[KVS_VALUE_MAX] = malloc(KVS_WARM_CHUNK * sizeof(*values));
+  bool* full = calloc(kvs->shard_count, sizeof(bool));
+  if (snapshot == NULL || keys == NULL || values == NULL || full == NULL) {
+    kvs_snapshot_free(&snapshot);
+    free(keys);
+    free(values);
+    free(full);
+    return;
+  }
+
+  const char* key_ptrs[KVS_WARM_CHUNK];
+  char* value_ptrs[KVS_WARM_CHUNK];
+  bool referenced[KVS_WARM_CHUNK];
+  bool read[KVS_WARM_CHUNK];
+  unsigned long gens[KVS_WARM_CHUNK];
+  int open_shards = kvs->shard_count;
+  bool more = true;
+  while (more && open_shards > 0 && !atomic_load(&kvs->warm_stop)) {
+    int count = 0;
+    while (count < KVS_WARM_CHUNK) {
+      if (kvs_snapshot_next(snapshot, keys[count], &referenced[count]) !=
+          SUCCESS) {
+        more = false;
+        break;
+      }
+      kvs_shard_t* shard = shard_of(kvs, keys[count]);
+      if (full[shard - kvs->shards]) {
+        continue;
+      }
+      pthread_mutex_lock(&shard->lock);
+      gens[count] = shard->write_gen;
+      pthread_mutex_unlock(&shard->lock);
+      key_ptrs[count] = keys[count];
+      value_ptrs[count] = values[count];
+      count += 1;
+    }
+    if (count == 0) {
+      break;
+    }
+    kvs_base_read_batch(kvs->kvs_base, count, key_ptrs, value_ptrs, read);
+
+    for (int i = 0; i < count; ++i) {
+      kvs_shard_t* shard = shard_of(kvs, keys[i]);
+      int index = shard - kvs->shards;
+      // an empty value is a key that has gone from the store
+      if (!read[i] || full[index] || values[i][0] == '\0') {
+        continue;
+      }
+      pthread_mutex_lock(&shard->lock);
+      wait_for_write(shard, keys[i]);
+      if (shard->write_gen == gens[i]) {
+        if (shard_restore(kvs, shard, keys[i], values[i], referenced[i]) ==
+            SUCCESS) {
+          atomic_fetch_add(&kvs->warmed, 1);
+        } else {
+          full[index] = true;
+          open_shards -= 1;
+        }
+      }
+      pthread_mutex_unlock(&shard->lock);
+    }
+  }
+
+  kvs_snapshot_free(&snapshot);
+  free(keys);
+  free(values);
+  free(full);
+}
+
+static int replay_set(void* arg, const char* key, const char* value) {
+  return kvs_base_set(arg, key, value);
+}
+
+/**
+ * `open_wal` writes the SETs a crash left in the log to the store, syncs
+ * them, and starts a new log.
+ */
+static kvs_wal_t* open_wal(kvs_base_t* kvs_base, const kvs_config_t* config) {
+  long replayed = kvs_wal_replay(kvs_base->dir.fd, replay_set, kvs_base);
+  if (replayed < 0 ||
+      (replayed > 0 && kvs_base_sync(kvs_base) != SUCCESS)) {
+    return NULL;
+  }
+  return kvs_wal_open(kvs_base->dir.fd, config->wal_durability,
+                      config->wal_interval_ms);
+}
+
+// the worker side of `kvs_prefetch`, below with the other requests
+static void prefetch_keys(void* arg, int count, const char** keys);
+
+static void* warmer_loop(void* arg) {
+  warm_start(arg);
+  return NULL;
+}
+
+kvs_t* kvs_new_config(const kvs_config_t* config) {
+  kvs_t* instance = malloc(sizeof(kvs_t));
+  if (instance == NULL) {
+    return NULL;
+  }
+  instance->trace = NULL;
+  if (config->trace && (instance->trace = kvs_trace_open(
+                            config->trace, config->trace_keys)) == NULL) {
+    free(instance);
+    return NULL;
+  }
+  instance->kvs_base = kvs_base_new_layout(config->directory, config->backend,
+                                           config->layout);
+  if (instance->kvs_base == NULL) {
+    kvs_trace_free(&instance->trace);
+    free(instance);
+    return NULL;
+  }
+  if (config->filter && kvs_base_enable_filter(instance->kvs_base) != SUCCESS) {
+    kvs_base_free(&instance->kvs_base);
+    kvs_trace_free(&instance->trace);
+    free(instance);
+    return NULL;
+  }
+  if (config->scan && kvs_base_enable_keys(instance->kvs_base) != SUCCESS) {
+    kvs_base_free(&instance->kvs_base);
+    kvs_trace_free(&instance->trace);
+    free(instance);
+    return NULL;
+  }
+  // only evictions fill the flash tier, so it needs a cache above it
+  if (config->l2_size > 0 && config->policy != KVS_CACHE_NONE &&
+      kvs_base_enable_l2(instance->kvs_base, config->l2_path,
+                         config->l2_size) != SUCCESS) {
+    kvs_base_free(&instance->kvs_base);
+    kvs_trace_free(&instance->trace);
+    free(instance);
+    return NULL;
+  }
+  instance->wal = NULL;
+  if (config->wal &&
+      (instance->wal = open_wal(instance->kvs_base, config)) == NULL) {
+    kvs_base_free(&instance->kvs_base);
+    kvs_trace_free(&instance->trace);
+    free(instance);
+    return NULL;
+  }
+  instance->policy = config->policy;
+  instance->memory = config->policy != KVS_CACHE_NONE ? config->memory : 0;
+  instance->capacity = instance->memory == 0 ? config->capacity : 0;
+  instance->compress = config->compress;
+  instance->dirty_high = config->dirty_high;
+  instance->dirty_low = config->dirty_low;
+
+  // every shard needs room for at least one entry
+  int shard_count = config->shards > 0 ? config->shards : 1;
+  if (config->policy != KVS_CACHE_NONE && instance->memory == 0 &&
+      shard_count > config->capacity) {
+    shard_count = config->capacity > 0 ? config->capacity : 1;
+  }
+  instance->shard_count = shard_count;
+  instance->shards =
+      aligned_alloc(alignof(kvs_shard_t), shard_count * sizeof(kvs_shard_t));
+  if (instance->shards == NULL) {
+    if (instance->wal) {
+      kvs_wal_free(&instance->wal);
+    }
+    kvs_base_free(&instance->kvs_base);
+    kvs_trace_free(&instance->trace);
+    free(instance);
+    return NULL;
+  }
+  for (int i = 0; i < shard_count; ++i) {
+    // spread the remainder over the first shards
+    int capacity = config->capacity / shard_count +
+                   (i < config->capacity % shard_count ? 1 : 0);
+    size_t budget = instance->memory / shard_count;
+    if (instance->memory > 0 && budget == 0) {
+      budget = 1;
+    }
+    shard_init(instance, &instance->shards[i], capacity, budget);
+  }
+
+  instance->write_back =
+      config->write_back && config->policy != KVS_CACHE_NONE;
+  if (instance->write_back && start_flusher(instance) != SUCCESS) {
+    instance->write_back = false;
+  }
+
+  // the models stand for a cache of so many entries, which a byte budget
+  // does not have
+  instance->shadow = config->mrc && config->policy != KVS_CACHE_NONE &&
+                             instance->capacity > 0
+                         ? kvs_shadow_new(instance->capacity)
+                         : NULL;
+  instance->auto_policy = instance->shadow && config->auto_policy &&
+                          can_snapshot(config->policy);
+  atomic_init(&instance->switching, false);
+  instance->auto_windows = 0;
+  atomic_init(&instance->policy_switches, 0);
+
+  atomic_init(&instance->prefetched, 0);
+  instance->readahead =
+      config->policy != KVS_CACHE_NONE && config->prefetch_threads > 0
+          ? kvs_readahead_new(config->prefetch_threads, KVS_PREFETCH_QUEUE,
+                              prefetch_keys, instance)
+          : NULL;
+
+  instance->snapshot = config->snapshot && can_snapshot(config->policy);
+  instance->warming = false;
+  atomic_init(&instance->warm_stop, false);
+  atomic_init(&instance->warmed, 0);
+  if (instance->snapshot) {
+    instance->warming =
+        config->warm_background &&
+        pthread_create(&instance->warmer, NULL, warmer_loop, instance) == 0;
+    if (!instance->warming) {
+      warm_start(instance);
+    }
+  }
+  return instance;
+}
+
+void kvs_free(kvs_t** ptr) {
+  kvs_t* instance = *ptr;
+  if (instance->warming) {
+    atomic_store(&instance->warm_stop, true);
+    pthread_join(instance->warmer, NULL);
+  }
+  kvs_readahead_free(&instance->readahead);
+  if (instance->write_back) {
+    stop_flusher(instance);
   }
+  if (instance->snapshot) {
+    save_snapshot(instance);
+  }
+  if (instance->wal) {
+    kvs_wal_free(&instance->wal);
+  }
+  for (int i = 0; i < instance->shard_count; ++i) {
+    shard_destroy(instance, &instance->shards[i]);
+  }
+  free(instance->shards);
+  kvs_shadow_free(&instance->shadow);
+  kvs_trace_free(&instance->trace);
   kvs_base_free(&instance->kvs_base);
   free(instance);
   *ptr = NULL;
 }
 
-int kvs_get(kvs_t* kvs, const char* key, char* value) {
-  kvs->get_count += 1;
+static int shard_get(kvs_t* kvs, kvs_shard_t* shard, const char* key,
+                     char* value) {
   switch (kvs->policy) {
     case KVS_CACHE_NONE:
       return kvs_base_get(kvs->kvs_base, key, value);
     case KVS_CACHE_FIFO:
-      return kvs_fifo_get(kvs->fifo, key, value);
+      return kvs_fifo_get(shard->fifo, key, value);
     case KVS_CACHE_CLOCK:
-      return kvs_clock_get(kvs->clock, key, value);
+      return kvs_clock_get(shard->clock, key, value);
     case KVS_CACHE_LRU:
-      return kvs_lru_get(kvs->lru, key, value);
+      return kvs_lru_get(shard->lru, key, value);
+    case KVS_CACHE_ARC:
+      return kvs_arc_get(shard->arc, key, value);
+    case KVS_CACHE_2Q:
+      return kvs_2q_get(shard->two_q, key, value);
+    case KVS_CACHE_TINYLFU:
+      return kvs_tinylfu_get(shard->tinylfu, key, value);
   }
   return FAILURE;  // impossible
 }
 
-int kvs_set(kvs_t* kvs, const char* key, const char* value) {
-  kvs->set_count += 1;
+static int shard_get_cached(kvs_t* kvs, kvs_shard_t* shard,
+                            const char* key, char* value) {
+  switch (kvs->policy) {
+    case KVS_CACHE_NONE:
+      return FAILURE;
+    case KVS_CACHE_FIFO:
+      return kvs_fifo_get_cached(shard->fifo, key, value);
+    case KVS_CACHE_CLOCK:
+      return kvs_clock_get_cached(shard->clock, key, value);
+    case KVS_CACHE_LRU:
+      return kvs_lru_get_cached(shard->lru, key, value);
+    case KVS_CACHE_ARC:
+      return kvs_arc_get_cached(shard->arc, key, value);
+    case KVS_CACHE_2Q:
+      return kvs_2q_get_cached(shard->two_q, key, value);
+    case KVS_CACHE_TINYLFU:
+      return kvs_tinylfu_get_cached(shard->tinylfu, key, value);
+  }
+  return FAILURE;  // impossible
+}
+
+static int shard_load(kvs_t* kvs, kvs_shard_t* shard, const char* key,
+                      char* value) {
+  switch (kvs->policy) {
+    case KVS_CACHE_NONE:
+      return SUCCESS;
+    case KVS_CACHE_FIFO:
+      return kvs_fifo_load(shard->fifo, key, value);
+    case KVS_CACHE_CLOCK:
+      return kvs_clock_load(shard->clock, key, value);
+    case KVS_CACHE_LRU:
+      return kvs_lru_load(shard->lru, key, value);
+    case KVS_CACHE_ARC:
+      return kvs_arc_load(shard->arc, key, value);
+    case KVS_CACHE_2Q:
+      return kvs_2q_load(shard->two_q, key, value);
+    case KVS_CACHE_TINYLFU:
+      return kvs_tinylfu_load(shard->tinylfu, key, value);
+  }
+  return FAILURE;  // impossible
+}
+
+static bool shard_contains(kvs_t* kvs, kvs_shard_t* shard, const char* key) {
+  switch (kvs->policy) {
+    case KVS_CACHE_NONE:
+      return false;
+    case KVS_CACHE_FIFO:
+      return kvs_fifo_contains(shard->fifo, key);
+    case KVS_CACHE_CLOCK:
+      return kvs_clock_contains(shard->clock, key);
+    case KVS_CACHE_LRU:
+      return kvs_lru_contains(shard->lru, key);
+    case KVS_CACHE_ARC:
+      return kvs_arc_contains(shard->arc, key);
+    case KVS_CACHE_2Q:
+      return kvs_2q_contains(shard->two_q, key);
+    case KVS_CACHE_TINYLFU:
+      return kvs_tinylfu_contains(shard->tinylfu, key);
+  }
+  return false;  // impossible
+}
+
+static int shard_peek(kvs_t* kvs, kvs_shard_t* shard, const char* key,
+                      char* value) {
+  switch (kvs->policy) {
+    case KVS_CACHE_NONE:
+      return FAILURE;
+    case KVS_CACHE_FIFO:
+      return kvs_fifo_peek(shard->fifo, key, value);
+    case KVS_CACHE_CLOCK:
+      return kvs_clock_peek(shard->clock, key, value);
+    case KVS_CACHE_LRU:
+      return kvs_lru_peek(shard->lru, key, value);
+    case KVS_CACHE_ARC:
+      return kvs_arc_peek(shard->arc, key, value);
+    case KVS_CACHE_2Q:
+      return kvs_2q_peek(shard->two_q, key, value);
+    case KVS_CACHE_TINYLFU:
+      return kvs_tinylfu_peek(shard->tinylfu, key, value);
+  }
+  return FAILURE;  // impossible
+}
+
+static int shard_set(kvs_t* kvs, kvs_shard_t* shard, const char* key,
+                     const char* value) {
   switch (kvs->policy) {
     case KVS_CACHE_NONE:
       return kvs_base_set(kvs->kvs_base, key, value);
     case KVS_CACHE_FIFO:
-      return kvs_fifo_set(kvs->fifo, key, value);
+      return kvs_fifo_set(shard->fifo, key, value);
     case KVS_CACHE_CLOCK:
-      return kvs_clock_set(kvs->clock, key, value);
+      return kvs_clock_set(shard->clock, key, value);
     case KVS_CACHE_LRU:
-      return kvs_lru_set(kvs->lru, key, value);
+      return kvs_lru_set(shard->lru, key, value);
+    case KVS_CACHE_ARC:
+      return kvs_arc_set(shard->arc, key, value);
+    case KVS_CACHE_2Q:
+      return kvs_2q_set(shard->two_q, key, value);
+    case KVS_CACHE_TINYLFU:
+      return kvs_tinylfu_set(shard->tinylfu, key, value);
   }
   return FAILURE;  // impossible
 }
 
-int kvs_flush(kvs_t* kvs) {
+static int shard_flush(kvs_t* kvs, kvs_shard_t* shard) {
   switch (kvs->policy) {
     case KVS_CACHE_NONE:
       // no need to flush for KVS_CACHE_NONE
       return SUCCESS;
     case KVS_CACHE_FIFO:
-      return kvs_fifo_flush(kvs->fifo);
+      return kvs_fifo_flush(shard->fifo);
     case KVS_CACHE_CLOCK:
-      return kvs_clock_flush(kvs->clock);
+      return kvs_clock_flush(shard->clock);
     case KVS_CACHE_LRU:
-      return kvs_lru_flush(kvs->lru);
+      return kvs_lru_flush(shard->lru);
+    case KVS_CACHE_ARC:
+      return kvs_arc_flush(shard->arc);
+    case KVS_CACHE_2Q:
+      return kvs_2q_flush(shard->two_q);
+    case KVS_CACHE_TINYLFU:
+      return kvs_tinylfu_flush(shard->tinylfu);
   }
   return SUCCESS;
 }
+
+/**
+ * `moving_t` holds the entries of a shard while it changes policy, packed
+ * one after another: a byte for the CLOCK reference bit, then the key and
+ * the value with their terminators.
+ */
+typedef struct moving {
+  char* data;
+  size_t length;
+  size_t capacity;
+  bool failed;
+} moving_t;
+
+static void moving_add(moving_t* moving, const char* bytes, size_t length) {
+  if (moving->failed) {
+    return;
+  }
+  if (moving->length + length > moving->capacity) {
+    size_t capacity = moving->capacity ? moving->capacity * 2 : 4096;
+    while (capacity < moving->length + length) {
+      capacity *= 2;
+    }
+    char* data = realloc(moving->data, capacity);
+    if (data == NULL) {
+      moving->failed = true;
+      return;
+    }
+    moving->data = data;
+    moving->capacity = capacity;
+  }
+  memcpy(moving->data + moving->length, bytes, length);
+  moving->length += length;
+}
+
+static void add_to_moving(void* arg, const char* key, bool referenced) {
+  char flag = referenced;
+  moving_add(arg, &flag, 1);
+  moving_add(arg, key, strlen(key) + 1);
+}
+
+/**
+ * `pack_shard` copies the entries of a clean shard to `entries` in the order
+ * its policy restores them from. The keys are gathered first, since reading
+ * a value may reorder the policy's lists.
+ */
+static void pack_shard(kvs_t* kvs, kvs_shard_t* shard, moving_t* entries) {
+  moving_t keys = {0};
+  char value[KVS_VALUE_MAX];
+  shard_snapshot(kvs, shard, add_to_moving, &keys);
+  for (size_t at = 0; !keys.failed && at < keys.length;) {
+    const char* key = keys.data + at + 1;
+    size_t length = strlen(key) + 1;
+    if (shard_get_cached(kvs, shard, key, value) == SUCCESS) {
+      moving_add(entries, keys.data + at, length + 1);
+      moving_add(entries, value, strlen(value) + 1);
+    }
+    at += length + 1;
+  }
+  free(keys.data);
+}
+
+static void unpack_shard(kvs_t* kvs, kvs_shard_t* shard, moving_t* entries) {
+  for (size_t at = 0; !entries->failed && at < entries->length;) {
+    bool referenced = entries->data[at] != 0;
+    const char* key = entries->data + at + 1;
+    const char* value = key + strlen(key) + 1;
+    shard_restore(kvs, shard, key, value, referenced);
+    at = value + strlen(value) + 1 - entries->data;
+  }
+}
+
+/**
+ * `switch_policy` moves the cache to `policy` with every shard locked, so
+ * no request sees a shard between policies. Dirty entries are written back
+ * first and the move is called off if any write fails; the clean entries
+ * then go across in their policy's order, the way a snapshot would reload
+ * them. A shard whose copy runs out of memory starts empty, which only costs
+ * misses.
+ */
+static void switch_policy(kvs_t* kvs, kvs_replacement_policy policy) {
+  // shards are only ever locked one at a time elsewhere, so taking them all
+  // in order cannot deadlock
+  for (int i = 0; i < kvs->shard_count; ++i) {
+    pthread_mutex_lock(&kvs->shards[i].lock);
+  }
+  bool clean = true;
+  for (int i = 0; i < kvs->shard_count; ++i) {
+    kvs_shard_t* shard = &kvs->shards[i];
+    wait_for_write(shard, NULL);
+    unsigned long writes = kvs_base_thread_writes();
+    if (shard_flush(kvs, shard) != SUCCESS) {
+      clean = false;
+    }
+    shard->write_gen += kvs_base_thread_writes() - writes;
+  }
+  if (clean) {
+    moving_t* moving = calloc(kvs->shard_count, sizeof(moving_t));
+    for (int i = 0; i < kvs->shard_count; ++i) {
+      if (moving) {
+        pack_shard(kvs, &kvs->shards[i], &moving[i]);
+      }
+      shard_free_cache(kvs, &kvs->shards[i]);
+    }
+    kvs->policy = policy;
+    for (int i = 0; i < kvs->shard_count; ++i) {
+      kvs_shard_t* shard = &kvs->shards[i];
+      shard_new_cache(kvs, shard, shard->capacity, 0);
+      if (moving) {
+        unpack_shard(kvs, shard, &moving[i]);
+        free(moving[i].data);
+      }
+    }
+    free(moving);
+    atomic_fetch_add(&kvs->policy_switches, 1);
+  }
+  for (int i = kvs->shard_count - 1; i >= 0; --i) {
+    pthread_mutex_unlock(&kvs->shards[i].lock);
+  }
+}
+
+/**
+ * `consider_switch` runs at the end of every window of the shadow models.
+ * Once enough windows have passed since the last switch, it moves to the
+ * policy predicted to hit most often at the cache's capacity if that beats
+ * the current one by `KVS_AUTO_MARGIN`. Only the thread holding `switching`
+ * changes `kvs->policy`, so it may read it without a shard lock.
+ */
+static void consider_switch(kvs_t* kvs) {
+  if (atomic_exchange(&kvs->switching, true)) {
+    return;
+  }
+  if (++kvs->auto_windows >= KVS_AUTO_WINDOWS) {
+    kvs_mrc_point_t points[KVS_MRC_POINTS];
+    int count = kvs_shadow_curve(kvs->shadow, points, KVS_MRC_POINTS);
+    double current = 0;
+    kvs_mrc_point_t* best = NULL;
+    for (int i = 0; i < count; ++i) {
+      if (points[i].capacity != kvs->capacity ||
+          !can_snapshot(points[i].policy)) {
+        continue;
+      }
+      if (points[i].policy == kvs->policy) {
+        current = points[i].hit_rate;
+      }
+      if (best == NULL || points[i].hit_rate > best->hit_rate) {
+        best = &points[i];
+      }
+    }
+    if (best && best->policy != kvs->policy &&
+        best->hit_rate >= current + KVS_AUTO_MARGIN) {
+      switch_policy(kvs, best->policy);
+      kvs->auto_windows = 0;
+    }
+  }
+  atomic_store(&kvs->switching, false);
+}
+
+/**
+ * `observe` shows a request to the shadow models, if any. It is called with
+ * no shard locked, since a switch of policy needs them all.
+ */
+static void observe(kvs_t* kvs, const char* key, bool get) {
+  if (kvs->shadow && kvs_shadow_access(kvs->shadow, key, get) &&
+      kvs->auto_policy) {
+    consider_switch(kvs);
+  }
+}
+
+/**
+ * `trace` records a request that started at `start`, if the store is
+ * tracing, with the length of the value it stored or found.
+ */
+static void trace(kvs_t* kvs, kvs_trace_kind kind, const char* key,
+                  const char* value, uint64_t start) {
+  if (kvs->trace) {
+    kvs_trace_record(kvs->trace, kind, key, value ? strlen(value) : 0,
+                     start);
+  }
+}
+
+/**
+ * `get_unlocked` answers a GET of a key a CLOCK shard holds without taking
+ * the shard lock (see `kvs_clock_get_unlocked`), and returns FAILURE for
+ * any other GET. A cached value is current even while the flusher writes it
+ * back, so there is no write to wait for. The policy and the shard's cache
+ * are only read without the lock when `auto_policy` cannot switch them.
+ */
+static int get_unlocked(kvs_t* kvs, kvs_shard_t* shard, const char* key,
+                        char* value) {
+  if (kvs->auto_policy || kvs->policy != KVS_CACHE_CLOCK ||
+      kvs_clock_get_unlocked(shard->clock, key, value) != SUCCESS) {
+    return FAILURE;
+  }
+  atomic_fetch_add_explicit(&shard->get_count, 1, memory_order_relaxed);
+  return SUCCESS;
+}
+
+/**
+ * `key_fits` tells whether the store can hold `key` (see
+ * `kvs_base_valid_key`). Every layer copies keys into `KVS_KEY_MAX` bytes,
+ * and a cached key the store cannot write could never be evicted.
+ */
+static bool key_fits(kvs_t* kvs, const char* key) {
+  return kvs_base_valid_key(kvs->kvs_base, key);
+}
+
+/**
+ * `fits` tells whether `key` and `value` can be stored: every reader copies
+ * values into `KVS_VALUE_MAX` bytes.
+ */
+static bool fits(kvs_t* kvs, const char* key, const char* value) {
+  return key_fits(kvs, key) && strlen(value) < KVS_VALUE_MAX;
+}
+
+int kvs_get(kvs_t* kvs, const char* key, char* value) {
+  if (!key_fits(kvs, key)) {
+    return FAILURE;
+  }
+  uint64_t start = kvs_metrics_now();
+  // the storage layer is only reached on a miss
+  unsigned long base_gets = kvs_base_thread_gets();
+  kvs_shard_t* shard = shard_of(kvs, key);
+  int rc = get_unlocked(kvs, shard, key, value);
+  if (rc != SUCCESS) {
+    pthread_mutex_lock(&shard->lock);
+    wait_for_write(shard, key);
+    shard->get_count += 1;
+    unsigned long writes = kvs_base_thread_writes();
+    rc = shard_get(kvs, shard, key, value);
+    shard->write_gen += kvs_base_thread_writes() - writes;
+    pthread_mutex_unlock(&shard->lock);
+  }
+  bool hit = kvs_base_thread_gets() == base_gets;
+  observe(kvs, key, true);
+  trace(kvs, KVS_TRACE_GET, key, rc == SUCCESS ? value : NULL, start);
+  kvs_metrics_record(&kvs->kvs_base->metrics,
+                     hit ? KVS_STATS_GET_HIT : KVS_STATS_GET_MISS,
+                     kvs_metrics_now() - start);
+  return rc;
+}
+
+/**
+ * `apply_set` is `kvs_set` short of waiting for the write-ahead log: it
+ * stores in `*sequence` the log record to commit.
+ */
+static int apply_set(kvs_t* kvs, const char* key, const char* value,
+                     uint64_t* sequence) {
+  *sequence = 0;
+  if (!fits(kvs, key, value)) {
+    return FAILURE;
+  }
+  kvs_shard_t* shard = shard_of(kvs, key);
+  pthread_mutex_lock(&shard->lock);
+  wait_for_write(shard, key);
+  shard->set_count += 1;
+  // logged under the shard lock, so the log holds the SETs of a key in the
+  // order the cache applies them, and a flush that gets the lock after a
+  // record was appended also finds its entry
+  *sequence = kvs->wal ? kvs_wal_append(kvs->wal, key, value) : 0;
+  if (kvs->wal && *sequence == 0) {
+    pthread_mutex_unlock(&shard->lock);
+    return FAILURE;
+  }
+  unsigned long writes = kvs_base_thread_writes();
+  int rc = shard_set(kvs, shard, key, value);
+  shard->write_gen += kvs_base_thread_writes() - writes;
+  if (kvs->memory > 0) {
+    // a byte budget holds however many entries fit
+    set_watermarks(kvs, shard, shard_size(kvs, shard));
+  }
+  bool wake = false;
+  if (kvs->write_back && !shard->cleaning &&
+      shard_dirty(kvs, shard) >= shard->dirty_high) {
+    shard->cleaning = true;
+    wake = true;
+  }
+  pthread_mutex_unlock(&shard->lock);
+  if (wake) {
+    wake_flusher(kvs);
+  }
+  // a cached key is listed before it reaches the store
+  if (rc == SUCCESS && kvs->kvs_base->keys) {
+    kvs_btree_insert(kvs->kvs_base->keys, key);
+  }
+  observe(kvs, key, false);
+  return rc;
+}
+
+int kvs_set(kvs_t* kvs, const char* key, const char* value) {
+  uint64_t start = kvs_metrics_now();
+  uint64_t sequence;
+  int rc = apply_set(kvs, key, value, &sequence);
+  trace(kvs, KVS_TRACE_SET, key, value, start);
+  // waiting for the sync with no lock held lets other SETs share it
+  if (kvs->wal && kvs_wal_commit(kvs->wal, sequence) != SUCCESS) {
+    rc = FAILURE;
+  }
+  kvs_metrics_record(&kvs->kvs_base->metrics, KVS_STATS_SET,
+                     kvs_metrics_now() - start);
+  return rc;
+}
+
+int kvs_flush(kvs_t* kvs) {
+  uint64_t start = kvs_metrics_now();
+  int rc = SUCCESS;
+  // every record of the older log files belongs to a SET that has released
+  // its shard, so the flush below writes it back
+  unsigned wal_file = kvs->wal ? kvs_wal_rotate(kvs->wal) : 0;
+  for (int i = 0; i < kvs->shard_count; ++i) {
+    kvs_shard_t* shard = &kvs->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    wait_for_write(shard, NULL);
+    unsigned long writes = kvs_base_thread_writes();
+    if (shard_flush(kvs, shard) != SUCCESS) {
+      rc = FAILURE;
+    }
+    shard->write_gen += kvs_base_thread_writes() - writes;
+    pthread_mutex_unlock(&shard->lock);
+  }
+  if (kvs->wal) {
+    if (wal_file == 0 || rc != SUCCESS ||
+        kvs_base_sync(kvs->kvs_base) != SUCCESS) {
+      rc = FAILURE;
+    } else {
+      kvs_wal_release(kvs->wal, wal_file);
+    }
+  }
+  trace(kvs, KVS_TRACE_FLUSH, NULL, NULL, start);
+  kvs_metrics_record(&kvs->kvs_base->metrics, KVS_STATS_FLUSH,
+                     kvs_metrics_now() - start);
+  return rc;
+}
+
+/**
+ * `kvs_mget` reads its misses from disk with no lock held, so by the time a
+ * value comes back the key may have been set and written back by another
+ * thread. Each miss remembers its shard's `write_gen`; a value is only
+ * admitted if the shard has not written anything since, and otherwise the
+ * key is looked up again the ordinary way.
+ */
+int kvs_mget(kvs_t* kvs, int count, const char** keys, char** values) {
+  uint64_t start = kvs_metrics_now();
+  int* misses = malloc(count * sizeof(int));
+  unsigned long* gens = malloc(count * sizeof(unsigned long));
+  bool* read = malloc(count * sizeof(bool));
+  const char** miss_keys = malloc(count * sizeof(char*));
+  char** miss_values = malloc(count * sizeof(char*));
+  if (misses == NULL || gens == NULL || read == NULL || miss_keys == NULL ||
+      miss_values == NULL) {
+    free(misses);
+    free(gens);
+    free(read);
+    free(miss_keys);
+    free(miss_values);
+    int rc = SUCCESS;
+    for (int i = 0; i < count; ++i) {
+      if (kvs_get(kvs, keys[i], values[i]) != SUCCESS) {
+        rc = FAILURE;
+      }
+    }
+    return rc;
+  }
+
+  // serve what is cached, and note the shard generation of each miss
+  int rc = SUCCESS;
+  int miss_count = 0;
+  for (int i = 0; i < count; ++i) {
+    if (!key_fits(kvs, keys[i])) {
+      rc = FAILURE;
+      continue;
+    }
+    uint64_t hit_start = kvs_metrics_now();
+    kvs_shard_t* shard = shard_of(kvs, keys[i]);
+    pthread_mutex_lock(&shard->lock);
+    wait_for_write(shard, keys[i]);
+    shard->get_count += 1;
+    if (shard_get_cached(kvs, shard, keys[i], values[i]) == SUCCESS) {
+      pthread_mutex_unlock(&shard->lock);
+      observe(kvs, keys[i], true);
+      trace(kvs, KVS_TRACE_GET, keys[i], values[i], hit_start);
+      kvs_metrics_record(&kvs->kvs_base->metrics, KVS_STATS_GET_HIT,
+                         kvs_metrics_now() - hit_start);
+      continue;
+    }
+    gens[miss_count] = shard->write_gen;
+    pthread_mutex_unlock(&shard->lock);
+    observe(kvs, keys[i], true);
+    misses[miss_count] = i;
+    miss_keys[miss_count] = keys[i];
+    miss_values[miss_count] = values[i];
+    miss_count += 1;
+  }
+
+  if (miss_count > 0) {
+    kvs_base_get_batch(kvs->kvs_base, miss_count, miss_keys, miss_values,
+                       read);
+  }
+
+  for (int m = 0; m < miss_count; ++m) {
+    int i = misses[m];
+    kvs_shard_t* shard = shard_of(kvs, keys[i]);
+    pthread_mutex_lock(&shard->lock);
+    wait_for_write(shard, keys[i]);
+    bool fresh = read[m] && shard->write_gen == gens[m];
+    unsigned long writes = kvs_base_thread_writes();
+    unsigned long base_gets = kvs_base_thread_gets();
+    int key_rc = fresh ? shard_load(kvs, shard, keys[i], values[i])
+                       : shard_get(kvs, shard, keys[i], values[i]);
+    shard->write_gen += kvs_base_thread_writes() - writes;
+    pthread_mutex_unlock(&shard->lock);
+    // a key looked up again may have been cached meanwhile, which is a hit
+    // as it would be for `kvs_get`
+    bool hit = !fresh && kvs_base_thread_gets() == base_gets;
+    if (key_rc != SUCCESS) {
+      rc = FAILURE;
+    }
+    trace(kvs, KVS_TRACE_GET, keys[i], key_rc == SUCCESS ? values[i] : NULL,
+          start);
+    kvs_metrics_record(&kvs->kvs_base->metrics,
+                       hit ? KVS_STATS_GET_HIT : KVS_STATS_GET_MISS,
+                       kvs_metrics_now() - start);
+  }
+
+  free(misses);
+  free(gens);
+  free(read);
+  free(miss_keys);
+  free(miss_values);
+  return rc;
+}
+
+int kvs_mset(kvs_t* kvs, int count, const char** keys, const char** values) {
+  // a batch is written with no shard locked, which the log cannot order
+  // against `kvs_flush`
+  kvs_batch_t* batch = kvs->policy == KVS_CACHE_NONE && kvs->wal == NULL
+                           ? kvs_batch_new(count)
+                           : NULL;
+  if (batch == NULL) {
+    int rc = SUCCESS;
+    uint64_t last = 0;
+    for (int i = 0; i < count; ++i) {
+      uint64_t start = kvs_metrics_now();
+      uint64_t sequence;
+      if (apply_set(kvs, keys[i], values[i], &sequence) != SUCCESS) {
+        rc = FAILURE;
+      }
+      trace(kvs, KVS_TRACE_SET, keys[i], values[i], start);
+      last = sequence > last ? sequence : last;
+      kvs_metrics_record(&kvs->kvs_base->metrics, KVS_STATS_SET,
+                         kvs_metrics_now() - start);
+    }
+    // one sync covers the whole group
+    if (kvs->wal && kvs_wal_commit(kvs->wal, last) != SUCCESS) {
+      rc = FAILURE;
+    }
+    return rc;
+  }
+
+  uint64_t start = kvs_metrics_now();
+  int rc = SUCCESS;
+  for (int i = 0; i < count; ++i) {
+    if (!fits(kvs, keys[i], values[i])) {
+      rc = FAILURE;
+      continue;
+    }
+    // the batch is written in no particular order, so only the last value
+    // of a repeated key may go in
+    bool repeated = false;
+    for (int j = i + 1; j < count && !repeated; ++j) {
+      repeated = strcmp(keys[i], keys[j]) == 0;
+    }
+    if (!repeated) {
+      kvs_batch_add(batch, keys[i], values[i]);
+    }
+    kvs_shard_t* shard = shard_of(kvs, keys[i]);
+    pthread_mutex_lock(&shard->lock);
+    shard->set_count += 1;
+    shard->write_gen += 1;
+    pthread_mutex_unlock(&shard->lock);
+    trace(kvs, KVS_TRACE_SET, keys[i], values[i], start);
+  }
+  if (kvs_base_set_batch(kvs->kvs_base, batch) != SUCCESS) {
+    rc = FAILURE;
+  }
+  uint64_t elapsed = kvs_metrics_now() - start;
+  for (int i = 0; i < count; ++i) {
+    kvs_metrics_record(&kvs->kvs_base->metrics, KVS_STATS_SET, elapsed);
+  }
+  kvs_batch_free(&batch);
+  return rc;
+}
+
+/**
+ * `prefetch_keys` reads a batch of prefetched keys and adds them to the
+ * cache. Keys already resident are skipped before the read and again before
+ * the insert, so an entry is never promoted by a prefetch. As in `kvs_mget`,
+ * a value is only added if its shard wrote nothing while it was being read.
+ */
+static void prefetch_keys(void* arg, int count, const char** keys) {
+  kvs_t* kvs = arg;
+  char(*values)[KVS_VALUE_MAX] = malloc(count * sizeof(*values));
+  if (values == NULL) {
+    return;
+  }
+  const char* read_keys[KVS_READAHEAD_BATCH];
+  char* value_ptrs[KVS_READAHEAD_BATCH];
+  bool read[KVS_READAHEAD_BATCH];
+  unsigned long gens[KVS_READAHEAD_BATCH];
+  int read_count = 0;
+  for (int i = 0; i < count; ++i) {
+    kvs_shard_t* shard = shard_of(kvs, keys[i]);
+    pthread_mutex_lock(&shard->lock);
+    if (!shard_contains(kvs, shard, keys[i])) {
+      gens[read_count] = shard->write_gen;
+      read_keys[read_count] = keys[i];
+      value_ptrs[read_count] = values[read_count];
+      read_count += 1;
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+  if (read_count > 0) {
+    kvs_base_read_batch(kvs->kvs_base, read_count, read_keys, value_ptrs,
+                        read);
+  }
+
+  for (int i = 0; i < read_count; ++i) {
+    // an empty value is a key the store does not have
+    if (!read[i] || value_ptrs[i][0] == '\0') {
+      continue;
+    }
+    kvs_shard_t* shard = shard_of(kvs, read_keys[i]);
+    pthread_mutex_lock(&shard->lock);
+    wait_for_write(shard, read_keys[i]);
+    if (shard->write_gen == gens[i] &&
+        !shard_contains(kvs, shard, read_keys[i])) {
+      // the insert may evict a dirty entry and write it back
+      unsigned long writes = kvs_base_thread_writes();
+      if (shard_load(kvs, shard, read_keys[i], value_ptrs[i]) == SUCCESS) {
+        atomic_fetch_add(&kvs->prefetched, 1);
+      }
+      shard->write_gen += kvs_base_thread_writes() - writes;
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+  free(values);
+}
+
+int kvs_prefetch(kvs_t* kvs, int count, const char** keys) {
+  if (kvs->readahead == NULL) {
+    return 0;
+  }
+  // the keys are queued in runs that leave out the ones too long to cache
+  int queued = 0;
+  int run = 0;
+  for (int i = 0; i <= count; ++i) {
+    if (i < count && key_fits(kvs, keys[i])) {
+      continue;
+    }
+    if (i > run) {
+      queued += kvs_readahead_push(kvs->readahead, i - run, keys + run);
+    }
+    run = i + 1;
+  }
+  return queued;
+}
+
+void kvs_prefetch_wait(kvs_t* kvs) {
+  if (kvs->readahead) {
+    kvs_readahead_wait(kvs->readahead);
+  }
+}
+
+/**
+ * `scan_value` reads the value of a key `kvs_scan` lists: the cached one if
+ * there is one, or else the stored one, which it leaves out of the cache.
+ * Like the lookup in the cache, the read is not counted as a GET.
+ */
+static int scan_value(kvs_t* kvs, const char* key, char* value) {
+  kvs_shard_t* shard = shard_of(kvs, key);
+  pthread_mutex_lock(&shard->lock);
+  wait_for_write(shard, key);
+  int rc = shard_peek(kvs, shard, key, value);
+  if (rc != SUCCESS) {
+    bool read;
+    kvs_base_read_batch(kvs->kvs_base, 1, &key, &value, &read);
+    rc = read ? SUCCESS : FAILURE;
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return rc;
+}
+
+int kvs_scan(kvs_t* kvs, const char* start, const char* end, int limit,
+             kvs_scan_fn fn, void* arg) {
+  if (kvs->kvs_base->keys == NULL) {
+    return -1;
+  }
+  char(*keys)[KVS_KEY_MAX] = malloc(KVS_SCAN_CHUNK * KVS_KEY_MAX);
+  char* value = malloc(KVS_VALUE_MAX);
+  // where the next chunk starts: after the last key of this one
+  char* last = malloc(KVS_KEY_MAX);
+  if (keys == NULL || value == NULL || last == NULL) {
+    free(keys);
+    free(value);
+    free(last);
+    return -1;
+  }
+  const char* from = start;
+  bool inclusive = true;
+  int count = 0;
+  bool more = true;
+  while (more && (limit <= 0 || count < limit)) {
+    int max = limit > 0 && limit - count < KVS_SCAN_CHUNK ? limit - count
+                                                          : KVS_SCAN_CHUNK;
+    int got = kvs_btree_range(kvs->kvs_base->keys, from, inclusive, end, max,
+                              keys);
+    more = got == max;
+    for (int i = 0; i < got; ++i) {
+      if (scan_value(kvs, keys[i], value) != SUCCESS) {
+        count = -1;
+        more = false;
+        break;
+      }
+      count += 1;
+      if (fn(arg, keys[i], value) != SUCCESS) {
+        more = false;
+        break;
+      }
+    }
+    if (more) {
+      memcpy(last, keys[got - 1], KVS_KEY_MAX);
+      from = last;
+      inclusive = false;
+    }
+  }
+  free(keys);
+  free(value);
+  free(last);
+  return count;
+}
+
+int kvs_scan_prefix(kvs_t* kvs, const char* prefix, int limit,
+                    kvs_scan_fn fn, void* arg) {
+  // the keys with the prefix end before the first string that is greater
+  // than the prefix in its last byte that can still be raised
+  char end[KVS_KEY_MAX];
+  size_t length = strlen(prefix);
+  if (length >= KVS_KEY_MAX) {
+    return 0;
+  }
+  memcpy(end, prefix, length + 1);
+  while (length > 0 && (unsigned char)end[length - 1] == 0xff) {
+    end[--length] = '\0';
+  }
+  if (length > 0) {
+    end[length - 1] = (char)((unsigned char)end[length - 1] + 1);
+  }
+  return kvs_scan(kvs, prefix, length > 0 ? end : NULL, limit, fn, arg);
+}
+
+int kvs_mrc(kvs_t* kvs, kvs_mrc_point_t* points, int max) {
+  return kvs->shadow ? kvs_shadow_curve(kvs->shadow, points, max) : 0;
+}
+
+int kvs_get_count(kvs_t* kvs) {
+  int count = 0;
+  for (int i = 0; i < kvs->shard_count; ++i) {
+    pthread_mutex_lock(&kvs->shards[i].lock);
+    count += kvs->shards[i].get_count;
+    pthread_mutex_unlock(&kvs->shards[i].lock);
+  }
+  return count;
+}
+
+int kvs_set_count(kvs_t* kvs) {
+  int count = 0;
+  for (int i = 0; i < kvs->shard_count; ++i) {
+    pthread_mutex_lock(&kvs->shards[i].lock);
+    count += kvs->shards[i].set_count;
+    pthread_mutex_unlock(&kvs->shards[i].lock);
+  }
+  return count;
+}
+
+static size_t shard_memory(kvs_t* kvs, kvs_shard_t* shard) {
+  switch (kvs->policy) {
+    case KVS_CACHE_NONE:
+      return 0;
+    case KVS_CACHE_FIFO:
+      return kvs_fifo_memory(shard->fifo);
+    case KVS_CACHE_CLOCK:
+      return kvs_clock_memory(shard->clock);
+    case KVS_CACHE_LRU:
+      return kvs_lru_memory(shard->lru);
+    case KVS_CACHE_ARC:
+      return kvs_arc_memory(shard->arc);
+    case KVS_CACHE_2Q:
+      return kvs_2q_memory(shard->two_q);
+    case KVS_CACHE_TINYLFU:
+      return kvs_tinylfu_memory(shard->tinylfu);
+  }
+  return 0;
+}
+
+size_t kvs_memory(kvs_t* kvs) {
+  size_t memory = 0;
+  for (int i = 0; i < kvs->shard_count; ++i) {
+    pthread_mutex_lock(&kvs->shards[i].lock);
+    memory += shard_memory(kvs, &kvs->shards[i]);
+    pthread_mutex_unlock(&kvs->shards[i].lock);
+  }
+  return memory;
+}
+
+void kvs_stats(kvs_t* kvs, kvs_stats_t* stats) {
+  kvs_metrics_snapshot(&kvs->kvs_base->metrics, stats);
+  stats->resident = 0;
+  stats->dirty = 0;
+  stats->memory = 0;
+  stats->gets = 0;
+  stats->sets = 0;
+  for (int i = 0; i < kvs->shard_count; ++i) {
+    kvs_shard_t* shard = &kvs->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    stats->resident += shard_size(kvs, shard);
+    stats->dirty += shard_dirty(kvs, shard);
+    stats->memory += shard_memory(kvs, shard);
+    stats->gets += shard->get_count;
+    stats->sets += shard->set_count;
+    if (i == 0) {
+      stats->policy = kvs_policy_name(kvs->policy);
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+  uint64_t hits = stats->latencies[KVS_STATS_GET_HIT].count;
+  uint64_t misses = stats->latencies[KVS_STATS_GET_MISS].count;
+  stats->hit_rate = hits + misses ? (double)hits / (hits + misses) : 0;
+  stats->disk_reads = atomic_load(&kvs->kvs_base->get_count);
+  stats->disk_writes = atomic_load(&kvs->kvs_base->set_count);
+  stats->warmed = atomic_load(&kvs->warmed);
+  stats->prefetched = atomic_load(&kvs->prefetched);
+  stats->policy_switches = atomic_load(&kvs->policy_switches);
+  stats->wal_records = 0;
+  stats->wal_syncs = 0;
+  if (kvs->wal) {
+    kvs_wal_counts(kvs->wal, &stats->wal_records, &stats->wal_syncs);
+  }
+  stats->l2_entries = kvs->kvs_base->l2 ? kvs_l2_size(kvs->kvs_base->l2) : 0;
+}
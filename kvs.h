@@ -1,9 +1,20 @@
 #pragma once
 
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "kvs_2q.h"
+#include "kvs_arc.h"
 #include "kvs_base.h"
 #include "kvs_clock.h"
 #include "kvs_fifo.h"
 #include "kvs_lru.h"
+#include "kvs_readahead.h"
+#include "kvs_tinylfu.h"
+#include "kvs_trace.h"
+#include "kvs_wal.h"
 
 /**
  * `kvs_replacement_policy` represents a cache policy.
@@ -13,25 +24,296 @@ typedef enum {
   KVS_CACHE_FIFO,
   KVS_CACHE_CLOCK,
   KVS_CACHE_LRU,
+  KVS_CACHE_ARC,
+  KVS_CACHE_2Q,
+  KVS_CACHE_TINYLFU,
 } kvs_replacement_policy;
 
-typedef struct kvs {
-  kvs_base_t* kvs_base;
+/**
+ * `kvs_policy_name` returns the name of a policy as the command line spells
+ * it, such as "LRU".
+ */
+const char* kvs_policy_name(kvs_replacement_policy policy);
+
+/**
+ * `kvs_mrc_point_t` is one point of a miss-ratio curve (see `kvs_mrc`): the
+ * hit rate `policy` is predicted to reach with room for `capacity` entries.
+ */
+typedef struct kvs_mrc_point {
+  kvs_replacement_policy policy;
+  int capacity;
+  double hit_rate;
+} kvs_mrc_point_t;
+
+/**
+ * `KVS_MRC_POINTS` is the number of points `kvs_mrc` reports: five
+ * capacities for each of the six policies.
+ */
+#define KVS_MRC_POINTS 30
+
+// see kvs_shadow.h
+struct kvs_shadow;
+
+/**
+ * `kvs_config_t` collects the settings of a store. Initialize it with
+ * `kvs_config_init`, which fills in the defaults, then override fields as
+ * needed before passing it to `kvs_new_config`.
+ */
+typedef struct kvs_config {
+  const char* directory;
   kvs_replacement_policy policy;
-  int get_count;
+  int capacity;
+  kvs_base_backend backend;
+  // directory layout of a new FILE store (see `kvs_dir_open`)
+  kvs_dir_layout layout;
+  // number of independently locked cache shards (see `kvs_shard_t`)
+  int shards;
+  // start a background thread that writes dirty entries back once a shard is
+  // `dirty_high` percent dirty, until it is down to `dirty_low` percent
+  bool write_back;
+  int dirty_high;
+  int dirty_low;
+  // answer GETs of absent keys without touching the disk (see
+  // `kvs_base_enable_filter`)
+  bool filter;
+  // when nonzero, bound the cache by this many bytes, split evenly between
+  // the shards, instead of by `capacity` entries (see kvs_budget.h)
+  size_t memory;
+  // save the resident keys to a snapshot in the store directory on
+  // `kvs_free`, and reload them on `kvs_new_config`, so a restarted cache
+  // starts warm (FIFO, CLOCK and LRU only; see kvs_snapshot.h)
+  bool snapshot;
+  // reload the snapshot on a background thread rather than before
+  // `kvs_new_config` returns
+  bool warm_background;
+  // log every SET ahead of applying it, so dirty entries survive a crash;
+  // the log is replayed into the store on open (see kvs_wal.h)
+  bool wal;
+  kvs_wal_durability wal_durability;
+  // how often a `KVS_WAL_BATCH` log is synced
+  int wal_interval_ms;
+  // threads that read the keys passed to `kvs_prefetch`; 0 turns prefetching
+  // off
+  int prefetch_threads;
+  // keep cached values compressed where that saves memory, which lets a
+  // byte budget hold more of them at the cost of expanding every hit (see
+  // kvs_arena.h)
+  bool compress;
+  // replay a sample of the requests against small caches of every policy
+  // and size, to predict the hit rates `kvs_mrc` reports; needs a cache
+  // bounded by entries
+  bool mrc;
+  // with `mrc`, switch to FIFO, CLOCK or LRU at runtime when one of them is
+  // predicted to hit clearly more often at the configured capacity than the
+  // current policy, which must itself be one of the three
+  bool auto_policy;
+  // when set, record every request to a trace file at this path, with the
+  // keys themselves if `trace_keys` is set and their hashes otherwise (see
+  // kvs_trace.h)
+  const char* trace;
+  bool trace_keys;
+  // when nonzero, keep copies of evicted entries in a flash tier of this
+  // many bytes, in the file at `l2_path` relative to the store directory,
+  // so misses on them skip the store (see `kvs_base_enable_l2`); ignored
+  // without a cache
+  size_t l2_size;
+  const char* l2_path;
+  // keep every key of the store in order, which `kvs_scan` needs (see
+  // `kvs_base_enable_keys`)
+  bool scan;
+} kvs_config_t;
+
+void kvs_config_init(kvs_config_t* config, const char* directory,
+                     kvs_replacement_policy policy, int capacity);
+
+/**
+ * `kvs_shard_t` is one slice of the cache. Every key belongs to exactly one
+ * shard, chosen by its hash; each shard runs its own policy instance over its
+ * share of the capacity behind its own lock, so threads working on different
+ * shards never wait for each other.
+ */
+typedef struct kvs_shard {
+  alignas(64) pthread_mutex_t lock;
+  // atomic, since a hit of a CLOCK shard counts itself without the lock
+  atomic_int get_count;
   int set_count;
+  // watermarks in entries, and whether the flusher is working on this shard
+  int dirty_high;
+  int dirty_low;
+  bool cleaning;
+  // the key the flusher is writing back outside the lock, if any
+  const char* writing_key;
+  pthread_cond_t written;
+  // bumped for every value this shard writes to disk, so `kvs_mget` can tell
+  // whether a value it read outside the lock may have gone stale
+  unsigned long write_gen;
+  // entries the shard holds, 0 under a byte budget
+  int capacity;
   union {
     kvs_fifo_t* fifo;
     kvs_clock_t* clock;
     kvs_lru_t* lru;
+    kvs_arc_t* arc;
+    kvs_2q_t* two_q;
+    kvs_tinylfu_t* tinylfu;
   };
+} kvs_shard_t;
+
+/**
+ * `kvs_t` is safe to use from several threads at once.
+ */
+typedef struct kvs {
+  kvs_base_t* kvs_base;
+  // read and changed with the shards locked, since `auto_policy` may switch
+  // it at any time
+  kvs_replacement_policy policy;
+  // entries of the whole cache, 0 under a byte budget
+  int capacity;
+  int shard_count;
+  kvs_shard_t* shards;
+  bool compress;
+  bool write_back;
+  // the byte budget and the watermark percentages it needs to recompute the
+  // watermarks, which follow the number of resident entries
+  size_t memory;
+  int dirty_high;
+  int dirty_low;
+  // see `kvs_config_t.snapshot`; `warmer` reloads it in the background
+  // while `warming`, and stops early once `warm_stop` is set
+  bool snapshot;
+  bool warming;
+  pthread_t warmer;
+  atomic_bool warm_stop;
+  // entries reloaded from the snapshot so far
+  atomic_int warmed;
+  // NULL unless `kvs_config_t.wal` is set
+  kvs_wal_t* wal;
+  // the queue of `kvs_prefetch`, NULL without a cache or prefetch threads
+  kvs_readahead_t* readahead;
+  // entries `kvs_prefetch` added to the cache
+  atomic_int prefetched;
+  // NULL unless `kvs_config_t.mrc` is set
+  struct kvs_shadow* shadow;
+  bool auto_policy;
+  // held by the thread considering a switch; `auto_windows` counts the
+  // windows of the shadow models since the last switch
+  atomic_bool switching;
+  int auto_windows;
+  atomic_int policy_switches;
+  // NULL unless `kvs_config_t.trace` is set
+  kvs_trace_t* trace;
+  pthread_t flusher;
+  pthread_mutex_t flusher_lock;
+  pthread_cond_t flusher_wake;
+  bool flusher_pending;
+  bool flusher_stop;
 } kvs_t;
 
 kvs_t* kvs_new(const char* directory, kvs_replacement_policy policy,
                int capacity);
+kvs_t* kvs_new_config(const kvs_config_t* config);
 
 void kvs_free(kvs_t** ptr);
 
+/**
+ * `kvs_get` writes the value of `key` to `value` (`KVS_VALUE_MAX` bytes), or
+ * the empty string if the store does not have it. It returns FAILURE for a
+ * key the store cannot hold (see `kvs_base_valid_key`), which no SET could
+ * have stored.
+ */
 int kvs_get(kvs_t* kvs, const char* key, char* value);
+
+/**
+ * `kvs_set` stores `value` for `key`. It returns FAILURE without storing
+ * anything for a key the store cannot hold (see `kvs_base_valid_key`) or a
+ * value of `KVS_VALUE_MAX` bytes or more, which no reader could copy out.
+ */
 int kvs_set(kvs_t* kvs, const char* key, const char* value);
 int kvs_flush(kvs_t* kvs);
+
+/**
+ * `kvs_mget` looks up `count` keys at once, writing each value to
+ * `values[i]`. Cached keys are served in a single pass over their shards;
+ * the misses are then read from disk together (see `kvs_base_get_batch`)
+ * rather than one after another, and admitted to the cache as `kvs_get`
+ * would have. Keys `kvs_get` would refuse are skipped, and make it return
+ * FAILURE.
+ */
+int kvs_mget(kvs_t* kvs, int count, const char** keys, char** values);
+
+/**
+ * `kvs_mset` stores `count` key-value pairs. Without a cache the pairs are
+ * written to disk as one batch; otherwise it is the same as `count` SETs.
+ * Pairs `kvs_set` would refuse are skipped, and make it return FAILURE.
+ */
+int kvs_mset(kvs_t* kvs, int count, const char** keys, const char** values);
+
+/**
+ * `kvs_prefetch` queues `count` keys to be read from disk in the background
+ * and added to the cache as clean entries, as a GET that missed would add
+ * them. A key already cached is left where it is rather than promoted, and
+ * its value is not read. The call does not wait for the reads and returns
+ * how many keys were queued, which falls short of `count` when the queue is
+ * full: prefetching is a hint. Without a cache it queues nothing, and keys
+ * `kvs_get` would refuse are never queued.
+ */
+int kvs_prefetch(kvs_t* kvs, int count, const char** keys);
+
+/**
+ * `kvs_prefetch_wait` returns once every key queued by `kvs_prefetch` has
+ * been read and added.
+ */
+void kvs_prefetch_wait(kvs_t* kvs);
+
+/**
+ * `kvs_scan_fn` is handed one key of a scan and its value. Returning
+ * anything but SUCCESS ends the scan.
+ */
+typedef int (*kvs_scan_fn)(void* arg, const char* key, const char* value);
+
+/**
+ * `kvs_scan` calls `fn` with the keys from `start` up to, but not including,
+ * `end`, in byte order, and their values; a NULL `start` or `end` leaves that
+ * side open, and a `limit` above 0 stops after that many keys. The keys come
+ * from the ordered index, and each value from the cache if the key is
+ * resident, without counting as a use of it, or else from the store, without
+ * being admitted to the cache. Keys set while the scan runs may or may not be
+ * seen. It returns how many keys it passed to `fn`, or -1 if a value could
+ * not be read or `kvs_config_t.scan` is not set.
+ */
+int kvs_scan(kvs_t* kvs, const char* start, const char* end, int limit,
+             kvs_scan_fn fn, void* arg);
+
+/**
+ * `kvs_scan_prefix` is `kvs_scan` over the keys that start with `prefix`.
+ */
+int kvs_scan_prefix(kvs_t* kvs, const char* prefix, int limit,
+                    kvs_scan_fn fn, void* arg);
+
+/**
+ * `kvs_mrc` writes the latest predicted hit rates of every policy at a
+ * quarter, half, one, two and four times the cache's capacity to `points`,
+ * up to `max` of them, and returns how many it wrote. The predictions follow
+ * the recent requests and are 0 until a sampled GET arrives. It returns 0
+ * unless `kvs_config_t.mrc` is set.
+ */
+int kvs_mrc(kvs_t* kvs, kvs_mrc_point_t* points, int max);
+
+/**
+ * `kvs_get_count` and `kvs_set_count` return the number of GETs and SETs the
+ * store has served, summed over all shards.
+ */
+int kvs_get_count(kvs_t* kvs);
+int kvs_set_count(kvs_t* kvs);
+
+/**
+ * `kvs_memory` returns the bytes the cache spends on resident entries.
+ */
+size_t kvs_memory(kvs_t* kvs);
+
+/**
+ * `kvs_stats` fills `stats` with a snapshot of the store's latency
+ * histograms and counters (see kvs_stats.h). It can be called at any time,
+ * from any thread, while other threads keep using the store.
+ */
+void kvs_stats(kvs_t* kvs, kvs_stats_t* stats);
@@ -0,0 +1,350 @@
+#include "kvs_2q.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "kvs_arena.h"
+#include "kvs_budget.h"
+#include "kvs_dirty.h"
+#include "kvs_index.h"
+#include "kvs_list.h"
+#include "kvs_pool.h"
+
+// shares of the capacity given to A1in and A1out, in percent, as suggested
+// by the 2Q paper
+#define KVS_2Q_IN_PERCENT 25
+#define KVS_2Q_OUT_PERCENT 50
+
+typedef enum { Q_A1IN, Q_AM, Q_A1OUT, Q_LISTS } q_list;
+
+typedef struct cache_entry {
+  // `kv.value` is NULL for ghost entries
+  kvs_entry_t kv;
+  kvs_list_link_t link;
+  q_list list;
+} cache_entry_t;
+
+struct kvs_2q {
+  kvs_base_t* kvs_base;
+  int capacity;
+  // bytes the entries, ghosts included, may take, or 0 to hold `capacity`
+  // resident entries
+  size_t budget;
+  // resident entries the queues are sized for: `capacity`, or under a byte
+  // budget the number that currently fit
+  int target;
+  int in_capacity;
+  int out_capacity;
+  kvs_list_t lists[Q_LISTS];
+  kvs_pool_t* pool;
+  kvs_arena_t* arena;
+  kvs_index_t* index;
+  kvs_dirty_t dirty;
+};
+
+static int share(int capacity, int percent) {
+  int size = capacity * percent / 100;
+  return size > 0 ? size : 1;
+}
+
+/**
+ * `create` makes a cache of `capacity` entries. Without a `budget` its index
+ * is sized for all of them and their ghosts; with one it starts empty and
+ * grows with the entries, since its bytes are charged to the budget.
+ */
+static kvs_2q_t* create(kvs_base_t* kvs, int capacity, size_t budget) {
+  kvs_2q_t* kvs_2q = malloc(sizeof(kvs_2q_t));
+  if (!kvs_2q) return NULL;
+
+  kvs_2q->kvs_base = kvs;
+  kvs_2q->capacity = capacity;
+  kvs_2q->budget = budget;
+  kvs_2q->target = capacity;
+  kvs_2q->in_capacity = share(capacity, KVS_2Q_IN_PERCENT);
+  kvs_2q->out_capacity = share(capacity, KVS_2Q_OUT_PERCENT);
+  for (int i = 0; i < Q_LISTS; ++i) {
+    kvs_list_init(&kvs_2q->lists[i]);
+  }
+  int entries = capacity + kvs_2q->out_capacity;
+  kvs_2q->pool = kvs_pool_new(sizeof(cache_entry_t), entries);
+  kvs_2q->arena = kvs_arena_new();
+  kvs_2q->index = kvs_index_new(budget > 0 ? 0 : entries);
+  kvs_dirty_init(&kvs_2q->dirty);
+
+  return kvs_2q;
+}
+
+kvs_2q_t* kvs_2q_new(kvs_base_t* kvs, int capacity) {
+  return create(kvs, capacity, 0);
+}
+
+kvs_2q_t* kvs_2q_new_budget(kvs_base_t* kvs, size_t budget) {
+  return create(kvs, kvs_budget_entries(budget, sizeof(cache_entry_t)),
+                budget);
+}
+
+void kvs_2q_enable_compression(kvs_2q_t* kvs_2q) {
+  kvs_arena_enable_compression(kvs_2q->arena, &kvs_2q->kvs_base->metrics);
+}
+
+void kvs_2q_free(kvs_2q_t** ptr) {
+  if (ptr && *ptr) {
+    kvs_index_free(&(*ptr)->index);
+    kvs_arena_free(&(*ptr)->arena);
+    kvs_pool_free(&(*ptr)->pool);
+    free(*ptr);
+    *ptr = NULL;
+  }
+}
+
+static cache_entry_t* tail_of(kvs_2q_t* kvs_2q, q_list list) {
+  kvs_list_link_t* tail = kvs_2q->lists[list].tail;
+  return tail ? KVS_LIST_ENTRY(tail, cache_entry_t, link) : NULL;
+}
+
+static void move_to(kvs_2q_t* kvs_2q, cache_entry_t* entry, q_list list) {
+  kvs_list_move(&kvs_2q->lists[entry->list], &kvs_2q->lists[list],
+                &entry->link);
+  entry->list = list;
+}
+
+static int drop(kvs_2q_t* kvs_2q, cache_entry_t* entry) {
+  if (kvs_dirty_evict(&kvs_2q->dirty, kvs_2q->kvs_base, &entry->kv) !=
+      SUCCESS) {
+    return FAILURE;
+  }
+  kvs_list_remove(&kvs_2q->lists[entry->list], &entry->link);
+  kvs_index_remove(kvs_2q->index, entry->kv.key);
+  kvs_arena_release(kvs_2q->arena, entry->kv.key);
+  kvs_arena_release(kvs_2q->arena, entry->kv.value);
+  kvs_pool_release(kvs_2q->pool, entry);
+  return SUCCESS;
+}
+
+static int resident(kvs_2q_t* kvs_2q) {
+  return kvs_2q->lists[Q_A1IN].size + kvs_2q->lists[Q_AM].size;
+}
+
+static bool over_budget(kvs_2q_t* kvs_2q, size_t incoming) {
+  return kvs_budget_over(kvs_2q->budget, kvs_2q_memory(kvs_2q), incoming);
+}
+
+/**
+ * `retarget` resizes the queues under a byte budget to the shares of the
+ * number of resident entries that fit at their current average cost.
+ */
+static void retarget(kvs_2q_t* kvs_2q) {
+  if (kvs_2q->budget == 0) {
+    return;
+  }
+  kvs_2q->target = kvs_budget_capacity(kvs_2q->budget, resident(kvs_2q),
+                                       kvs_2q_memory(kvs_2q),
+                                       kvs_2q->capacity);
+  kvs_2q->in_capacity = share(kvs_2q->target, KVS_2Q_IN_PERCENT);
+  kvs_2q->out_capacity = share(kvs_2q->target, KVS_2Q_OUT_PERCENT);
+}
+
+/**
+ * `evict_one` frees one resident slot. The oldest entry of A1in becomes a
+ * ghost while A1in is over its share; otherwise the LRU entry of Am is
+ * evicted. It returns FAILURE, evicting nothing, if the entry could not be
+ * written back.
+ */
+static int evict_one(kvs_2q_t* kvs_2q) {
+  int a1in = kvs_2q->lists[Q_A1IN].size;
+  int am = kvs_2q->lists[Q_AM].size;
+  if (a1in > kvs_2q->in_capacity || am == 0) {
+    cache_entry_t* entry = tail_of(kvs_2q, Q_A1IN);
+    if (kvs_dirty_evict(&kvs_2q->dirty, kvs_2q->kvs_base, &entry->kv) !=
+        SUCCESS) {
+      return FAILURE;
+    }
+    // ghosts are clean, so dropping them cannot fail
+    while (kvs_2q->lists[Q_A1OUT].size > 0 &&
+           kvs_2q->lists[Q_A1OUT].size >= kvs_2q->out_capacity) {
+      drop(kvs_2q, tail_of(kvs_2q, Q_A1OUT));
+    }
+    kvs_arena_release(kvs_2q->arena, entry->kv.value);
+    entry->kv.value = NULL;
+    move_to(kvs_2q, entry, Q_A1OUT);
+    return SUCCESS;
+  }
+  return drop(kvs_2q, tail_of(kvs_2q, Q_AM));
+}
+
+/**
+ * `reclaim` makes room for a new resident entry of `charge` bytes: one slot
+ * if the cache is full, and under a byte budget as many as it takes.
+ */
+static int reclaim(kvs_2q_t* kvs_2q, size_t charge) {
+  if (resident(kvs_2q) >= kvs_2q->target && evict_one(kvs_2q) != SUCCESS) {
+    return FAILURE;
+  }
+  while (resident(kvs_2q) > 0 && over_budget(kvs_2q, charge)) {
+    if (evict_one(kvs_2q) != SUCCESS) {
+      return FAILURE;
+    }
+  }
+  return SUCCESS;
+}
+
+/**
+ * `admit` brings `key` into the cache after a miss. `ghost` is its entry in
+ * A1out if it has one.
+ */
+static int admit(kvs_2q_t* kvs_2q, cache_entry_t* ghost, const char* key,
+                 const char* value, bool modified) {
+  if (kvs_2q->capacity == 0) {
+    return FAILURE;
+  }
+  retarget(kvs_2q);
+  if (ghost) {
+    // take the ghost out first so that `reclaim` cannot recycle it; until it
+    // is back on a list, its slot is no longer counted
+    kvs_list_remove(&kvs_2q->lists[Q_A1OUT], &ghost->link);
+    if (reclaim(kvs_2q, sizeof(cache_entry_t) +
+                            kvs_arena_footprint(strlen(value))) != SUCCESS) {
+      kvs_list_push(&kvs_2q->lists[Q_A1OUT], &ghost->link);
+      return FAILURE;
+    }
+    ghost->kv.value = kvs_arena_pack(kvs_2q->arena, NULL, value);
+    if (!ghost->kv.value) {
+      kvs_index_remove(kvs_2q->index, ghost->kv.key);
+      kvs_arena_release(kvs_2q->arena, ghost->kv.key);
+      kvs_pool_release(kvs_2q->pool, ghost);
+      return FAILURE;
+    }
+    ghost->list = Q_AM;
+    kvs_list_push(&kvs_2q->lists[Q_AM], &ghost->link);
+    if (modified) {
+      kvs_dirty_mark(&kvs_2q->dirty, &ghost->kv);
+    }
+    return SUCCESS;
+  }
+
+  if (reclaim(kvs_2q, kvs_budget_charge(sizeof(cache_entry_t), key, value)) !=
+      SUCCESS) {
+    return FAILURE;
+  }
+  cache_entry_t* entry = kvs_pool_alloc(kvs_2q->pool);
+  if (!entry) return FAILURE;
+  entry->kv.key = kvs_arena_strdup(kvs_2q->arena, key);
+  entry->kv.value = kvs_arena_pack(kvs_2q->arena, NULL, value);
+  if (!entry->kv.key || !entry->kv.value ||
+      kvs_index_put(kvs_2q->index, entry->kv.key, entry) != SUCCESS) {
+    kvs_arena_release(kvs_2q->arena, entry->kv.key);
+    kvs_arena_release(kvs_2q->arena, entry->kv.value);
+    kvs_pool_release(kvs_2q->pool, entry);
+    return FAILURE;
+  }
+  entry->kv.modified = false;
+  if (modified) {
+    kvs_dirty_mark(&kvs_2q->dirty, &entry->kv);
+  }
+  entry->list = Q_A1IN;
+  kvs_list_push(&kvs_2q->lists[Q_A1IN], &entry->link);
+  return SUCCESS;
+}
+
+// a hit in Am refreshes its recency; a hit in A1in leaves it in FIFO order
+static void touch(kvs_2q_t* kvs_2q, cache_entry_t* entry) {
+  if (entry->list == Q_AM) {
+    move_to(kvs_2q, entry, Q_AM);
+  }
+}
+
+int kvs_2q_set(kvs_2q_t* kvs_2q, const char* key, const char* value) {
+  cache_entry_t* entry = kvs_index_get(kvs_2q->index, key);
+  if (entry && entry->kv.value) {
+    char* stored = kvs_arena_pack(kvs_2q->arena, entry->kv.value, value);
+    if (!stored) return FAILURE;
+    entry->kv.value = stored;
+    kvs_dirty_mark(&kvs_2q->dirty, &entry->kv);
+    touch(kvs_2q, entry);
+    // a larger value may take the cache over its budget
+    while (resident(kvs_2q) > 1 && over_budget(kvs_2q, 0)) {
+      if (evict_one(kvs_2q) != SUCCESS) {
+        return FAILURE;
+      }
+    }
+    return SUCCESS;
+  }
+
+  return admit(kvs_2q, entry, key, value, true);
+}
+
+int kvs_2q_get_cached(kvs_2q_t* kvs_2q, const char* key, char* value) {
+  cache_entry_t* entry = kvs_index_get(kvs_2q->index, key);
+  if (entry && entry->kv.value) {
+    kvs_arena_read(kvs_2q->arena, entry->kv.value, value);
+    touch(kvs_2q, entry);
+    return SUCCESS;
+  }
+  return FAILURE;
+}
+
+bool kvs_2q_contains(kvs_2q_t* kvs_2q, const char* key) {
+  // a ghost is not resident
+  cache_entry_t* entry = kvs_index_get(kvs_2q->index, key);
+  return entry && entry->kv.value;
+}
+
+int kvs_2q_peek(kvs_2q_t* kvs_2q, const char* key, char* value) {
+  cache_entry_t* entry = kvs_index_get(kvs_2q->index, key);
+  if (entry && entry->kv.value) {
+    kvs_arena_read(kvs_2q->arena, entry->kv.value, value);
+    return SUCCESS;
+  }
+  return FAILURE;
+}
+
+int kvs_2q_load(kvs_2q_t* kvs_2q, const char* key, char* value) {
+  if (kvs_2q_get_cached(kvs_2q, key, value) == SUCCESS) {
+    return SUCCESS;
+  }
+  cache_entry_t* ghost = kvs_index_get(kvs_2q->index, key);
+  return admit(kvs_2q, ghost, key, value, false);
+}
+
+int kvs_2q_get(kvs_2q_t* kvs_2q, const char* key, char* value) {
+  if (kvs_2q_get_cached(kvs_2q, key, value) == SUCCESS) {
+    return SUCCESS;
+  }
+
+  int result = kvs_base_get(kvs_2q->kvs_base, key, value);
+  if (result == SUCCESS) {
+    return kvs_2q_load(kvs_2q, key, value);
+  }
+
+  return result;
+}
+
+int kvs_2q_flush(kvs_2q_t* kvs_2q) {
+  return kvs_dirty_flush(&kvs_2q->dirty, kvs_2q->kvs_base);
+}
+
+int kvs_2q_size(kvs_2q_t* kvs_2q) { return resident(kvs_2q); }
+
+int kvs_2q_dirty(kvs_2q_t* kvs_2q) { return kvs_2q->dirty.count; }
+
+int kvs_2q_take_dirty(kvs_2q_t* kvs_2q, char* key, char* value) {
+  return kvs_dirty_take(&kvs_2q->dirty, key, value);
+}
+
+void kvs_2q_mark_dirty(kvs_2q_t* kvs_2q, const char* key) {
+  cache_entry_t* entry = kvs_index_get(kvs_2q->index, key);
+  if (entry && entry->kv.value) {
+    kvs_dirty_mark(&kvs_2q->dirty, &entry->kv);
+  }
+}
+
+size_t kvs_2q_memory(kvs_2q_t* kvs_2q) {
+  int entries = 0;
+  for (int i = 0; i < Q_LISTS; ++i) {
+    entries += kvs_2q->lists[i].size;
+  }
+  return entries * sizeof(cache_entry_t) + kvs_arena_used(kvs_2q->arena) +
+         kvs_index_memory(kvs_2q->index);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "kvs_base.h"
+
+/**
+ * `kvs_2q_t` is a 2Q cache. New keys enter a small FIFO queue (A1in); when
+ * they fall out of it only their key is remembered in a ghost FIFO (A1out).
+ * A key missed again while it is still in A1out has proved it is reused and
+ * goes into the main LRU queue (Am). Keys touched once, such as a scan, never
+ * displace the hot set in Am.
+ */
+struct kvs_2q;
+typedef struct kvs_2q kvs_2q_t;
+
+kvs_2q_t* kvs_2q_new(kvs_base_t* kvs, int capacity);
+
+/**
+ * `kvs_2q_new_budget` creates a cache bounded by `budget` bytes, like
+ * `kvs_lru_new_budget`. A1in and A1out keep their shares of the number of
+ * entries that currently fit, and A1out's ghosts count against the budget.
+ */
+kvs_2q_t* kvs_2q_new_budget(kvs_base_t* kvs, size_t budget);
+
+/**
+ * `kvs_2q_enable_compression` compresses values as
+ * `kvs_lru_enable_compression` does.
+ */
+void kvs_2q_enable_compression(kvs_2q_t* kvs_2q);
+void kvs_2q_free(kvs_2q_t** ptr);
+
+int kvs_2q_set(kvs_2q_t* kvs_2q, const char* key, const char* value);
+int kvs_2q_get(kvs_2q_t* kvs_2q, const char* key, char* value);
+
+/**
+ * `kvs_2q_get_cached`, `kvs_2q_load`, `kvs_2q_contains` and `kvs_2q_peek` work
+ * like their LRU counterparts (see kvs_lru.h).
+ */
+int kvs_2q_get_cached(kvs_2q_t* kvs_2q, const char* key, char* value);
+int kvs_2q_load(kvs_2q_t* kvs_2q, const char* key, char* value);
+bool kvs_2q_contains(kvs_2q_t* kvs_2q, const char* key);
+int kvs_2q_peek(kvs_2q_t* kvs_2q, const char* key, char* value);
+
+int kvs_2q_flush(kvs_2q_t* kvs_2q);
+
+/**
+ * `kvs_2q_size` returns the number of resident entries.
+ */
+int kvs_2q_size(kvs_2q_t* kvs_2q);
+
+/**
+ * `kvs_2q_dirty` returns the number of modified entries.
+ */
+int kvs_2q_dirty(kvs_2q_t* kvs_2q);
+
+/**
+ * `kvs_2q_take_dirty` and `kvs_2q_mark_dirty` work like their LRU
+ * counterparts (see kvs_lru.h).
+ */
+int kvs_2q_take_dirty(kvs_2q_t* kvs_2q, char* key, char* value);
+void kvs_2q_mark_dirty(kvs_2q_t* kvs_2q, const char* key);
+
+/**
+ * `kvs_2q_memory` returns the bytes held by the resident and ghost entries:
+ * their slots in the pool plus their keys and values in the arena.
+ */
+size_t kvs_2q_memory(kvs_2q_t* kvs_2q);
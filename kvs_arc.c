@@ -0,0 +1,351 @@
+#include "kvs_arc.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "kvs_arena.h"
+#include "kvs_budget.h"
+#include "kvs_dirty.h"
+#include "kvs_index.h"
+#include "kvs_list.h"
+#include "kvs_pool.h"
+
+typedef enum { ARC_T1, ARC_T2, ARC_B1, ARC_B2, ARC_LISTS } arc_list;
+
+typedef struct cache_entry {
+  // `kv.value` is NULL for ghost entries
+  kvs_entry_t kv;
+  kvs_list_link_t link;
+  arc_list list;
+} cache_entry_t;
+
+struct kvs_arc {
+  kvs_base_t* kvs_base;
+  int capacity;
+  // bytes the entries, ghosts included, may take, or 0 to hold `capacity`
+  // resident entries
+  size_t budget;
+  // target size of T1
+  int p;
+  kvs_list_t lists[ARC_LISTS];
+  // resident and ghost entries together never exceed twice the capacity
+  kvs_pool_t* pool;
+  kvs_arena_t* arena;
+  kvs_index_t* index;
+  kvs_dirty_t dirty;
+};
+
+/**
+ * `create` makes a cache of `capacity` entries. Without a `budget` its index
+ * is sized for all of them and their ghosts; with one it starts empty and
+ * grows with the entries, since its bytes are charged to the budget.
+ */
+static kvs_arc_t* create(kvs_base_t* kvs, int capacity, size_t budget) {
+  kvs_arc_t* kvs_arc = malloc(sizeof(kvs_arc_t));
+  if (!kvs_arc) return NULL;
+
+  kvs_arc->kvs_base = kvs;
+  kvs_arc->capacity = capacity;
+  kvs_arc->budget = budget;
+  kvs_arc->p = 0;
+  for (int i = 0; i < ARC_LISTS; ++i) {
+    kvs_list_init(&kvs_arc->lists[i]);
+  }
+  kvs_arc->pool = kvs_pool_new(sizeof(cache_entry_t), 2 * capacity);
+  kvs_arc->arena = kvs_arena_new();
+  kvs_arc->index = kvs_index_new(budget > 0 ? 0 : 2 * capacity);
+  kvs_dirty_init(&kvs_arc->dirty);
+
+  return kvs_arc;
+}
+
+kvs_arc_t* kvs_arc_new(kvs_base_t* kvs, int capacity) {
+  return create(kvs, capacity, 0);
+}
+
+kvs_arc_t* kvs_arc_new_budget(kvs_base_t* kvs, size_t budget) {
+  return create(kvs, kvs_budget_entries(budget, sizeof(cache_entry_t)),
+                budget);
+}
+
+void kvs_arc_enable_compression(kvs_arc_t* kvs_arc) {
+  kvs_arena_enable_compression(kvs_arc->arena, &kvs_arc->kvs_base->metrics);
+}
+
+void kvs_arc_free(kvs_arc_t** ptr) {
+  if (ptr && *ptr) {
+    kvs_index_free(&(*ptr)->index);
+    kvs_arena_free(&(*ptr)->arena);
+    kvs_pool_free(&(*ptr)->pool);
+    free(*ptr);
+    *ptr = NULL;
+  }
+}
+
+static int list_size(kvs_arc_t* kvs_arc, arc_list list) {
+  return kvs_arc->lists[list].size;
+}
+
+static cache_entry_t* lru_of(kvs_arc_t* kvs_arc, arc_list list) {
+  kvs_list_link_t* tail = kvs_arc->lists[list].tail;
+  return tail ? KVS_LIST_ENTRY(tail, cache_entry_t, link) : NULL;
+}
+
+static void move_to(kvs_arc_t* kvs_arc, cache_entry_t* entry, arc_list list) {
+  kvs_list_move(&kvs_arc->lists[entry->list], &kvs_arc->lists[list],
+                &entry->link);
+  entry->list = list;
+}
+
+/**
+ * `demote` evicts a resident entry but keeps its key on a ghost list.
+ */
+static int demote(kvs_arc_t* kvs_arc, cache_entry_t* entry, arc_list ghost) {
+  if (kvs_dirty_evict(&kvs_arc->dirty, kvs_arc->kvs_base, &entry->kv) !=
+      SUCCESS) {
+    return FAILURE;
+  }
+  kvs_arena_release(kvs_arc->arena, entry->kv.value);
+  entry->kv.value = NULL;
+  move_to(kvs_arc, entry, ghost);
+  return SUCCESS;
+}
+
+/**
+ * `drop` forgets an entry completely, writing it back first if it is dirty.
+ * Like `demote`, it leaves an entry that could not be written back alone
+ * and returns FAILURE.
+ */
+static int drop(kvs_arc_t* kvs_arc, cache_entry_t* entry) {
+  if (kvs_dirty_evict(&kvs_arc->dirty, kvs_arc->kvs_base, &entry->kv) !=
+      SUCCESS) {
+    return FAILURE;
+  }
+  kvs_list_remove(&kvs_arc->lists[entry->list], &entry->link);
+  kvs_index_remove(kvs_arc->index, entry->kv.key);
+  kvs_arena_release(kvs_arc->arena, entry->kv.key);
+  kvs_arena_release(kvs_arc->arena, entry->kv.value);
+  kvs_pool_release(kvs_arc->pool, entry);
+  return SUCCESS;
+}
+
+/**
+ * `replace` makes room for one resident entry by demoting the LRU entry of
+ * T1 or of T2, whichever is over its share of the target `p`.
+ */
+static int replace(kvs_arc_t* kvs_arc, bool in_b2) {
+  int t1 = list_size(kvs_arc, ARC_T1);
+  if (t1 >= 1 && ((in_b2 && t1 == kvs_arc->p) || t1 > kvs_arc->p ||
+                  list_size(kvs_arc, ARC_T2) == 0)) {
+    return demote(kvs_arc, lru_of(kvs_arc, ARC_T1), ARC_B1);
+  }
+  return demote(kvs_arc, lru_of(kvs_arc, ARC_T2), ARC_B2);
+}
+
+static int resident(kvs_arc_t* kvs_arc) {
+  return list_size(kvs_arc, ARC_T1) + list_size(kvs_arc, ARC_T2);
+}
+
+/**
+ * `target` is the capacity `c` of the ARC paper, in entries. Under a byte
+ * budget it is the number of resident entries that fit at their current
+ * average cost, ghosts included, so the lists keep the paper's proportions
+ * while the sizes of the values vary.
+ */
+static int target(kvs_arc_t* kvs_arc) {
+  if (kvs_arc->budget == 0) {
+    return kvs_arc->capacity;
+  }
+  return kvs_budget_capacity(kvs_arc->budget, resident(kvs_arc),
+                             kvs_arc_memory(kvs_arc), kvs_arc->capacity);
+}
+
+static bool over_budget(kvs_arc_t* kvs_arc, size_t incoming) {
+  return kvs_budget_over(kvs_arc->budget, kvs_arc_memory(kvs_arc), incoming);
+}
+
+/**
+ * `admit` brings `key` into the cache after a miss. `ghost` is its ghost
+ * entry if it has one.
+ */
+static int admit(kvs_arc_t* kvs_arc, cache_entry_t* ghost, const char* key,
+                 const char* value, bool modified) {
+  if (kvs_arc->capacity == 0) {
+    return FAILURE;
+  }
+  int c = target(kvs_arc);
+  int b1 = list_size(kvs_arc, ARC_B1);
+  int b2 = list_size(kvs_arc, ARC_B2);
+
+  if (ghost) {
+    if (ghost->list == ARC_B1) {
+      int delta = b2 > b1 ? b2 / b1 : 1;
+      kvs_arc->p = kvs_arc->p + delta < c ? kvs_arc->p + delta : c;
+    } else {
+      int delta = b1 > b2 ? b1 / b2 : 1;
+      kvs_arc->p = kvs_arc->p - delta > 0 ? kvs_arc->p - delta : 0;
+    }
+    bool in_b2 = ghost->list == ARC_B2;
+    if (resident(kvs_arc) >= c && replace(kvs_arc, in_b2) != SUCCESS) {
+      return FAILURE;
+    }
+    size_t charge = kvs_arena_footprint(strlen(value));
+    while (resident(kvs_arc) > 0 && over_budget(kvs_arc, charge)) {
+      if (replace(kvs_arc, in_b2) != SUCCESS) {
+        return FAILURE;
+      }
+    }
+    ghost->kv.value = kvs_arena_pack(kvs_arc->arena, NULL, value);
+    if (!ghost->kv.value) {
+      return FAILURE;
+    }
+    move_to(kvs_arc, ghost, ARC_T2);
+    if (modified) {
+      kvs_dirty_mark(&kvs_arc->dirty, &ghost->kv);
+    }
+    return SUCCESS;
+  }
+
+  int t1 = list_size(kvs_arc, ARC_T1);
+  int total = resident(kvs_arc) + b1 + b2;
+  // under a byte budget `c` moves, so the lists can be over it, not just at.
+  // Ghosts are clean, so dropping one cannot fail.
+  if (t1 + b1 >= c) {
+    if (t1 < c) {
+      drop(kvs_arc, lru_of(kvs_arc, ARC_B1));
+      if (resident(kvs_arc) >= c && replace(kvs_arc, false) != SUCCESS) {
+        return FAILURE;
+      }
+    } else if (drop(kvs_arc, lru_of(kvs_arc, ARC_T1)) != SUCCESS) {
+      return FAILURE;
+    }
+  } else if (total >= c) {
+    if (total >= 2 * c && b1 + b2 > 0) {
+      drop(kvs_arc, lru_of(kvs_arc, b2 > 0 ? ARC_B2 : ARC_B1));
+    }
+    if (resident(kvs_arc) >= c && replace(kvs_arc, false) != SUCCESS) {
+      return FAILURE;
+    }
+  }
+  size_t charge = kvs_budget_charge(sizeof(cache_entry_t), key, value);
+  while (resident(kvs_arc) > 0 && over_budget(kvs_arc, charge)) {
+    if (replace(kvs_arc, false) != SUCCESS) {
+      return FAILURE;
+    }
+  }
+
+  cache_entry_t* entry = kvs_pool_alloc(kvs_arc->pool);
+  if (!entry) return FAILURE;
+  entry->kv.key = kvs_arena_strdup(kvs_arc->arena, key);
+  entry->kv.value = kvs_arena_pack(kvs_arc->arena, NULL, value);
+  if (!entry->kv.key || !entry->kv.value ||
+      kvs_index_put(kvs_arc->index, entry->kv.key, entry) != SUCCESS) {
+    kvs_arena_release(kvs_arc->arena, entry->kv.key);
+    kvs_arena_release(kvs_arc->arena, entry->kv.value);
+    kvs_pool_release(kvs_arc->pool, entry);
+    return FAILURE;
+  }
+  entry->kv.modified = false;
+  if (modified) {
+    kvs_dirty_mark(&kvs_arc->dirty, &entry->kv);
+  }
+  entry->list = ARC_T1;
+  kvs_list_push(&kvs_arc->lists[ARC_T1], &entry->link);
+  return SUCCESS;
+}
+
+int kvs_arc_set(kvs_arc_t* kvs_arc, const char* key, const char* value) {
+  cache_entry_t* entry = kvs_index_get(kvs_arc->index, key);
+  if (entry && entry->kv.value) {
+    char* stored = kvs_arena_pack(kvs_arc->arena, entry->kv.value, value);
+    if (!stored) return FAILURE;
+    entry->kv.value = stored;
+    kvs_dirty_mark(&kvs_arc->dirty, &entry->kv);
+    move_to(kvs_arc, entry, ARC_T2);
+    // a larger value may take the cache over its budget
+    while (resident(kvs_arc) > 1 && over_budget(kvs_arc, 0)) {
+      if (replace(kvs_arc, false) != SUCCESS) {
+        return FAILURE;
+      }
+    }
+    return SUCCESS;
+  }
+
+  return admit(kvs_arc, entry, key, value, true);
+}
+
+int kvs_arc_get_cached(kvs_arc_t* kvs_arc, const char* key, char* value) {
+  cache_entry_t* entry = kvs_index_get(kvs_arc->index, key);
+  if (entry && entry->kv.value) {
+    kvs_arena_read(kvs_arc->arena, entry->kv.value, value);
+    move_to(kvs_arc, entry, ARC_T2);
+    return SUCCESS;
+  }
+  return FAILURE;
+}
+
+bool kvs_arc_contains(kvs_arc_t* kvs_arc, const char* key) {
+  // a ghost is not resident
+  cache_entry_t* entry = kvs_index_get(kvs_arc->index, key);
+  return entry && entry->kv.value;
+}
+
+int kvs_arc_peek(kvs_arc_t* kvs_arc, const char* key, char* value) {
+  cache_entry_t* entry = kvs_index_get(kvs_arc->index, key);
+  if (entry && entry->kv.value) {
+    kvs_arena_read(kvs_arc->arena, entry->kv.value, value);
+    return SUCCESS;
+  }
+  return FAILURE;
+}
+
+int kvs_arc_load(kvs_arc_t* kvs_arc, const char* key, char* value) {
+  if (kvs_arc_get_cached(kvs_arc, key, value) == SUCCESS) {
+    return SUCCESS;
+  }
+  cache_entry_t* ghost = kvs_index_get(kvs_arc->index, key);
+  return admit(kvs_arc, ghost, key, value, false);
+}
+
+int kvs_arc_get(kvs_arc_t* kvs_arc, const char* key, char* value) {
+  if (kvs_arc_get_cached(kvs_arc, key, value) == SUCCESS) {
+    return SUCCESS;
+  }
+
+  int result = kvs_base_get(kvs_arc->kvs_base, key, value);
+  if (result == SUCCESS) {
+    return kvs_arc_load(kvs_arc, key, value);
+  }
+
+  return result;
+}
+
+int kvs_arc_flush(kvs_arc_t* kvs_arc) {
+  return kvs_dirty_flush(&kvs_arc->dirty, kvs_arc->kvs_base);
+}
+
+int kvs_arc_size(kvs_arc_t* kvs_arc) { return resident(kvs_arc); }
+
+int kvs_arc_dirty(kvs_arc_t* kvs_arc) { return kvs_arc->dirty.count; }
+
+int kvs_arc_take_dirty(kvs_arc_t* kvs_arc, char* key, char* value) {
+  return kvs_dirty_take(&kvs_arc->dirty, key, value);
+}
+
+void kvs_arc_mark_dirty(kvs_arc_t* kvs_arc, const char* key) {
+  cache_entry_t* entry = kvs_index_get(kvs_arc->index, key);
+  if (entry && entry->kv.value) {
+    kvs_dirty_mark(&kvs_arc->dirty, &entry->kv);
+  }
+}
+
+size_t kvs_arc_memory(kvs_arc_t* kvs_arc) {
+  int entries = 0;
+  for (int i = 0; i < ARC_LISTS; ++i) {
+    entries += kvs_arc->lists[i].size;
+  }
+  return entries * sizeof(cache_entry_t) + kvs_arena_used(kvs_arc->arena) +
+         kvs_index_memory(kvs_arc->index);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "kvs_base.h"
+
+/**
+ * `kvs_arc_t` is an Adaptive Replacement Cache. Resident entries are split
+ * between T1 (seen once recently) and T2 (seen at least twice); the keys most
+ * recently evicted from each are remembered in the ghost lists B1 and B2. A
+ * miss on a ghost key shows which list was evicted too eagerly, and the
+ * target size of T1 moves towards it, so the cache tunes itself between
+ * recency and frequency. A one-off scan only ever passes through T1.
+ */
+struct kvs_arc;
+typedef struct kvs_arc kvs_arc_t;
+
+kvs_arc_t* kvs_arc_new(kvs_base_t* kvs, int capacity);
+
+/**
+ * `kvs_arc_new_budget` creates a cache bounded by `budget` bytes, like
+ * `kvs_lru_new_budget`. Ghost entries keep their key and slot, so they count
+ * against the budget too; the capacity the adaptation works with is the
+ * number of entries that currently fit.
+ */
+kvs_arc_t* kvs_arc_new_budget(kvs_base_t* kvs, size_t budget);
+
+/**
+ * `kvs_arc_enable_compression` compresses values as
+ * `kvs_lru_enable_compression` does.
+ */
+void kvs_arc_enable_compression(kvs_arc_t* kvs_arc);
+void kvs_arc_free(kvs_arc_t** ptr);
+
+int kvs_arc_set(kvs_arc_t* kvs_arc, const char* key, const char* value);
+int kvs_arc_get(kvs_arc_t* kvs_arc, const char* key, char* value);
+
+/**
+ * `kvs_arc_get_cached`, `kvs_arc_load`, `kvs_arc_contains` and `kvs_arc_peek`
+ * work like their LRU counterparts (see kvs_lru.h).
+ */
+int kvs_arc_get_cached(kvs_arc_t* kvs_arc, const char* key, char* value);
+int kvs_arc_load(kvs_arc_t* kvs_arc, const char* key, char* value);
+bool kvs_arc_contains(kvs_arc_t* kvs_arc, const char* key);
+int kvs_arc_peek(kvs_arc_t* kvs_arc, const char* key, char* value);
+
+int kvs_arc_flush(kvs_arc_t* kvs_arc);
+
+/**
+ * `kvs_arc_size` returns the number of resident entries.
+ */
+int kvs_arc_size(kvs_arc_t* kvs_arc);
+
+/**
+ * `kvs_arc_dirty` returns the number of modified entries.
+ */
+int kvs_arc_dirty(kvs_arc_t* kvs_arc);
+
+/**
+ * `kvs_arc_take_dirty` and `kvs_arc_mark_dirty` work like their LRU
+ * counterparts (see kvs_lru.h).
+ */
+int kvs_arc_take_dirty(kvs_arc_t* kvs_arc, char* key, char* value);
+void kvs_arc_mark_dirty(kvs_arc_t* kvs_arc, const char* key);
+
+/**
+ * `kvs_arc_memory` returns the bytes held by the resident and ghost entries:
+ * their slots in the pool plus their keys and values in the arena.
+ */
+size_t kvs_arc_memory(kvs_arc_t* kvs_arc);
@@ -0,0 +1,226 @@
+#include "kvs_arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "kvs_lz.h"
+
+#define SLAB_SIZE (16 * 1024)
+
+// a chunk is a 2-byte length, the string bytes and the null terminator
+#define CHUNK_OVERHEAD (sizeof(uint16_t) + 1)
+// set in the length of a chunk holding a compressed value
+#define PACKED_FLAG 0x8000
+// only one in this many expansions is timed, since reading the clock costs
+// about as much as expanding a short value
+#define READ_SAMPLE 16
+
+static const size_t class_sizes[] = {16,  24,  32,  48,  64,  96,
+                                     128, 192, 256, 384, 512, 768};
+#define CLASS_COUNT (sizeof(class_sizes) / sizeof(class_sizes[0]))
+
+typedef struct free_chunk {
+  struct free_chunk* next;
+} free_chunk_t;
+
+typedef struct slab {
+  struct slab* next;
+} slab_t;
+
+typedef struct size_class {
+  free_chunk_t* free_list;
+  // unused tail of the newest slab of this class
+  char* bump;
+  char* bump_end;
+} size_class_t;
+
+struct kvs_arena {
+  size_class_t classes[CLASS_COUNT];
+  slab_t* slabs;
+  size_t used;
+  size_t reserved;
+  // where compression is counted, or NULL if values are stored as they are
+  kvs_metrics_t* metrics;
+  // compressed values read by `kvs_arena_read`
+  unsigned long reads;
+};
+
+static int class_of(size_t length) {
+  for (size_t i = 0; i < CLASS_COUNT; ++i) {
+    if (length + CHUNK_OVERHEAD <= class_sizes[i]) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+static char* chunk_of(char* handle) { return handle - sizeof(uint16_t); }
+
+static char* chunk_alloc(kvs_arena_t* arena, int cls) {
+  size_class_t* size_class = &arena->classes[cls];
+  if (size_class->free_list) {
+    free_chunk_t* chunk = size_class->free_list;
+    size_class->free_list = chunk->next;
+    arena->used += class_sizes[cls];
+    return (char*)chunk;
+  }
+
+  if (size_class->bump == NULL ||
+      size_class->bump + class_sizes[cls] > size_class->bump_end) {
+    // slabs come from malloc and the slab header and every class size are
+    // multiples of 8, so each chunk can hold the free-list link
+    slab_t* slab = malloc(SLAB_SIZE);
+    if (!slab) return NULL;
+    slab->next = arena->slabs;
+    arena->slabs = slab;
+    arena->reserved += SLAB_SIZE;
+    size_class->bump = (char*)slab + sizeof(slab_t);
+    size_class->bump_end = (char*)slab + SLAB_SIZE;
+  }
+  char* chunk = size_class->bump;
+  size_class->bump += class_sizes[cls];
+  arena->used += class_sizes[cls];
+  return chunk;
+}
+
+static uint16_t header_of(const char* handle) {
+  uint16_t header;
+  memcpy(&header, handle - sizeof(uint16_t), sizeof(header));
+  return header;
+}
+
+static char* chunk_fill(char* chunk, const char* str, size_t length,
+                        uint16_t flags) {
+  uint16_t stored = length | flags;
+  memcpy(chunk, &stored, sizeof(stored));
+  char* handle = chunk + sizeof(uint16_t);
+  memcpy(handle, str, length);
+  handle[length] = '\0';
+  return handle;
+}
+
+/**
+ * `store` puts the `length` bytes at `str` in place of `handle`, which may
+ * be NULL, reusing its chunk when the size class is the same.
+ */
+static char* store(kvs_arena_t* arena, char* handle, const char* str,
+                   size_t length, uint16_t flags) {
+  int cls = class_of(length);
+  if (cls < 0) return NULL;
+  if (handle && cls == class_of(kvs_arena_length(handle))) {
+    return chunk_fill(chunk_of(handle), str, length, flags);
+  }
+  char* chunk = chunk_alloc(arena, cls);
+  if (!chunk) return NULL;
+  kvs_arena_release(arena, handle);
+  return chunk_fill(chunk, str, length, flags);
+}
+
+kvs_arena_t* kvs_arena_new(void) {
+  kvs_arena_t* arena = calloc(1, sizeof(kvs_arena_t));
+  return arena;
+}
+
+void kvs_arena_free(kvs_arena_t** ptr) {
+  if (ptr && *ptr) {
+    slab_t* slab = (*ptr)->slabs;
+    while (slab) {
+      slab_t* next = slab->next;
+      free(slab);
+      slab = next;
+    }
+    free(*ptr);
+    *ptr = NULL;
+  }
+}
+
+void kvs_arena_enable_compression(kvs_arena_t* arena,
+                                  kvs_metrics_t* metrics) {
+  arena->metrics = metrics;
+}
+
+char* kvs_arena_strdup(kvs_arena_t* arena, const char* str) {
+  return store(arena, NULL, str, strlen(str), 0);
+}
+
+char* kvs_arena_replace(kvs_arena_t* arena, char* handle, const char* str) {
+  return store(arena, handle, str, strlen(str), 0);
+}
+
+char* kvs_arena_pack(kvs_arena_t* arena, char* handle, const char* str) {
+  size_t length = strlen(str);
+  if (arena->metrics == NULL) {
+    return store(arena, handle, str, length, 0);
+  }
+  // compressing only pays if the value drops to a smaller size class
+  int cls = class_of(length);
+  size_t packed_length = 0;
+  char packed[KVS_VALUE_MAX];
+  if (cls > 0 && length < KVS_VALUE_MAX) {
+    uint64_t start = kvs_metrics_now();
+    packed_length = kvs_lz_compress(str, length, packed,
+                                    class_sizes[cls - 1] - CHUNK_OVERHEAD);
+    kvs_metrics_add(&arena->metrics->compress_ns, kvs_metrics_now() - start);
+  }
+  kvs_metrics_add(&arena->metrics->value_bytes, length);
+  if (packed_length == 0) {
+    kvs_metrics_add(&arena->metrics->incompressible, 1);
+    kvs_metrics_add(&arena->metrics->stored_bytes, length);
+    return store(arena, handle, str, length, 0);
+  }
+  kvs_metrics_add(&arena->metrics->compressed, 1);
+  kvs_metrics_add(&arena->metrics->stored_bytes, packed_length);
+  return store(arena, handle, packed, packed_length, PACKED_FLAG);
+}
+
+size_t kvs_arena_unpack(const char* handle, char* out) {
+  size_t length = kvs_arena_length(handle);
+  if (header_of(handle) & PACKED_FLAG) {
+    // only values shorter than `KVS_VALUE_MAX` are packed
+    long unpacked = kvs_lz_decompress(handle, length, out, KVS_VALUE_MAX - 1);
+    length = unpacked < 0 ? 0 : (size_t)unpacked;
+  } else {
+    memcpy(out, handle, length);
+  }
+  out[length] = '\0';
+  return length;
+}
+
+size_t kvs_arena_read(kvs_arena_t* arena, const char* handle, char* out) {
+  if (!kvs_arena_packed(handle) || arena->reads++ % READ_SAMPLE != 0) {
+    return kvs_arena_unpack(handle, out);
+  }
+  uint64_t start = kvs_metrics_now();
+  size_t length = kvs_arena_unpack(handle, out);
+  kvs_metrics_add(&arena->metrics->decompress_ns,
+                  (kvs_metrics_now() - start) * READ_SAMPLE);
+  return length;
+}
+
+bool kvs_arena_packed(const char* handle) {
+  return header_of(handle) & PACKED_FLAG;
+}
+
+void kvs_arena_release(kvs_arena_t* arena, char* handle) {
+  if (handle == NULL) return;
+  int cls = class_of(kvs_arena_length(handle));
+  free_chunk_t* chunk = (free_chunk_t*)chunk_of(handle);
+  chunk->next = arena->classes[cls].free_list;
+  arena->classes[cls].free_list = chunk;
+  arena->used -= class_sizes[cls];
+}
+
+size_t kvs_arena_length(const char* handle) {
+  return header_of(handle) & ~PACKED_FLAG;
+}
+
+size_t kvs_arena_footprint(size_t length) {
+  int cls = class_of(length);
+  return cls < 0 ? 0 : class_sizes[cls];
+}
+
+size_t kvs_arena_used(const kvs_arena_t* arena) { return arena->used; }
+
+size_t kvs_arena_reserved(const kvs_arena_t* arena) { return arena->reserved; }
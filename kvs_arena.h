@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "kvs_stats.h"
+
+/**
+ * `kvs_arena_t` stores the keys and values of a cache. Each string is kept in
+ * the smallest size-classed chunk that fits it, prefixed by its length, so a
+ * short key or value only takes a few bytes more than its length. Chunks are
+ * carved out of large slabs; a released chunk goes onto the free list of its
+ * class and is reused by the next string of that class. Slabs are never
+ * returned or moved to another class, so once the mix of value sizes
+ * shifts, `kvs_arena_reserved` can stay well above `kvs_arena_used`, and
+ * above the budget of the cache.
+ *
+ * A stored string is referred to by its handle: a pointer to the
+ * null-terminated bytes inside the chunk, which can be read like any other C
+ * string. A handle stays valid until it is released or replaced.
+ *
+ * Values may instead be stored with `kvs_arena_pack`, which compresses them
+ * once `kvs_arena_enable_compression` has been called. The handle of a
+ * compressed value is not a readable string; values are read back with
+ * `kvs_arena_read` or `kvs_arena_unpack`.
+ */
+struct kvs_arena;
+typedef struct kvs_arena kvs_arena_t;
+
+kvs_arena_t* kvs_arena_new(void);
+void kvs_arena_free(kvs_arena_t** ptr);
+
+/**
+ * `kvs_arena_enable_compression` makes `kvs_arena_pack` compress values,
+ * counting what it stores, compresses and decompresses in `metrics`.
+ */
+void kvs_arena_enable_compression(kvs_arena_t* arena,
+                                  kvs_metrics_t* metrics);
+
+/**
+ * `kvs_arena_strdup` copies `str` into the arena and returns its handle, or
+ * NULL if memory runs out.
+ */
+char* kvs_arena_strdup(kvs_arena_t* arena, const char* str);
+
+/**
+ * `kvs_arena_replace` stores `str` in place of `handle` and returns the new
+ * handle. The old chunk is reused when `str` fits in the same size class.
+ * `handle` may be NULL, in which case this is `kvs_arena_strdup`.
+ */
+char* kvs_arena_replace(kvs_arena_t* arena, char* handle, const char* str);
+
+/**
+ * `kvs_arena_pack` is `kvs_arena_replace` for values. With compression
+ * enabled, it stores `str` compressed (see kvs_lz.h) when that moves it to a
+ * smaller size class, and as it is otherwise.
+ */
+char* kvs_arena_pack(kvs_arena_t* arena, char* handle, const char* str);
+
+/**
+ * `kvs_arena_unpack` copies the value behind `handle` into `out`, which
+ * must hold `KVS_VALUE_MAX` bytes, expanding it if it was compressed, and
+ * returns its length.
+ */
+size_t kvs_arena_unpack(const char* handle, char* out);
+
+/**
+ * `kvs_arena_read` is `kvs_arena_unpack` for cache hits: it also times a
+ * sample of the compressed values it expands, to estimate their cost.
+ */
+size_t kvs_arena_read(kvs_arena_t* arena, const char* handle, char* out);
+
+/**
+ * `kvs_arena_packed` tells whether the value behind `handle` is compressed.
+ */
+bool kvs_arena_packed(const char* handle);
+
+/**
+ * `kvs_arena_release` gives the chunk behind `handle` back to the arena.
+ */
+void kvs_arena_release(kvs_arena_t* arena, char* handle);
+
+/**
+ * `kvs_arena_length` returns the length of the string behind `handle`
+ * without scanning it; for a compressed value, its compressed length.
+ */
+size_t kvs_arena_length(const char* handle);
+
+/**
+ * `kvs_arena_footprint` returns the bytes of the chunk a string of `length`
+ * bytes would take, or 0 if it is too long to store.
+ */
+size_t kvs_arena_footprint(size_t length);
+
+/**
+ * `kvs_arena_used` returns the bytes held by live chunks.
+ */
+size_t kvs_arena_used(const kvs_arena_t* arena);
+
+/**
+ * `kvs_arena_reserved` returns the bytes of all slabs, used or not.
+ */
+size_t kvs_arena_reserved(const kvs_arena_t* arena);
@@ -1,12 +1,52 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "kvs_base.h"
 
+#include <errno.h>
 #include <linux/limits.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 
+#include "kvs_bloom.h"
+#include "kvs_btree.h"
+#include "kvs_index.h"
+#include "kvs_l2.h"
+
+/**
+ * `KVS_MISSING_SLOTS` is the size of the direct-mapped table of keys known to
+ * be absent: each slot holds the hash of one such key, or 0.
+ */
+#define KVS_MISSING_SLOTS 4096
+
+struct kvs_base_filter {
+  kvs_bloom_t* bloom;
+  pthread_rwlock_t lock;
+  _Atomic uint64_t missing[KVS_MISSING_SLOTS];
+  // bumped by every `filter_found`, so a read can tell that a key it found
+  // missing may have been written since (see `filter_missing`)
+  _Atomic unsigned long generation;
+};
+
+// per-thread call counts (see `kvs_base_thread_gets`)
+static _Thread_local unsigned long thread_gets;
+static _Thread_local unsigned long thread_writes;
+
 kvs_base_t* kvs_base_new(const char* directory) {
+  return kvs_base_new_backend(directory, KVS_BASE_FILE);
+}
+
+kvs_base_t* kvs_base_new_backend(const char* directory,
+                                 kvs_base_backend backend) {
+  return kvs_base_new_layout(directory, backend, KVS_DIR_FLAT);
+}
+
+kvs_base_t* kvs_base_new_layout(const char* directory,
+                                kvs_base_backend backend,
+                                kvs_dir_layout layout) {
   kvs_base_t* kvs_base = malloc(sizeof(kvs_base_t));
   if (kvs_base == NULL) {
     return NULL;
@@ -17,60 +57,519 @@ kvs_base_t* kvs_base_new(const char* directory) {
   if (stat(directory, &st) == -1) {
     int rc = mkdir(directory, S_IRWXU | S_IRWXG | S_IRWXO);
     if (rc != 0) {
+      free(kvs_base);
       return NULL;
     }
   }
   strcpy(kvs_base->directory, directory);
+  // the layout only matters to the FILE backend
+  if (kvs_dir_open(&kvs_base->dir, directory,
+                   backend == KVS_BASE_FILE ? layout : KVS_DIR_FLAT) !=
+      SUCCESS) {
+    free(kvs_base);
+    return NULL;
+  }
+
+  kvs_base->backend = backend;
+  kvs_base->log = NULL;
+  if (backend == KVS_BASE_LOG) {
+    kvs_base->log = kvs_log_new(directory);
+    if (kvs_base->log == NULL) {
+      kvs_dir_close(&kvs_base->dir);
+      free(kvs_base);
+      return NULL;
+    }
+  }
 
-  kvs_base->get_count = 0;
-  kvs_base->set_count = 0;
+  atomic_init(&kvs_base->get_count, 0);
+  atomic_init(&kvs_base->set_count, 0);
+  kvs_base->filter = NULL;
+  atomic_init(&kvs_base->filtered_count, 0);
+  kvs_base->l2 = NULL;
+  kvs_base->keys = NULL;
+  kvs_metrics_init(&kvs_base->metrics);
+  kvs_base->read_ring = NULL;
+  pthread_mutex_init(&kvs_base->read_ring_lock, NULL);
 
   return kvs_base;
 }
 
 void kvs_base_free(kvs_base_t** ptr) {
+  if ((*ptr)->log) {
+    kvs_log_free(&(*ptr)->log);
+  }
+  if ((*ptr)->filter) {
+    kvs_bloom_free(&(*ptr)->filter->bloom);
+    pthread_rwlock_destroy(&(*ptr)->filter->lock);
+    free((*ptr)->filter);
+  }
+  if ((*ptr)->l2) {
+    kvs_l2_free(&(*ptr)->l2);
+  }
+  if ((*ptr)->keys) {
+    kvs_btree_free(&(*ptr)->keys);
+  }
+  if ((*ptr)->read_ring) {
+    kvs_uring_free(&(*ptr)->read_ring);
+  }
+  pthread_mutex_destroy(&(*ptr)->read_ring_lock);
+  kvs_dir_close(&(*ptr)->dir);
   free(*ptr);
   *ptr = NULL;
 }
 
+bool kvs_base_valid_key(const kvs_base_t* kvs, const char* key) {
+  if (kvs->backend == KVS_BASE_FILE) {
+    return kvs_dir_valid_key(key);
+  }
+  return strlen(key) < KVS_KEY_MAX;
+}
+
+typedef struct key_hashes {
+  uint64_t* hashes;
+  size_t count;
+  size_t size;
+} key_hashes_t;
+
+static void add_hash(void* arg, const char* key) {
+  key_hashes_t* keys = arg;
+  if (keys->hashes == NULL) {
+    return;
+  }
+  if (keys->count == keys->size) {
+    keys->size *= 2;
+    uint64_t* grown = realloc(keys->hashes, keys->size * sizeof(uint64_t));
+    if (grown == NULL) {
+      free(keys->hashes);
+      keys->hashes = NULL;
+      return;
+    }
+    keys->hashes = grown;
+  }
+  keys->hashes[keys->count++] = kvs_hash(key);
+}
+
+/**
+ * `scan_directory` builds a filter over every key stored in `dir`.
+ */
+static kvs_bloom_t* scan_directory(const kvs_dir_t* dir) {
+  key_hashes_t keys = {malloc(1024 * sizeof(uint64_t)), 0, 1024};
+  if (kvs_dir_scan(dir, add_hash, &keys) != SUCCESS ||
+      keys.hashes == NULL) {
+    free(keys.hashes);
+    return NULL;
+  }
+
+  // leave room for the store to double before the filter adds a layer
+  size_t count = keys.count;
+  kvs_bloom_t* bloom = kvs_bloom_new(count * 2 > 1 << 16 ? count * 2 : 1 << 16);
+  for (size_t i = 0; bloom && i < count; ++i) {
+    kvs_bloom_add(bloom, keys.hashes[i]);
+  }
+  free(keys.hashes);
+  return bloom;
+}
+
+int kvs_base_enable_filter(kvs_base_t* kvs) {
+  if (kvs->backend != KVS_BASE_FILE || kvs->filter) {
+    return SUCCESS;
+  }
+  struct kvs_base_filter* filter = calloc(1, sizeof(struct kvs_base_filter));
+  if (filter == NULL) {
+    return FAILURE;
+  }
+  filter->bloom = scan_directory(&kvs->dir);
+  if (filter->bloom == NULL) {
+    free(filter);
+    return FAILURE;
+  }
+  pthread_rwlock_init(&filter->lock, NULL);
+  kvs->filter = filter;
+  return SUCCESS;
+}
+
+/**
+ * `filter_found` forgets that `key` was missing. A GET that read no file
+ * just before the key was written may record it as missing after
+ * `filter_add`, so writers call this again once the file exists. The
+ * generation it bumps first lets a miss recorded later still be taken back.
+ */
+static void filter_found(kvs_base_t* kvs, const char* key) {
+  uint64_t hash = kvs_hash(key);
+  uint64_t expected = hash;
+  atomic_fetch_add(&kvs->filter->generation, 1);
+  atomic_compare_exchange_strong(
+      &kvs->filter->missing[hash % KVS_MISSING_SLOTS], &expected, 0);
+}
+
+/**
+ * `filter_missing` remembers that `key` was found missing by a read issued
+ * at filter `generation`. A writer that created the file since then has
+ * bumped the generation, and may already have called `filter_found` for
+ * the last time, so the miss is taken back rather than left to hide the
+ * key from every later read.
+ */
+static void filter_missing(kvs_base_t* kvs, const char* key,
+                           unsigned long generation) {
+  uint64_t hash = kvs_hash(key);
+  _Atomic uint64_t* slot = &kvs->filter->missing[hash % KVS_MISSING_SLOTS];
+  atomic_store(slot, hash);
+  if (atomic_load(&kvs->filter->generation) != generation) {
+    uint64_t expected = hash;
+    atomic_compare_exchange_strong(slot, &expected, 0);
+  }
+}
+
+/**
+ * `filter_add` records that `key` exists. A key the filter already reports
+ * is not added again, so rewriting a key does not inflate the counters. It
+ * returns FAILURE if the filter could not grow to take the key; the key must
+ * then not be written, since the filter would report it absent.
+ */
+static int filter_add(kvs_base_t* kvs, const char* key) {
+  struct kvs_base_filter* filter = kvs->filter;
+  uint64_t hash = kvs_hash(key);
+  filter_found(kvs, key);
+
+  int rc = SUCCESS;
+  pthread_rwlock_wrlock(&filter->lock);
+  if (!kvs_bloom_contains(filter->bloom, hash)) {
+    rc = kvs_bloom_add(filter->bloom, hash);
+  }
+  pthread_rwlock_unlock(&filter->lock);
+  return rc;
+}
+
+/**
+ * `filter_excludes` returns whether `key` is known not to exist.
+ */
+static int filter_excludes(kvs_base_t* kvs, uint64_t hash) {
+  struct kvs_base_filter* filter = kvs->filter;
+  pthread_rwlock_rdlock(&filter->lock);
+  int contains = kvs_bloom_contains(filter->bloom, hash);
+  pthread_rwlock_unlock(&filter->lock);
+  return !contains ||
+         atomic_load(&filter->missing[hash % KVS_MISSING_SLOTS]) == hash;
+}
+
+int kvs_base_enable_l2(kvs_base_t* kvs, const char* path, size_t size) {
+  if (kvs->l2) {
+    return SUCCESS;
+  }
+  kvs->l2 = kvs_l2_open(kvs->dir.fd, path, size);
+  return kvs->l2 ? SUCCESS : FAILURE;
+}
+
+typedef struct key_list {
+  const kvs_base_t* kvs;
+  char** keys;
+  int count;
+  int size;
+  bool failed;
+} key_list_t;
+
+static void add_key(void* arg, const char* key) {
+  key_list_t* list = arg;
+  // a file name the store could not have written is not one of its keys
+  if (list->failed || !kvs_base_valid_key(list->kvs, key)) {
+    return;
+  }
+  if (list->count == list->size) {
+    char** grown = realloc(list->keys, 2 * list->size * sizeof(char*));
+    if (grown == NULL) {
+      list->failed = true;
+      return;
+    }
+    list->keys = grown;
+    list->size *= 2;
+  }
+  list->keys[list->count] = strdup(key);
+  list->failed = list->keys[list->count] == NULL;
+  list->count += !list->failed;
+}
+
+static int compare_keys(const void* a, const void* b) {
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+int kvs_base_enable_keys(kvs_base_t* kvs) {
+  if (kvs->keys) {
+    return SUCCESS;
+  }
+  key_list_t list = {kvs, malloc(1024 * sizeof(char*)), 0, 1024, false};
+  list.failed = list.keys == NULL;
+  int rc = list.failed ? FAILURE
+           : kvs->backend == KVS_BASE_LOG
+               ? kvs_log_scan(kvs->log, add_key, &list)
+               : kvs_dir_scan(&kvs->dir, add_key, &list);
+  if (rc == SUCCESS && !list.failed) {
+    // the tree is built from the sorted keys at once (see `kvs_btree_load`)
+    qsort(list.keys, list.count, sizeof(char*), compare_keys);
+    kvs->keys = kvs_btree_load(list.keys, list.count);
+  } else {
+    for (int i = 0; i < list.count; ++i) {
+      free(list.keys[i]);
+    }
+  }
+  free(list.keys);
+  return kvs->keys ? SUCCESS : FAILURE;
+}
+
+void kvs_base_demote(kvs_base_t* kvs, const char* key, const char* value) {
+  if (kvs->l2 && value[0] != '\0' && kvs_l2_put(kvs->l2, key, value)) {
+    kvs_metrics_add(&kvs->metrics.l2_writes, 1);
+  }
+}
+
+/**
+ * `l2_get` reads `key` from the flash tier, if there is one, and returns
+ * whether it was there.
+ */
+static bool l2_get(kvs_base_t* kvs, const char* key, char* value,
+                   bool counted) {
+  if (kvs->l2 == NULL || kvs_l2_get(kvs->l2, key, value) != SUCCESS) {
+    return false;
+  }
+  if (counted) {
+    kvs_metrics_add(&kvs->metrics.l2_hits, 1);
+  }
+  return true;
+}
+
 int kvs_base_set(kvs_base_t* kvs, const char* key, const char* value) {
   int rc;
-  char filename[PATH_MAX];
-  strcpy(filename, kvs->directory);
-  strcat(filename, "/");
-  strcat(filename, key);
-  FILE* fp = fopen(filename, "w");
-  if (fp == NULL) {
-    return -1;
-  }
-  fwrite(value, sizeof(char), strlen(value), fp);
-  rc = fclose(fp);
-  if (rc != 0) {
-    return rc;
-  }
-  kvs->set_count += 1;
+  thread_writes++;
+  if (kvs->l2) {
+    kvs_l2_remove(kvs->l2, key);
+  }
+  if (kvs->backend == KVS_BASE_LOG) {
+    rc = kvs_log_set(kvs->log, key, value);
+    if (rc != 0) {
+      return rc;
+    }
+    atomic_fetch_add_explicit(&kvs->set_count, 1, memory_order_relaxed);
+    kvs_metrics_add(&kvs->metrics.bytes_written, strlen(value));
+    if (kvs->keys) {
+      kvs_btree_insert(kvs->keys, key);
+    }
+    return 0;
+  }
+
+  if (kvs->filter && filter_add(kvs, key) != SUCCESS) {
+    return FAILURE;
+  }
+
+  if (kvs_dir_write(&kvs->dir, key, value) != SUCCESS) {
+    return FAILURE;
+  }
+  if (kvs->filter) {
+    filter_found(kvs, key);
+  }
+  atomic_fetch_add_explicit(&kvs->set_count, 1, memory_order_relaxed);
+  kvs_metrics_add(&kvs->metrics.bytes_written, strlen(value));
+  if (kvs->keys) {
+    kvs_btree_insert(kvs->keys, key);
+  }
   return 0;
 }
 
 int kvs_base_get(kvs_base_t* kvs, const char* key, char* value) {
   int rc;
-  char filename[PATH_MAX];
-  strcpy(filename, kvs->directory);
-  strcat(filename, "/");
-  strcat(filename, key);
-  FILE* fp = fopen(filename, "r");
-  if (fp == NULL) {
+  thread_gets++;
+  if (l2_get(kvs, key, value, true)) {
+    return 0;
+  }
+  if (kvs->backend == KVS_BASE_LOG) {
+    rc = kvs_log_get(kvs->log, key, value);
+    if (rc != 0) {
+      return rc;
+    }
+    atomic_fetch_add_explicit(&kvs->get_count, 1, memory_order_relaxed);
+    kvs_metrics_add(&kvs->metrics.bytes_read, strlen(value));
+    return 0;
+  }
+
+  unsigned long generation = 0;
+  if (kvs->filter) {
+    generation = atomic_load(&kvs->filter->generation);
+    if (filter_excludes(kvs, kvs_hash(key))) {
+      atomic_fetch_add_explicit(&kvs->filtered_count, 1, memory_order_relaxed);
+      strcpy(value, "");
+      return 0;
+    }
+  }
+
+  ssize_t length = kvs_dir_read(&kvs->dir, key, value);
+  if (length < 0) {
     // if the file doesn't exist, return the empty string
-    kvs->get_count += 1;
+    if (kvs->filter && errno == ENOENT) {
+      filter_missing(kvs, key, generation);
+    }
+    atomic_fetch_add_explicit(&kvs->get_count, 1, memory_order_relaxed);
     strcpy(value, "");
     return 0;
   }
-  size_t num_read = fread(value, sizeof(char), KVS_VALUE_MAX, fp);
-  value[num_read] = '\0';
-  rc = fclose(fp);
-  if (rc != 0) {
-    return rc;
-  }
-  kvs->get_count += 1;
+  atomic_fetch_add_explicit(&kvs->get_count, 1, memory_order_relaxed);
+  kvs_metrics_add(&kvs->metrics.bytes_read, length);
   return 0;
 }
+
+unsigned long kvs_base_thread_gets(void) { return thread_gets; }
+
+unsigned long kvs_base_thread_writes(void) { return thread_writes; }
+
+int kvs_base_set_batch(kvs_base_t* kvs, kvs_batch_t* batch) {
+  int written = 0;
+  thread_writes += batch->count;
+  for (int i = 0; kvs->l2 && i < batch->count; ++i) {
+    kvs_l2_remove(kvs->l2, batch->keys[i]);
+  }
+  if (kvs->backend == KVS_BASE_LOG) {
+    // appends are already sequential; there is nothing to overlap
+    for (int i = 0; i < batch->count; ++i) {
+      batch->written[i] =
+          kvs_log_set(kvs->log, batch->keys[i], batch->values[i]) == 0;
+      written += batch->written[i];
+    }
+  } else {
+    for (int i = 0; kvs->filter && i < batch->count; ++i) {
+      // nothing is written yet, so every entry stays marked unwritten
+      if (filter_add(kvs, batch->keys[i]) != SUCCESS) {
+        return FAILURE;
+      }
+    }
+    written = kvs_batch_write_files(batch, &kvs->dir);
+    for (int i = 0; kvs->filter && i < batch->count; ++i) {
+      filter_found(kvs, batch->keys[i]);
+    }
+  }
+  atomic_fetch_add_explicit(&kvs->set_count, written, memory_order_relaxed);
+  size_t bytes = 0;
+  for (int i = 0; i < batch->count; ++i) {
+    if (batch->written[i]) {
+      bytes += strlen(batch->values[i]);
+      if (kvs->keys) {
+        kvs_btree_insert(kvs->keys, batch->keys[i]);
+      }
+    }
+  }
+  kvs_metrics_add(&kvs->metrics.bytes_written, bytes);
+  return written == batch->count ? SUCCESS : FAILURE;
+}
+
+int kvs_base_sync(kvs_base_t* kvs) {
+  if (kvs->backend == KVS_BASE_LOG) {
+    return kvs_log_sync(kvs->log);
+  }
+  return kvs_dir_sync(&kvs->dir);
+}
+
+/**
+ * `get_batch` is `kvs_base_get_batch`; unless `counted` is set, the reads
+ * are left out of the store's counters and metrics.
+ */
+static void get_batch(kvs_base_t* kvs, int count, const char** keys,
+                      char** values, bool* read, bool counted) {
+  if (kvs->backend == KVS_BASE_LOG) {
+    // the index is in memory and each read is a single pread already
+    for (int i = 0; i < count; ++i) {
+      read[i] = counted ? kvs_base_get(kvs, keys[i], values[i]) == SUCCESS
+                        : l2_get(kvs, keys[i], values[i], false) ||
+                              kvs_log_get(kvs->log, keys[i], values[i]) ==
+                                  SUCCESS;
+    }
+    return;
+  }
+
+  // gather the keys neither the flash tier nor the filter can answer
+  const char** pending_keys = malloc(count * sizeof(char*));
+  char** pending_values = malloc(count * sizeof(char*));
+  bool* pending_read = malloc(count * sizeof(bool));
+  bool* pending_missing = malloc(count * sizeof(bool));
+  int* pending_index = malloc(count * sizeof(int));
+  if (!pending_keys || !pending_values || !pending_read || !pending_missing ||
+      !pending_index) {
+    free(pending_keys);
+    free(pending_values);
+    free(pending_read);
+    free(pending_missing);
+    free(pending_index);
+    for (int i = 0; i < count; ++i) {
+      read[i] = false;
+    }
+    return;
+  }
+  int pending = 0;
+  for (int i = 0; i < count; ++i) {
+    read[i] = false;
+    if (l2_get(kvs, keys[i], values[i], counted)) {
+      read[i] = true;
+      continue;
+    }
+    if (kvs->filter && filter_excludes(kvs, kvs_hash(keys[i]))) {
+      if (counted) {
+        atomic_fetch_add_explicit(&kvs->filtered_count, 1,
+                                  memory_order_relaxed);
+      }
+      strcpy(values[i], "");
+      read[i] = true;
+      continue;
+    }
+    pending_keys[pending] = keys[i];
+    pending_values[pending] = values[i];
+    pending_index[pending] = i;
+    pending++;
+  }
+
+  // the misses are recorded against the generation the reads started at
+  unsigned long generation =
+      kvs->filter ? atomic_load(&kvs->filter->generation) : 0;
+
+  // a batch that finds the shared ring busy brings its own
+  if (pthread_mutex_trylock(&kvs->read_ring_lock) == 0) {
+    kvs_batch_read_files(&kvs->read_ring, pending, pending_keys,
+                         pending_values, pending_read, pending_missing,
+                         &kvs->dir);
+    pthread_mutex_unlock(&kvs->read_ring_lock);
+  } else {
+    kvs_uring_t* ring = NULL;
+    kvs_batch_read_files(&ring, pending, pending_keys, pending_values,
+                         pending_read, pending_missing, &kvs->dir);
+    if (ring) {
+      kvs_uring_free(&ring);
+    }
+  }
+
+  size_t bytes = 0;
+  int done = 0;
+  for (int j = 0; j < pending; ++j) {
+    if (pending_read[j]) {
+      read[pending_index[j]] = true;
+      bytes += strlen(pending_values[j]);
+      done++;
+    }
+    // as in `kvs_base_get`, a key found missing is remembered
+    if (kvs->filter && pending_missing[j]) {
+      filter_missing(kvs, pending_keys[j], generation);
+    }
+  }
+  if (counted) {
+    atomic_fetch_add_explicit(&kvs->get_count, done, memory_order_relaxed);
+    kvs_metrics_add(&kvs->metrics.bytes_read, bytes);
+  }
+  free(pending_keys);
+  free(pending_values);
+  free(pending_read);
+  free(pending_missing);
+  free(pending_index);
+}
+
+void kvs_base_get_batch(kvs_base_t* kvs, int count, const char** keys,
+                        char** values, bool* read) {
+  get_batch(kvs, count, keys, values, read, true);
+}
+
+void kvs_base_read_batch(kvs_base_t* kvs, int count, const char** keys,
+                         char** values, bool* read) {
+  get_batch(kvs, count, keys, values, read, false);
+}
@@ -1,17 +1,149 @@
 #pragma once
 
 #include <linux/limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "constants.h"
+#include "kvs_batch.h"
+#include "kvs_dir.h"
+#include "kvs_log.h"
+#include "kvs_stats.h"
+
+/**
+ * `kvs_base_backend` selects how `kvs_base_t` lays out the store on disk.
+ */
+typedef enum {
+  // one file per key, named after the key
+  KVS_BASE_FILE,
+  // append-only segment files with an in-memory index (see kvs_log.h)
+  KVS_BASE_LOG,
+} kvs_base_backend;
 
 typedef struct kvs_base {
   char directory[PATH_MAX];
-  int get_count;
-  int set_count;
+  // the open store directory, which FILE backend keys are opened relative to
+  kvs_dir_t dir;
+  kvs_base_backend backend;
+  kvs_log_t* log;
+  // updated from every cache shard, so counted atomically
+  atomic_int get_count;
+  atomic_int set_count;
+  // FILE backend only, see `kvs_base_enable_filter`; NULL when disabled
+  struct kvs_base_filter* filter;
+  // GETs answered as absent without touching the disk
+  atomic_int filtered_count;
+  // the flash tier, see `kvs_base_enable_l2`; NULL when disabled
+  struct kvs_l2* l2;
+  // every key in order, see `kvs_base_enable_keys`; NULL when disabled
+  struct kvs_btree* keys;
+  // latencies and counters of the whole store (see kvs_stats.h)
+  kvs_metrics_t metrics;
+  // FILE backend only, the io_uring instance of `kvs_base_get_batch`, used
+  // by one batch at a time
+  kvs_uring_t* read_ring;
+  pthread_mutex_t read_ring_lock;
 } kvs_base_t;
 
 kvs_base_t* kvs_base_new(const char* directory);
+kvs_base_t* kvs_base_new_backend(const char* directory,
+                                 kvs_base_backend backend);
+
+/**
+ * `kvs_base_new_layout` also picks the directory layout of a new FILE store
+ * (see `kvs_dir_open`); `kvs_base_new_backend` uses `KVS_DIR_FLAT`. An
+ * existing store keeps the layout it was created with.
+ */
+kvs_base_t* kvs_base_new_layout(const char* directory,
+                                kvs_base_backend backend,
+                                kvs_dir_layout layout);
 void kvs_base_free(kvs_base_t** ptr);
 
+/**
+ * `kvs_base_valid_key` tells whether the store can hold `key`: it must be
+ * shorter than `KVS_KEY_MAX`, and for the FILE backend also name a key file
+ * (see `kvs_dir_valid_key`).
+ */
+bool kvs_base_valid_key(const kvs_base_t* kvs, const char* key);
+
+/**
+ * `kvs_base_enable_filter` makes GETs of absent keys skip the disk. It builds
+ * a counting Bloom filter over the keys already in the store directory and
+ * keeps it up to date on every SET; a GET the filter rules out returns the
+ * empty string at once. The rare false positive that still reaches `fopen`
+ * and misses is remembered in a small table of confirmed-missing keys, so it
+ * is only looked up once. The LOG backend keeps its whole index in memory and
+ * needs no filter, so this does nothing there.
+ */
+int kvs_base_enable_filter(kvs_base_t* kvs);
+
+/**
+ * `kvs_base_enable_l2` puts a flash tier of `size` bytes, kept in the file
+ * at `path` relative to the store directory, between the caches and the
+ * store (see kvs_l2.h). Reads look in it before the store; a read it answers
+ * still counts as a miss of the calling thread (see `kvs_base_thread_gets`)
+ * but not as a disk read. It is filled by `kvs_base_demote` and every write
+ * of a key drops the key's copy, so it never answers with a stale value.
+ */
+int kvs_base_enable_l2(kvs_base_t* kvs, const char* path, size_t size);
+
+/**
+ * `kvs_base_enable_keys` keeps every key of the store in a B+tree (see
+ * kvs_btree.h), so keys can be listed in order without reading the
+ * directory. The tree is built from the store directory, or from the LOG
+ * backend's index, and every key written afterwards is added to it.
+ */
+int kvs_base_enable_keys(kvs_base_t* kvs);
+
+/**
+ * `kvs_base_demote` offers the flash tier a copy of an entry a cache is
+ * evicting, whose value the store already holds. It does nothing without a
+ * flash tier or for an empty value, which stands for an absent key.
+ */
+void kvs_base_demote(kvs_base_t* kvs, const char* key, const char* value);
+
 int kvs_base_set(kvs_base_t* kvs, const char* key, const char* value);
 int kvs_base_get(kvs_base_t* kvs, const char* key, char* value);
+
+/**
+ * `kvs_base_get_batch` reads the values of `count` keys into the `values`
+ * buffers at once, with the file reads running concurrently (see
+ * `kvs_batch_read_files`), and marks in `read` which keys it read. The
+ * caller must make sure nothing writes these keys meanwhile (see
+ * `kvs_mget`).
+ */
+void kvs_base_get_batch(kvs_base_t* kvs, int count, const char** keys,
+                        char** values, bool* read);
+
+/**
+ * `kvs_base_read_batch` is `kvs_base_get_batch` for reads the store makes on
+ * its own behalf, such as reloading a cache snapshot: they are not counted
+ * as GETs, so they do not show up in hit rates.
+ */
+void kvs_base_read_batch(kvs_base_t* kvs, int count, const char** keys,
+                         char** values, bool* read);
+
+/**
+ * `kvs_base_thread_gets` returns how many times the calling thread has
+ * called `kvs_base_get`, so a caller can tell whether an operation reached
+ * the storage layer.
+ */
+unsigned long kvs_base_thread_gets(void);
+
+/**
+ * `kvs_base_thread_writes` likewise counts the writes (`kvs_base_set` and
+ * each entry of `kvs_base_set_batch`) the calling thread has made.
+ */
+unsigned long kvs_base_thread_writes(void);
+
+/**
+ * `kvs_base_set_batch` stores every entry of `batch`, marking in
+ * `batch->written` which ones succeeded. It returns FAILURE if any did not.
+ */
+int kvs_base_set_batch(kvs_base_t* kvs, kvs_batch_t* batch);
+
+/**
+ * `kvs_base_sync` makes every value stored so far durable; `kvs_base_set`
+ * itself does not wait for the disk.
+ */
+int kvs_base_sync(kvs_base_t* kvs);
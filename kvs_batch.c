@@ -0,0 +1,467 @@
+#define _DEFAULT_SOURCE
+
+#include "kvs_batch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "kvs_uring.h"
+
+/**
+ * `KVS_BATCH_CHUNK` is how many files are opened per io_uring submission; the
+ * ring holds a write and a close for each of them.
+ */
+#define KVS_BATCH_CHUNK 64
+
+/**
+ * `KVS_BATCH_THREADS` bounds the worker pool used without io_uring.
+ */
+#define KVS_BATCH_THREADS 8
+
+enum { BATCH_OPEN, BATCH_WRITE, BATCH_READ, BATCH_CLOSE };
+
+kvs_batch_t* kvs_batch_new(int capacity) {
+  kvs_batch_t* batch = malloc(sizeof(kvs_batch_t));
+  if (batch == NULL) {
+    return NULL;
+  }
+  batch->count = 0;
+  batch->capacity = capacity > 0 ? capacity : 1;
+  batch->keys = malloc(batch->capacity * sizeof(char*));
+  batch->values = malloc(batch->capacity * sizeof(char*));
+  batch->written = calloc(batch->capacity, sizeof(bool));
+  if (!batch->keys || !batch->values || !batch->written) {
+    kvs_batch_free(&batch);
+    return NULL;
+  }
+  return batch;
+}
+
+void kvs_batch_free(kvs_batch_t** ptr) {
+  if (ptr && *ptr) {
+    free((*ptr)->keys);
+    free((*ptr)->values);
+    free((*ptr)->written);
+    free(*ptr);
+    *ptr = NULL;
+  }
+}
+
+int kvs_batch_add(kvs_batch_t* batch, const char* key, const char* value) {
+  if (batch->count == batch->capacity) {
+    return FAILURE;
+  }
+  batch->keys[batch->count] = key;
+  batch->values[batch->count] = value;
+  batch->written[batch->count] = false;
+  batch->count++;
+  return SUCCESS;
+}
+
+static void close_fds(int* fds, int count) {
+  for (int i = 0; i < count; ++i) {
+    if (fds[i] >= 0) {
+      close(fds[i]);
+      fds[i] = -1;
+    }
+  }
+}
+
+/**
+ * `write_chunk` writes entries `start` to `end` of the batch through `ring`:
+ * one submission opens all of their files, a second writes and closes them,
+ * each write linked to its close. It returns FAILURE if the ring fails; the
+ * files it opened are closed, but completions may still be outstanding, so
+ * the ring must not be used again.
+ */
+static int write_chunk(kvs_uring_t* ring, kvs_batch_t* batch,
+                       const kvs_dir_t* dir, int start, int end,
+                       char (*paths)[KVS_DIR_PATH_MAX], int* fds) {
+  unsigned pending = 0;
+  for (int i = start; i < end; ++i) {
+    fds[i - start] = -1;
+  }
+  for (int i = start; i < end; ++i) {
+    if (kvs_dir_path(dir, batch->keys[i], paths[i - start]) != SUCCESS) {
+      continue;
+    }
+    struct io_uring_sqe* sqe = kvs_uring_sqe(ring);
+    if (sqe == NULL) {
+      return FAILURE;
+    }
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = dir->fd;
+    sqe->addr = (uint64_t)(uintptr_t)paths[i - start];
+    sqe->len = 0666;
+    sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+    sqe->user_data = (uint64_t)i << 2 | BATCH_OPEN;
+    pending++;
+  }
+
+  uint64_t user_data;
+  int32_t res;
+  if (kvs_uring_submit(ring, pending) != SUCCESS) {
+    return FAILURE;
+  }
+  while (pending > 0) {
+    if (kvs_uring_complete(ring, &user_data, &res) != SUCCESS) {
+      if (kvs_uring_submit(ring, 1) != SUCCESS) {
+        // cannot reap the remaining opens; leave them to the fallback
+        close_fds(fds, end - start);
+        return FAILURE;
+      }
+      continue;
+    }
+    fds[(user_data >> 2) - start] = res;
+    pending--;
+  }
+
+  for (int i = start; i < end; ++i) {
+    int fd = fds[i - start];
+    if (fd < 0) {
+      continue;
+    }
+    struct io_uring_sqe* sqe = kvs_uring_sqe(ring);
+    struct io_uring_sqe* close_sqe = sqe ? kvs_uring_sqe(ring) : NULL;
+    if (close_sqe == NULL) {
+      // nothing of this submission has reached the kernel yet
+      close_fds(fds, end - start);
+      return FAILURE;
+    }
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)batch->values[i];
+    sqe->len = strlen(batch->values[i]);
+    sqe->off = 0;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = (uint64_t)i << 2 | BATCH_WRITE;
+
+    close_sqe->opcode = IORING_OP_CLOSE;
+    close_sqe->fd = fd;
+    close_sqe->user_data = (uint64_t)i << 2 | BATCH_CLOSE;
+    pending += 2;
+  }
+  if (kvs_uring_submit(ring, pending) != SUCCESS) {
+    // a failed submission hands nothing to the kernel
+    close_fds(fds, end - start);
+    return FAILURE;
+  }
+  while (pending > 0) {
+    if (kvs_uring_complete(ring, &user_data, &res) != SUCCESS) {
+      if (kvs_uring_submit(ring, 1) != SUCCESS) {
+        // the closes still outstanding were submitted and are the
+        // kernel's to run
+        return FAILURE;
+      }
+      continue;
+    }
+    int i = user_data >> 2;
+    switch (user_data & 3) {
+      case BATCH_WRITE:
+        // -2 marks a failed close that completed first
+        batch->written[i] = res == (int32_t)strlen(batch->values[i]) &&
+                            fds[i - start] != -2;
+        break;
+      case BATCH_CLOSE:
+        if (res == -ECANCELED) {
+          // the write failed, which cancels its linked close
+          close(fds[i - start]);
+          fds[i - start] = -1;
+        } else if (res < 0) {
+          fds[i - start] = -2;
+          batch->written[i] = false;
+        } else {
+          fds[i - start] = -1;
+        }
+        break;
+    }
+    pending--;
+  }
+  return SUCCESS;
+}
+
+/**
+ * `write_uring` writes the batch through `ring` a chunk at a time, and stops
+ * at the first chunk the ring fails on; the worker pool writes the rest.
+ */
+static int write_uring(kvs_uring_t* ring, kvs_batch_t* batch,
+                       const kvs_dir_t* dir) {
+  // relative paths are short enough to keep a chunk's worth on the stack
+  char paths[KVS_BATCH_CHUNK][KVS_DIR_PATH_MAX];
+  int fds[KVS_BATCH_CHUNK];
+  for (int start = 0; start < batch->count; start += KVS_BATCH_CHUNK) {
+    int end = start + KVS_BATCH_CHUNK;
+    if (end > batch->count) {
+      end = batch->count;
+    }
+    if (write_chunk(ring, batch, dir, start, end, paths, fds) != SUCCESS) {
+      return FAILURE;
+    }
+  }
+  return SUCCESS;
+}
+
+/**
+ * `batch_pool_t` hands the indices `0 .. count - 1` to a small pool of
+ * threads, each calling `fn(arg, i)` for the indices it claims.
+ */
+typedef struct batch_pool {
+  int count;
+  atomic_int next;
+  void (*fn)(void* arg, int i);
+  void* arg;
+} batch_pool_t;
+
+static void* pool_worker(void* arg) {
+  batch_pool_t* pool = arg;
+  for (;;) {
+    int i = atomic_fetch_add(&pool->next, 1);
+    if (i >= pool->count) {
+      return NULL;
+    }
+    pool->fn(pool->arg, i);
+  }
+}
+
+/**
+ * `run_pool` calls `fn` for `remaining` of the `count` indices, spread over
+ * up to `KVS_BATCH_THREADS` threads; `fn` skips the indices already done.
+ */
+static void run_pool(int count, int remaining, void (*fn)(void*, int),
+                     void* arg) {
+  batch_pool_t pool;
+  pool.count = count;
+  atomic_init(&pool.next, 0);
+  pool.fn = fn;
+  pool.arg = arg;
+
+  int threads = remaining < KVS_BATCH_THREADS ? remaining : KVS_BATCH_THREADS;
+  pthread_t tids[KVS_BATCH_THREADS];
+  int started = 0;
+  // the calling thread is one of the workers
+  while (started < threads - 1 &&
+         pthread_create(&tids[started], NULL, pool_worker, &pool) == 0) {
+    started++;
+  }
+  pool_worker(&pool);
+  for (int t = 0; t < started; ++t) {
+    pthread_join(tids[t], NULL);
+  }
+}
+
+typedef struct write_job {
+  kvs_batch_t* batch;
+  const kvs_dir_t* dir;
+} write_job_t;
+
+static void write_one(void* arg, int i) {
+  write_job_t* job = arg;
+  kvs_batch_t* batch = job->batch;
+  if (!batch->written[i]) {
+    // in a fan-out store this also makes directories the ring could not
+    batch->written[i] =
+        kvs_dir_write(job->dir, batch->keys[i], batch->values[i]) == SUCCESS;
+  }
+}
+
+/**
+ * `write_pool` writes every entry not yet written with plain system calls,
+ * spread over up to `KVS_BATCH_THREADS` threads.
+ */
+static void write_pool(kvs_batch_t* batch, const kvs_dir_t* dir) {
+  write_job_t job = {batch, dir};
+  int remaining = 0;
+  for (int i = 0; i < batch->count; ++i) {
+    remaining += !batch->written[i];
+  }
+  run_pool(batch->count, remaining, write_one, &job);
+}
+
+int kvs_batch_write_files(kvs_batch_t* batch, const kvs_dir_t* dir) {
+  kvs_uring_t* ring = kvs_uring_new(2 * KVS_BATCH_CHUNK);
+  if (ring) {
+    // a ring that failed is dropped either way
+    write_uring(ring, batch, dir);
+    kvs_uring_free(&ring);
+  }
+  write_pool(batch, dir);
+
+  int written = 0;
+  for (int i = 0; i < batch->count; ++i) {
+    written += batch->written[i];
+  }
+  return written;
+}
+
+typedef struct read_job {
+  const char** keys;
+  char** values;
+  bool* read;
+  bool* missing;
+  const kvs_dir_t* dir;
+} read_job_t;
+
+/**
+ * `read_chunk` reads the files of keys `start` to `end` through `ring`, the
+ * way `write_chunk` writes them: one submission opens them all, a second
+ * reads and closes them. A key without a file reads as the empty string.
+ */
+static int read_chunk(kvs_uring_t* ring, read_job_t* job, int start,
+                      int end, char (*paths)[KVS_DIR_PATH_MAX], int* fds) {
+  unsigned pending = 0;
+  for (int i = start; i < end; ++i) {
+    fds[i - start] = -1;
+  }
+  for (int i = start; i < end; ++i) {
+    if (kvs_dir_path(job->dir, job->keys[i], paths[i - start]) != SUCCESS) {
+      continue;
+    }
+    struct io_uring_sqe* sqe = kvs_uring_sqe(ring);
+    if (sqe == NULL) {
+      return FAILURE;
+    }
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = job->dir->fd;
+    sqe->addr = (uint64_t)(uintptr_t)paths[i - start];
+    sqe->open_flags = O_RDONLY;
+    sqe->user_data = (uint64_t)i << 2 | BATCH_OPEN;
+    pending++;
+  }
+
+  uint64_t user_data;
+  int32_t res;
+  if (kvs_uring_submit(ring, pending) != SUCCESS) {
+    return FAILURE;
+  }
+  while (pending > 0) {
+    if (kvs_uring_complete(ring, &user_data, &res) != SUCCESS) {
+      if (kvs_uring_submit(ring, 1) != SUCCESS) {
+        close_fds(fds, end - start);
+        return FAILURE;
+      }
+      continue;
+    }
+    int i = user_data >> 2;
+    fds[i - start] = res;
+    if (res == -ENOENT) {
+      job->values[i][0] = '\0';
+      job->read[i] = true;
+      job->missing[i] = true;
+    }
+    pending--;
+  }
+
+  for (int i = start; i < end; ++i) {
+    int fd = fds[i - start];
+    if (fd < 0) {
+      continue;
+    }
+    struct io_uring_sqe* sqe = kvs_uring_sqe(ring);
+    struct io_uring_sqe* close_sqe = sqe ? kvs_uring_sqe(ring) : NULL;
+    if (close_sqe == NULL) {
+      close_fds(fds, end - start);
+      return FAILURE;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)job->values[i];
+    sqe->len = KVS_VALUE_MAX - 1;
+    sqe->off = 0;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = (uint64_t)i << 2 | BATCH_READ;
+
+    close_sqe->opcode = IORING_OP_CLOSE;
+    close_sqe->fd = fd;
+    close_sqe->user_data = (uint64_t)i << 2 | BATCH_CLOSE;
+    pending += 2;
+  }
+  if (kvs_uring_submit(ring, pending) != SUCCESS) {
+    close_fds(fds, end - start);
+    return FAILURE;
+  }
+  while (pending > 0) {
+    if (kvs_uring_complete(ring, &user_data, &res) != SUCCESS) {
+      if (kvs_uring_submit(ring, 1) != SUCCESS) {
+        return FAILURE;
+      }
+      continue;
+    }
+    int i = user_data >> 2;
+    switch (user_data & 3) {
+      case BATCH_READ:
+        if (res >= 0) {
+          job->values[i][res] = '\0';
+          job->read[i] = true;
+        }
+        break;
+      case BATCH_CLOSE:
+        if (res == -ECANCELED) {
+          close(fds[i - start]);
+        }
+        fds[i - start] = -1;
+        break;
+    }
+    pending--;
+  }
+  return SUCCESS;
+}
+
+static void read_one(void* arg, int i) {
+  read_job_t* job = arg;
+  if (job->read[i]) {
+    return;
+  }
+  if (kvs_dir_read(job->dir, job->keys[i], job->values[i]) >= 0) {
+    job->read[i] = true;
+  } else if (errno == ENOENT) {
+    job->values[i][0] = '\0';
+    job->read[i] = true;
+    job->missing[i] = true;
+  }
+}
+
+int kvs_batch_read_files(kvs_uring_t** ring, int count, const char** keys,
+                         char** values, bool* read, bool* missing,
+                         const kvs_dir_t* dir) {
+  read_job_t job = {keys, values, read, missing, dir};
+  for (int i = 0; i < count; ++i) {
+    read[i] = false;
+    missing[i] = false;
+  }
+  if (*ring == NULL && count > 1) {
+    *ring = kvs_uring_new(2 * KVS_BATCH_CHUNK);
+  }
+  if (*ring && count > 1) {
+    char paths[KVS_BATCH_CHUNK][KVS_DIR_PATH_MAX];
+    int fds[KVS_BATCH_CHUNK];
+    for (int start = 0; start < count; start += KVS_BATCH_CHUNK) {
+      int end = start + KVS_BATCH_CHUNK < count ? start + KVS_BATCH_CHUNK
+                                                 : count;
+      if (read_chunk(*ring, &job, start, end, paths, fds) != SUCCESS) {
+        // completions may still be outstanding; never reuse this ring
+        kvs_uring_free(ring);
+        break;
+      }
+    }
+  }
+
+  int remaining = 0;
+  for (int i = 0; i < count; ++i) {
+    remaining += !read[i];
+  }
+  if (remaining > 0) {
+    run_pool(count, remaining, read_one, &job);
+  }
+
+  int done = 0;
+  for (int i = 0; i < count; ++i) {
+    done += read[i];
+  }
+  return done;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "kvs_dir.h"
+#include "kvs_uring.h"
+
+/**
+ * `kvs_batch_t` collects write-backs so they can be handed to the storage
+ * backend in one go. The batch points at the caller's key and value strings;
+ * they must stay valid until the batch has been written.
+ */
+typedef struct kvs_batch {
+  int count;
+  int capacity;
+  const char** keys;
+  const char** values;
+  // whether each write-back reached the disk, filled in by the writer
+  bool* written;
+} kvs_batch_t;
+
+kvs_batch_t* kvs_batch_new(int capacity);
+void kvs_batch_free(kvs_batch_t** ptr);
+
+/**
+ * `kvs_batch_add` appends a write-back. It returns FAILURE if the batch is
+ * full.
+ */
+int kvs_batch_add(kvs_batch_t* batch, const char* key, const char* value);
+
+/**
+ * `kvs_batch_write_files` writes every entry of `batch` to its own file in
+ * `dir`, the layout of the FILE backend, and returns how many were
+ * written. The open/write/close calls are submitted to io_uring in large
+ * batches; where io_uring is unavailable, or for entries it failed, a small
+ * pool of threads issues the same calls directly.
+ */
+int kvs_batch_write_files(kvs_batch_t* batch, const kvs_dir_t* dir);
+
+/**
+ * `kvs_batch_read_files` is the read side of `kvs_batch_write_files`: it
+ * reads the file of each of the `count` keys in `dir` into the matching
+ * `values` buffer (`KVS_VALUE_MAX` bytes), or the empty string if the key has
+ * no file, and marks in `read` which keys succeeded and in `missing` which
+ * of them had no file. It returns how many succeeded.
+ * Reads are small and frequent, so the ring is the caller's: `*ring` is set
+ * up on first use and kept for the next call, or freed and reset to NULL if
+ * it failed.
+ */
+int kvs_batch_read_files(kvs_uring_t** ring, int count, const char** keys,
+                         char** values, bool* read, bool* missing,
+                         const kvs_dir_t* dir);
@@ -0,0 +1,138 @@
+#include "kvs_bloom.h"
+
+#include <stdlib.h>
+
+#include "constants.h"
+
+/**
+ * Seven counters per key, with ten counters per key of capacity, gives the
+ * first layer a false-positive rate just under 1%. Every added layer gets
+ * three more counters per key, so the rates of all layers together stay
+ * close to that of the first.
+ */
+#define KVS_BLOOM_HASHES 7
+#define KVS_BLOOM_COUNTERS_PER_KEY 10
+#define KVS_BLOOM_COUNTERS_STEP 3
+#define KVS_BLOOM_LAYERS_MAX 32
+
+typedef struct bloom_layer {
+  size_t mask;
+  size_t count;
+  size_t capacity;
+  uint8_t* counters;
+} bloom_layer_t;
+
+struct kvs_bloom {
+  int layer_count;
+  bloom_layer_t layers[KVS_BLOOM_LAYERS_MAX];
+};
+
+static int layer_init(bloom_layer_t* layer, size_t capacity,
+                      size_t counters_per_key) {
+  size_t size = 1024;
+  while (size < capacity * counters_per_key) {
+    size *= 2;
+  }
+  layer->counters = calloc(size, sizeof(uint8_t));
+  if (!layer->counters) return FAILURE;
+  layer->mask = size - 1;
+  layer->count = 0;
+  layer->capacity = size / counters_per_key;
+  return SUCCESS;
+}
+
+// double hashing: probe `i` is `h1 + i * h2`, with `h2` odd so the probes of a
+// key are distinct
+static size_t layer_probe(bloom_layer_t* layer, uint64_t hash, size_t i) {
+  return ((uint32_t)hash + i * ((hash >> 32) | 1)) & layer->mask;
+}
+
+static int layer_contains(bloom_layer_t* layer, uint64_t hash) {
+  for (size_t i = 0; i < KVS_BLOOM_HASHES; ++i) {
+    if (layer->counters[layer_probe(layer, hash, i)] == 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+kvs_bloom_t* kvs_bloom_new(size_t capacity) {
+  kvs_bloom_t* bloom = malloc(sizeof(kvs_bloom_t));
+  if (!bloom) return NULL;
+
+  if (layer_init(&bloom->layers[0], capacity, KVS_BLOOM_COUNTERS_PER_KEY) !=
+      SUCCESS) {
+    free(bloom);
+    return NULL;
+  }
+  bloom->layer_count = 1;
+  return bloom;
+}
+
+void kvs_bloom_free(kvs_bloom_t** ptr) {
+  if (ptr && *ptr) {
+    for (int i = 0; i < (*ptr)->layer_count; ++i) {
+      free((*ptr)->layers[i].counters);
+    }
+    free(*ptr);
+    *ptr = NULL;
+  }
+}
+
+int kvs_bloom_add(kvs_bloom_t* bloom, uint64_t hash) {
+  bloom_layer_t* layer = &bloom->layers[bloom->layer_count - 1];
+  if (layer->count >= layer->capacity &&
+      bloom->layer_count < KVS_BLOOM_LAYERS_MAX) {
+    size_t counters_per_key = KVS_BLOOM_COUNTERS_PER_KEY +
+                              bloom->layer_count * KVS_BLOOM_COUNTERS_STEP;
+    if (layer_init(layer + 1, layer->capacity * 2, counters_per_key) !=
+        SUCCESS) {
+      return FAILURE;
+    }
+    bloom->layer_count++;
+    layer++;
+  }
+  for (size_t i = 0; i < KVS_BLOOM_HASHES; ++i) {
+    uint8_t* counter = &layer->counters[layer_probe(layer, hash, i)];
+    // a saturated counter stays put so it can never drop to zero too early
+    if (*counter < UINT8_MAX) {
+      (*counter)++;
+    }
+  }
+  layer->count++;
+  return SUCCESS;
+}
+
+void kvs_bloom_remove(kvs_bloom_t* bloom, uint64_t hash) {
+  for (int l = bloom->layer_count - 1; l >= 0; --l) {
+    bloom_layer_t* layer = &bloom->layers[l];
+    if (!layer_contains(layer, hash)) {
+      continue;
+    }
+    for (size_t i = 0; i < KVS_BLOOM_HASHES; ++i) {
+      uint8_t* counter = &layer->counters[layer_probe(layer, hash, i)];
+      if (*counter < UINT8_MAX) {
+        (*counter)--;
+      }
+    }
+    layer->count--;
+    return;
+  }
+}
+
+int kvs_bloom_contains(kvs_bloom_t* bloom, uint64_t hash) {
+  for (int l = bloom->layer_count - 1; l >= 0; --l) {
+    if (layer_contains(&bloom->layers[l], hash)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+size_t kvs_bloom_count(kvs_bloom_t* bloom) {
+  size_t count = 0;
+  for (int l = 0; l < bloom->layer_count; ++l) {
+    count += bloom->layers[l].count;
+  }
+  return count;
+}
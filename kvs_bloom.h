@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * `kvs_bloom_t` is a counting Bloom filter over key hashes. Each key bumps
+ * a handful of 8-bit counters, so keys can be removed again as well as added.
+ * `kvs_bloom_contains` never answers false for a key that was added and not
+ * removed, and answers true for an absent key about 1% of the time.
+ *
+ * The filter grows on its own: once its newest layer holds as many keys as it
+ * was sized for, new keys go into an added layer twice as large, and lookups
+ * check every layer. Nothing has to be rehashed, so the keys never need to be
+ * enumerated again.
+ */
+struct kvs_bloom;
+typedef struct kvs_bloom kvs_bloom_t;
+
+/**
+ * `kvs_bloom_new` creates a filter whose first layer is sized for `capacity`
+ * keys.
+ */
+kvs_bloom_t* kvs_bloom_new(size_t capacity);
+void kvs_bloom_free(kvs_bloom_t** ptr);
+
+/**
+ * The filter takes the 64-bit hash of a key (`kvs_hash`) rather than the key
+ * itself, so callers that already hashed it do not hash it again.
+ */
+int kvs_bloom_add(kvs_bloom_t* bloom, uint64_t hash);
+void kvs_bloom_remove(kvs_bloom_t* bloom, uint64_t hash);
+int kvs_bloom_contains(kvs_bloom_t* bloom, uint64_t hash);
+
+/**
+ * `kvs_bloom_count` returns the number of keys in the filter.
+ */
+size_t kvs_bloom_count(kvs_bloom_t* bloom);
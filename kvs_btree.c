@@ -0,0 +1,411 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "kvs_btree.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kvs_index.h"
+
+// the most keys a node holds, and the keys `kvs_btree_load` puts in one,
+// which leaves room to insert more before it splits
+#define BTREE_ORDER 64
+#define BTREE_FILL (BTREE_ORDER * 3 / 4)
+
+typedef struct btree_node {
+  bool leaf;
+  int count;
+  // a leaf owns its keys; key `i` of an inner node is the first key of its
+  // child `i + 1`, shared with the leaf that owns it
+  char* keys[BTREE_ORDER];
+  struct btree_node* children[BTREE_ORDER + 1];
+  // the leaf to the right, or the next spare node
+  struct btree_node* next;
+} btree_node_t;
+
+struct kvs_btree {
+  pthread_rwlock_t lock;
+  btree_node_t* root;
+  int height;
+  int count;
+  // the keys of the leaves by hash, so that a key already present, as most
+  // writes find theirs, is found without walking the tree
+  kvs_index_t* index;
+  // nodes allocated ahead of an insertion, so that splitting never fails
+  // halfway up the tree
+  btree_node_t* spares;
+  int spare_count;
+};
+
+/**
+ * `create` returns a tree with no nodes yet, whose index is sized for
+ * `capacity` keys.
+ */
+static kvs_btree_t* create(int capacity) {
+  kvs_btree_t* btree = malloc(sizeof(kvs_btree_t));
+  if (btree == NULL) {
+    return NULL;
+  }
+  btree->index = kvs_index_new(capacity > 1024 ? capacity : 1024);
+  if (btree->index == NULL) {
+    free(btree);
+    return NULL;
+  }
+  pthread_rwlock_init(&btree->lock, NULL);
+  btree->root = NULL;
+  btree->height = 1;
+  btree->count = 0;
+  btree->spares = NULL;
+  btree->spare_count = 0;
+  return btree;
+}
+
+kvs_btree_t* kvs_btree_new(void) {
+  kvs_btree_t* btree = create(0);
+  if (btree && (btree->root = calloc(1, sizeof(btree_node_t)))) {
+    btree->root->leaf = true;
+    return btree;
+  }
+  kvs_btree_free(&btree);
+  return NULL;
+}
+
+static void free_node(btree_node_t* node) {
+  if (node->leaf) {
+    for (int i = 0; i < node->count; ++i) {
+      free(node->keys[i]);
+    }
+  } else {
+    for (int i = 0; i <= node->count; ++i) {
+      free_node(node->children[i]);
+    }
+  }
+  free(node);
+}
+
+void kvs_btree_free(kvs_btree_t** ptr) {
+  if (ptr && *ptr) {
+    kvs_btree_t* btree = *ptr;
+    if (btree->root) {
+      free_node(btree->root);
+    }
+    while (btree->spares) {
+      btree_node_t* next = btree->spares->next;
+      free(btree->spares);
+      btree->spares = next;
+    }
+    kvs_index_free(&btree->index);
+    pthread_rwlock_destroy(&btree->lock);
+    free(btree);
+    *ptr = NULL;
+  }
+}
+
+/**
+ * `build_level` gives the `width` nodes of `level`, whose first keys are in
+ * `firsts`, as few parents as hold them, spread evenly, and replaces both
+ * arrays with those of the parents. On failure it frees every node.
+ */
+static int build_level(btree_node_t** level, char** firsts, int* width) {
+  int parents = (*width + BTREE_FILL) / (BTREE_FILL + 1);
+  int child = 0;
+  for (int p = 0; p < parents; ++p) {
+    // the first `*width % parents` parents take one child more
+    int children = *width / parents + (p < *width % parents);
+    btree_node_t* node = calloc(1, sizeof(btree_node_t));
+    if (node == NULL) {
+      // the parents built so far, which hold the children before `child`,
+      // and the children left
+      for (int i = 0; i < p; ++i) {
+        free_node(level[i]);
+      }
+      for (int i = child; i < *width; ++i) {
+        free_node(level[i]);
+      }
+      return FAILURE;
+    }
+    node->leaf = false;
+    node->count = children - 1;
+    memcpy(node->children, &level[child], children * sizeof(btree_node_t*));
+    for (int i = 1; i < children; ++i) {
+      node->keys[i - 1] = firsts[child + i];
+    }
+    firsts[p] = firsts[child];
+    level[p] = node;
+    child += children;
+  }
+  *width = parents;
+  return SUCCESS;
+}
+
+kvs_btree_t* kvs_btree_load(char** keys, int count) {
+  kvs_btree_t* btree = create(count);
+  if (btree == NULL || count == 0) {
+    for (int i = 0; i < count; ++i) {
+      free(keys[i]);
+    }
+    if (btree && (btree->root = calloc(1, sizeof(btree_node_t)))) {
+      btree->root->leaf = true;
+      return btree;
+    }
+    kvs_btree_free(&btree);
+    return NULL;
+  }
+  int width = (count + BTREE_FILL - 1) / BTREE_FILL;
+  btree_node_t** level = malloc(width * sizeof(btree_node_t*));
+  char** firsts = malloc(width * sizeof(char*));
+  int built = 0;
+  int key = 0;
+  while (level && firsts && built < width) {
+    btree_node_t* leaf = calloc(1, sizeof(btree_node_t));
+    if (leaf == NULL) {
+      break;
+    }
+    leaf->leaf = true;
+    leaf->count = count / width + (built < count % width);
+    memcpy(leaf->keys, &keys[key], leaf->count * sizeof(char*));
+    key += leaf->count;
+    firsts[built] = leaf->keys[0];
+    if (built > 0) {
+      level[built - 1]->next = leaf;
+    }
+    level[built++] = leaf;
+  }
+  bool complete = built == width;
+  for (int i = 0; complete && i < count; ++i) {
+    complete = kvs_index_put(btree->index, keys[i], keys[i]) == SUCCESS;
+  }
+  if (!complete) {
+    for (int i = 0; i < built; ++i) {
+      free_node(level[i]);
+    }
+    for (int i = key; i < count; ++i) {
+      free(keys[i]);
+    }
+  }
+  while (complete && width > 1) {
+    complete = build_level(level, firsts, &width) == SUCCESS;
+    btree->height += complete;
+  }
+  if (complete) {
+    btree->root = level[0];
+    btree->count = count;
+  }
+  free(level);
+  free(firsts);
+  if (!complete) {
+    kvs_btree_free(&btree);
+  }
+  return btree;
+}
+
+/**
+ * `lower_bound` returns the position of the first key of `node` that is not
+ * less than `key`, and `upper_bound` that of the first key greater than it.
+ */
+static int lower_bound(const btree_node_t* node, const char* key) {
+  int low = 0;
+  int high = node->count;
+  while (low < high) {
+    int middle = (low + high) / 2;
+    if (strcmp(node->keys[middle], key) < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+static int upper_bound(const btree_node_t* node, const char* key) {
+  int low = 0;
+  int high = node->count;
+  while (low < high) {
+    int middle = (low + high) / 2;
+    if (strcmp(node->keys[middle], key) <= 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+static btree_node_t* take_spare(kvs_btree_t* btree) {
+  btree_node_t* node = btree->spares;
+  btree->spares = node->next;
+  btree->spare_count -= 1;
+  memset(node, 0, sizeof(btree_node_t));
+  return node;
+}
+
+/**
+ * `place` puts `key` at position `i` of `node` and, in an inner node,
+ * `child` right after it. A full node is split in two: the new right half is
+ * stored in `*right` and the key that separates the halves in `*separator`.
+ */
+static void place(kvs_btree_t* btree, btree_node_t* node, int i, char* key,
+                  btree_node_t* child, btree_node_t** right,
+                  char** separator) {
+  *right = NULL;
+  if (node->count < BTREE_ORDER) {
+    memmove(&node->keys[i + 1], &node->keys[i],
+            (node->count - i) * sizeof(char*));
+    node->keys[i] = key;
+    if (!node->leaf) {
+      memmove(&node->children[i + 2], &node->children[i + 1],
+              (node->count - i) * sizeof(btree_node_t*));
+      node->children[i + 1] = child;
+    }
+    node->count += 1;
+    return;
+  }
+
+  char* keys[BTREE_ORDER + 1];
+  btree_node_t* children[BTREE_ORDER + 2];
+  memcpy(keys, node->keys, i * sizeof(char*));
+  keys[i] = key;
+  memcpy(&keys[i + 1], &node->keys[i], (BTREE_ORDER - i) * sizeof(char*));
+  if (!node->leaf) {
+    memcpy(children, node->children, (i + 1) * sizeof(btree_node_t*));
+    children[i + 1] = child;
+    memcpy(&children[i + 2], &node->children[i + 1],
+           (BTREE_ORDER - i) * sizeof(btree_node_t*));
+  }
+
+  btree_node_t* sibling = take_spare(btree);
+  sibling->leaf = node->leaf;
+  int half = (BTREE_ORDER + 1) / 2;
+  if (node->leaf) {
+    // a leaf keeps all of its keys, and the right half's first key also
+    // serves as the separator
+    node->count = half;
+    memcpy(node->keys, keys, half * sizeof(char*));
+    sibling->count = BTREE_ORDER + 1 - half;
+    memcpy(sibling->keys, &keys[half], sibling->count * sizeof(char*));
+    sibling->next = node->next;
+    node->next = sibling;
+    *separator = sibling->keys[0];
+  } else {
+    // an inner node hands its middle key up instead
+    node->count = half;
+    memcpy(node->keys, keys, half * sizeof(char*));
+    memcpy(node->children, children, (half + 1) * sizeof(btree_node_t*));
+    sibling->count = BTREE_ORDER - half;
+    memcpy(sibling->keys, &keys[half + 1], sibling->count * sizeof(char*));
+    memcpy(sibling->children, &children[half + 1],
+           (sibling->count + 1) * sizeof(btree_node_t*));
+    *separator = keys[half];
+  }
+  *right = sibling;
+}
+
+/**
+ * `insert` adds `key` below `node`, setting `*added` if it was not there,
+ * and reports a split of `node` as `place` does.
+ */
+static int insert(kvs_btree_t* btree, btree_node_t* node, const char* key,
+                  bool* added, btree_node_t** right, char** separator) {
+  *right = NULL;
+  if (node->leaf) {
+    int i = lower_bound(node, key);
+    if (i < node->count && strcmp(node->keys[i], key) == 0) {
+      *added = false;
+      return SUCCESS;
+    }
+    char* copy = strdup(key);
+    if (copy == NULL || kvs_index_put(btree->index, copy, copy) != SUCCESS) {
+      free(copy);
+      return FAILURE;
+    }
+    place(btree, node, i, copy, NULL, right, separator);
+    *added = true;
+    return SUCCESS;
+  }
+  int i = upper_bound(node, key);
+  btree_node_t* child_right;
+  char* child_separator;
+  if (insert(btree, node->children[i], key, added, &child_right,
+             &child_separator) != SUCCESS) {
+    return FAILURE;
+  }
+  if (child_right) {
+    place(btree, node, i, child_separator, child_right, right, separator);
+  }
+  return SUCCESS;
+}
+
+int kvs_btree_insert(kvs_btree_t* btree, const char* key) {
+  // most writes are to keys the tree has, which readers can look up at once
+  pthread_rwlock_rdlock(&btree->lock);
+  bool present = kvs_index_get(btree->index, key) != NULL;
+  pthread_rwlock_unlock(&btree->lock);
+  if (present) {
+    return SUCCESS;
+  }
+  pthread_rwlock_wrlock(&btree->lock);
+  // one node for every level that may split, and one for a new root
+  while (btree->spare_count < btree->height + 1) {
+    btree_node_t* node = malloc(sizeof(btree_node_t));
+    if (node == NULL) {
+      pthread_rwlock_unlock(&btree->lock);
+      return FAILURE;
+    }
+    node->next = btree->spares;
+    btree->spares = node;
+    btree->spare_count += 1;
+  }
+  bool added = false;
+  btree_node_t* right;
+  char* separator;
+  int rc = insert(btree, btree->root, key, &added, &right, &separator);
+  if (right) {
+    btree_node_t* root = take_spare(btree);
+    root->leaf = false;
+    root->count = 1;
+    root->keys[0] = separator;
+    root->children[0] = btree->root;
+    root->children[1] = right;
+    btree->root = root;
+    btree->height += 1;
+  }
+  btree->count += added;
+  pthread_rwlock_unlock(&btree->lock);
+  return rc;
+}
+
+int kvs_btree_range(kvs_btree_t* btree, const char* from, bool inclusive,
+                    const char* end, int max, char (*keys)[KVS_KEY_MAX]) {
+  pthread_rwlock_rdlock(&btree->lock);
+  btree_node_t* node = btree->root;
+  while (!node->leaf) {
+    node = node->children[from ? upper_bound(node, from) : 0];
+  }
+  int i = 0;
+  if (from) {
+    i = inclusive ? lower_bound(node, from) : upper_bound(node, from);
+  }
+  int count = 0;
+  while (node && count < max) {
+    if (i == node->count) {
+      node = node->next;
+      i = 0;
+      continue;
+    }
+    if (end && strcmp(node->keys[i], end) >= 0) {
+      break;
+    }
+    snprintf(keys[count++], KVS_KEY_MAX, "%s", node->keys[i++]);
+  }
+  pthread_rwlock_unlock(&btree->lock);
+  return count;
+}
+
+int kvs_btree_size(kvs_btree_t* btree) {
+  pthread_rwlock_rdlock(&btree->lock);
+  int count = btree->count;
+  pthread_rwlock_unlock(&btree->lock);
+  return count;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "constants.h"
+
+/**
+ * `kvs_btree_t` is a B+tree of keys, kept in byte order, that answers range
+ * queries over the keys of a store (see `kvs_scan`). Leaves hold copies of
+ * the keys and are chained left to right, so a range is one descent to its
+ * first key and then a walk along the leaves. A hash index of the same keys
+ * tells an addition of a key already present, the common case, without
+ * walking the tree. Keys are only ever added: the store has no way to delete
+ * one. A read-write lock lets several ranges be read at once while additions
+ * wait.
+ */
+struct kvs_btree;
+typedef struct kvs_btree kvs_btree_t;
+
+kvs_btree_t* kvs_btree_new(void);
+
+/**
+ * `kvs_btree_load` builds a tree from `count` keys in increasing byte order,
+ * with no key twice, allocated with `malloc`. It takes the keys over, and
+ * frees them if it fails. Filling the leaves in order is much faster than
+ * inserting the keys one by one.
+ */
+kvs_btree_t* kvs_btree_load(char** keys, int count);
+void kvs_btree_free(kvs_btree_t** ptr);
+
+/**
+ * `kvs_btree_insert` adds a copy of `key`; a key already present is left as
+ * it is. It returns FAILURE only when out of memory.
+ */
+int kvs_btree_insert(kvs_btree_t* btree, const char* key);
+
+/**
+ * `kvs_btree_range` copies into `keys`, in order, up to `max` keys that
+ * come after `from` (or are equal to it, with `inclusive`) and before `end`,
+ * and returns how many it copied. A NULL `from` or `end` leaves that side of
+ * the range open. The lock is only held for the copy, so a caller walks a
+ * long range by calling again from the last key it got, and may do anything
+ * with the keys meanwhile. A key is cut to fit its `KVS_KEY_MAX` bytes.
+ */
+int kvs_btree_range(kvs_btree_t* btree, const char* from, bool inclusive,
+                    const char* end, int max, char (*keys)[KVS_KEY_MAX]);
+
+/**
+ * `kvs_btree_size` returns the number of keys.
+ */
+int kvs_btree_size(kvs_btree_t* btree);
@@ -0,0 +1,37 @@
+#include "kvs_budget.h"
+
+#include <string.h>
+
+#include "kvs_arena.h"
+
+int kvs_budget_entries(size_t budget, size_t entry_size) {
+  // the shortest key is one byte and the shortest value empty
+  size_t smallest =
+      entry_size + kvs_arena_footprint(1) + kvs_arena_footprint(0);
+  size_t entries = budget / smallest;
+  if (entries < 1) {
+    return 1;
+  }
+  return entries < (size_t)(1 << 30) ? (int)entries : 1 << 30;
+}
+
+size_t kvs_budget_charge(size_t entry_size, const char* key,
+                         const char* value) {
+  return entry_size + kvs_arena_footprint(strlen(key)) +
+         kvs_arena_footprint(strlen(value));
+}
+
+bool kvs_budget_over(size_t budget, size_t memory, size_t incoming) {
+  return budget > 0 && memory + incoming > budget;
+}
+
+int kvs_budget_capacity(size_t budget, int entries, size_t memory, int max) {
+  if (entries == 0 || memory == 0) {
+    return max;
+  }
+  double estimate = (double)entries * budget / memory;
+  if (estimate < 1) {
+    return 1;
+  }
+  return estimate < max ? (int)estimate : max;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A cache created with a byte budget (see `kvs_lru_new_budget`) keeps as many
+ * entries as fit in the budget instead of a fixed number of them. An entry is
+ * charged for its slot in the pool and for the arena chunks of its key and
+ * value, and the cache for the slots of its hash index, the same bytes
+ * `kvs_lru_memory` reports, so the budget bounds the real memory of the
+ * cache whatever the sizes of the values. The index therefore starts empty
+ * and grows with the entries instead of being sized up front for
+ * `kvs_budget_entries` of them, which would take most of the budget.
+ */
+
+/**
+ * `kvs_budget_entries` returns the most entries of `entry_size` bytes, each
+ * with the smallest key and value, that fit in `budget`. Caches size their
+ * pool with it, so they never run out of slots before bytes; the pool's
+ * block is only touched as its slots are handed out.
+ */
+int kvs_budget_entries(size_t budget, size_t entry_size);
+
+/**
+ * `kvs_budget_charge` returns the bytes an entry of `entry_size` bytes
+ * holding `key` and `value` is charged.
+ */
+size_t kvs_budget_charge(size_t entry_size, const char* key,
+                         const char* value);
+
+/**
+ * `kvs_budget_over` tells whether a cache holding `memory` bytes would exceed
+ * `budget` by taking `incoming` more. A `budget` of 0 means the cache counts
+ * entries instead, and is never over.
+ */
+bool kvs_budget_over(size_t budget, size_t memory, size_t incoming);
+
+/**
+ * `kvs_budget_capacity` estimates how many entries fit in `budget` when
+ * `entries` entries take `memory` bytes, for policies whose lists are sized
+ * in entries. The estimate is kept between 1 and `max`.
+ */
+int kvs_budget_capacity(size_t budget, int entries, size_t memory, int max);
@@ -0,0 +1,195 @@
+#include "kvs_cindex.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "kvs_index.h"
+
+// the item of a slot whose key was removed
+static char tombstone;
+#define TOMBSTONE ((void*)&tombstone)
+
+typedef struct cindex_slot {
+  // the hash of the item's key, written before the item is published
+  atomic_uint_least64_t hash;
+  // NULL while the slot was never used
+  _Atomic(void*) item;
+} cindex_slot_t;
+
+typedef struct cindex_table {
+  size_t mask;
+  cindex_slot_t slots[];
+} cindex_table_t;
+
+struct kvs_cindex {
+  _Atomic(cindex_table_t*) table;
+  // the rest is only used by the writer: live keys, slots that are live or
+  // tombstones, and the keys the table is sized for at the least
+  size_t count;
+  size_t used;
+  size_t capacity;
+  kvs_epoch_t* epoch;
+  const char* (*key_of)(void* item);
+};
+
+static cindex_table_t* table_new(size_t keys) {
+  // a fresh table is at most half full
+  size_t size = 16;
+  while (size < keys * 2) {
+    size *= 2;
+  }
+  cindex_table_t* table =
+      malloc(sizeof(cindex_table_t) + size * sizeof(cindex_slot_t));
+  if (table == NULL) {
+    return NULL;
+  }
+  table->mask = size - 1;
+  for (size_t i = 0; i < size; ++i) {
+    atomic_init(&table->slots[i].hash, 0);
+    atomic_init(&table->slots[i].item, NULL);
+  }
+  return table;
+}
+
+/**
+ * `find` returns the slot of `table` holding `key`, storing its item in
+ * `*item`, or NULL if the key is not there.
+ */
+static cindex_slot_t* find(kvs_cindex_t* index, cindex_table_t* table,
+                           uint64_t hash, const char* key, void** item) {
+  for (size_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+    cindex_slot_t* slot = &table->slots[i];
+    *item = atomic_load_explicit(&slot->item, memory_order_acquire);
+    if (*item == NULL) {
+      return NULL;
+    }
+    if (*item != TOMBSTONE &&
+        atomic_load_explicit(&slot->hash, memory_order_relaxed) == hash) {
+      const char* stored = index->key_of(*item);
+      if (stored && strcmp(stored, key) == 0) {
+        return slot;
+      }
+    }
+  }
+}
+
+kvs_cindex_t* kvs_cindex_new(int capacity, kvs_epoch_t* epoch,
+                             const char* (*key_of)(void* item)) {
+  kvs_cindex_t* index = malloc(sizeof(kvs_cindex_t));
+  cindex_table_t* table = table_new(capacity > 0 ? capacity : 0);
+  if (index == NULL || table == NULL) {
+    free(index);
+    free(table);
+    return NULL;
+  }
+  atomic_init(&index->table, table);
+  index->count = 0;
+  index->used = 0;
+  index->capacity = capacity > 0 ? capacity : 0;
+  index->epoch = epoch;
+  index->key_of = key_of;
+  return index;
+}
+
+void kvs_cindex_free(kvs_cindex_t** ptr) {
+  if (ptr && *ptr) {
+    free(atomic_load(&(*ptr)->table));
+    free(*ptr);
+    *ptr = NULL;
+  }
+}
+
+void* kvs_cindex_get(kvs_cindex_t* index, const char* key) {
+  cindex_table_t* table =
+      atomic_load_explicit(&index->table, memory_order_acquire);
+  void* item;
+  return find(index, table, kvs_hash(key), key, &item) ? item : NULL;
+}
+
+/**
+ * `rebuild` copies the live entries into a new table, room for one more
+ * included, and frees the old table once no reader can be in it.
+ */
+static int rebuild(kvs_cindex_t* index) {
+  cindex_table_t* old =
+      atomic_load_explicit(&index->table, memory_order_relaxed);
+  size_t keys = index->count + 1;
+  cindex_table_t* table =
+      table_new(keys > index->capacity ? keys : index->capacity);
+  if (table == NULL) {
+    return FAILURE;
+  }
+  for (size_t i = 0; i <= old->mask; ++i) {
+    void* item = atomic_load_explicit(&old->slots[i].item,
+                                      memory_order_relaxed);
+    if (item == NULL || item == TOMBSTONE) {
+      continue;
+    }
+    uint64_t hash =
+        atomic_load_explicit(&old->slots[i].hash, memory_order_relaxed);
+    size_t j = hash & table->mask;
+    while (atomic_load_explicit(&table->slots[j].item,
+                                memory_order_relaxed) != NULL) {
+      j = (j + 1) & table->mask;
+    }
+    atomic_store_explicit(&table->slots[j].hash, hash, memory_order_relaxed);
+    atomic_store_explicit(&table->slots[j].item, item, memory_order_relaxed);
+  }
+  atomic_store_explicit(&index->table, table, memory_order_release);
+  index->used = index->count;
+  kvs_epoch_synchronize(index->epoch);
+  free(old);
+  return SUCCESS;
+}
+
+int kvs_cindex_put(kvs_cindex_t* index, const char* key, void* item) {
+  uint64_t hash = kvs_hash(key);
+  cindex_table_t* table =
+      atomic_load_explicit(&index->table, memory_order_relaxed);
+  void* current;
+  cindex_slot_t* slot = find(index, table, hash, key, &current);
+  if (slot) {
+    atomic_store_explicit(&slot->item, item, memory_order_release);
+    return SUCCESS;
+  }
+  // the key goes into the first tombstone or empty slot of its probe run
+  size_t i = hash & table->mask;
+  while ((current = atomic_load_explicit(&table->slots[i].item,
+                                         memory_order_relaxed)) != NULL &&
+         current != TOMBSTONE) {
+    i = (i + 1) & table->mask;
+  }
+  if (current == NULL) {
+    if ((index->used + 1) * 4 > (table->mask + 1) * 3) {
+      if (rebuild(index) != SUCCESS) {
+        return FAILURE;
+      }
+      return kvs_cindex_put(index, key, item);
+    }
+    index->used++;
+  }
+  atomic_store_explicit(&table->slots[i].hash, hash, memory_order_relaxed);
+  atomic_store_explicit(&table->slots[i].item, item, memory_order_release);
+  index->count++;
+  return SUCCESS;
+}
+
+void kvs_cindex_remove(kvs_cindex_t* index, const char* key) {
+  cindex_table_t* table =
+      atomic_load_explicit(&index->table, memory_order_relaxed);
+  void* item;
+  cindex_slot_t* slot = find(index, table, kvs_hash(key), key, &item);
+  if (slot) {
+    atomic_store_explicit(&slot->item, TOMBSTONE, memory_order_release);
+    index->count--;
+  }
+}
+
+size_t kvs_cindex_memory(kvs_cindex_t* index) {
+  cindex_table_t* table =
+      atomic_load_explicit(&index->table, memory_order_relaxed);
+  return sizeof(cindex_table_t) + (table->mask + 1) * sizeof(cindex_slot_t);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "kvs_epoch.h"
+
+/**
+ * `kvs_cindex_t` is the counterpart of `kvs_index_t` for caches that are
+ * read without a lock: `kvs_cindex_get` may run on any number of threads,
+ * inside a read of `epoch`, while one thread at a time changes the index.
+ * It uses linear probing over slots holding a hash and an item, published
+ * with atomic stores. Removing a key leaves a tombstone instead of shifting
+ * the rest of its probe run back, so an entry never moves under a reader;
+ * later insertions reuse tombstones, and once live entries and tombstones
+ * fill three quarters of the slots the table is rebuilt into a new one and
+ * the old one is freed after `kvs_epoch_synchronize`.
+ *
+ * The index keeps no keys: `key_of` reads the key of an item, and may return
+ * NULL for an item that no longer has one. A reader must still check the
+ * item it gets, since the item may have been removed, and even reused for
+ * another key, while the reader looked at it.
+ */
+struct kvs_cindex;
+typedef struct kvs_cindex kvs_cindex_t;
+
+/**
+ * `kvs_cindex_new` creates an index sized to hold `capacity` keys without
+ * being rebuilt. It grows on its own if more keys are inserted.
+ */
+kvs_cindex_t* kvs_cindex_new(int capacity, kvs_epoch_t* epoch,
+                             const char* (*key_of)(void* item));
+void kvs_cindex_free(kvs_cindex_t** ptr);
+
+/**
+ * `kvs_cindex_get` returns the item stored for `key`, or NULL if there is
+ * none.
+ */
+void* kvs_cindex_get(kvs_cindex_t* index, const char* key);
+
+/**
+ * `kvs_cindex_put` maps `key` to `item`, replacing any previous mapping. It
+ * returns FAILURE if a rebuild runs out of memory.
+ */
+int kvs_cindex_put(kvs_cindex_t* index, const char* key, void* item);
+
+/**
+ * `kvs_cindex_remove` drops the mapping for `key` if there is one.
+ */
+void kvs_cindex_remove(kvs_cindex_t* index, const char* key);
+
+/**
+ * `kvs_cindex_memory` returns the bytes of the current table.
+ */
+size_t kvs_cindex_memory(kvs_cindex_t* index);
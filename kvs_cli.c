@@ -0,0 +1,290 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "kvs_cli.h"
+
+#include <err.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * `get_replacement_policy` takes a string representation of the cache
+ * replacement policy and returns the value of enum `kvs_replacement_policy`. If
+ * the input is unknown, it falls back to the NONE policy and prints a warning
+ * message.
+ */
+static kvs_replacement_policy get_replacement_policy(const char* policy) {
+  if (strcmp(policy, "NONE") == 0) {
+    return KVS_CACHE_NONE;
+  }
+  if (strcmp(policy, "FIFO") == 0) {
+    return KVS_CACHE_FIFO;
+  }
+  if (strcmp(policy, "CLOCK") == 0) {
+    return KVS_CACHE_CLOCK;
+  }
+  if (strcmp(policy, "LRU") == 0) {
+    return KVS_CACHE_LRU;
+  }
+  if (strcmp(policy, "ARC") == 0) {
+    return KVS_CACHE_ARC;
+  }
+  if (strcmp(policy, "2Q") == 0) {
+    return KVS_CACHE_2Q;
+  }
+  if (strcmp(policy, "TINYLFU") == 0) {
+    return KVS_CACHE_TINYLFU;
+  }
+  warnx("invalid cache replacement policy %s: falling back to NONE", policy);
+  return KVS_CACHE_NONE;
+}
+
+/**
+ * `get_backend` takes a string representation of the storage backend and
+ * returns the value of enum `kvs_base_backend`. If the input is unknown, it
+ * falls back to the FILE backend and prints a warning message.
+ */
+static kvs_base_backend get_backend(const char* backend) {
+  if (strcmp(backend, "FILE") == 0) {
+    return KVS_BASE_FILE;
+  }
+  if (strcmp(backend, "LOG") == 0) {
+    return KVS_BASE_LOG;
+  }
+  warnx("invalid storage backend %s: falling back to FILE", backend);
+  return KVS_BASE_FILE;
+}
+
+/**
+ * `get_layout` likewise parses the directory layout of a FILE store.
+ */
+static kvs_dir_layout get_layout(const char* layout) {
+  if (strcmp(layout, "FLAT") == 0) {
+    return KVS_DIR_FLAT;
+  }
+  if (strcmp(layout, "FANOUT") == 0) {
+    return KVS_DIR_FANOUT;
+  }
+  warnx("invalid directory layout %s: falling back to FLAT", layout);
+  return KVS_DIR_FLAT;
+}
+
+/**
+ * `get_durability` parses the durability of the write-ahead log: `NONE`,
+ * `ALWAYS`, or `BATCH:MS` to sync every MS milliseconds (10 if omitted).
+ */
+static kvs_wal_durability get_durability(const char* durability,
+                                         int* interval_ms) {
+  if (strcmp(durability, "NONE") == 0) {
+    return KVS_WAL_NONE;
+  }
+  if (strcmp(durability, "ALWAYS") == 0) {
+    return KVS_WAL_ALWAYS;
+  }
+  if (strncmp(durability, "BATCH", 5) == 0 &&
+      (durability[5] == '\0' || durability[5] == ':')) {
+    *interval_ms = durability[5] == ':' ? atoi(durability + 6) : 10;
+    return KVS_WAL_BATCH;
+  }
+  warnx("invalid durability %s: falling back to ALWAYS", durability);
+  return KVS_WAL_ALWAYS;
+}
+
+/**
+ * `get_memory` returns the byte budget given as CAPACITY, or 0 if CAPACITY is
+ * a plain number of entries. A budget is a number followed by B for bytes or
+ * K, M or G for binary multiples of them, such as `64M`.
+ */
+static size_t get_memory(const char* capacity) {
+  const char* units = "BKMG";
+  char* end;
+  unsigned long long bytes = strtoull(capacity, &end, 10);
+  const char* unit = *end != '\0' ? strchr(units, *end) : NULL;
+  if (unit == NULL) {
+    return 0;
+  }
+  for (const char* u = units; u < unit; ++u) {
+    bytes *= 1024;
+  }
+  return bytes;
+}
+
+/**
+ * `get_l2` parses the flash tier option `SIZE[:PATH]`, where SIZE is a byte
+ * count, optionally followed by B, K, M or G as in a byte budget, and PATH
+ * names the tier's file, relative to the store directory.
+ */
+static int get_l2(kvs_config_t* config, const char* arg) {
+  char* end;
+  unsigned long long size = strtoull(arg, &end, 10);
+  if (*end != '\0' && *end != ':') {
+    size = get_memory(arg);
+    end++;
+  }
+  if (size == 0 || (*end != '\0' && *end != ':') ||
+      (*end == ':' && end[1] == '\0')) {
+    warnx("invalid flash tier %s: expected SIZE[:PATH]", arg);
+    return FAILURE;
+  }
+  config->l2_size = size;
+  if (*end == ':') {
+    config->l2_path = end + 1;
+  }
+  return SUCCESS;
+}
+
+int kvs_cli_option(kvs_config_t* config, int opt, const char* arg) {
+  switch (opt) {
+    case 'b':
+      config->backend = get_backend(arg);
+      return SUCCESS;
+    case 'l':
+      config->layout = get_layout(arg);
+      return SUCCESS;
+    case 's':
+      config->shards = atoi(arg);
+      return SUCCESS;
+    case 'w': {
+      int dirty_high;
+      int dirty_low;
+      if (sscanf(arg, "%d:%d", &dirty_high, &dirty_low) != 2 ||
+          dirty_low < 0 || dirty_low >= dirty_high) {
+        warnx("invalid watermarks %s: expected HIGH:LOW percentages", arg);
+        return FAILURE;
+      }
+      config->write_back = true;
+      config->dirty_high = dirty_high;
+      config->dirty_low = dirty_low;
+      return SUCCESS;
+    }
+    case 'f':
+      config->filter = true;
+      return SUCCESS;
+    case 'R':
+      config->warm_background = true;
+      // fall through
+    case 'r':
+      config->snapshot = true;
+      return SUCCESS;
+    case 'd':
+      config->wal_durability =
+          get_durability(arg, &config->wal_interval_ms);
+      config->wal = true;
+      return SUCCESS;
+    case 'z':
+      config->compress = true;
+      return SUCCESS;
+    case 'a':
+      config->auto_policy = true;
+      // fall through
+    case 'm':
+      config->mrc = true;
+      return SUCCESS;
+    case 'T':
+      config->trace = arg;
+      return SUCCESS;
+    case 'K':
+      config->trace_keys = true;
+      return SUCCESS;
+    case 'L':
+      return get_l2(config, arg);
+    case 'o':
+      config->scan = true;
+      return SUCCESS;
+  }
+  return FAILURE;
+}
+
+void kvs_cli_store(kvs_config_t* config, const char* directory,
+                   const char* policy, const char* capacity) {
+  config->directory = directory;
+  config->policy = get_replacement_policy(policy);
+  config->memory = get_memory(capacity);
+  config->capacity = config->memory > 0 ? 0 : atoi(capacity);
+}
+
+int kvs_cli_scan(kvs_t* kvs, bool range, char* args, kvs_scan_fn fn,
+                 void* arg) {
+  char* words[4];
+  int count = 0;
+  char* save;
+  for (char* word = strtok_r(args, " ", &save); word != NULL && count < 4;
+       word = strtok_r(NULL, " ", &save)) {
+    words[count++] = word;
+  }
+  // the words before the limit
+  int bounds = range ? 2 : count < 2 ? count : 1;
+  if (count < bounds || count > bounds + 1) {
+    return -1;
+  }
+  int limit = 0;
+  if (count > bounds) {
+    char* end;
+    long parsed = strtol(words[bounds], &end, 10);
+    if (*end != '\0' || parsed <= 0 || parsed > INT_MAX) {
+      return -1;
+    }
+    limit = (int)parsed;
+  }
+  if (range) {
+    return kvs_scan(kvs, words[0], words[1], limit, fn, arg);
+  }
+  return kvs_scan_prefix(kvs, bounds > 0 ? words[0] : "", limit, fn, arg);
+}
+
+void kvs_cli_print_stats(FILE* out, kvs_t* kvs) {
+  kvs_stats_t stats;
+  kvs_stats(kvs, &stats);
+  fprintf(out, "STATS GETS: %llu SETS: %llu HIT RATE: %.2f%%\n",
+          (unsigned long long)stats.gets, (unsigned long long)stats.sets,
+          stats.hit_rate * 100);
+  fprintf(out,
+          "STATS RESIDENT: %d DIRTY: %d MEMORY: %zu EVICTIONS: %llu DIRTY "
+          "EVICTIONS: %llu WARMED: %d PREFETCHED: %d\n",
+          stats.resident, stats.dirty, stats.memory,
+          (unsigned long long)stats.evictions,
+          (unsigned long long)stats.dirty_evictions, stats.warmed,
+          stats.prefetched);
+  fprintf(out,
+          "STATS COMPRESSED: %llu INCOMPRESSIBLE: %llu RATIO: %.2f COMPRESS: "
+          "%.0f NS DECOMPRESS PER HIT: %.0f NS\n",
+          (unsigned long long)stats.compressed,
+          (unsigned long long)stats.incompressible, stats.compression_ratio,
+          stats.compress_ns, stats.decompress_ns_per_hit);
+  fprintf(out, "STATS POLICY: %s SWITCHES: %d\n", stats.policy,
+          stats.policy_switches);
+  fprintf(out, "STATS WAL RECORDS: %llu SYNCS: %llu\n",
+          (unsigned long long)stats.wal_records,
+          (unsigned long long)stats.wal_syncs);
+  fprintf(out, "STATS L2 ENTRIES: %d HITS: %llu WRITES: %llu\n",
+          stats.l2_entries, (unsigned long long)stats.l2_hits,
+          (unsigned long long)stats.l2_writes);
+  fprintf(out,
+          "STATS DISK READS: %llu WRITES: %llu BYTES READ: %llu BYTES "
+          "WRITTEN: %llu\n",
+          (unsigned long long)stats.disk_reads,
+          (unsigned long long)stats.disk_writes,
+          (unsigned long long)stats.bytes_read,
+          (unsigned long long)stats.bytes_written);
+  for (int i = 0; i < KVS_STATS_LATENCIES; ++i) {
+    kvs_latency_t* latency = &stats.latencies[i];
+    fprintf(out,
+            "STATS %s COUNT: %llu MEAN: %.0f P50: %llu P99: %llu P999: %llu "
+            "MAX: %llu NS\n",
+            kvs_stats_name(i), (unsigned long long)latency->count,
+            latency->mean, (unsigned long long)latency->p50,
+            (unsigned long long)latency->p99,
+            (unsigned long long)latency->p999,
+            (unsigned long long)latency->max);
+  }
+}
+
+void kvs_cli_print_mrc(FILE* out, kvs_t* kvs) {
+  kvs_mrc_point_t points[KVS_MRC_POINTS];
+  int count = kvs_mrc(kvs, points, KVS_MRC_POINTS);
+  for (int i = 0; i < count; ++i) {
+    fprintf(out, "MRC %s CAPACITY: %d HIT RATE: %.2f%%\n",
+            kvs_policy_name(points[i].policy), points[i].capacity,
+            points[i].hit_rate * 100);
+  }
+}
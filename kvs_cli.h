@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "kvs.h"
+
+/**
+ * kvs_cli.h holds what the command-line front ends, `client` and
+ * `kvs_server`, share: the options that configure the store, the arguments
+ * of the `SCAN` and `RANGE` commands, and the reports of the `STATS` and
+ * `MRC` commands.
+ */
+
+/**
+ * `KVS_CLI_OPTIONS` are the `getopt` letters of the store options, and
+ * `KVS_CLI_USAGE` describes them for a usage line.
+ */
+#define KVS_CLI_OPTIONS "b:l:s:w:frRd:zmaT:KL:o"
+#define KVS_CLI_USAGE \
+  "[-b BACKEND] [-l LAYOUT] [-s SHARDS] [-w HIGH:LOW] [-f] [-r | -R] " \
+  "[-d DURABILITY] [-z] [-m | -a] [-T TRACE [-K]] [-L SIZE[:PATH]] [-o]"
+
+/**
+ * `kvs_cli_option` applies store option `opt` with argument `arg` to
+ * `config`. It returns FAILURE for a letter that is not a store option or
+ * an argument that cannot be used; an unknown name of a policy, backend,
+ * layout or durability only draws a warning and falls back to the default.
+ */
+int kvs_cli_option(kvs_config_t* config, int opt, const char* arg);
+
+/**
+ * `kvs_cli_store` applies the positional arguments `DIRECTORY POLICY
+ * CAPACITY` to `config`. CAPACITY is a number of entries, or a byte budget
+ * when followed by B, K, M or G.
+ */
+void kvs_cli_store(kvs_config_t* config, const char* directory,
+                   const char* policy, const char* capacity);
+
+/**
+ * `kvs_cli_scan` runs `SCAN [PREFIX] [LIMIT]`, or `RANGE START END [LIMIT]`
+ * if `range` is set, given the words after the command in `args`, which it
+ * splits in place. It returns what `kvs_scan` does, or -1 for arguments it
+ * cannot use.
+ */
+int kvs_cli_scan(kvs_t* kvs, bool range, char* args, kvs_scan_fn fn,
+                 void* arg);
+
+/**
+ * `kvs_cli_print_stats` writes the answer to `STATS` to `out`: a snapshot of
+ * the store's counters and latency percentiles.
+ */
+void kvs_cli_print_stats(FILE* out, kvs_t* kvs);
+
+/**
+ * `kvs_cli_print_mrc` writes the answer to `MRC` to `out`: one line per point
+ * of the predicted miss-ratio curves (see `kvs_mrc`), and nothing unless the
+ * store was opened with `-m` or `-a`.
+ */
+void kvs_cli_print_mrc(FILE* out, kvs_t* kvs);
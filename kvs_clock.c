@@ -1,126 +1,433 @@
 #include "kvs_clock.h"
 
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "kvs_arena.h"
+#include "kvs_budget.h"
+#include "kvs_cindex.h"
+#include "kvs_dirty.h"
+#include "kvs_epoch.h"
+#include "kvs_pool.h"
+
+// key and value chunks held back from the arena before waiting for readers
+#define CLOCK_RETIRED_MAX 256
+
 typedef struct cache_entry {
-  char key[KVS_KEY_MAX];
-  char value[KVS_VALUE_MAX];
-  int reference_bit;
-  int modified;
+  // `kv.value` is NULL while the slot is empty
+  kvs_entry_t kv;
+  atomic_bool reference_bit;
+  // `kv.key` and `kv.value` as `kvs_clock_get_unlocked` reads them, NULL
+  // while the slot is empty; the key is published first
+  _Atomic(char*) key;
+  _Atomic(char*) value;
 } cache_entry_t;
 
 struct kvs_clock {
   kvs_base_t* kvs_base;
   int capacity;
-  cache_entry_t* entries;
+  // bytes the entries may take, or 0 to hold `capacity` entries
+  size_t budget;
+  // the clock is the pool's block itself: slot `i` is `kvs_pool_at(pool, i)`
+  kvs_pool_t* pool;
+  kvs_arena_t* arena;
+  kvs_epoch_t* epoch;
+  kvs_cindex_t* index;
   int count;
   int cursor;
+  kvs_dirty_t dirty;
+  // chunks evicted or replaced that readers may still be copying, and the
+  // arena bytes they take
+  char* retired[CLOCK_RETIRED_MAX];
+  int retired_count;
+  size_t retired_bytes;
 };
 
-kvs_clock_t* kvs_clock_new(kvs_base_t* kvs, int capacity) {
+static const char* entry_key(void* item) {
+  cache_entry_t* entry = item;
+  return atomic_load_explicit(&entry->key, memory_order_acquire);
+}
+
+/**
+ * `create` makes a cache of `capacity` entries. Without a `budget` its index
+ * is sized for all of them; with one it starts empty and grows with
+ * the entries, since its bytes are charged to the budget.
+ */
+static kvs_clock_t* create(kvs_base_t* kvs, int capacity, size_t budget) {
   kvs_clock_t* kvs_clock = malloc(sizeof(kvs_clock_t));
   kvs_clock->kvs_base = kvs;
   kvs_clock->capacity = capacity;
-  kvs_clock->entries = calloc(capacity, sizeof(cache_entry_t));
+  kvs_clock->budget = budget;
+  kvs_clock->pool = kvs_pool_new(sizeof(cache_entry_t), capacity);
+  kvs_clock->arena = kvs_arena_new();
+  kvs_clock->epoch = kvs_epoch_new();
+  kvs_clock->index = kvs_cindex_new(budget > 0 ? 0 : capacity,
+                                    kvs_clock->epoch, entry_key);
   kvs_clock->count = 0;
   kvs_clock->cursor = 0;
+  kvs_dirty_init(&kvs_clock->dirty);
+  kvs_clock->retired_count = 0;
+  kvs_clock->retired_bytes = 0;
   return kvs_clock;
 }
 
+kvs_clock_t* kvs_clock_new(kvs_base_t* kvs, int capacity) {
+  return create(kvs, capacity, 0);
+}
+
+kvs_clock_t* kvs_clock_new_budget(kvs_base_t* kvs, size_t budget) {
+  return create(kvs, kvs_budget_entries(budget, sizeof(cache_entry_t)),
+                budget);
+}
+
+void kvs_clock_enable_compression(kvs_clock_t* kvs_clock) {
+  kvs_arena_enable_compression(kvs_clock->arena, &kvs_clock->kvs_base->metrics);
+}
+
 void kvs_clock_free(kvs_clock_t** ptr) {
   kvs_clock_t* kvs_clock = *ptr;
-  free(kvs_clock->entries);
+  kvs_cindex_free(&kvs_clock->index);
+  kvs_epoch_free(&kvs_clock->epoch);
+  kvs_arena_free(&kvs_clock->arena);
+  kvs_pool_free(&kvs_clock->pool);
   free(kvs_clock);
   *ptr = NULL;
 }
 
-int kvs_clock_set(kvs_clock_t* kvs_clock, const char* key, const char* value) {
-  for (int i = 0; i < kvs_clock->count; ++i) {
-    if (strcmp(kvs_clock->entries[i].key, key) == 0) {
-      strcpy(kvs_clock->entries[i].value, value);
-      kvs_clock->entries[i].reference_bit = 1;
-      kvs_clock->entries[i].modified = 1;
-      return SUCCESS;
+static bool over_budget(kvs_clock_t* kvs_clock, size_t incoming) {
+  return kvs_budget_over(kvs_clock->budget, kvs_clock_memory(kvs_clock),
+                         incoming);
+}
+
+/**
+ * `retire` gives `handle` back to the arena once no reader can be copying
+ * it. Chunks are held back in a batch, and the whole batch is released
+ * after one wait for the readers, so the wait is rare.
+ */
+static void retire(kvs_clock_t* kvs_clock, char* handle) {
+  if (handle == NULL) {
+    return;
+  }
+  if (kvs_clock->retired_count == CLOCK_RETIRED_MAX) {
+    kvs_epoch_synchronize(kvs_clock->epoch);
+    for (int i = 0; i < kvs_clock->retired_count; ++i) {
+      kvs_arena_release(kvs_clock->arena, kvs_clock->retired[i]);
     }
+    kvs_clock->retired_count = 0;
+    kvs_clock->retired_bytes = 0;
   }
+  kvs_clock->retired[kvs_clock->retired_count++] = handle;
+  kvs_clock->retired_bytes += kvs_arena_footprint(kvs_arena_length(handle));
+}
 
-  if (kvs_clock->count < kvs_clock->capacity) {
-    strcpy(kvs_clock->entries[kvs_clock->count].key, key);
-    strcpy(kvs_clock->entries[kvs_clock->count].value, value);
-    kvs_clock->entries[kvs_clock->count].reference_bit = 1;
-    kvs_clock->entries[kvs_clock->count].modified = 1;
-    kvs_clock->count++;
-    return SUCCESS;
-  }
+/**
+ * `publish` makes the entry in `entry` visible to readers that find it
+ * through the index.
+ */
+static void publish(cache_entry_t* entry) {
+  atomic_store_explicit(&entry->key, entry->kv.key, memory_order_release);
+  atomic_store_explicit(&entry->value, entry->kv.value, memory_order_release);
+}
 
-  while (kvs_clock->entries[kvs_clock->cursor].reference_bit == 1) {
-    kvs_clock->entries[kvs_clock->cursor].reference_bit = 0;
-    kvs_clock->cursor = (kvs_clock->cursor + 1) % kvs_clock->capacity;
+static void reference(cache_entry_t* entry) {
+  // a hit only writes the bit when it is clear, so hits on a hot entry do
+  // not keep taking its cache line from each other
+  if (!atomic_load_explicit(&entry->reference_bit, memory_order_relaxed)) {
+    atomic_store_explicit(&entry->reference_bit, true, memory_order_relaxed);
   }
+}
+
+/**
+ * `empty_slot` unpublishes the entry in `entry`, retires its chunks and
+ * gives its slot back to the pool. The slot stays on the clock, empty,
+ * until the pool hands it out again.
+ */
+static void empty_slot(kvs_clock_t* kvs_clock, cache_entry_t* entry) {
+  // the value goes first, the order `kvs_clock_get_unlocked` relies on
+  atomic_store_explicit(&entry->value, NULL, memory_order_release);
+  atomic_store_explicit(&entry->key, NULL, memory_order_release);
+  retire(kvs_clock, entry->kv.key);
+  retire(kvs_clock, entry->kv.value);
+  entry->kv.key = NULL;
+  entry->kv.value = NULL;
+  atomic_store_explicit(&entry->reference_bit, false, memory_order_relaxed);
+  kvs_pool_release(kvs_clock->pool, entry);
+  kvs_clock->count--;
+}
 
-  if (kvs_clock->entries[kvs_clock->cursor].modified) {
-    kvs_base_set(kvs_clock->kvs_base, kvs_clock->entries[kvs_clock->cursor].key,
-                 kvs_clock->entries[kvs_clock->cursor].value);
+/**
+ * `evict_slot` writes back `victim` if it is modified and evicts it, or
+ * returns FAILURE and leaves it resident if the write-back fails.
+ */
+static int evict_slot(kvs_clock_t* kvs_clock, cache_entry_t* victim) {
+  if (kvs_dirty_evict(&kvs_clock->dirty, kvs_clock->kvs_base, &victim->kv) !=
+      SUCCESS) {
+    return FAILURE;
   }
-  strcpy(kvs_clock->entries[kvs_clock->cursor].key, key);
-  strcpy(kvs_clock->entries[kvs_clock->cursor].value, value);
-  kvs_clock->entries[kvs_clock->cursor].reference_bit = 1;
-  kvs_clock->entries[kvs_clock->cursor].modified = 1;
-  kvs_clock->cursor = (kvs_clock->cursor + 1) % kvs_clock->capacity;
+  kvs_cindex_remove(kvs_clock->index, victim->kv.key);
+  empty_slot(kvs_clock, victim);
+  return SUCCESS;
+}
 
+/**
+ * `insert` publishes a slot filled by `fill_slot` and adds it to the index.
+ * If the index cannot grow the slot is emptied again, so no entry is ever
+ * resident without being found.
+ */
+static int insert(kvs_clock_t* kvs_clock, cache_entry_t* entry) {
+  publish(entry);
+  if (kvs_cindex_put(kvs_clock->index, entry->kv.key, entry) != SUCCESS) {
+    empty_slot(kvs_clock, entry);
+    return FAILURE;
+  }
   return SUCCESS;
 }
 
-int kvs_clock_get(kvs_clock_t* kvs_clock, const char* key, char* value) {
-  for (int i = 0; i < kvs_clock->count; ++i) {
-    if (strcmp(kvs_clock->entries[i].key, key) == 0) {
-      strcpy(value, kvs_clock->entries[i].value);
-      kvs_clock->entries[i].reference_bit = 1;
-      return SUCCESS;
+/**
+ * `evict_one` sweeps the hand over the slots handed out so far until it
+ * finds an entry with a clear reference bit, and evicts it. Empty slots are
+ * passed over; the pool's free-list link overwrites a released slot's key,
+ * so emptiness is told by its value. It returns FAILURE if the victim could
+ * not be written back; the hand has passed it by then, so the next sweep
+ * tries another entry first.
+ */
+static int evict_one(kvs_clock_t* kvs_clock) {
+  int span = kvs_pool_span(kvs_clock->pool);
+  for (;;) {
+    cache_entry_t* entry = kvs_pool_at(kvs_clock->pool, kvs_clock->cursor);
+    kvs_clock->cursor = (kvs_clock->cursor + 1) % span;
+    if (!entry->kv.value) {
+      continue;
     }
+    if (atomic_load_explicit(&entry->reference_bit, memory_order_relaxed)) {
+      atomic_store_explicit(&entry->reference_bit, false,
+                            memory_order_relaxed);
+      continue;
+    }
+    return evict_slot(kvs_clock, entry);
   }
+}
 
-  if (kvs_base_get(kvs_clock->kvs_base, key, value) == FAILURE) {
+/**
+ * `claim_slot` returns an empty slot for a new entry of `charge` bytes,
+ * evicting entries until there is room for it, or NULL if the clock has no
+ * slots at all or an eviction failed. While the clock is filling up no
+ * entry is evicted; once it is full, the evicted entry's slot is the one
+ * returned.
+ */
+static cache_entry_t* claim_slot(kvs_clock_t* kvs_clock, size_t charge) {
+  while (kvs_clock->count > 0 && (kvs_clock->count == kvs_clock->capacity ||
+                                  over_budget(kvs_clock, charge))) {
+    if (evict_one(kvs_clock) != SUCCESS) {
+      return NULL;
+    }
+  }
+  cache_entry_t* entry = kvs_pool_alloc(kvs_clock->pool);
+  if (entry) {
+    entry->kv.key = NULL;
+    entry->kv.value = NULL;
+    kvs_clock->count++;
+  }
+  return entry;
+}
+
+/**
+ * `fill_slot` stores `key` and `value` in a slot returned by `claim_slot`.
+ * If the arena runs out of memory the slot goes back to the pool.
+ */
+static int fill_slot(kvs_clock_t* kvs_clock, cache_entry_t* entry,
+                     const char* key, const char* value) {
+  entry->kv.key = kvs_arena_strdup(kvs_clock->arena, key);
+  entry->kv.value = kvs_arena_pack(kvs_clock->arena, NULL, value);
+  if (!entry->kv.key || !entry->kv.value) {
+    kvs_arena_release(kvs_clock->arena, entry->kv.key);
+    kvs_arena_release(kvs_clock->arena, entry->kv.value);
+    entry->kv.key = NULL;
+    entry->kv.value = NULL;
+    atomic_store_explicit(&entry->reference_bit, false, memory_order_relaxed);
+    kvs_pool_release(kvs_clock->pool, entry);
+    kvs_clock->count--;
     return FAILURE;
   }
+  entry->kv.modified = false;
+  return SUCCESS;
+}
 
-  if (kvs_clock->count < kvs_clock->capacity) {
-    strcpy(kvs_clock->entries[kvs_clock->count].key, key);
-    strcpy(kvs_clock->entries[kvs_clock->count].value, value);
-    kvs_clock->entries[kvs_clock->count].reference_bit = 1;
-    kvs_clock->entries[kvs_clock->count].modified = 0;
-    kvs_clock->count++;
-  } else {
-    while (kvs_clock->entries[kvs_clock->cursor].reference_bit == 1) {
-      kvs_clock->entries[kvs_clock->cursor].reference_bit = 0;
-      kvs_clock->cursor = (kvs_clock->cursor + 1) % kvs_clock->capacity;
+int kvs_clock_set(kvs_clock_t* kvs_clock, const char* key, const char* value) {
+  cache_entry_t* entry = kvs_cindex_get(kvs_clock->index, key);
+  if (entry) {
+    // the old value may still be being read, so it is never overwritten
+    char* stored = kvs_arena_pack(kvs_clock->arena, NULL, value);
+    if (!stored) {
+      return FAILURE;
     }
-
-    if (kvs_clock->entries[kvs_clock->cursor].modified) {
-      kvs_base_set(kvs_clock->kvs_base,
-                   kvs_clock->entries[kvs_clock->cursor].key,
-                   kvs_clock->entries[kvs_clock->cursor].value);
+    retire(kvs_clock, entry->kv.value);
+    entry->kv.value = stored;
+    atomic_store_explicit(&entry->value, stored, memory_order_release);
+    reference(entry);
+    kvs_dirty_mark(&kvs_clock->dirty, &entry->kv);
+    // a larger value may take the cache over its budget
+    while (kvs_clock->count > 1 && over_budget(kvs_clock, 0)) {
+      if (evict_one(kvs_clock) != SUCCESS) {
+        return FAILURE;
+      }
     }
-    strcpy(kvs_clock->entries[kvs_clock->cursor].key, key);
-    strcpy(kvs_clock->entries[kvs_clock->cursor].value, value);
-    kvs_clock->entries[kvs_clock->cursor].reference_bit = 1;
-    kvs_clock->entries[kvs_clock->cursor].modified = 0;
-    kvs_clock->cursor = (kvs_clock->cursor + 1) % kvs_clock->capacity;
+    return SUCCESS;
   }
 
+  entry = claim_slot(kvs_clock,
+                     kvs_budget_charge(sizeof(cache_entry_t), key, value));
+  if (!entry || fill_slot(kvs_clock, entry, key, value) != SUCCESS) {
+    return FAILURE;
+  }
+  atomic_store_explicit(&entry->reference_bit, true, memory_order_relaxed);
+  if (insert(kvs_clock, entry) != SUCCESS) {
+    return FAILURE;
+  }
+  kvs_dirty_mark(&kvs_clock->dirty, &entry->kv);
+
   return SUCCESS;
 }
 
+int kvs_clock_get_cached(kvs_clock_t* kvs_clock, const char* key,
+                         char* value) {
+  cache_entry_t* entry = kvs_cindex_get(kvs_clock->index, key);
+  if (entry) {
+    kvs_arena_read(kvs_clock->arena, entry->kv.value, value);
+    reference(entry);
+    return SUCCESS;
+  }
+  return FAILURE;
+}
+
+int kvs_clock_get_unlocked(kvs_clock_t* kvs_clock, const char* key,
+                           char* value) {
+  int ticket = kvs_epoch_enter(kvs_clock->epoch);
+  cache_entry_t* entry = kvs_cindex_get(kvs_clock->index, key);
+  char* stored = NULL;
+  if (entry) {
+    stored = atomic_load_explicit(&entry->value, memory_order_acquire);
+    // the slot may have been given to another key since the index was
+    // read, and even back to `key`, between the loads. Emptying a slot
+    // clears its value before its key and publishing sets its key before
+    // its value, and a retired chunk is not reused while this read lasts,
+    // so if the slot holds `key` and its value is still `stored` after the
+    // key was checked, `stored` is `key`'s value. Anything else goes to the
+    // locked path.
+    const char* current =
+        atomic_load_explicit(&entry->key, memory_order_acquire);
+    if (current == NULL || strcmp(current, key) != 0 ||
+        atomic_load_explicit(&entry->value, memory_order_acquire) != stored) {
+      stored = NULL;
+    }
+  }
+  if (stored) {
+    // `kvs_arena_read` samples its timing in the arena, which readers must
+    // not write
+    kvs_arena_unpack(stored, value);
+    reference(entry);
+  }
+  kvs_epoch_exit(kvs_clock->epoch, ticket);
+  return stored ? SUCCESS : FAILURE;
+}
+
+bool kvs_clock_contains(kvs_clock_t* kvs_clock, const char* key) {
+  return kvs_cindex_get(kvs_clock->index, key) != NULL;
+}
+
+int kvs_clock_peek(kvs_clock_t* kvs_clock, const char* key, char* value) {
+  cache_entry_t* entry = kvs_cindex_get(kvs_clock->index, key);
+  if (entry) {
+    kvs_arena_read(kvs_clock->arena, entry->kv.value, value);
+    return SUCCESS;
+  }
+  return FAILURE;
+}
+
+int kvs_clock_load(kvs_clock_t* kvs_clock, const char* key, char* value) {
+  if (kvs_clock_get_cached(kvs_clock, key, value) == SUCCESS) {
+    return SUCCESS;
+  }
+
+  cache_entry_t* entry = claim_slot(
+      kvs_clock, kvs_budget_charge(sizeof(cache_entry_t), key, value));
+  if (!entry || fill_slot(kvs_clock, entry, key, value) != SUCCESS) {
+    return FAILURE;
+  }
+  atomic_store_explicit(&entry->reference_bit, true, memory_order_relaxed);
+  return insert(kvs_clock, entry);
+}
+
+int kvs_clock_get(kvs_clock_t* kvs_clock, const char* key, char* value) {
+  if (kvs_clock_get_cached(kvs_clock, key, value) == SUCCESS) {
+    return SUCCESS;
+  }
+
+  int result = kvs_base_get(kvs_clock->kvs_base, key, value);
+  if (result == SUCCESS) {
+    return kvs_clock_load(kvs_clock, key, value);
+  }
+
+  return result;
+}
+
 int kvs_clock_flush(kvs_clock_t* kvs_clock) {
-  for (int i = 0; i < kvs_clock->count; ++i) {
-    if (kvs_clock->entries[i].modified) {
-      if (kvs_base_set(kvs_clock->kvs_base, kvs_clock->entries[i].key,
-                       kvs_clock->entries[i].value) == FAILURE) {
-        return FAILURE;
-      }
-      kvs_clock->entries[i].modified = 0;
+  return kvs_dirty_flush(&kvs_clock->dirty, kvs_clock->kvs_base);
+}
+
+int kvs_clock_size(kvs_clock_t* kvs_clock) { return kvs_clock->count; }
+
+int kvs_clock_dirty(kvs_clock_t* kvs_clock) { return kvs_clock->dirty.count; }
+
+int kvs_clock_take_dirty(kvs_clock_t* kvs_clock, char* key, char* value) {
+  return kvs_dirty_take(&kvs_clock->dirty, key, value);
+}
+
+void kvs_clock_mark_dirty(kvs_clock_t* kvs_clock, const char* key) {
+  cache_entry_t* entry = kvs_cindex_get(kvs_clock->index, key);
+  if (entry) {
+    kvs_dirty_mark(&kvs_clock->dirty, &entry->kv);
+  }
+}
+
+void kvs_clock_snapshot(kvs_clock_t* kvs_clock, kvs_snapshot_fn fn,
+                        void* arg) {
+  int span = kvs_pool_span(kvs_clock->pool);
+  for (int i = 0; i < span; ++i) {
+    cache_entry_t* entry =
+        kvs_pool_at(kvs_clock->pool, (kvs_clock->cursor + i) % span);
+    if (entry->kv.value) {
+      fn(arg, entry->kv.key,
+         atomic_load_explicit(&entry->reference_bit, memory_order_relaxed));
     }
   }
-  return SUCCESS;
+}
+
+int kvs_clock_restore(kvs_clock_t* kvs_clock, const char* key,
+                      const char* value, bool referenced) {
+  if (kvs_cindex_get(kvs_clock->index, key)) {
+    return SUCCESS;
+  }
+  if (kvs_clock->count == kvs_clock->capacity ||
+      over_budget(kvs_clock,
+                  kvs_budget_charge(sizeof(cache_entry_t), key, value))) {
+    return FAILURE;
+  }
+  // with room left, claiming a slot evicts nothing
+  cache_entry_t* entry = claim_slot(kvs_clock, 0);
+  if (!entry || fill_slot(kvs_clock, entry, key, value) != SUCCESS) {
+    return FAILURE;
+  }
+  atomic_store_explicit(&entry->reference_bit, referenced,
+                        memory_order_relaxed);
+  return insert(kvs_clock, entry);
+}
+
+size_t kvs_clock_memory(kvs_clock_t* kvs_clock) {
+  // retired chunks are about to go back to the arena, and do not count
+  return kvs_clock->count * sizeof(cache_entry_t) +
+         kvs_arena_used(kvs_clock->arena) - kvs_clock->retired_bytes +
+         kvs_cindex_memory(kvs_clock->index);
 }
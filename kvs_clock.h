@@ -1,13 +1,91 @@
 #pragma once
 
+#include <stddef.h>
+
 #include "kvs_base.h"
+#include "kvs_snapshot.h"
 
 struct kvs_clock;
 typedef struct kvs_clock kvs_clock_t;
 
 kvs_clock_t* kvs_clock_new(kvs_base_t* kvs, int capacity);
+
+/**
+ * `kvs_clock_new_budget` creates a cache bounded by `budget` bytes, like
+ * `kvs_lru_new_budget`. The hand keeps sweeping until enough entries are
+ * evicted for a new one to fit; their slots stay on the clock, empty, until
+ * they are reused.
+ */
+kvs_clock_t* kvs_clock_new_budget(kvs_base_t* kvs, size_t budget);
+
+/**
+ * `kvs_clock_enable_compression` compresses values as
+ * `kvs_lru_enable_compression` does.
+ */
+void kvs_clock_enable_compression(kvs_clock_t* kvs_clock);
 void kvs_clock_free(kvs_clock_t** ptr);
 
 int kvs_clock_set(kvs_clock_t* kvs_clock, const char* key, const char* value);
 int kvs_clock_get(kvs_clock_t* kvs_clock, const char* key, char* value);
+
+/**
+ * `kvs_clock_get_unlocked` copies the value of `key` into `value` if it is
+ * cached, and returns FAILURE otherwise, without loading it. Unlike every
+ * other function here, it may be called without the caller's lock, from
+ * any number of threads at once: the entry is found through a concurrent
+ * index (see kvs_cindex.h), the hit only sets its reference bit, and keys
+ * and values the lock holder evicts or replaces are only given back to the
+ * arena once no reader can be copying them (see kvs_epoch.h). The hand,
+ * insertions and evictions stay behind the caller's lock.
+ */
+int kvs_clock_get_unlocked(kvs_clock_t* kvs_clock, const char* key,
+                           char* value);
+
+/**
+ * `kvs_clock_get_cached`, `kvs_clock_load`, `kvs_clock_contains` and
+ * `kvs_clock_peek` work like their LRU counterparts (see kvs_lru.h).
+ */
+int kvs_clock_get_cached(kvs_clock_t* kvs_clock, const char* key,
+                         char* value);
+int kvs_clock_load(kvs_clock_t* kvs_clock, const char* key, char* value);
+bool kvs_clock_contains(kvs_clock_t* kvs_clock, const char* key);
+int kvs_clock_peek(kvs_clock_t* kvs_clock, const char* key, char* value);
+
 int kvs_clock_flush(kvs_clock_t* kvs_clock);
+
+/**
+ * `kvs_clock_size` returns the number of resident entries.
+ */
+int kvs_clock_size(kvs_clock_t* kvs_clock);
+
+/**
+ * `kvs_clock_dirty` returns the number of modified entries.
+ */
+int kvs_clock_dirty(kvs_clock_t* kvs_clock);
+
+/**
+ * `kvs_clock_take_dirty` copies the key and value of the oldest modified entry
+ * into `key` and `value` and marks it clean, so the caller can write it back
+ * without holding up the cache. It returns FAILURE if nothing is dirty. If the
+ * write fails, `kvs_clock_mark_dirty` puts the entry back on the dirty list.
+ */
+int kvs_clock_take_dirty(kvs_clock_t* kvs_clock, char* key, char* value);
+void kvs_clock_mark_dirty(kvs_clock_t* kvs_clock, const char* key);
+
+/**
+ * `kvs_clock_snapshot` and `kvs_clock_restore` work like their LRU
+ * counterparts (see kvs_lru.h). Keys come in the order the hand would reach
+ * them, with their reference bits; restored into an empty clock they take
+ * the slots in that order, so the next sweep visits them as the old one
+ * would have.
+ */
+void kvs_clock_snapshot(kvs_clock_t* kvs_clock, kvs_snapshot_fn fn,
+                        void* arg);
+int kvs_clock_restore(kvs_clock_t* kvs_clock, const char* key,
+                      const char* value, bool referenced);
+
+/**
+ * `kvs_clock_memory` returns the bytes held by the resident entries: their
+ * slots in the pool plus their keys and values in the arena.
+ */
+size_t kvs_clock_memory(kvs_clock_t* kvs_clock);
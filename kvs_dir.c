@@ -0,0 +1,347 @@
+#define _GNU_SOURCE
+
+#include "kvs_dir.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kvs_index.h"
+
+// present in the store directory of a fan-out store
+#define FANOUT_MARKER ".kvs-fanout"
+// where `kvs_dir_migrate` gathers the keys
+#define MIGRATE_DIR ".kvs-migrate"
+
+/**
+ * `visit_fn` is called by `walk` for each key file, with the directory that
+ * holds it. Returning FAILURE stops the walk.
+ */
+typedef int (*visit_fn)(void* arg, int parent, const char* name);
+
+static bool is_key_name(const char* name) {
+  return strcmp(name, ".") != 0 && strcmp(name, "..") != 0 &&
+         strncmp(name, ".kvs-", 5) != 0;
+}
+
+// fan-out directories are named by two lowercase hex digits
+static bool is_fanout_name(const char* name) {
+  for (int i = 0; i < 2; ++i) {
+    if (!((name[i] >= '0' && name[i] <= '9') ||
+          (name[i] >= 'a' && name[i] <= 'f'))) {
+      return false;
+    }
+  }
+  return name[2] == '\0';
+}
+
+static bool is_directory(int parent, const struct dirent* entry) {
+  if (entry->d_type != DT_UNKNOWN) {
+    return entry->d_type == DT_DIR;
+  }
+  struct stat st;
+  return fstatat(parent, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+         S_ISDIR(st.st_mode);
+}
+
+/**
+ * `walk` visits the key files under `fd`, which is `depth` levels below the
+ * store directory: the plain files of the top level, as in a flat store, and
+ * the files two fan-out directories down. Both are visited whatever the
+ * layout, so a walk also finds the keys of a half-migrated store. Other
+ * directories are skipped. With `prune`, fan-out directories are removed
+ * once empty.
+ */
+static int walk(int fd, int depth, bool prune, visit_fn visit, void* arg) {
+  // a descriptor of its own, so the caller's offset is left alone
+  int copy = openat(fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (copy < 0) {
+    return FAILURE;
+  }
+  DIR* stream = fdopendir(copy);
+  if (stream == NULL) {
+    close(copy);
+    return FAILURE;
+  }
+  int rc = SUCCESS;
+  struct dirent* entry;
+  while (rc == SUCCESS && (entry = readdir(stream)) != NULL) {
+    const char* name = entry->d_name;
+    if (!is_key_name(name)) {
+      continue;
+    }
+    bool directory = is_directory(copy, entry);
+    if (depth < 2 && directory && is_fanout_name(name)) {
+      int sub = openat(copy, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (sub < 0) {
+        rc = FAILURE;
+        break;
+      }
+      rc = walk(sub, depth + 1, prune, visit, arg);
+      close(sub);
+      if (rc == SUCCESS && prune) {
+        unlinkat(copy, name, AT_REMOVEDIR);
+      }
+    } else if (depth != 1 && !directory) {
+      rc = visit(arg, copy, name);
+    }
+  }
+  closedir(stream);
+  return rc;
+}
+
+// stops the walk at the first key
+static int found_key(void* arg, int parent, const char* name) {
+  return FAILURE;
+}
+
+int kvs_dir_open(kvs_dir_t* dir, const char* directory,
+                 kvs_dir_layout layout) {
+  dir->fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir->fd < 0) {
+    return FAILURE;
+  }
+  dir->layout = KVS_DIR_FLAT;
+  if (faccessat(dir->fd, FANOUT_MARKER, F_OK, 0) == 0) {
+    dir->layout = KVS_DIR_FANOUT;
+    return SUCCESS;
+  }
+  if (layout == KVS_DIR_FLAT) {
+    return SUCCESS;
+  }
+
+  // only an empty store can start out as a fan-out one
+  int marker = -1;
+  if (walk(dir->fd, 0, false, found_key, NULL) == SUCCESS) {
+    marker = openat(dir->fd, FANOUT_MARKER, O_WRONLY | O_CREAT | O_CLOEXEC,
+                    0666);
+  }
+  if (marker < 0) {
+    kvs_dir_close(dir);
+    return FAILURE;
+  }
+  close(marker);
+  dir->layout = KVS_DIR_FANOUT;
+  return SUCCESS;
+}
+
+void kvs_dir_close(kvs_dir_t* dir) {
+  if (dir->fd >= 0) {
+    close(dir->fd);
+    dir->fd = -1;
+  }
+}
+
+bool kvs_dir_valid_key(const char* key) {
+  return key[0] != '\0' && strlen(key) < KVS_KEY_MAX &&
+         strchr(key, '/') == NULL && is_key_name(key);
+}
+
+int kvs_dir_path(const kvs_dir_t* dir, const char* key, char* path) {
+  if (!kvs_dir_valid_key(key)) {
+    return FAILURE;
+  }
+  int n;
+  if (dir->layout == KVS_DIR_FANOUT) {
+    uint64_t hash = kvs_hash(key);
+    n = snprintf(path, KVS_DIR_PATH_MAX, "%02x/%02x/%s",
+                 (unsigned)(hash >> 56), (unsigned)(hash >> 48) & 0xff, key);
+  } else {
+    n = snprintf(path, KVS_DIR_PATH_MAX, "%s", key);
+  }
+  return n >= 0 && n < KVS_DIR_PATH_MAX ? SUCCESS : FAILURE;
+}
+
+/**
+ * `make_parents` creates the two fan-out directories of the relative `path`
+ * of a key file.
+ */
+static int make_parents(int fd, const char* path) {
+  char parent[6];
+  memcpy(parent, path, 5);
+  parent[2] = '\0';
+  if (mkdirat(fd, parent, 0777) != 0 && errno != EEXIST) {
+    return FAILURE;
+  }
+  parent[2] = '/';
+  parent[5] = '\0';
+  if (mkdirat(fd, parent, 0777) != 0 && errno != EEXIST) {
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+int kvs_dir_open_file(const kvs_dir_t* dir, const char* key, int flags) {
+  char path[KVS_DIR_PATH_MAX];
+  if (kvs_dir_path(dir, key, path) != SUCCESS) {
+    errno = EINVAL;
+    return -1;
+  }
+  int fd = openat(dir->fd, path, flags | O_CLOEXEC, 0666);
+  if (fd < 0 && errno == ENOENT && (flags & O_CREAT) &&
+      dir->layout == KVS_DIR_FANOUT && make_parents(dir->fd, path) == SUCCESS) {
+    fd = openat(dir->fd, path, flags | O_CLOEXEC, 0666);
+  }
+  return fd;
+}
+
+int kvs_dir_write(const kvs_dir_t* dir, const char* key, const char* value) {
+  int fd = kvs_dir_open_file(dir, key, O_WRONLY | O_CREAT | O_TRUNC);
+  if (fd < 0) {
+    return FAILURE;
+  }
+  size_t length = strlen(value);
+  size_t done = 0;
+  while (done < length) {
+    ssize_t n = write(fd, value + done, length - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      close(fd);
+      return FAILURE;
+    }
+    done += n;
+  }
+  return close(fd) == 0 ? SUCCESS : FAILURE;
+}
+
+ssize_t kvs_dir_read(const kvs_dir_t* dir, const char* key, char* value) {
+  int fd = kvs_dir_open_file(dir, key, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  size_t done = 0;
+  for (;;) {
+    ssize_t n = read(fd, value + done, KVS_VALUE_MAX - 1 - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      int error = errno;
+      close(fd);
+      errno = error;
+      return -1;
+    }
+    done += n;
+    if (n == 0 || done == KVS_VALUE_MAX - 1) {
+      break;
+    }
+  }
+  close(fd);
+  value[done] = '\0';
+  return done;
+}
+
+int kvs_dir_sync(const kvs_dir_t* dir) {
+  return syncfs(dir->fd) == 0 ? SUCCESS : FAILURE;
+}
+
+typedef struct scan {
+  void (*fn)(void* arg, const char* key);
+  void* arg;
+} scan_t;
+
+static int scan_key(void* arg, int parent, const char* name) {
+  scan_t* scan = arg;
+  scan->fn(scan->arg, name);
+  return SUCCESS;
+}
+
+int kvs_dir_scan(const kvs_dir_t* dir, void (*fn)(void* arg, const char* key),
+                 void* arg) {
+  scan_t scan = {fn, arg};
+  return walk(dir->fd, 0, false, scan_key, &scan);
+}
+
+typedef struct migrate {
+  // the store, with the layout being migrated to
+  kvs_dir_t dir;
+  int staging;
+  long gathered;
+  long moved;
+} migrate_t;
+
+static int gather_key(void* arg, int parent, const char* name) {
+  migrate_t* migrate = arg;
+  if (renameat(parent, name, migrate->staging, name) != 0) {
+    return FAILURE;
+  }
+  migrate->gathered++;
+  return SUCCESS;
+}
+
+static int place_key(void* arg, int parent, const char* name) {
+  migrate_t* migrate = arg;
+  char path[KVS_DIR_PATH_MAX];
+  if (kvs_dir_path(&migrate->dir, name, path) != SUCCESS) {
+    return FAILURE;
+  }
+  if (migrate->dir.layout == KVS_DIR_FANOUT &&
+      make_parents(migrate->dir.fd, path) != SUCCESS) {
+    return FAILURE;
+  }
+  if (renameat(parent, name, migrate->dir.fd, path) != 0) {
+    return FAILURE;
+  }
+  migrate->moved++;
+  return SUCCESS;
+}
+
+int kvs_dir_migrate(const char* directory, kvs_dir_layout layout,
+                    long* moved) {
+  migrate_t migrate = {{-1, layout}, -1, 0, 0};
+  *moved = 0;
+  migrate.dir.fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (migrate.dir.fd < 0) {
+    return FAILURE;
+  }
+  if (mkdirat(migrate.dir.fd, MIGRATE_DIR, 0777) != 0 && errno != EEXIST) {
+    kvs_dir_close(&migrate.dir);
+    return FAILURE;
+  }
+  migrate.staging =
+      openat(migrate.dir.fd, MIGRATE_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (migrate.staging < 0) {
+    kvs_dir_close(&migrate.dir);
+    return FAILURE;
+  }
+
+  // renaming entries out of a directory being read may make `readdir` skip
+  // others, so walk again until a pass finds nothing left
+  int rc;
+  do {
+    migrate.gathered = 0;
+    rc = walk(migrate.dir.fd, 0, true, gather_key, &migrate);
+  } while (rc == SUCCESS && migrate.gathered > 0);
+  if (rc == SUCCESS) {
+    if (layout == KVS_DIR_FANOUT) {
+      int marker = openat(migrate.dir.fd, FANOUT_MARKER,
+                          O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+      rc = marker >= 0 ? SUCCESS : FAILURE;
+      if (marker >= 0) {
+        close(marker);
+      }
+    } else if (unlinkat(migrate.dir.fd, FANOUT_MARKER, 0) != 0 &&
+               errno != ENOENT) {
+      rc = FAILURE;
+    }
+  }
+  // the staging directory is flat, so it is walked as a leaf
+  for (long placed = -1; rc == SUCCESS && placed != migrate.moved;) {
+    placed = migrate.moved;
+    rc = walk(migrate.staging, 2, false, place_key, &migrate);
+  }
+  close(migrate.staging);
+  if (rc == SUCCESS) {
+    unlinkat(migrate.dir.fd, MIGRATE_DIR, AT_REMOVEDIR);
+  }
+  kvs_dir_close(&migrate.dir);
+  *moved = migrate.moved;
+  return rc;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "constants.h"
+
+/**
+ * `kvs_dir_layout` is how the FILE backend places key files in the store
+ * directory.
+ */
+typedef enum {
+  // every key file directly in the store directory
+  KVS_DIR_FLAT,
+  // key files two directories down, `ab/cd/KEY`, where `ab` and `cd` are the
+  // top two bytes of the key's hash in hex: 65536 leaf directories keep each
+  // one small however many keys the store holds
+  KVS_DIR_FANOUT,
+} kvs_dir_layout;
+
+/**
+ * `KVS_DIR_PATH_MAX` bounds the path of a key file relative to the store
+ * directory, including the terminator.
+ */
+#define KVS_DIR_PATH_MAX (KVS_KEY_MAX + 6)
+
+/**
+ * `kvs_dir_t` is an open store directory. Key files are opened relative to
+ * its descriptor with `openat`, so no call builds or resolves the full path
+ * of the store again.
+ */
+typedef struct kvs_dir {
+  int fd;
+  kvs_dir_layout layout;
+} kvs_dir_t;
+
+/**
+ * `kvs_dir_open` opens `directory`, which must exist. The layout a store was
+ * created with is recorded in it (a fan-out store holds a `.kvs-fanout`
+ * file) and wins over `layout`, which only decides the layout of a store
+ * that is still empty. Asking for a fan-out over a flat store that already
+ * holds keys fails; convert it with `kvs_dir_migrate` first.
+ */
+int kvs_dir_open(kvs_dir_t* dir, const char* directory, kvs_dir_layout layout);
+void kvs_dir_close(kvs_dir_t* dir);
+
+/**
+ * `kvs_dir_valid_key` tells whether `key` can name a key file: it must be
+ * shorter than `KVS_KEY_MAX`, not empty, hold no `/`, and be neither `.` nor
+ * `..` nor start with `.kvs-`, which names the store's own files. Any other
+ * key could reach a file outside the store or one the store keeps.
+ */
+bool kvs_dir_valid_key(const char* key);
+
+/**
+ * `kvs_dir_path` writes the path of the file of `key` relative to the store
+ * directory to `path` (`KVS_DIR_PATH_MAX` bytes). It fails for a key that
+ * is not `kvs_dir_valid_key`.
+ */
+int kvs_dir_path(const kvs_dir_t* dir, const char* key, char* path);
+
+/**
+ * `kvs_dir_open_file` opens the file of `key` with `flags`. When creating it
+ * in a fan-out store, the two directories above it are made as needed.
+ * Returns the descriptor, or -1 with `errno` set.
+ */
+int kvs_dir_open_file(const kvs_dir_t* dir, const char* key, int flags);
+
+/**
+ * `kvs_dir_write` replaces the file of `key` with `value`.
+ */
+int kvs_dir_write(const kvs_dir_t* dir, const char* key, const char* value);
+
+/**
+ * `kvs_dir_read` reads the file of `key` into `value` (`KVS_VALUE_MAX`
+ * bytes) and returns its length. Returns -1 with `errno` set if the file
+ * cannot be opened or read; `errno` is `ENOENT` for a key that was never
+ * set.
+ */
+ssize_t kvs_dir_read(const kvs_dir_t* dir, const char* key, char* value);
+
+/**
+ * `kvs_dir_sync` makes the key files written so far durable. It syncs the
+ * whole filesystem that holds the store, which is one call however many
+ * files were written.
+ */
+int kvs_dir_sync(const kvs_dir_t* dir);
+
+/**
+ * `kvs_dir_scan` calls `fn` with the name of every key in the store. Files
+ * named `.kvs-*` belong to the store itself and are skipped.
+ */
+int kvs_dir_scan(const kvs_dir_t* dir, void (*fn)(void* arg, const char* key),
+                 void* arg);
+
+/**
+ * `kvs_dir_migrate` converts the FILE store in `directory` to `layout` by
+ * renaming its key files, without copying them; the store must not be open
+ * meanwhile. Keys are first gathered in a `.kvs-migrate` directory and then
+ * moved to their new places, so a migration that was interrupted can simply
+ * be run again. Sets `*moved` to the number of keys in the store.
+ */
+int kvs_dir_migrate(const char* directory, kvs_dir_layout layout,
+                    long* moved);
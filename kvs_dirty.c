@@ -0,0 +1,135 @@
+#include "kvs_dirty.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "kvs_arena.h"
+
+void kvs_dirty_init(kvs_dirty_t* dirty) {
+  dirty->head = NULL;
+  dirty->tail = NULL;
+  dirty->count = 0;
+}
+
+void kvs_dirty_mark(kvs_dirty_t* dirty, kvs_entry_t* entry) {
+  if (entry->modified) {
+    return;
+  }
+  entry->modified = true;
+  entry->dirty_prev = dirty->tail;
+  entry->dirty_next = NULL;
+  if (dirty->tail) {
+    dirty->tail->dirty_next = entry;
+  } else {
+    dirty->head = entry;
+  }
+  dirty->tail = entry;
+  dirty->count++;
+}
+
+void kvs_dirty_clear(kvs_dirty_t* dirty, kvs_entry_t* entry) {
+  if (!entry->modified) {
+    return;
+  }
+  entry->modified = false;
+  if (entry->dirty_prev) {
+    entry->dirty_prev->dirty_next = entry->dirty_next;
+  } else {
+    dirty->head = entry->dirty_next;
+  }
+  if (entry->dirty_next) {
+    entry->dirty_next->dirty_prev = entry->dirty_prev;
+  } else {
+    dirty->tail = entry->dirty_prev;
+  }
+  dirty->count--;
+}
+
+int kvs_dirty_evict(kvs_dirty_t* dirty, kvs_base_t* kvs_base,
+                    kvs_entry_t* entry) {
+  // ghost entries, which only remember a key, have nothing to evict
+  if (!entry->value) {
+    return SUCCESS;
+  }
+  if (!entry->modified && kvs_base->l2 == NULL) {
+    kvs_metrics_add(&kvs_base->metrics.evictions, 1);
+    return SUCCESS;
+  }
+  const char* value = entry->value;
+  char unpacked[KVS_VALUE_MAX];
+  if (kvs_arena_packed(value)) {
+    kvs_arena_unpack(value, unpacked);
+    value = unpacked;
+  }
+  if (entry->modified) {
+    uint64_t start = kvs_metrics_now();
+    int rc = kvs_base_set(kvs_base, entry->key, value);
+    kvs_metrics_record(&kvs_base->metrics, KVS_STATS_WRITE_BACK,
+                       kvs_metrics_now() - start);
+    // the value only exists here, so the entry stays
+    if (rc != SUCCESS) {
+      return FAILURE;
+    }
+    kvs_metrics_add(&kvs_base->metrics.dirty_evictions, 1);
+    kvs_dirty_clear(dirty, entry);
+  }
+  kvs_metrics_add(&kvs_base->metrics.evictions, 1);
+  kvs_base_demote(kvs_base, entry->key, value);
+  return SUCCESS;
+}
+
+int kvs_dirty_flush(kvs_dirty_t* dirty, kvs_base_t* kvs_base) {
+  if (dirty->count == 0) {
+    return SUCCESS;
+  }
+  kvs_batch_t* batch = kvs_batch_new(dirty->count);
+  // expanded copies of the compressed values, which the batch points into
+  char** unpacked = calloc(dirty->count, sizeof(char*));
+  if (!batch || !unpacked) {
+    kvs_batch_free(&batch);
+    free(unpacked);
+    return FAILURE;
+  }
+  int count = 0;
+  for (kvs_entry_t* entry = dirty->head; entry; entry = entry->dirty_next) {
+    const char* value = entry->value;
+    if (kvs_arena_packed(value)) {
+      unpacked[count] = malloc(KVS_VALUE_MAX);
+      if (!unpacked[count]) break;
+      kvs_arena_unpack(value, unpacked[count]);
+      value = unpacked[count];
+    }
+    kvs_batch_add(batch, entry->key, value);
+    count += 1;
+  }
+
+  // out of memory for a copy: write nothing rather than part of the list
+  bool complete = count == dirty->count;
+  int rc = complete ? kvs_base_set_batch(kvs_base, batch) : FAILURE;
+  kvs_entry_t* entry = dirty->head;
+  for (int i = 0; complete && i < batch->count; ++i) {
+    kvs_entry_t* next = entry->dirty_next;
+    if (batch->written[i]) {
+      kvs_dirty_clear(dirty, entry);
+    }
+    entry = next;
+  }
+  for (int i = 0; i < count; ++i) {
+    free(unpacked[i]);
+  }
+  free(unpacked);
+  kvs_batch_free(&batch);
+
+  return rc;
+}
+
+int kvs_dirty_take(kvs_dirty_t* dirty, char* key, char* value) {
+  kvs_entry_t* entry = dirty->head;
+  if (!entry) {
+    return FAILURE;
+  }
+  memcpy(key, entry->key, kvs_arena_length(entry->key) + 1);
+  kvs_arena_unpack(entry->value, value);
+  kvs_dirty_clear(dirty, entry);
+  return SUCCESS;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "kvs_base.h"
+#include "kvs_entry.h"
+
+/**
+ * `kvs_dirty_t` is the list of modified cache entries, oldest first. Entries
+ * are put on the list when they become dirty and taken off when they are
+ * written back or evicted, so flushing and background cleaning never scan
+ * clean entries.
+ */
+typedef struct kvs_dirty {
+  kvs_entry_t* head;
+  kvs_entry_t* tail;
+  int count;
+} kvs_dirty_t;
+
+void kvs_dirty_init(kvs_dirty_t* dirty);
+
+/**
+ * `kvs_dirty_mark` flags `entry` as modified and appends it to the list if it
+ * was clean.
+ */
+void kvs_dirty_mark(kvs_dirty_t* dirty, kvs_entry_t* entry);
+
+/**
+ * `kvs_dirty_clear` flags `entry` as clean and takes it off the list if it was
+ * dirty.
+ */
+void kvs_dirty_clear(kvs_dirty_t* dirty, kvs_entry_t* entry);
+
+/**
+ * `kvs_dirty_evict` is called for an entry that is about to be evicted: if it
+ * is dirty it is written back to `kvs_base` and taken off the list, and its
+ * value is then offered to the flash tier (see `kvs_base_demote`). The
+ * eviction and the write-back are recorded in `kvs_base->metrics`. If the
+ * write-back fails the entry stays dirty and FAILURE is returned: the
+ * caller must not evict it.
+ */
+int kvs_dirty_evict(kvs_dirty_t* dirty, kvs_base_t* kvs_base,
+                    kvs_entry_t* entry);
+
+/**
+ * `kvs_dirty_flush` writes every dirty entry back as one batch (see
+ * `kvs_base_set_batch`) and marks clean the ones that were written.
+ */
+int kvs_dirty_flush(kvs_dirty_t* dirty, kvs_base_t* kvs_base);
+
+/**
+ * `kvs_dirty_take` copies the key and value of the oldest dirty entry into
+ * `key` and `value` and marks it clean, so the caller can write it back
+ * without holding up the cache. It returns FAILURE if nothing is dirty.
+ */
+int kvs_dirty_take(kvs_dirty_t* dirty, char* key, char* value);
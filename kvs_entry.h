@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * `kvs_entry_t` is the part of a cache entry every policy shares. Policies
+ * embed it as the first member of their own entry type, so a `kvs_entry_t*`
+ * can be cast back to the policy's entry.
+ */
+typedef struct kvs_entry {
+  // handles into the cache's arena
+  char* key;
+  char* value;
+  bool modified;
+  // links on the cache's dirty list while `modified` is set
+  struct kvs_entry* dirty_prev;
+  struct kvs_entry* dirty_next;
+} kvs_entry_t;
@@ -0,0 +1,74 @@
+#include "kvs_epoch.h"
+
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define EPOCH_SLOTS 64
+
+typedef struct epoch_slot {
+  // readers of this slot inside a read, by the parity they entered with
+  alignas(64) atomic_long readers[2];
+} epoch_slot_t;
+
+struct kvs_epoch {
+  atomic_uint epoch;
+  epoch_slot_t slots[EPOCH_SLOTS];
+};
+
+static atomic_int next_slot;
+// -1 until the thread first reads
+static _Thread_local int thread_slot = -1;
+
+kvs_epoch_t* kvs_epoch_new(void) {
+  kvs_epoch_t* epoch = aligned_alloc(alignof(kvs_epoch_t), sizeof(kvs_epoch_t));
+  if (epoch == NULL) {
+    return NULL;
+  }
+  atomic_init(&epoch->epoch, 0);
+  for (int i = 0; i < EPOCH_SLOTS; ++i) {
+    atomic_init(&epoch->slots[i].readers[0], 0);
+    atomic_init(&epoch->slots[i].readers[1], 0);
+  }
+  return epoch;
+}
+
+void kvs_epoch_free(kvs_epoch_t** ptr) {
+  if (ptr && *ptr) {
+    free(*ptr);
+    *ptr = NULL;
+  }
+}
+
+int kvs_epoch_enter(kvs_epoch_t* epoch) {
+  if (thread_slot < 0) {
+    thread_slot = atomic_fetch_add(&next_slot, 1) % EPOCH_SLOTS;
+  }
+  int parity = atomic_load_explicit(&epoch->epoch, memory_order_relaxed) & 1;
+  atomic_fetch_add_explicit(&epoch->slots[thread_slot].readers[parity], 1,
+                            memory_order_relaxed);
+  // pairs with the fence in `kvs_epoch_synchronize`: either the writer sees
+  // this reader, or the reader sees everything the writer unlinked
+  atomic_thread_fence(memory_order_seq_cst);
+  return thread_slot * 2 + parity;
+}
+
+void kvs_epoch_exit(kvs_epoch_t* epoch, int ticket) {
+  atomic_fetch_sub_explicit(&epoch->slots[ticket / 2].readers[ticket % 2], 1,
+                            memory_order_release);
+}
+
+void kvs_epoch_synchronize(kvs_epoch_t* epoch) {
+  atomic_thread_fence(memory_order_seq_cst);
+  for (int round = 0; round < 2; ++round) {
+    int parity = atomic_fetch_add_explicit(&epoch->epoch, 1,
+                                           memory_order_seq_cst) & 1;
+    for (int i = 0; i < EPOCH_SLOTS; ++i) {
+      while (atomic_load_explicit(&epoch->slots[i].readers[parity],
+                                  memory_order_acquire) != 0) {
+        sched_yield();
+      }
+    }
+  }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+/**
+ * `kvs_epoch_t` lets readers walk a structure with no lock while one writer
+ * changes it, by holding back the memory the writer unlinks until every
+ * reader that could still see it is gone. A reader brackets its walk with
+ * `kvs_epoch_enter` and `kvs_epoch_exit`; the writer unlinks what it
+ * replaces, calls `kvs_epoch_synchronize`, and may then free it.
+ *
+ * The epoch is a counter whose parity tells readers which of two counts to
+ * join. Each thread has a slot of its own, on its own cache line, so readers
+ * on different threads never write to the same line. Synchronizing bumps
+ * the epoch, so new readers join the other count, and waits for the old
+ * count to drain in every slot; doing that twice waits for readers of both
+ * parities. Readers never wait, and the writer only waits for walks already
+ * under way, so a writer should batch what it retires (see kvs_clock.c).
+ */
+struct kvs_epoch;
+typedef struct kvs_epoch kvs_epoch_t;
+
+kvs_epoch_t* kvs_epoch_new(void);
+void kvs_epoch_free(kvs_epoch_t** ptr);
+
+/**
+ * `kvs_epoch_enter` starts a read and returns the ticket to pass to
+ * `kvs_epoch_exit` when it ends. Any number of threads may read at once;
+ * threads beyond the number of slots share them.
+ */
+int kvs_epoch_enter(kvs_epoch_t* epoch);
+void kvs_epoch_exit(kvs_epoch_t* epoch, int ticket);
+
+/**
+ * `kvs_epoch_synchronize` returns once every read that started before it
+ * was called has ended. Only one thread at a time may call it, and never
+ * from inside a read.
+ */
+void kvs_epoch_synchronize(kvs_epoch_t* epoch);
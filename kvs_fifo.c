@@ -5,84 +5,143 @@
 #include <string.h>
 
 #include "constants.h"
+#include "kvs_arena.h"
+#include "kvs_budget.h"
+#include "kvs_dirty.h"
+#include "kvs_index.h"
+#include "kvs_pool.h"
 
 typedef struct cache_entry {
-  char key[KVS_KEY_MAX];
-  char value[KVS_VALUE_MAX];
-  bool modified;
+  kvs_entry_t kv;
   struct cache_entry* next;
 } cache_entry_t;
 
 struct kvs_fifo {
   kvs_base_t* kvs_base;
   int capacity;
+  // bytes the entries may take, or 0 to hold `capacity` entries
+  size_t budget;
   int size;
-  cache_entry_t* cache;
+  kvs_pool_t* pool;
+  kvs_arena_t* arena;
+  kvs_index_t* index;
   cache_entry_t* front;
   cache_entry_t* rear;
+  kvs_dirty_t dirty;
 };
 
-kvs_fifo_t* kvs_fifo_new(kvs_base_t* kvs, int capacity) {
+/**
+ * `create` makes a cache of `capacity` entries. Without a `budget` its index
+ * is sized for all of them; with one it starts empty and grows with
+ * the entries, since its bytes are charged to the budget.
+ */
+static kvs_fifo_t* create(kvs_base_t* kvs, int capacity, size_t budget) {
   kvs_fifo_t* kvs_fifo = malloc(sizeof(kvs_fifo_t));
   if (!kvs_fifo) return NULL;
 
   kvs_fifo->kvs_base = kvs;
   kvs_fifo->capacity = capacity;
+  kvs_fifo->budget = budget;
   kvs_fifo->size = 0;
-  kvs_fifo->cache = malloc(capacity * sizeof(cache_entry_t));
+  kvs_fifo->pool = kvs_pool_new(sizeof(cache_entry_t), capacity);
+  kvs_fifo->arena = kvs_arena_new();
+  kvs_fifo->index = kvs_index_new(budget > 0 ? 0 : capacity);
   kvs_fifo->front = NULL;
   kvs_fifo->rear = NULL;
+  kvs_dirty_init(&kvs_fifo->dirty);
 
   return kvs_fifo;
 }
 
+kvs_fifo_t* kvs_fifo_new(kvs_base_t* kvs, int capacity) {
+  return create(kvs, capacity, 0);
+}
+
+kvs_fifo_t* kvs_fifo_new_budget(kvs_base_t* kvs, size_t budget) {
+  return create(kvs, kvs_budget_entries(budget, sizeof(cache_entry_t)),
+                budget);
+}
+
+void kvs_fifo_enable_compression(kvs_fifo_t* kvs_fifo) {
+  kvs_arena_enable_compression(kvs_fifo->arena, &kvs_fifo->kvs_base->metrics);
+}
+
 void kvs_fifo_free(kvs_fifo_t** ptr) {
   if (ptr && *ptr) {
-    free((*ptr)->cache);
+    kvs_index_free(&(*ptr)->index);
+    kvs_arena_free(&(*ptr)->arena);
+    kvs_pool_free(&(*ptr)->pool);
     free(*ptr);
     *ptr = NULL;
   }
 }
 
 cache_entry_t* find_cache_entry(kvs_fifo_t* kvs_fifo, const char* key) {
-  cache_entry_t* current = kvs_fifo->front;
-  while (current) {
-    if (strcmp(current->key, key) == 0) {
-      return current;
-    }
-    current = current->next;
-  }
-  return NULL;
+  return kvs_index_get(kvs_fifo->index, key);
 }
 
-int kvs_fifo_set(kvs_fifo_t* kvs_fifo, const char* key, const char* value) {
-  cache_entry_t* existing_entry = find_cache_entry(kvs_fifo, key);
+static int evict_front(kvs_fifo_t* kvs_fifo) {
+  cache_entry_t* old_front = kvs_fifo->front;
+  if (kvs_dirty_evict(&kvs_fifo->dirty, kvs_fifo->kvs_base, &old_front->kv) !=
+      SUCCESS) {
+    return FAILURE;
+  }
+  kvs_index_remove(kvs_fifo->index, old_front->kv.key);
+  kvs_arena_release(kvs_fifo->arena, old_front->kv.key);
+  kvs_arena_release(kvs_fifo->arena, old_front->kv.value);
 
-  if (existing_entry) {
-    strcpy(existing_entry->value, value);
-    existing_entry->modified = true;
-    return SUCCESS;
+  kvs_fifo->front = old_front->next;
+  if (!kvs_fifo->front) {
+    kvs_fifo->rear = NULL;
   }
 
-  if (kvs_fifo->size == kvs_fifo->capacity) {
-    cache_entry_t* old_front = kvs_fifo->front;
-    if (old_front->modified) {
-      kvs_base_set(kvs_fifo->kvs_base, old_front->key, old_front->value);
-    }
+  kvs_pool_release(kvs_fifo->pool, old_front);
+  kvs_fifo->size--;
+  return SUCCESS;
+}
 
-    kvs_fifo->front = old_front->next;
-    if (!kvs_fifo->front) {
-      kvs_fifo->rear = NULL;
-    }
+static bool over_budget(kvs_fifo_t* kvs_fifo, size_t incoming) {
+  return kvs_budget_over(kvs_fifo->budget, kvs_fifo_memory(kvs_fifo),
+                         incoming);
+}
 
-    free(old_front);
-    kvs_fifo->size--;
+/**
+ * `make_entry` allocates a clean entry holding copies of `key` and `value`,
+ * indexed but not yet linked, or returns NULL if the pool, the arena or the
+ * index is out of room.
+ */
+static cache_entry_t* make_entry(kvs_fifo_t* kvs_fifo, const char* key,
+                                 const char* value) {
+  cache_entry_t* entry = kvs_pool_alloc(kvs_fifo->pool);
+  if (!entry) return NULL;
+  entry->kv.key = kvs_arena_strdup(kvs_fifo->arena, key);
+  entry->kv.value = kvs_arena_pack(kvs_fifo->arena, NULL, value);
+  if (!entry->kv.key || !entry->kv.value ||
+      kvs_index_put(kvs_fifo->index, entry->kv.key, entry) != SUCCESS) {
+    kvs_arena_release(kvs_fifo->arena, entry->kv.key);
+    kvs_arena_release(kvs_fifo->arena, entry->kv.value);
+    kvs_pool_release(kvs_fifo->pool, entry);
+    return NULL;
+  }
+  entry->kv.modified = false;
+  return entry;
+}
+
+static int push_rear(kvs_fifo_t* kvs_fifo, const char* key, const char* value,
+                     bool modified) {
+  size_t charge = kvs_budget_charge(sizeof(cache_entry_t), key, value);
+  while (kvs_fifo->size > 0 && (kvs_fifo->size == kvs_fifo->capacity ||
+                                over_budget(kvs_fifo, charge))) {
+    if (evict_front(kvs_fifo) != SUCCESS) {
+      return FAILURE;
+    }
   }
 
-  cache_entry_t* new_entry = malloc(sizeof(cache_entry_t));
-  strcpy(new_entry->key, key);
-  strcpy(new_entry->value, value);
-  new_entry->modified = true;
+  cache_entry_t* new_entry = make_entry(kvs_fifo, key, value);
+  if (!new_entry) return FAILURE;
+  if (modified) {
+    kvs_dirty_mark(&kvs_fifo->dirty, &new_entry->kv);
+  }
   new_entry->next = NULL;
 
   if (kvs_fifo->rear) {
@@ -96,66 +155,120 @@ int kvs_fifo_set(kvs_fifo_t* kvs_fifo, const char* key, const char* value) {
   return SUCCESS;
 }
 
-int kvs_fifo_get(kvs_fifo_t* kvs_fifo, const char* key, char* value) {
+int kvs_fifo_set(kvs_fifo_t* kvs_fifo, const char* key, const char* value) {
   cache_entry_t* existing_entry = find_cache_entry(kvs_fifo, key);
 
   if (existing_entry) {
-    strcpy(value, existing_entry->value);
+    char* stored =
+        kvs_arena_pack(kvs_fifo->arena, existing_entry->kv.value, value);
+    if (!stored) return FAILURE;
+    existing_entry->kv.value = stored;
+    kvs_dirty_mark(&kvs_fifo->dirty, &existing_entry->kv);
+    while (kvs_fifo->size > 1 && over_budget(kvs_fifo, 0)) {
+      if (evict_front(kvs_fifo) != SUCCESS) {
+        return FAILURE;
+      }
+    }
     return SUCCESS;
   }
 
-  int result = kvs_base_get(kvs_fifo->kvs_base, key, value);
-  if (result == SUCCESS) {
-    if (kvs_fifo->size == kvs_fifo->capacity) {
-      cache_entry_t* old_front = kvs_fifo->front;
-      if (old_front->modified) {
-        kvs_base_set(kvs_fifo->kvs_base, old_front->key, old_front->value);
-      }
+  return push_rear(kvs_fifo, key, value, true);
+}
 
-      kvs_fifo->front = old_front->next;
-      if (!kvs_fifo->front) {
-        kvs_fifo->rear = NULL;
-      }
+int kvs_fifo_get_cached(kvs_fifo_t* kvs_fifo, const char* key, char* value) {
+  cache_entry_t* existing_entry = find_cache_entry(kvs_fifo, key);
 
-      free(old_front);
-      kvs_fifo->size--;
-    }
+  if (existing_entry) {
+    kvs_arena_read(kvs_fifo->arena, existing_entry->kv.value, value);
+    return SUCCESS;
+  }
 
-    cache_entry_t* new_entry = malloc(sizeof(cache_entry_t));
-    strcpy(new_entry->key, key);
-    strcpy(new_entry->value, value);
-    new_entry->modified = false;
-    new_entry->next = NULL;
+  return FAILURE;
+}
 
-    if (kvs_fifo->rear) {
-      kvs_fifo->rear->next = new_entry;
-    } else {
-      kvs_fifo->front = new_entry;
-    }
-    kvs_fifo->rear = new_entry;
-    kvs_fifo->size++;
+bool kvs_fifo_contains(kvs_fifo_t* kvs_fifo, const char* key) {
+  return find_cache_entry(kvs_fifo, key) != NULL;
+}
+
+int kvs_fifo_peek(kvs_fifo_t* kvs_fifo, const char* key, char* value) {
+  // a FIFO hit changes nothing to begin with
+  return kvs_fifo_get_cached(kvs_fifo, key, value);
+}
+
+int kvs_fifo_load(kvs_fifo_t* kvs_fifo, const char* key, char* value) {
+  if (kvs_fifo_get_cached(kvs_fifo, key, value) == SUCCESS) {
+    return SUCCESS;
+  }
+  return push_rear(kvs_fifo, key, value, false);
+}
+
+int kvs_fifo_get(kvs_fifo_t* kvs_fifo, const char* key, char* value) {
+  if (kvs_fifo_get_cached(kvs_fifo, key, value) == SUCCESS) {
+    return SUCCESS;
+  }
+
+  int result = kvs_base_get(kvs_fifo->kvs_base, key, value);
+  if (result == SUCCESS) {
+    return kvs_fifo_load(kvs_fifo, key, value);
   }
 
   return result;
 }
 
 int kvs_fifo_flush(kvs_fifo_t* kvs_fifo) {
-  cache_entry_t* current = kvs_fifo->front;
-  while (current) {
-    if (current->modified) {
-      kvs_base_set(kvs_fifo->kvs_base, current->key, current->value);
-      current->modified = false;
-    }
-    current = current->next;
+  return kvs_dirty_flush(&kvs_fifo->dirty, kvs_fifo->kvs_base);
+}
+
+int kvs_fifo_size(kvs_fifo_t* kvs_fifo) { return kvs_fifo->size; }
+
+int kvs_fifo_dirty(kvs_fifo_t* kvs_fifo) { return kvs_fifo->dirty.count; }
+
+int kvs_fifo_take_dirty(kvs_fifo_t* kvs_fifo, char* key, char* value) {
+  return kvs_dirty_take(&kvs_fifo->dirty, key, value);
+}
+
+void kvs_fifo_mark_dirty(kvs_fifo_t* kvs_fifo, const char* key) {
+  cache_entry_t* entry = find_cache_entry(kvs_fifo, key);
+  if (entry) {
+    kvs_dirty_mark(&kvs_fifo->dirty, &entry->kv);
   }
+}
 
-  while (kvs_fifo->front) {
-    cache_entry_t* temp = kvs_fifo->front;
-    kvs_fifo->front = kvs_fifo->front->next;
-    free(temp);
+void kvs_fifo_snapshot(kvs_fifo_t* kvs_fifo, kvs_snapshot_fn fn, void* arg) {
+  // the queue only links forward, so walk it into an array first
+  cache_entry_t** entries = malloc(kvs_fifo->size * sizeof(cache_entry_t*));
+  if (!entries) return;
+  int count = 0;
+  for (cache_entry_t* entry = kvs_fifo->front; entry; entry = entry->next) {
+    entries[count++] = entry;
   }
-  kvs_fifo->rear = NULL;
-  kvs_fifo->size = 0;
+  while (count > 0) {
+    fn(arg, entries[--count]->kv.key, false);
+  }
+  free(entries);
+}
 
+int kvs_fifo_restore(kvs_fifo_t* kvs_fifo, const char* key, const char* value,
+                     bool referenced) {
+  if (find_cache_entry(kvs_fifo, key)) {
+    return SUCCESS;
+  }
+  size_t charge = kvs_budget_charge(sizeof(cache_entry_t), key, value);
+  if (kvs_fifo->size == kvs_fifo->capacity || over_budget(kvs_fifo, charge)) {
+    return FAILURE;
+  }
+  cache_entry_t* entry = make_entry(kvs_fifo, key, value);
+  if (!entry) return FAILURE;
+  entry->next = kvs_fifo->front;
+  kvs_fifo->front = entry;
+  if (!kvs_fifo->rear) {
+    kvs_fifo->rear = entry;
+  }
+  kvs_fifo->size++;
   return SUCCESS;
 }
+
+size_t kvs_fifo_memory(kvs_fifo_t* kvs_fifo) {
+  return kvs_fifo->size * sizeof(cache_entry_t) +
+         kvs_arena_used(kvs_fifo->arena) + kvs_index_memory(kvs_fifo->index);
+}
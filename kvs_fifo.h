@@ -1,13 +1,72 @@
 #pragma once
 
+#include <stddef.h>
+
 #include "kvs_base.h"
+#include "kvs_snapshot.h"
 
 struct kvs_fifo;
 typedef struct kvs_fifo kvs_fifo_t;
 
 kvs_fifo_t* kvs_fifo_new(kvs_base_t* kvs, int capacity);
+
+/**
+ * `kvs_fifo_new_budget` creates a cache bounded by `budget` bytes, like
+ * `kvs_lru_new_budget`; the oldest entries are evicted until a new one fits.
+ */
+kvs_fifo_t* kvs_fifo_new_budget(kvs_base_t* kvs, size_t budget);
+
+/**
+ * `kvs_fifo_enable_compression` compresses values as
+ * `kvs_lru_enable_compression` does.
+ */
+void kvs_fifo_enable_compression(kvs_fifo_t* kvs_fifo);
 void kvs_fifo_free(kvs_fifo_t** ptr);
 
 int kvs_fifo_set(kvs_fifo_t* kvs_fifo, const char* key, const char* value);
 int kvs_fifo_get(kvs_fifo_t* kvs_fifo, const char* key, char* value);
+
+/**
+ * `kvs_fifo_get_cached`, `kvs_fifo_load`, `kvs_fifo_contains` and
+ * `kvs_fifo_peek` work like their LRU counterparts (see kvs_lru.h).
+ */
+int kvs_fifo_get_cached(kvs_fifo_t* kvs_fifo, const char* key, char* value);
+int kvs_fifo_load(kvs_fifo_t* kvs_fifo, const char* key, char* value);
+bool kvs_fifo_contains(kvs_fifo_t* kvs_fifo, const char* key);
+int kvs_fifo_peek(kvs_fifo_t* kvs_fifo, const char* key, char* value);
+
 int kvs_fifo_flush(kvs_fifo_t* kvs_fifo);
+
+/**
+ * `kvs_fifo_size` returns the number of resident entries.
+ */
+int kvs_fifo_size(kvs_fifo_t* kvs_fifo);
+
+/**
+ * `kvs_fifo_dirty` returns the number of modified entries.
+ */
+int kvs_fifo_dirty(kvs_fifo_t* kvs_fifo);
+
+/**
+ * `kvs_fifo_take_dirty` copies the key and value of the oldest modified entry
+ * into `key` and `value` and marks it clean, so the caller can write it back
+ * without holding up the cache. It returns FAILURE if nothing is dirty. If the
+ * write fails, `kvs_fifo_mark_dirty` puts the entry back on the dirty list.
+ */
+int kvs_fifo_take_dirty(kvs_fifo_t* kvs_fifo, char* key, char* value);
+void kvs_fifo_mark_dirty(kvs_fifo_t* kvs_fifo, const char* key);
+
+/**
+ * `kvs_fifo_snapshot` and `kvs_fifo_restore` work like their LRU counterparts
+ * (see kvs_lru.h); the newest entry comes first and restored entries join
+ * the queue at the front, next in line for eviction.
+ */
+void kvs_fifo_snapshot(kvs_fifo_t* kvs_fifo, kvs_snapshot_fn fn, void* arg);
+int kvs_fifo_restore(kvs_fifo_t* kvs_fifo, const char* key, const char* value,
+                     bool referenced);
+
+/**
+ * `kvs_fifo_memory` returns the bytes held by the resident entries: their
+ * slots in the pool plus their keys and values in the arena.
+ */
+size_t kvs_fifo_memory(kvs_fifo_t* kvs_fifo);
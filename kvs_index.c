@@ -0,0 +1,183 @@
+#include "kvs_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+
+typedef struct index_slot {
+  const char* key;
+  void* item;
+} index_slot_t;
+
+struct kvs_index {
+  size_t mask;
+  size_t count;
+  // `hashes[i] == 0` marks an empty slot; real hashes are never zero
+  uint64_t* hashes;
+  index_slot_t* slots;
+};
+
+uint64_t kvs_hash(const char* key) {
+  // FNV-1a followed by a murmur3 finalizer so the low bits mix well
+  uint64_t hash = 14695981039346656037ULL;
+  for (const unsigned char* p = (const unsigned char*)key; *p; ++p) {
+    hash ^= *p;
+    hash *= 1099511628211ULL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+static uint64_t index_hash(const char* key) {
+  uint64_t hash = kvs_hash(key);
+  return hash == 0 ? 1 : hash;
+}
+
+static int index_alloc(kvs_index_t* index, size_t size) {
+  index->hashes = calloc(size, sizeof(uint64_t));
+  index->slots = malloc(size * sizeof(index_slot_t));
+  if (!index->hashes || !index->slots) {
+    free(index->hashes);
+    free(index->slots);
+    return FAILURE;
+  }
+  index->mask = size - 1;
+  index->count = 0;
+  return SUCCESS;
+}
+
+static void index_insert(kvs_index_t* index, uint64_t hash, const char* key,
+                         void* item) {
+  size_t i = hash & index->mask;
+  while (index->hashes[i] != 0) {
+    i = (i + 1) & index->mask;
+  }
+  index->hashes[i] = hash;
+  index->slots[i].key = key;
+  index->slots[i].item = item;
+  index->count++;
+}
+
+static int index_grow(kvs_index_t* index) {
+  uint64_t* old_hashes = index->hashes;
+  index_slot_t* old_slots = index->slots;
+  size_t old_size = index->mask + 1;
+
+  if (index_alloc(index, old_size * 2) != SUCCESS) {
+    index->hashes = old_hashes;
+    index->slots = old_slots;
+    return FAILURE;
+  }
+  for (size_t i = 0; i < old_size; ++i) {
+    if (old_hashes[i] != 0) {
+      index_insert(index, old_hashes[i], old_slots[i].key, old_slots[i].item);
+    }
+  }
+  free(old_hashes);
+  free(old_slots);
+  return SUCCESS;
+}
+
+// returns the slot holding `key`, or the empty slot that ends its probe run
+static size_t index_find(kvs_index_t* index, uint64_t hash, const char* key) {
+  size_t i = hash & index->mask;
+  while (index->hashes[i] != 0) {
+    if (index->hashes[i] == hash && strcmp(index->slots[i].key, key) == 0) {
+      return i;
+    }
+    i = (i + 1) & index->mask;
+  }
+  return i;
+}
+
+kvs_index_t* kvs_index_new(int capacity) {
+  kvs_index_t* index = malloc(sizeof(kvs_index_t));
+  if (!index) return NULL;
+
+  // keep the load factor at or below one half
+  size_t size = 16;
+  while (size < (size_t)capacity * 2) {
+    size *= 2;
+  }
+  if (index_alloc(index, size) != SUCCESS) {
+    free(index);
+    return NULL;
+  }
+  return index;
+}
+
+void kvs_index_free(kvs_index_t** ptr) {
+  if (ptr && *ptr) {
+    free((*ptr)->hashes);
+    free((*ptr)->slots);
+    free(*ptr);
+    *ptr = NULL;
+  }
+}
+
+void* kvs_index_get(kvs_index_t* index, const char* key) {
+  size_t i = index_find(index, index_hash(key), key);
+  return index->hashes[i] != 0 ? index->slots[i].item : NULL;
+}
+
+int kvs_index_put(kvs_index_t* index, const char* key, void* item) {
+  uint64_t hash = index_hash(key);
+  size_t i = index_find(index, hash, key);
+  if (index->hashes[i] != 0) {
+    index->slots[i].key = key;
+    index->slots[i].item = item;
+    return SUCCESS;
+  }
+  if ((index->count + 1) * 2 > index->mask + 1) {
+    if (index_grow(index) != SUCCESS) {
+      return FAILURE;
+    }
+  }
+  index_insert(index, hash, key, item);
+  return SUCCESS;
+}
+
+void kvs_index_remove(kvs_index_t* index, const char* key) {
+  size_t i = index_find(index, index_hash(key), key);
+  if (index->hashes[i] == 0) {
+    return;
+  }
+
+  // backward-shift deletion: pull later members of the probe run into the
+  // hole so lookups never need tombstones
+  size_t hole = i;
+  size_t j = (i + 1) & index->mask;
+  while (index->hashes[j] != 0) {
+    size_t home = index->hashes[j] & index->mask;
+    if (((j - home) & index->mask) >= ((j - hole) & index->mask)) {
+      index->hashes[hole] = index->hashes[j];
+      index->slots[hole] = index->slots[j];
+      hole = j;
+    }
+    j = (j + 1) & index->mask;
+  }
+  index->hashes[hole] = 0;
+  index->count--;
+}
+
+size_t kvs_index_memory(const kvs_index_t* index) {
+  return (index->mask + 1) * (sizeof(uint64_t) + sizeof(index_slot_t));
+}
+
+void kvs_index_for_each(kvs_index_t* index,
+                        void (*fn)(const char* key, void* item, void* arg),
+                        void* arg) {
+  for (size_t i = 0; i <= index->mask; ++i) {
+    if (index->hashes[i] != 0) {
+      fn(index->slots[i].key, index->slots[i].item, arg);
+    }
+  }
+}
+
+void kvs_index_clear(kvs_index_t* index) {
+  memset(index->hashes, 0, (index->mask + 1) * sizeof(uint64_t));
+  index->count = 0;
+}
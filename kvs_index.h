@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * `kvs_index_t` is an open-addressing hash index from keys to cache entries.
+ * It uses linear probing and stores the full 64-bit hash of every key next to
+ * it, so a probe only calls `strcmp` when the hashes already match. The index
+ * does not own the keys: the caller keeps the key string alive (usually inside
+ * the entry itself) until it removes the mapping.
+ */
+struct kvs_index;
+typedef struct kvs_index kvs_index_t;
+
+/**
+ * `kvs_hash` returns the 64-bit hash of `key` used by the index.
+ */
+uint64_t kvs_hash(const char* key);
+
+/**
+ * `kvs_index_new` creates an index sized to hold `capacity` keys without
+ * growing. It grows on its own if more keys are inserted.
+ */
+kvs_index_t* kvs_index_new(int capacity);
+void kvs_index_free(kvs_index_t** ptr);
+
+/**
+ * `kvs_index_get` returns the item stored for `key`, or NULL if there is none.
+ */
+void* kvs_index_get(kvs_index_t* index, const char* key);
+
+/**
+ * `kvs_index_put` maps `key` to `item`, replacing any previous mapping.
+ */
+int kvs_index_put(kvs_index_t* index, const char* key, void* item);
+
+/**
+ * `kvs_index_remove` drops the mapping for `key` if there is one.
+ */
+void kvs_index_remove(kvs_index_t* index, const char* key);
+
+/**
+ * `kvs_index_clear` drops every mapping.
+ */
+void kvs_index_clear(kvs_index_t* index);
+
+/**
+ * `kvs_index_memory` returns the bytes of the index's slots.
+ */
+size_t kvs_index_memory(const kvs_index_t* index);
+
+/**
+ * `kvs_index_for_each` calls `fn` once for every mapping, in no particular
+ * order. `fn` must not modify the index.
+ */
+void kvs_index_for_each(kvs_index_t* index,
+                        void (*fn)(const char* key, void* item, void* arg),
+                        void* arg);
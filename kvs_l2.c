@@ -0,0 +1,283 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "kvs_l2.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "kvs_index.h"
+
+#define SEGMENT_SIZE (64 * 1024)
+// slots of 64, 128, 256, 512 and 1024 bytes; the largest fits any entry
+#define CLASS_COUNT 5
+#define SLOT_MIN 64
+#define SLOT_MAX (SLOT_MIN << (CLASS_COUNT - 1))
+
+typedef struct slot_header {
+  uint16_t key_length;
+  uint16_t value_length;
+} slot_header_t;
+
+_Static_assert(sizeof(slot_header_t) + KVS_KEY_MAX + KVS_VALUE_MAX <= SLOT_MAX,
+               "an entry must fit the largest slot");
+
+typedef struct l2_slot {
+  // NULL while the slot is free
+  char* key;
+  off_t offset;
+  // the index of the slot's class in `kvs_l2_t.classes`
+  int size_class;
+  // set by readers, who share the lock
+  atomic_bool referenced;
+  struct l2_slot* next_free;
+} l2_slot_t;
+
+typedef struct l2_class {
+  size_t slot_size;
+  // one block of slots per segment the class was given; slot `i` of the
+  // class is slot `i % per_segment` of block `i / per_segment`
+  l2_slot_t** blocks;
+  int block_count;
+  int per_segment;
+  // slots handed out so far, in order
+  int used;
+  l2_slot_t* free;
+  int hand;
+} l2_class_t;
+
+struct kvs_l2 {
+  // readers share the lock; `kvs_l2_put` and `kvs_l2_remove` take it alone
+  pthread_rwlock_t lock;
+  int fd;
+  kvs_index_t* index;
+  l2_class_t classes[CLASS_COUNT];
+  int segment_count;
+  int next_segment;
+  // classes that have no segment yet, for which one is held back
+  int classes_waiting;
+  int count;
+};
+
+kvs_l2_t* kvs_l2_open(int dirfd, const char* path, size_t size) {
+  int segment_count = (size + SEGMENT_SIZE - 1) / SEGMENT_SIZE;
+  if (segment_count < CLASS_COUNT) {
+    segment_count = CLASS_COUNT;
+  }
+  int fd = openat(dirfd, path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    return NULL;
+  }
+  kvs_l2_t* l2 = calloc(1, sizeof(kvs_l2_t));
+  if (l2 == NULL ||
+      posix_fallocate(fd, 0, (off_t)segment_count * SEGMENT_SIZE) != 0 ||
+      (l2->index = kvs_index_new(1024)) == NULL) {
+    free(l2);
+    close(fd);
+    return NULL;
+  }
+  pthread_rwlock_init(&l2->lock, NULL);
+  l2->fd = fd;
+  for (int c = 0; c < CLASS_COUNT; ++c) {
+    l2->classes[c].slot_size = (size_t)SLOT_MIN << c;
+    l2->classes[c].per_segment = SEGMENT_SIZE / l2->classes[c].slot_size;
+  }
+  l2->segment_count = segment_count;
+  l2->next_segment = 0;
+  l2->classes_waiting = CLASS_COUNT;
+  l2->count = 0;
+  return l2;
+}
+
+void kvs_l2_free(kvs_l2_t** ptr) {
+  if (ptr && *ptr) {
+    kvs_l2_t* l2 = *ptr;
+    for (int c = 0; c < CLASS_COUNT; ++c) {
+      l2_class_t* class = &l2->classes[c];
+      for (int b = 0; b < class->block_count; ++b) {
+        for (int i = 0; i < class->per_segment; ++i) {
+          free(class->blocks[b][i].key);
+        }
+        free(class->blocks[b]);
+      }
+      free(class->blocks);
+    }
+    kvs_index_free(&l2->index);
+    pthread_rwlock_destroy(&l2->lock);
+    close(l2->fd);
+    free(l2);
+    *ptr = NULL;
+  }
+}
+
+static l2_slot_t* slot_at(l2_class_t* class, int i) {
+  return &class->blocks[i / class->per_segment][i % class->per_segment];
+}
+
+/**
+ * `add_segment` gives `class` the next free segment of the file. A class
+ * that already has one may not take the last segments, which are held back
+ * for the classes still waiting for their first.
+ */
+static int add_segment(kvs_l2_t* l2, l2_class_t* class) {
+  int spare = l2->segment_count - l2->next_segment;
+  if (spare == 0 || (class->block_count > 0 && spare <= l2->classes_waiting)) {
+    return FAILURE;
+  }
+  l2_slot_t** blocks =
+      realloc(class->blocks, (class->block_count + 1) * sizeof(l2_slot_t*));
+  if (blocks == NULL) {
+    return FAILURE;
+  }
+  class->blocks = blocks;
+  l2_slot_t* block = calloc(class->per_segment, sizeof(l2_slot_t));
+  if (block == NULL) {
+    return FAILURE;
+  }
+  off_t base = (off_t)l2->next_segment * SEGMENT_SIZE;
+  for (int i = 0; i < class->per_segment; ++i) {
+    block[i].offset = base + (off_t)i * class->slot_size;
+    block[i].size_class = (int)(class - l2->classes);
+    atomic_init(&block[i].referenced, false);
+  }
+  class->blocks[class->block_count] = block;
+  if (class->block_count == 0) {
+    l2->classes_waiting -= 1;
+  }
+  class->block_count += 1;
+  l2->next_segment += 1;
+  return SUCCESS;
+}
+
+static void release_slot(kvs_l2_t* l2, l2_class_t* class, l2_slot_t* slot) {
+  kvs_index_remove(l2->index, slot->key);
+  free(slot->key);
+  slot->key = NULL;
+  atomic_store_explicit(&slot->referenced, false, memory_order_relaxed);
+  slot->next_free = class->free;
+  class->free = slot;
+  l2->count -= 1;
+}
+
+/**
+ * `claim_slot` returns a free slot of `class`: one given back earlier, a
+ * new one from its segments or a new segment, or else the first slot the
+ * hand finds unreferenced, whose entry it evicts.
+ */
+static l2_slot_t* claim_slot(kvs_l2_t* l2, l2_class_t* class) {
+  if (class->free == NULL &&
+      (class->used < class->block_count * class->per_segment ||
+       add_segment(l2, class) == SUCCESS)) {
+    return slot_at(class, class->used++);
+  }
+  while (class->free == NULL && class->used > 0) {
+    l2_slot_t* slot = slot_at(class, class->hand);
+    class->hand = (class->hand + 1) % class->used;
+    if (slot->key == NULL) {
+      continue;
+    }
+    if (atomic_exchange_explicit(&slot->referenced, false,
+                                 memory_order_relaxed)) {
+      continue;
+    }
+    release_slot(l2, class, slot);
+  }
+  l2_slot_t* slot = class->free;
+  if (slot) {
+    class->free = slot->next_free;
+  }
+  return slot;
+}
+
+bool kvs_l2_put(kvs_l2_t* l2, const char* key, const char* value) {
+  size_t key_length = strlen(key);
+  size_t value_length = strlen(value);
+  size_t length = sizeof(slot_header_t) + key_length + value_length;
+  int c = 0;
+  while (((size_t)SLOT_MIN << c) < length) {
+    c++;
+  }
+  char record[SLOT_MAX];
+  slot_header_t header = {(uint16_t)key_length, (uint16_t)value_length};
+  memcpy(record, &header, sizeof(header));
+  memcpy(record + sizeof(header), key, key_length);
+  memcpy(record + sizeof(header) + key_length, value, value_length);
+
+  pthread_rwlock_wrlock(&l2->lock);
+  l2_slot_t* held = kvs_index_get(l2->index, key);
+  if (held) {
+    atomic_store_explicit(&held->referenced, true, memory_order_relaxed);
+    pthread_rwlock_unlock(&l2->lock);
+    return false;
+  }
+  l2_class_t* class = &l2->classes[c];
+  l2_slot_t* slot = claim_slot(l2, class);
+  bool stored = false;
+  if (slot) {
+    slot->key = malloc(key_length + 1);
+    if (slot->key && pwrite(l2->fd, record, length, slot->offset) ==
+                         (ssize_t)length) {
+      memcpy(slot->key, key, key_length + 1);
+      stored = kvs_index_put(l2->index, slot->key, slot) == SUCCESS;
+    }
+    if (stored) {
+      l2->count += 1;
+    } else {
+      free(slot->key);
+      slot->key = NULL;
+      slot->next_free = class->free;
+      class->free = slot;
+    }
+  }
+  pthread_rwlock_unlock(&l2->lock);
+  return stored;
+}
+
+int kvs_l2_get(kvs_l2_t* l2, const char* key, char* value) {
+  char record[SLOT_MAX];
+  slot_header_t header;
+  int rc = FAILURE;
+  pthread_rwlock_rdlock(&l2->lock);
+  l2_slot_t* slot = kvs_index_get(l2->index, key);
+  if (slot) {
+    size_t key_length = strlen(key);
+    ssize_t got = pread(l2->fd, record, sizeof(record), slot->offset);
+    if (got >= (ssize_t)sizeof(header)) {
+      memcpy(&header, record, sizeof(header));
+    }
+    if (got >= (ssize_t)sizeof(header) && header.key_length == key_length &&
+        header.value_length < KVS_VALUE_MAX &&
+        (size_t)got >= sizeof(header) + key_length + header.value_length &&
+        memcmp(record + sizeof(header), key, key_length) == 0) {
+      memcpy(value, record + sizeof(header) + key_length,
+             header.value_length);
+      value[header.value_length] = '\0';
+      atomic_store_explicit(&slot->referenced, true, memory_order_relaxed);
+      rc = SUCCESS;
+    }
+  }
+  pthread_rwlock_unlock(&l2->lock);
+  return rc;
+}
+
+void kvs_l2_remove(kvs_l2_t* l2, const char* key) {
+  pthread_rwlock_wrlock(&l2->lock);
+  l2_slot_t* slot = kvs_index_get(l2->index, key);
+  if (slot) {
+    release_slot(l2, &l2->classes[slot->size_class], slot);
+  }
+  pthread_rwlock_unlock(&l2->lock);
+}
+
+int kvs_l2_size(kvs_l2_t* l2) {
+  pthread_rwlock_rdlock(&l2->lock);
+  int count = l2->count;
+  pthread_rwlock_unlock(&l2->lock);
+  return count;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * `kvs_l2_t` is a second cache tier on flash, between the memory caches and
+ * the store: one preallocated file holding copies of entries the caches
+ * evicted, so a later miss on them is a single `pread` instead of opening
+ * the key's own file. The file is cut into 64 KiB segments, each handed to
+ * one size class of slots (64 bytes to 1 KiB) the first time that class
+ * needs room; once every segment is taken, a class reuses its own slots,
+ * picking victims with a CLOCK hand. The index of which key sits in which
+ * slot is kept in memory only, so the file is a plain cache: nothing in it
+ * survives `kvs_l2_free`, and it never holds the only copy of a value.
+ */
+struct kvs_l2;
+typedef struct kvs_l2 kvs_l2_t;
+
+/**
+ * `kvs_l2_open` creates, or reuses, the file at `path`, relative to the
+ * directory open as `dirfd`, and preallocates `size` bytes for it, rounded
+ * up to a segment for every size class.
+ */
+kvs_l2_t* kvs_l2_open(int dirfd, const char* path, size_t size);
+void kvs_l2_free(kvs_l2_t** ptr);
+
+/**
+ * `kvs_l2_get` copies the value held for `key` into `value` and marks it
+ * referenced. It returns FAILURE if the key is not held.
+ */
+int kvs_l2_get(kvs_l2_t* l2, const char* key, char* value);
+
+/**
+ * `kvs_l2_put` stores a copy of `key` and its current `value`, evicting
+ * another entry of the same size class if there is no free slot, and
+ * returns whether it wrote anything. A key already held is only marked
+ * referenced: every write of a key drops its copy first (see
+ * `kvs_l2_remove`), so a copy still held is current.
+ */
+bool kvs_l2_put(kvs_l2_t* l2, const char* key, const char* value);
+
+/**
+ * `kvs_l2_remove` drops the copy of `key`, if any, because its value is
+ * about to change.
+ */
+void kvs_l2_remove(kvs_l2_t* l2, const char* key);
+
+/**
+ * `kvs_l2_size` returns the number of entries held.
+ */
+int kvs_l2_size(kvs_l2_t* l2);
@@ -0,0 +1,41 @@
+#include "kvs_list.h"
+
+void kvs_list_init(kvs_list_t* list) {
+  list->head = NULL;
+  list->tail = NULL;
+  list->size = 0;
+}
+
+void kvs_list_push(kvs_list_t* list, kvs_list_link_t* link) {
+  link->prev = NULL;
+  link->next = list->head;
+  if (list->head) {
+    list->head->prev = link;
+  } else {
+    list->tail = link;
+  }
+  list->head = link;
+  list->size++;
+}
+
+void kvs_list_remove(kvs_list_t* list, kvs_list_link_t* link) {
+  if (link->prev) {
+    link->prev->next = link->next;
+  } else {
+    list->head = link->next;
+  }
+  if (link->next) {
+    link->next->prev = link->prev;
+  } else {
+    list->tail = link->prev;
+  }
+  list->size--;
+}
+
+void kvs_list_move(kvs_list_t* from, kvs_list_t* to, kvs_list_link_t* link) {
+  if (from == to && to->head == link) {
+    return;
+  }
+  kvs_list_remove(from, link);
+  kvs_list_push(to, link);
+}
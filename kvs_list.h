@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * `kvs_list_t` is an intrusive doubly-linked list, most recently pushed entry
+ * first. Entries embed a `kvs_list_link_t` and can sit on one list per link.
+ * The policies that juggle several recency lists (ARC, 2Q, W-TinyLFU) keep
+ * them with it.
+ */
+typedef struct kvs_list_link {
+  struct kvs_list_link* prev;
+  struct kvs_list_link* next;
+} kvs_list_link_t;
+
+typedef struct kvs_list {
+  kvs_list_link_t* head;
+  kvs_list_link_t* tail;
+  int size;
+} kvs_list_t;
+
+/**
+ * `KVS_LIST_ENTRY` turns a `link` back into the entry of type `type` whose
+ * member `member` it is.
+ */
+#define KVS_LIST_ENTRY(link, type, member) \
+  ((type*)((char*)(link) - offsetof(type, member)))
+
+void kvs_list_init(kvs_list_t* list);
+
+/**
+ * `kvs_list_push` puts `link` at the head of `list`.
+ */
+void kvs_list_push(kvs_list_t* list, kvs_list_link_t* link);
+
+/**
+ * `kvs_list_remove` takes `link` off `list`.
+ */
+void kvs_list_remove(kvs_list_t* list, kvs_list_link_t* link);
+
+/**
+ * `kvs_list_move` moves `link` from `from` to the head of `to`, which may be
+ * the same list.
+ */
+void kvs_list_move(kvs_list_t* from, kvs_list_t* to, kvs_list_link_t* link);
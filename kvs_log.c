@@ -0,0 +1,548 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "kvs_log.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "kvs_index.h"
+
+#define SEGMENT_PREFIX ".kvs-segment-"
+
+/**
+ * The active segment is sealed and a new one started once it reaches
+ * `SEGMENT_MAX` bytes.
+ */
+#define SEGMENT_MAX (64 * 1024 * 1024)
+
+/**
+ * A sealed segment is compacted once fewer than 1 in `COMPACT_RATIO` of its
+ * bytes still belong to live records.
+ */
+#define COMPACT_RATIO 2
+
+typedef struct record_header {
+  // FNV-1a over the lengths, the key and the value
+  uint32_t checksum;
+  uint16_t key_length;
+  uint16_t value_length;
+} record_header_t;
+
+#define RECORD_MAX (sizeof(record_header_t) + KVS_KEY_MAX + KVS_VALUE_MAX)
+
+typedef struct log_segment {
+  unsigned id;
+  int fd;
+  size_t size;
+  // bytes of the records the index still points at
+  size_t live;
+} log_segment_t;
+
+typedef struct log_entry {
+  char* key;
+  log_segment_t* segment;
+  size_t offset;
+  uint16_t value_length;
+} log_entry_t;
+
+struct kvs_log {
+  char directory[PATH_MAX];
+  // `lock` guards the index and the segments; readers share it
+  pthread_rwlock_t lock;
+  kvs_index_t* index;
+  // ordered by id; the last one is the active segment
+  log_segment_t** segments;
+  int segment_count;
+  int segment_capacity;
+
+  pthread_t compactor;
+  pthread_mutex_t compactor_lock;
+  pthread_cond_t compactor_wakeup;
+  bool stop;
+};
+
+static uint32_t record_checksum(const char* record, size_t length) {
+  // the checksum field itself is skipped
+  uint32_t hash = 2166136261u;
+  for (size_t i = sizeof(uint32_t); i < length; ++i) {
+    hash ^= (unsigned char)record[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static size_t record_size(size_t key_length, size_t value_length) {
+  return sizeof(record_header_t) + key_length + value_length;
+}
+
+static int segment_path(kvs_log_t* log, unsigned id, char* path) {
+  int length = snprintf(path, PATH_MAX, "%s/" SEGMENT_PREFIX "%08u",
+                        log->directory, id);
+  return length < PATH_MAX ? SUCCESS : FAILURE;
+}
+
+static log_segment_t* segment_open(kvs_log_t* log, unsigned id) {
+  char path[PATH_MAX];
+  if (segment_path(log, id, path) != SUCCESS) return NULL;
+  log_segment_t* segment = malloc(sizeof(log_segment_t));
+  if (!segment) return NULL;
+  segment->fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+  if (segment->fd < 0) {
+    free(segment);
+    return NULL;
+  }
+  segment->id = id;
+  segment->size = 0;
+  segment->live = 0;
+
+  if (log->segment_count == log->segment_capacity) {
+    int capacity = log->segment_capacity ? log->segment_capacity * 2 : 8;
+    log_segment_t** segments =
+        realloc(log->segments, capacity * sizeof(log_segment_t*));
+    if (!segments) {
+      close(segment->fd);
+      free(segment);
+      return NULL;
+    }
+    log->segments = segments;
+    log->segment_capacity = capacity;
+  }
+  log->segments[log->segment_count++] = segment;
+  return segment;
+}
+
+static log_segment_t* active_segment(kvs_log_t* log) {
+  return log->segments[log->segment_count - 1];
+}
+
+static void segment_remove(kvs_log_t* log, log_segment_t* segment) {
+  char path[PATH_MAX];
+  int i = 0;
+  while (log->segments[i] != segment) {
+    i++;
+  }
+  memmove(&log->segments[i], &log->segments[i + 1],
+          (log->segment_count - i - 1) * sizeof(log_segment_t*));
+  log->segment_count--;
+
+  close(segment->fd);
+  if (segment_path(log, segment->id, path) == SUCCESS) {
+    unlink(path);
+  }
+  free(segment);
+}
+
+/**
+ * `index_record` points the index at a record that was just appended or
+ * scanned, and moves its bytes from the key's previous segment to `segment`.
+ * The segment that held the previous record, if any, is stored in `previous`.
+ * The caller holds the write lock.
+ */
+static int index_record(kvs_log_t* log, const char* key,
+                        log_segment_t* segment, size_t offset,
+                        uint16_t value_length, log_segment_t** previous) {
+  *previous = NULL;
+  log_entry_t* entry = kvs_index_get(log->index, key);
+  if (entry) {
+    *previous = entry->segment;
+    entry->segment->live -=
+        record_size(strlen(entry->key), entry->value_length);
+  } else {
+    entry = malloc(sizeof(log_entry_t));
+    if (!entry) return FAILURE;
+    entry->key = malloc(strlen(key) + 1);
+    if (!entry->key) {
+      free(entry);
+      return FAILURE;
+    }
+    strcpy(entry->key, key);
+    if (kvs_index_put(log->index, entry->key, entry) != SUCCESS) {
+      free(entry->key);
+      free(entry);
+      return FAILURE;
+    }
+  }
+  entry->segment = segment;
+  entry->offset = offset;
+  entry->value_length = value_length;
+  segment->live += record_size(strlen(key), value_length);
+  return SUCCESS;
+}
+
+/**
+ * `append_record` writes one record at the end of the active segment, sealing
+ * it first if it is full, and indexes it. The segment that held the key's
+ * previous record is stored in `previous`. A key or value too long for a
+ * record fails. The caller holds the write lock.
+ */
+static int append_record(kvs_log_t* log, const char* key, const char* value,
+                         log_segment_t** previous) {
+  char record[RECORD_MAX];
+  record_header_t header;
+  size_t key_length = strlen(key);
+  size_t value_length = strlen(value);
+  size_t length = record_size(key_length, value_length);
+  *previous = NULL;
+  if (key_length >= KVS_KEY_MAX || value_length >= KVS_VALUE_MAX) {
+    return FAILURE;
+  }
+
+  header.key_length = key_length;
+  header.value_length = value_length;
+  memcpy(record, &header, sizeof(header));
+  memcpy(record + sizeof(header), key, key_length);
+  memcpy(record + sizeof(header) + key_length, value, value_length);
+  header.checksum = record_checksum(record, length);
+  memcpy(record, &header.checksum, sizeof(header.checksum));
+
+  log_segment_t* segment = active_segment(log);
+  if (segment->size > 0 && segment->size + length > SEGMENT_MAX) {
+    segment = segment_open(log, segment->id + 1);
+    if (!segment) return FAILURE;
+  }
+  if (pwrite(segment->fd, record, length, segment->size) != (ssize_t)length) {
+    return FAILURE;
+  }
+  size_t offset = segment->size;
+  segment->size += length;
+
+  return index_record(log, key, segment, offset, value_length, previous);
+}
+
+/**
+ * `sync_directory` makes the creation and removal of segment files in the
+ * store directory durable.
+ */
+static int sync_directory(kvs_log_t* log) {
+  int fd = open(log->directory, O_RDONLY | O_DIRECTORY);
+  if (fd < 0) return FAILURE;
+  int rc = fsync(fd) == 0 ? SUCCESS : FAILURE;
+  close(fd);
+  return rc;
+}
+
+static bool should_compact(kvs_log_t* log, log_segment_t* segment) {
+  return segment != active_segment(log) &&
+         segment->live * COMPACT_RATIO < segment->size;
+}
+
+/**
+ * `compact_segment` copies the records of `segment` that are still live to the
+ * active segment and deletes it. The segment is sealed, so it can be read
+ * without the lock; each live record is moved under the write lock. The
+ * copies are made durable before the segment is unlinked, since the records
+ * it held may have been synced by `kvs_log_sync` and no longer be anywhere
+ * else.
+ */
+static int compact_segment(kvs_log_t* log, log_segment_t* segment) {
+  log_segment_t* previous;
+  char record[RECORD_MAX];
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+  record_header_t header;
+  size_t offset = 0;
+
+  while (offset < segment->size) {
+    if (pread(segment->fd, &header, sizeof(header), offset) !=
+        (ssize_t)sizeof(header)) {
+      return FAILURE;
+    }
+    size_t length = record_size(header.key_length, header.value_length);
+    if (pread(segment->fd, record, length, offset) != (ssize_t)length) {
+      return FAILURE;
+    }
+    memcpy(key, record + sizeof(header), header.key_length);
+    key[header.key_length] = '\0';
+    memcpy(value, record + sizeof(header) + header.key_length,
+           header.value_length);
+    value[header.value_length] = '\0';
+
+    int rc = SUCCESS;
+    pthread_rwlock_wrlock(&log->lock);
+    log_entry_t* entry = kvs_index_get(log->index, key);
+    if (entry && entry->segment == segment && entry->offset == offset) {
+      rc = append_record(log, key, value, &previous);
+    }
+    pthread_rwlock_unlock(&log->lock);
+    if (rc != SUCCESS) {
+      return rc;
+    }
+    offset += length;
+  }
+  if (kvs_log_sync(log) != SUCCESS || sync_directory(log) != SUCCESS) {
+    return FAILURE;
+  }
+
+  pthread_rwlock_wrlock(&log->lock);
+  bool empty = segment->live == 0;
+  if (empty) {
+    segment_remove(log, segment);
+  }
+  pthread_rwlock_unlock(&log->lock);
+  return empty ? SUCCESS : FAILURE;
+}
+
+static void* compact_loop(void* arg) {
+  kvs_log_t* log = arg;
+  pthread_mutex_lock(&log->compactor_lock);
+  while (!log->stop) {
+    log_segment_t* candidate = NULL;
+    pthread_rwlock_rdlock(&log->lock);
+    for (int i = 0; i < log->segment_count; ++i) {
+      if (should_compact(log, log->segments[i])) {
+        candidate = log->segments[i];
+        break;
+      }
+    }
+    pthread_rwlock_unlock(&log->lock);
+
+    if (candidate == NULL) {
+      pthread_cond_wait(&log->compactor_wakeup, &log->compactor_lock);
+      continue;
+    }
+    pthread_mutex_unlock(&log->compactor_lock);
+    int rc = compact_segment(log, candidate);
+    pthread_mutex_lock(&log->compactor_lock);
+    if (rc != SUCCESS && !log->stop) {
+      // the disk is full or failing: wait for the next SET before retrying
+      pthread_cond_wait(&log->compactor_wakeup, &log->compactor_lock);
+    }
+  }
+  pthread_mutex_unlock(&log->compactor_lock);
+  return NULL;
+}
+
+static void wake_compactor(kvs_log_t* log) {
+  pthread_mutex_lock(&log->compactor_lock);
+  pthread_cond_signal(&log->compactor_wakeup);
+  pthread_mutex_unlock(&log->compactor_lock);
+}
+
+/**
+ * `scan_segment` indexes every record of `segment`. A record that fails its
+ * checksum marks the end of the data that reached the disk; the segment is
+ * truncated there.
+ */
+static int scan_segment(kvs_log_t* log, log_segment_t* segment) {
+  struct stat st;
+  if (fstat(segment->fd, &st) != 0) {
+    return FAILURE;
+  }
+  size_t file_size = st.st_size;
+  char* data = malloc(file_size > 0 ? file_size : 1);
+  if (!data) return FAILURE;
+  if (pread(segment->fd, data, file_size, 0) != (ssize_t)file_size) {
+    free(data);
+    return FAILURE;
+  }
+
+  char key[KVS_KEY_MAX];
+  record_header_t header;
+  log_segment_t* previous;
+  size_t offset = 0;
+  while (offset + sizeof(header) <= file_size) {
+    memcpy(&header, data + offset, sizeof(header));
+    size_t length = record_size(header.key_length, header.value_length);
+    if (header.key_length >= KVS_KEY_MAX ||
+        header.value_length >= KVS_VALUE_MAX || offset + length > file_size ||
+        record_checksum(data + offset, length) != header.checksum) {
+      break;
+    }
+    memcpy(key, data + offset + sizeof(header), header.key_length);
+    key[header.key_length] = '\0';
+    if (index_record(log, key, segment, offset, header.value_length,
+                     &previous) != SUCCESS) {
+      free(data);
+      return FAILURE;
+    }
+    offset += length;
+  }
+  free(data);
+
+  segment->size = offset;
+  if (offset != file_size && ftruncate(segment->fd, offset) != 0) {
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+static int compare_ids(const void* a, const void* b) {
+  unsigned x = *(const unsigned*)a;
+  unsigned y = *(const unsigned*)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * `open_segments` opens the existing segments of the directory in id order
+ * and rebuilds the index from them, then makes sure there is an active
+ * segment to append to.
+ */
+static int open_segments(kvs_log_t* log) {
+  DIR* dir = opendir(log->directory);
+  if (!dir) return FAILURE;
+
+  unsigned* ids = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  struct dirent* dirent;
+  while ((dirent = readdir(dir)) != NULL) {
+    if (strncmp(dirent->d_name, SEGMENT_PREFIX, strlen(SEGMENT_PREFIX)) != 0) {
+      continue;
+    }
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : 16;
+      unsigned* grown = realloc(ids, capacity * sizeof(unsigned));
+      if (!grown) {
+        free(ids);
+        closedir(dir);
+        return FAILURE;
+      }
+      ids = grown;
+    }
+    ids[count++] = strtoul(dirent->d_name + strlen(SEGMENT_PREFIX), NULL, 10);
+  }
+  closedir(dir);
+  if (count > 0) {
+    qsort(ids, count, sizeof(unsigned), compare_ids);
+  }
+
+  int rc = SUCCESS;
+  for (size_t i = 0; i < count && rc == SUCCESS; ++i) {
+    log_segment_t* segment = segment_open(log, ids[i]);
+    rc = segment ? scan_segment(log, segment) : FAILURE;
+  }
+  free(ids);
+
+  if (rc == SUCCESS && log->segment_count == 0) {
+    rc = segment_open(log, 1) ? SUCCESS : FAILURE;
+  }
+  return rc;
+}
+
+static void free_entry(const char* key, void* item, void* arg) {
+  log_entry_t* entry = item;
+  free(entry->key);
+  free(entry);
+}
+
+kvs_log_t* kvs_log_new(const char* directory) {
+  kvs_log_t* log = calloc(1, sizeof(kvs_log_t));
+  if (!log) return NULL;
+
+  strcpy(log->directory, directory);
+  log->index = kvs_index_new(1024);
+  pthread_rwlock_init(&log->lock, NULL);
+  pthread_mutex_init(&log->compactor_lock, NULL);
+  pthread_cond_init(&log->compactor_wakeup, NULL);
+  log->stop = false;
+
+  if (!log->index || open_segments(log) != SUCCESS ||
+      pthread_create(&log->compactor, NULL, compact_loop, log) != 0) {
+    log->stop = true;
+    kvs_log_free(&log);
+    return NULL;
+  }
+  return log;
+}
+
+void kvs_log_free(kvs_log_t** ptr) {
+  kvs_log_t* log = *ptr;
+  if (!log->stop) {
+    pthread_mutex_lock(&log->compactor_lock);
+    log->stop = true;
+    pthread_cond_signal(&log->compactor_wakeup);
+    pthread_mutex_unlock(&log->compactor_lock);
+    pthread_join(log->compactor, NULL);
+  }
+
+  if (log->index) {
+    kvs_index_for_each(log->index, free_entry, NULL);
+    kvs_index_free(&log->index);
+  }
+  for (int i = 0; i < log->segment_count; ++i) {
+    close(log->segments[i]->fd);
+    free(log->segments[i]);
+  }
+  free(log->segments);
+  pthread_rwlock_destroy(&log->lock);
+  pthread_mutex_destroy(&log->compactor_lock);
+  pthread_cond_destroy(&log->compactor_wakeup);
+  free(log);
+  *ptr = NULL;
+}
+
+int kvs_log_set(kvs_log_t* log, const char* key, const char* value) {
+  log_segment_t* previous;
+  pthread_rwlock_wrlock(&log->lock);
+  int segment_count = log->segment_count;
+  int rc = append_record(log, key, value, &previous);
+  // wake the compactor when this SET sealed a segment or left one mostly dead
+  bool compact = log->segment_count != segment_count ||
+                 (previous && should_compact(log, previous));
+  pthread_rwlock_unlock(&log->lock);
+
+  if (compact) {
+    wake_compactor(log);
+  }
+  return rc;
+}
+
+int kvs_log_get(kvs_log_t* log, const char* key, char* value) {
+  int rc = SUCCESS;
+  pthread_rwlock_rdlock(&log->lock);
+  log_entry_t* entry = kvs_index_get(log->index, key);
+  if (entry == NULL) {
+    strcpy(value, "");
+  } else {
+    size_t offset =
+        entry->offset + sizeof(record_header_t) + strlen(entry->key);
+    if (pread(entry->segment->fd, value, entry->value_length, offset) !=
+        entry->value_length) {
+      rc = FAILURE;
+    }
+    value[entry->value_length] = '\0';
+  }
+  pthread_rwlock_unlock(&log->lock);
+  return rc;
+}
+
+typedef struct key_visitor {
+  void (*fn)(void* arg, const char* key);
+  void* arg;
+} key_visitor_t;
+
+static void visit_key(const char* key, void* item, void* arg) {
+  key_visitor_t* visitor = arg;
+  visitor->fn(visitor->arg, key);
+}
+
+int kvs_log_scan(kvs_log_t* log, void (*fn)(void* arg, const char* key),
+                 void* arg) {
+  key_visitor_t visitor = {fn, arg};
+  pthread_rwlock_rdlock(&log->lock);
+  kvs_index_for_each(log->index, visit_key, &visitor);
+  pthread_rwlock_unlock(&log->lock);
+  return SUCCESS;
+}
+
+int kvs_log_sync(kvs_log_t* log) {
+  int rc = SUCCESS;
+  pthread_rwlock_rdlock(&log->lock);
+  for (int i = 0; i < log->segment_count; ++i) {
+    if (fdatasync(log->segments[i]->fd) != 0) {
+      rc = FAILURE;
+    }
+  }
+  pthread_rwlock_unlock(&log->lock);
+  return rc;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+/**
+ * `kvs_log_t` is a log-structured store: every SET appends a record to the
+ * active segment file, and an in-memory index maps each key to the segment,
+ * offset and length of its latest record. Segments are named
+ * `.kvs-segment-NNNNNNNN` inside the store directory; the index is rebuilt by
+ * scanning them in order when the store is opened.
+ *
+ * A background thread compacts sealed segments once most of their records
+ * have been overwritten: it copies the still-live records to the active
+ * segment and deletes the old file.
+ */
+struct kvs_log;
+typedef struct kvs_log kvs_log_t;
+
+kvs_log_t* kvs_log_new(const char* directory);
+void kvs_log_free(kvs_log_t** ptr);
+
+int kvs_log_set(kvs_log_t* log, const char* key, const char* value);
+
+/**
+ * `kvs_log_get` copies the value of `key` into `value`, or the empty string if
+ * the key has never been set.
+ */
+int kvs_log_get(kvs_log_t* log, const char* key, char* value);
+
+/**
+ * `kvs_log_scan` calls `fn` with every key in the store, in no particular
+ * order. `fn` must not call back into the log.
+ */
+int kvs_log_scan(kvs_log_t* log, void (*fn)(void* arg, const char* key),
+                 void* arg);
+
+/**
+ * `kvs_log_sync` makes every record written so far durable.
+ */
+int kvs_log_sync(kvs_log_t* log);
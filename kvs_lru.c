@@ -6,11 +6,14 @@
 #include <string.h>
 
 #include "constants.h"
+#include "kvs_arena.h"
+#include "kvs_budget.h"
+#include "kvs_dirty.h"
+#include "kvs_index.h"
+#include "kvs_pool.h"
 
 typedef struct cache_entry {
-  char key[KVS_KEY_MAX];
-  char value[KVS_VALUE_MAX];
-  bool modified;
+  kvs_entry_t kv;
   struct cache_entry* prev;
   struct cache_entry* next;
 } cache_entry_t;
@@ -18,10 +21,15 @@ typedef struct cache_entry {
 struct kvs_lru {
   kvs_base_t* kvs_base;
   int capacity;
+  // bytes the entries may take, or 0 to hold `capacity` entries
+  size_t budget;
   int size;
   cache_entry_t* head;
   cache_entry_t* tail;
-  cache_entry_t* table;
+  kvs_pool_t* pool;
+  kvs_arena_t* arena;
+  kvs_index_t* index;
+  kvs_dirty_t dirty;
 };
 
 static void move_to_head(kvs_lru_t* kvs_lru, cache_entry_t* entry) {
@@ -48,68 +56,115 @@ static void move_to_head(kvs_lru_t* kvs_lru, cache_entry_t* entry) {
   }
 }
 
-static void remove_tail(kvs_lru_t* kvs_lru) {
+static int remove_tail(kvs_lru_t* kvs_lru) {
   if (kvs_lru->tail) {
-    if (kvs_lru->tail->modified) {
-      kvs_base_set(kvs_lru->kvs_base, kvs_lru->tail->key, kvs_lru->tail->value);
+    if (kvs_dirty_evict(&kvs_lru->dirty, kvs_lru->kvs_base,
+                        &kvs_lru->tail->kv) != SUCCESS) {
+      return FAILURE;
     }
     if (kvs_lru->tail->prev) {
       kvs_lru->tail->prev->next = NULL;
+    } else {
+      kvs_lru->head = NULL;
     }
     cache_entry_t* old_tail = kvs_lru->tail;
     kvs_lru->tail = kvs_lru->tail->prev;
-    free(old_tail);
+    kvs_index_remove(kvs_lru->index, old_tail->kv.key);
+    kvs_arena_release(kvs_lru->arena, old_tail->kv.key);
+    kvs_arena_release(kvs_lru->arena, old_tail->kv.value);
+    kvs_pool_release(kvs_lru->pool, old_tail);
     kvs_lru->size--;
   }
+  return SUCCESS;
 }
 
-kvs_lru_t* kvs_lru_new(kvs_base_t* kvs, int capacity) {
+/**
+ * `create` makes a cache of `capacity` entries. Without a `budget` its index
+ * is sized for all of them; with one it starts empty and grows with
+ * the entries, since its bytes are charged to the budget.
+ */
+static kvs_lru_t* create(kvs_base_t* kvs, int capacity, size_t budget) {
   kvs_lru_t* kvs_lru = malloc(sizeof(kvs_lru_t));
   if (!kvs_lru) return NULL;
 
   kvs_lru->kvs_base = kvs;
   kvs_lru->capacity = capacity;
+  kvs_lru->budget = budget;
   kvs_lru->size = 0;
   kvs_lru->head = NULL;
   kvs_lru->tail = NULL;
-  kvs_lru->table = calloc(capacity, sizeof(cache_entry_t));
+  kvs_lru->pool = kvs_pool_new(sizeof(cache_entry_t), capacity);
+  kvs_lru->arena = kvs_arena_new();
+  kvs_lru->index = kvs_index_new(budget > 0 ? 0 : capacity);
+  kvs_dirty_init(&kvs_lru->dirty);
 
   return kvs_lru;
 }
 
+kvs_lru_t* kvs_lru_new(kvs_base_t* kvs, int capacity) {
+  return create(kvs, capacity, 0);
+}
+
+kvs_lru_t* kvs_lru_new_budget(kvs_base_t* kvs, size_t budget) {
+  return create(kvs, kvs_budget_entries(budget, sizeof(cache_entry_t)),
+                budget);
+}
+
+void kvs_lru_enable_compression(kvs_lru_t* kvs_lru) {
+  kvs_arena_enable_compression(kvs_lru->arena, &kvs_lru->kvs_base->metrics);
+}
+
 void kvs_lru_free(kvs_lru_t** ptr) {
   if (ptr && *ptr) {
-    cache_entry_t* current = (*ptr)->head;
-    while (current) {
-      cache_entry_t* next = current->next;
-      free(current);
-      current = next;
-    }
-    free((*ptr)->table);
+    kvs_index_free(&(*ptr)->index);
+    kvs_arena_free(&(*ptr)->arena);
+    kvs_pool_free(&(*ptr)->pool);
     free(*ptr);
     *ptr = NULL;
   }
 }
 
-int kvs_lru_set(kvs_lru_t* kvs_lru, const char* key, const char* value) {
-  for (cache_entry_t* entry = kvs_lru->head; entry; entry = entry->next) {
-    if (strcmp(entry->key, key) == 0) {
-      strcpy(entry->value, value);
-      entry->modified = true;
-      move_to_head(kvs_lru, entry);
-      return SUCCESS;
-    }
+static bool over_budget(kvs_lru_t* kvs_lru, size_t incoming) {
+  return kvs_budget_over(kvs_lru->budget, kvs_lru_memory(kvs_lru), incoming);
+}
+
+/**
+ * `make_entry` allocates a clean entry holding copies of `key` and `value`,
+ * indexed but not yet linked, or returns NULL if the pool, the arena or the
+ * index is out of room.
+ */
+static cache_entry_t* make_entry(kvs_lru_t* kvs_lru, const char* key,
+                                 const char* value) {
+  cache_entry_t* entry = kvs_pool_alloc(kvs_lru->pool);
+  if (!entry) return NULL;
+  entry->kv.key = kvs_arena_strdup(kvs_lru->arena, key);
+  entry->kv.value = kvs_arena_pack(kvs_lru->arena, NULL, value);
+  if (!entry->kv.key || !entry->kv.value ||
+      kvs_index_put(kvs_lru->index, entry->kv.key, entry) != SUCCESS) {
+    kvs_arena_release(kvs_lru->arena, entry->kv.key);
+    kvs_arena_release(kvs_lru->arena, entry->kv.value);
+    kvs_pool_release(kvs_lru->pool, entry);
+    return NULL;
   }
+  entry->kv.modified = false;
+  return entry;
+}
 
-  if (kvs_lru->size == kvs_lru->capacity) {
-    remove_tail(kvs_lru);
+static int push_head(kvs_lru_t* kvs_lru, const char* key, const char* value,
+                     bool modified) {
+  size_t charge = kvs_budget_charge(sizeof(cache_entry_t), key, value);
+  while (kvs_lru->size > 0 && (kvs_lru->size == kvs_lru->capacity ||
+                               over_budget(kvs_lru, charge))) {
+    if (remove_tail(kvs_lru) != SUCCESS) {
+      return FAILURE;
+    }
   }
 
-  cache_entry_t* new_entry = malloc(sizeof(cache_entry_t));
+  cache_entry_t* new_entry = make_entry(kvs_lru, key, value);
   if (!new_entry) return FAILURE;
-  strcpy(new_entry->key, key);
-  strcpy(new_entry->value, value);
-  new_entry->modified = true;
+  if (modified) {
+    kvs_dirty_mark(&kvs_lru->dirty, &new_entry->kv);
+  }
   new_entry->prev = NULL;
   new_entry->next = kvs_lru->head;
 
@@ -125,51 +180,119 @@ int kvs_lru_set(kvs_lru_t* kvs_lru, const char* key, const char* value) {
   return SUCCESS;
 }
 
-int kvs_lru_get(kvs_lru_t* kvs_lru, const char* key, char* value) {
-  for (cache_entry_t* entry = kvs_lru->head; entry; entry = entry->next) {
-    if (strcmp(entry->key, key) == 0) {
-      strcpy(value, entry->value);
-      move_to_head(kvs_lru, entry);
-      return SUCCESS;
+int kvs_lru_set(kvs_lru_t* kvs_lru, const char* key, const char* value) {
+  cache_entry_t* entry = kvs_index_get(kvs_lru->index, key);
+  if (entry) {
+    char* stored = kvs_arena_pack(kvs_lru->arena, entry->kv.value, value);
+    if (!stored) return FAILURE;
+    entry->kv.value = stored;
+    kvs_dirty_mark(&kvs_lru->dirty, &entry->kv);
+    move_to_head(kvs_lru, entry);
+    // a larger value may take the cache over its budget
+    while (kvs_lru->size > 1 && over_budget(kvs_lru, 0)) {
+      if (remove_tail(kvs_lru) != SUCCESS) {
+        return FAILURE;
+      }
     }
+    return SUCCESS;
   }
 
-  int result = kvs_base_get(kvs_lru->kvs_base, key, value);
-  if (result == SUCCESS) {
-    if (kvs_lru->size == kvs_lru->capacity) {
-      remove_tail(kvs_lru);
-    }
+  return push_head(kvs_lru, key, value, true);
+}
 
-    cache_entry_t* new_entry = malloc(sizeof(cache_entry_t));
-    if (!new_entry) return FAILURE;
-    strcpy(new_entry->key, key);
-    strcpy(new_entry->value, value);
-    new_entry->modified = false;
-    new_entry->prev = NULL;
-    new_entry->next = kvs_lru->head;
+int kvs_lru_get_cached(kvs_lru_t* kvs_lru, const char* key, char* value) {
+  cache_entry_t* entry = kvs_index_get(kvs_lru->index, key);
+  if (entry) {
+    kvs_arena_read(kvs_lru->arena, entry->kv.value, value);
+    move_to_head(kvs_lru, entry);
+    return SUCCESS;
+  }
+  return FAILURE;
+}
 
-    if (kvs_lru->head) {
-      kvs_lru->head->prev = new_entry;
-    }
-    kvs_lru->head = new_entry;
-    if (!kvs_lru->tail) {
-      kvs_lru->tail = new_entry;
-    }
-    kvs_lru->size++;
+bool kvs_lru_contains(kvs_lru_t* kvs_lru, const char* key) {
+  return kvs_index_get(kvs_lru->index, key) != NULL;
+}
+
+int kvs_lru_peek(kvs_lru_t* kvs_lru, const char* key, char* value) {
+  cache_entry_t* entry = kvs_index_get(kvs_lru->index, key);
+  if (entry) {
+    kvs_arena_read(kvs_lru->arena, entry->kv.value, value);
+    return SUCCESS;
+  }
+  return FAILURE;
+}
+
+int kvs_lru_load(kvs_lru_t* kvs_lru, const char* key, char* value) {
+  if (kvs_lru_get_cached(kvs_lru, key, value) == SUCCESS) {
+    return SUCCESS;
+  }
+  return push_head(kvs_lru, key, value, false);
+}
+
+int kvs_lru_get(kvs_lru_t* kvs_lru, const char* key, char* value) {
+  if (kvs_lru_get_cached(kvs_lru, key, value) == SUCCESS) {
+    return SUCCESS;
+  }
+
+  int result = kvs_base_get(kvs_lru->kvs_base, key, value);
+  if (result == SUCCESS) {
+    return kvs_lru_load(kvs_lru, key, value);
   }
 
   return result;
 }
 
 int kvs_lru_flush(kvs_lru_t* kvs_lru) {
-  cache_entry_t* current = kvs_lru->head;
-  while (current) {
-    if (current->modified) {
-      kvs_base_set(kvs_lru->kvs_base, current->key, current->value);
-      current->modified = false;
-    }
-    current = current->next;
+  return kvs_dirty_flush(&kvs_lru->dirty, kvs_lru->kvs_base);
+}
+
+int kvs_lru_size(kvs_lru_t* kvs_lru) { return kvs_lru->size; }
+
+int kvs_lru_dirty(kvs_lru_t* kvs_lru) { return kvs_lru->dirty.count; }
+
+int kvs_lru_take_dirty(kvs_lru_t* kvs_lru, char* key, char* value) {
+  return kvs_dirty_take(&kvs_lru->dirty, key, value);
+}
+
+void kvs_lru_mark_dirty(kvs_lru_t* kvs_lru, const char* key) {
+  cache_entry_t* entry = kvs_index_get(kvs_lru->index, key);
+  if (entry) {
+    kvs_dirty_mark(&kvs_lru->dirty, &entry->kv);
+  }
+}
+
+void kvs_lru_snapshot(kvs_lru_t* kvs_lru, kvs_snapshot_fn fn, void* arg) {
+  for (cache_entry_t* entry = kvs_lru->head; entry; entry = entry->next) {
+    fn(arg, entry->kv.key, false);
   }
+}
 
+int kvs_lru_restore(kvs_lru_t* kvs_lru, const char* key, const char* value,
+                    bool referenced) {
+  if (kvs_index_get(kvs_lru->index, key)) {
+    return SUCCESS;
+  }
+  size_t charge = kvs_budget_charge(sizeof(cache_entry_t), key, value);
+  if (kvs_lru->size == kvs_lru->capacity || over_budget(kvs_lru, charge)) {
+    return FAILURE;
+  }
+  cache_entry_t* entry = make_entry(kvs_lru, key, value);
+  if (!entry) return FAILURE;
+  entry->next = NULL;
+  entry->prev = kvs_lru->tail;
+  if (kvs_lru->tail) {
+    kvs_lru->tail->next = entry;
+  }
+  kvs_lru->tail = entry;
+  if (!kvs_lru->head) {
+    kvs_lru->head = entry;
+  }
+  kvs_lru->size++;
   return SUCCESS;
 }
+
+size_t kvs_lru_memory(kvs_lru_t* kvs_lru) {
+  return kvs_lru->size * sizeof(cache_entry_t) +
+         kvs_arena_used(kvs_lru->arena) + kvs_index_memory(kvs_lru->index);
+}
@@ -1,14 +1,93 @@
 #pragma once
 
+#include <stddef.h>
+
 #include "kvs_base.h"
+#include "kvs_snapshot.h"
 
 struct kvs_lru;
 typedef struct kvs_lru kvs_lru_t;
 
 kvs_lru_t* kvs_lru_new(kvs_base_t* kvs, int capacity);
+
+/**
+ * `kvs_lru_new_budget` creates a cache bounded by `budget` bytes rather than
+ * a number of entries (see kvs_budget.h). Admitting an entry evicts as many
+ * entries from the tail as it takes to stay within the budget, and so does a
+ * SET that makes a resident value larger.
+ */
+kvs_lru_t* kvs_lru_new_budget(kvs_base_t* kvs, size_t budget);
+
+/**
+ * `kvs_lru_enable_compression` makes the cache store its values compressed
+ * where that saves memory (see `kvs_arena_pack`), and expand them on every
+ * hit. It is meant for byte budgets, which then hold more entries.
+ */
+void kvs_lru_enable_compression(kvs_lru_t* kvs_lru);
 void kvs_lru_free(kvs_lru_t** ptr);
 
 int kvs_lru_set(kvs_lru_t* kvs_lru, const char* key, const char* value);
 int kvs_lru_get(kvs_lru_t* kvs_lru, const char* key, char* value);
+
+/**
+ * `kvs_lru_get_cached` copies the value of `key` into `value` and counts the
+ * access only if the key is resident; otherwise it returns FAILURE without
+ * touching the disk. `kvs_lru_load` inserts a value the caller read from the
+ * disk after such a miss, as a clean entry. If the key became resident in
+ * the meantime, the resident value is copied into `value` instead.
+ * `kvs_lru_get` is the two steps together.
+ */
+int kvs_lru_get_cached(kvs_lru_t* kvs_lru, const char* key, char* value);
+int kvs_lru_load(kvs_lru_t* kvs_lru, const char* key, char* value);
+
+/**
+ * `kvs_lru_contains` reports whether `key` is resident without counting an
+ * access, so a caller can skip reading a value `kvs_lru_load` would not use.
+ */
+bool kvs_lru_contains(kvs_lru_t* kvs_lru, const char* key);
+
+/**
+ * `kvs_lru_peek` copies the value of `key` into `value` if it is resident,
+ * like `kvs_lru_get_cached`, but leaves the recency order alone, so that
+ * listing keys (see `kvs_scan`) does not look like using them.
+ */
+int kvs_lru_peek(kvs_lru_t* kvs_lru, const char* key, char* value);
+
 int kvs_lru_flush(kvs_lru_t* kvs_lru);
-#pragma once
+
+/**
+ * `kvs_lru_size` returns the number of resident entries.
+ */
+int kvs_lru_size(kvs_lru_t* kvs_lru);
+
+/**
+ * `kvs_lru_dirty` returns the number of modified entries.
+ */
+int kvs_lru_dirty(kvs_lru_t* kvs_lru);
+
+/**
+ * `kvs_lru_take_dirty` copies the key and value of the oldest modified entry
+ * into `key` and `value` and marks it clean, so the caller can write it back
+ * without holding up the cache. It returns FAILURE if nothing is dirty. If the
+ * write fails, `kvs_lru_mark_dirty` puts the entry back on the dirty list.
+ */
+int kvs_lru_take_dirty(kvs_lru_t* kvs_lru, char* key, char* value);
+void kvs_lru_mark_dirty(kvs_lru_t* kvs_lru, const char* key);
+
+/**
+ * `kvs_lru_snapshot` calls `fn` with every resident key, most recently used
+ * first. `kvs_lru_restore` adds a clean entry behind all resident ones, so
+ * restoring keys in that order rebuilds the recency order, and entries a
+ * running workload has loaded meanwhile stay ahead of restored ones. It never
+ * evicts: once the cache is full it returns FAILURE. A key that is already
+ * resident is left as it is.
+ */
+void kvs_lru_snapshot(kvs_lru_t* kvs_lru, kvs_snapshot_fn fn, void* arg);
+int kvs_lru_restore(kvs_lru_t* kvs_lru, const char* key, const char* value,
+                    bool referenced);
+
+/**
+ * `kvs_lru_memory` returns the bytes held by the resident entries: their
+ * slots in the pool plus their keys and values in the arena.
+ */
+size_t kvs_lru_memory(kvs_lru_t* kvs_lru);
@@ -0,0 +1,180 @@
+#include "kvs_lz.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// matches shorter than this cost more to encode than the literals
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+// a 4-bit field of the token, extended by bytes of 255 when it is full
+#define FIELD_MAX 15
+#define HASH_BITS 10
+
+static uint32_t read32(const char* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static unsigned hash4(uint32_t v) {
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/**
+ * `put_length` writes the part of a token field above `FIELD_MAX`, returning
+ * the new output position or NULL if it does not fit before `end`.
+ */
+static char* put_length(char* op, const char* end, size_t length) {
+  for (; length >= 255; length -= 255) {
+    if (op == end) return NULL;
+    *op++ = (char)255;
+  }
+  if (op == end) return NULL;
+  *op++ = (char)length;
+  return op;
+}
+
+/**
+ * `put_sequence` writes `literal_count` literals followed by a match of
+ * `match_length` bytes at `offset`; a `match_length` of 0 ends the block
+ * without a match.
+ */
+static char* put_sequence(char* op, const char* end, const char* literals,
+                          size_t literal_count, size_t offset,
+                          size_t match_length) {
+  if (op == end) return NULL;
+  char* token = op++;
+  size_t match_field = match_length ? match_length - MIN_MATCH : 0;
+  *token = (char)(((literal_count < FIELD_MAX ? literal_count : FIELD_MAX)
+                   << 4) |
+                  (match_field < FIELD_MAX ? match_field : FIELD_MAX));
+  if (literal_count >= FIELD_MAX &&
+      (op = put_length(op, end, literal_count - FIELD_MAX)) == NULL) {
+    return NULL;
+  }
+  if ((size_t)(end - op) < literal_count) return NULL;
+  memcpy(op, literals, literal_count);
+  op += literal_count;
+  if (match_length == 0) {
+    return op;
+  }
+  if (end - op < 2) return NULL;
+  *op++ = (char)(offset & 0xff);
+  *op++ = (char)(offset >> 8);
+  if (match_field >= FIELD_MAX &&
+      (op = put_length(op, end, match_field - FIELD_MAX)) == NULL) {
+    return NULL;
+  }
+  return op;
+}
+
+size_t kvs_lz_compress(const char* src, size_t length, char* dst,
+                       size_t capacity) {
+  // the position of the last 4 bytes seen with each hash, plus one
+  uint32_t table[1 << HASH_BITS] = {0};
+  const char* end = dst + capacity;
+  char* op = dst;
+  size_t anchor = 0;
+  size_t ip = 0;
+  while (ip + MIN_MATCH <= length) {
+    uint32_t sequence = read32(src + ip);
+    unsigned h = hash4(sequence);
+    size_t candidate = table[h];
+    table[h] = (uint32_t)ip + 1;
+    if (candidate == 0 || ip - (candidate - 1) > MAX_OFFSET ||
+        read32(src + candidate - 1) != sequence) {
+      ip += 1;
+      continue;
+    }
+    size_t ref = candidate - 1;
+    size_t match_length = MIN_MATCH;
+    while (ip + match_length < length &&
+           src[ref + match_length] == src[ip + match_length]) {
+      match_length += 1;
+    }
+    op = put_sequence(op, end, src + anchor, ip - anchor, ip - ref,
+                      match_length);
+    if (op == NULL) return 0;
+    ip += match_length;
+    anchor = ip;
+  }
+  op = put_sequence(op, end, src + anchor, length - anchor, 0, 0);
+  return op ? (size_t)(op - dst) : 0;
+}
+
+/**
+ * `copy_forward` copies `count` bytes from `src` to `dst` front to back, 8 at
+ * a time, so it also repeats a match that overlaps its output by 8 bytes or
+ * more. The short fixed-size copies compile to plain moves.
+ */
+static void copy_forward(char* dst, const char* src, size_t count) {
+  for (; count >= 8; count -= 8, dst += 8, src += 8) {
+    memcpy(dst, src, 8);
+  }
+  while (count-- > 0) {
+    *dst++ = *src++;
+  }
+}
+
+/**
+ * `get_length` adds the extension bytes of a full token field to `*length`,
+ * returning the new input position or NULL if the input ends first.
+ */
+static const char* get_length(const char* ip, const char* end,
+                              size_t* length) {
+  unsigned char byte;
+  do {
+    if (ip == end) return NULL;
+    byte = (unsigned char)*ip++;
+    *length += byte;
+  } while (byte == 255);
+  return ip;
+}
+
+long kvs_lz_decompress(const char* src, size_t length, char* dst,
+                       size_t capacity) {
+  const char* ip = src;
+  const char* end = src + length;
+  size_t op = 0;
+  while (ip < end) {
+    unsigned char token = (unsigned char)*ip++;
+    size_t literal_count = token >> 4;
+    if (literal_count == FIELD_MAX &&
+        (ip = get_length(ip, end, &literal_count)) == NULL) {
+      return -1;
+    }
+    if ((size_t)(end - ip) < literal_count ||
+        capacity - op < literal_count) {
+      return -1;
+    }
+    copy_forward(dst + op, ip, literal_count);
+    ip += literal_count;
+    op += literal_count;
+    if (ip == end) {
+      break;
+    }
+
+    if (end - ip < 2) return -1;
+    size_t offset = (unsigned char)ip[0] | (unsigned char)ip[1] << 8;
+    ip += 2;
+    size_t match_length = token & FIELD_MAX;
+    if (match_length == FIELD_MAX &&
+        (ip = get_length(ip, end, &match_length)) == NULL) {
+      return -1;
+    }
+    match_length += MIN_MATCH;
+    if (offset == 0 || offset > op || capacity - op < match_length) {
+      return -1;
+    }
+    if (offset >= 8) {
+      copy_forward(dst + op, dst + op - offset, match_length);
+    } else {
+      // byte by byte, since the match repeats a run shorter than a word
+      for (size_t i = 0; i < match_length; ++i) {
+        dst[op + i] = dst[op - offset + i];
+      }
+    }
+    op += match_length;
+  }
+  return (long)op;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * kvs_lz.h is a small LZ77 codec for cached values, in the spirit of LZ4: the
+ * output is a series of sequences, each a token byte holding a literal count
+ * and a match length, the literals, and a 2-byte offset back to where the
+ * match is copied from. It favors speed over ratio and needs no buffers
+ * beyond its output, which suits values of a few hundred bytes that are
+ * decompressed on every cache hit.
+ */
+
+/**
+ * `kvs_lz_compress` compresses the `length` bytes at `src` into `dst` and
+ * returns the compressed length, or 0 if it would take more than `capacity`
+ * bytes. Passing a `capacity` below `length` makes it give up on input that
+ * would not shrink enough to be worth it.
+ */
+size_t kvs_lz_compress(const char* src, size_t length, char* dst,
+                       size_t capacity);
+
+/**
+ * `kvs_lz_decompress` expands the `length` bytes at `src` into `dst` and
+ * returns the expanded length, or -1 if `src` is corrupt or would expand
+ * past `capacity` bytes.
+ */
+long kvs_lz_decompress(const char* src, size_t length, char* dst,
+                       size_t capacity);
@@ -0,0 +1,70 @@
+#include "kvs_pool.h"
+
+#include <stdalign.h>
+#include <stdlib.h>
+
+typedef struct free_item {
+  struct free_item* next;
+} free_item_t;
+
+struct kvs_pool {
+  char* items;
+  size_t item_size;
+  int capacity;
+  // entries past `fresh` have never been handed out
+  int fresh;
+  free_item_t* free_list;
+};
+
+kvs_pool_t* kvs_pool_new(size_t item_size, int capacity) {
+  kvs_pool_t* pool = malloc(sizeof(kvs_pool_t));
+  if (!pool) return NULL;
+
+  // every entry must be able to hold the free-list link
+  if (item_size < sizeof(free_item_t)) {
+    item_size = sizeof(free_item_t);
+  }
+  size_t align = alignof(max_align_t);
+  pool->item_size = (item_size + align - 1) / align * align;
+  pool->capacity = capacity;
+  pool->fresh = 0;
+  pool->free_list = NULL;
+  pool->items = calloc(capacity > 0 ? capacity : 1, pool->item_size);
+  if (!pool->items) {
+    free(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+void kvs_pool_free(kvs_pool_t** ptr) {
+  if (ptr && *ptr) {
+    free((*ptr)->items);
+    free(*ptr);
+    *ptr = NULL;
+  }
+}
+
+void* kvs_pool_alloc(kvs_pool_t* pool) {
+  if (pool->free_list) {
+    free_item_t* item = pool->free_list;
+    pool->free_list = item->next;
+    return item;
+  }
+  if (pool->fresh < pool->capacity) {
+    return kvs_pool_at(pool, pool->fresh++);
+  }
+  return NULL;
+}
+
+void kvs_pool_release(kvs_pool_t* pool, void* item) {
+  free_item_t* released = item;
+  released->next = pool->free_list;
+  pool->free_list = released;
+}
+
+void* kvs_pool_at(kvs_pool_t* pool, int i) {
+  return pool->items + (size_t)i * pool->item_size;
+}
+
+int kvs_pool_span(const kvs_pool_t* pool) { return pool->fresh; }
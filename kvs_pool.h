@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * `kvs_pool_t` is a fixed-capacity allocator for cache entries. All entries
+ * live in one contiguous block allocated by `kvs_pool_new`; released entries
+ * are kept on an intrusive free list (the link is stored inside the released
+ * entry itself), so allocating and releasing never touch the heap.
+ */
+struct kvs_pool;
+typedef struct kvs_pool kvs_pool_t;
+
+kvs_pool_t* kvs_pool_new(size_t item_size, int capacity);
+void kvs_pool_free(kvs_pool_t** ptr);
+
+/**
+ * `kvs_pool_alloc` returns an unused entry, or NULL if all `capacity` entries
+ * are in use. A fresh pool hands out entries in index order.
+ */
+void* kvs_pool_alloc(kvs_pool_t* pool);
+
+/**
+ * `kvs_pool_release` gives `item` back to the pool.
+ */
+void kvs_pool_release(kvs_pool_t* pool, void* item);
+
+/**
+ * `kvs_pool_at` returns the entry at position `i` of the block.
+ */
+void* kvs_pool_at(kvs_pool_t* pool, int i);
+
+/**
+ * `kvs_pool_span` returns how many entries at the start of the block have
+ * ever been handed out. The entries past it are untouched and zeroed.
+ */
+int kvs_pool_span(const kvs_pool_t* pool);
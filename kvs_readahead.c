@@ -0,0 +1,154 @@
+#include "kvs_readahead.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+
+struct kvs_readahead {
+  pthread_mutex_t lock;
+  // signalled when keys are queued or the workers should stop
+  pthread_cond_t work;
+  // signalled when the queue empties and no batch is in flight
+  pthread_cond_t idle;
+  // a ring of `capacity` keys, the oldest at `head`
+  char (*keys)[KVS_KEY_MAX];
+  int capacity;
+  int head;
+  int length;
+  // workers handling a batch
+  int busy;
+  bool stop;
+  kvs_readahead_fn fn;
+  void* arg;
+  int thread_count;
+  pthread_t* threads;
+};
+
+static void* worker_loop(void* arg) {
+  kvs_readahead_t* readahead = arg;
+  char(*keys)[KVS_KEY_MAX] = malloc(KVS_READAHEAD_BATCH * sizeof(*keys));
+  const char* key_ptrs[KVS_READAHEAD_BATCH];
+  if (keys == NULL) {
+    return NULL;
+  }
+  pthread_mutex_lock(&readahead->lock);
+  while (!readahead->stop) {
+    if (readahead->length == 0) {
+      pthread_cond_wait(&readahead->work, &readahead->lock);
+      continue;
+    }
+    int count = readahead->length < KVS_READAHEAD_BATCH ? readahead->length
+                                                        : KVS_READAHEAD_BATCH;
+    for (int i = 0; i < count; ++i) {
+      strcpy(keys[i], readahead->keys[readahead->head]);
+      key_ptrs[i] = keys[i];
+      readahead->head = (readahead->head + 1) % readahead->capacity;
+    }
+    readahead->length -= count;
+    readahead->busy += 1;
+    pthread_mutex_unlock(&readahead->lock);
+
+    readahead->fn(readahead->arg, count, key_ptrs);
+
+    pthread_mutex_lock(&readahead->lock);
+    readahead->busy -= 1;
+    if (readahead->length == 0 && readahead->busy == 0) {
+      pthread_cond_broadcast(&readahead->idle);
+    }
+  }
+  pthread_mutex_unlock(&readahead->lock);
+  free(keys);
+  return NULL;
+}
+
+kvs_readahead_t* kvs_readahead_new(int threads, int capacity,
+                                   kvs_readahead_fn fn, void* arg) {
+  kvs_readahead_t* readahead = malloc(sizeof(kvs_readahead_t));
+  if (readahead == NULL) {
+    return NULL;
+  }
+  readahead->keys = malloc(capacity * sizeof(*readahead->keys));
+  readahead->threads = malloc(threads * sizeof(pthread_t));
+  if (readahead->keys == NULL || readahead->threads == NULL) {
+    free(readahead->keys);
+    free(readahead->threads);
+    free(readahead);
+    return NULL;
+  }
+  pthread_mutex_init(&readahead->lock, NULL);
+  pthread_cond_init(&readahead->work, NULL);
+  pthread_cond_init(&readahead->idle, NULL);
+  readahead->capacity = capacity;
+  readahead->head = 0;
+  readahead->length = 0;
+  readahead->busy = 0;
+  readahead->stop = false;
+  readahead->fn = fn;
+  readahead->arg = arg;
+  readahead->thread_count = 0;
+  for (int i = 0; i < threads; ++i) {
+    if (pthread_create(&readahead->threads[i], NULL, worker_loop, readahead) !=
+        0) {
+      break;
+    }
+    readahead->thread_count += 1;
+  }
+  if (readahead->thread_count == 0) {
+    kvs_readahead_free(&readahead);
+  }
+  return readahead;
+}
+
+void kvs_readahead_free(kvs_readahead_t** ptr) {
+  if (ptr && *ptr) {
+    kvs_readahead_t* readahead = *ptr;
+    pthread_mutex_lock(&readahead->lock);
+    readahead->stop = true;
+    readahead->length = 0;
+    pthread_cond_broadcast(&readahead->work);
+    pthread_cond_broadcast(&readahead->idle);
+    pthread_mutex_unlock(&readahead->lock);
+    for (int i = 0; i < readahead->thread_count; ++i) {
+      pthread_join(readahead->threads[i], NULL);
+    }
+    pthread_cond_destroy(&readahead->idle);
+    pthread_cond_destroy(&readahead->work);
+    pthread_mutex_destroy(&readahead->lock);
+    free(readahead->keys);
+    free(readahead->threads);
+    free(readahead);
+    *ptr = NULL;
+  }
+}
+
+int kvs_readahead_push(kvs_readahead_t* readahead, int count,
+                       const char** keys) {
+  pthread_mutex_lock(&readahead->lock);
+  int queued = 0;
+  for (int i = 0; i < count && readahead->length < readahead->capacity; ++i) {
+    size_t length = strlen(keys[i]);
+    if (length >= KVS_KEY_MAX) {
+      continue;
+    }
+    int tail = (readahead->head + readahead->length) % readahead->capacity;
+    memcpy(readahead->keys[tail], keys[i], length + 1);
+    readahead->length += 1;
+    queued += 1;
+  }
+  if (queued > 0) {
+    pthread_cond_broadcast(&readahead->work);
+  }
+  pthread_mutex_unlock(&readahead->lock);
+  return queued;
+}
+
+void kvs_readahead_wait(kvs_readahead_t* readahead) {
+  pthread_mutex_lock(&readahead->lock);
+  while (!readahead->stop && (readahead->length > 0 || readahead->busy > 0)) {
+    pthread_cond_wait(&readahead->idle, &readahead->lock);
+  }
+  pthread_mutex_unlock(&readahead->lock);
+}
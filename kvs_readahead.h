@@ -0,0 +1,46 @@
+#pragma once
+
+/**
+ * `KVS_READAHEAD_BATCH` is the most keys a worker takes off the queue at
+ * once and hands to its `kvs_readahead_fn`.
+ */
+#define KVS_READAHEAD_BATCH 64
+
+/**
+ * `kvs_readahead_fn` handles a batch of queued keys on a worker thread.
+ */
+typedef void (*kvs_readahead_fn)(void* arg, int count, const char** keys);
+
+/**
+ * `kvs_readahead_t` is a bounded queue of keys and a few threads that work it
+ * off, so a caller can hand over reads it wants done soon without waiting for
+ * them (see `kvs_prefetch`). The queue copies the keys.
+ */
+struct kvs_readahead;
+typedef struct kvs_readahead kvs_readahead_t;
+
+/**
+ * `kvs_readahead_new` starts `threads` workers calling `fn` with `arg`. The
+ * queue holds up to `capacity` keys.
+ */
+kvs_readahead_t* kvs_readahead_new(int threads, int capacity,
+                                   kvs_readahead_fn fn, void* arg);
+
+/**
+ * `kvs_readahead_free` stops the workers once they finish the batches they
+ * are handling. Keys still queued are dropped.
+ */
+void kvs_readahead_free(kvs_readahead_t** ptr);
+
+/**
+ * `kvs_readahead_push` queues `count` keys and returns how many fit; the
+ * rest are dropped. It never blocks on the workers.
+ */
+int kvs_readahead_push(kvs_readahead_t* readahead, int count,
+                       const char** keys);
+
+/**
+ * `kvs_readahead_wait` returns once the queue is empty and no worker is
+ * handling a batch.
+ */
+void kvs_readahead_wait(kvs_readahead_t* readahead);
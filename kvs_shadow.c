@@ -0,0 +1,264 @@
+#include "kvs_shadow.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kvs_index.h"
+
+#define POLICY_COUNT 6
+#define SIZE_COUNT 5
+
+static const kvs_replacement_policy policies[POLICY_COUNT] = {
+    KVS_CACHE_FIFO, KVS_CACHE_CLOCK, KVS_CACHE_LRU,
+    KVS_CACHE_ARC,  KVS_CACHE_2Q,    KVS_CACHE_TINYLFU,
+};
+
+// model sizes in quarters of the real capacity
+static const int quarters[SIZE_COUNT] = {1, 2, 4, 8, 16};
+
+typedef struct model {
+  kvs_replacement_policy policy;
+  // entries of the cache the model stands for
+  int capacity;
+  // hits among the sampled GETs, decayed with `kvs_shadow_t.gets`
+  double hits;
+  union {
+    kvs_fifo_t* fifo;
+    kvs_clock_t* clock;
+    kvs_lru_t* lru;
+    kvs_arc_t* arc;
+    kvs_2q_t* two_q;
+    kvs_tinylfu_t* tinylfu;
+  };
+} model_t;
+
+struct kvs_shadow {
+  pthread_mutex_t lock;
+  // a key is sampled when these bits of its hash are all zero, one key in
+  // `rate`
+  uint64_t sample_mask;
+  int rate;
+  // every GET, sampled or not, and its count at the end of the last window
+  atomic_ullong requests;
+  unsigned long long window_start;
+  // sampled GETs, and the GETs a sample of exactly one in `rate` would have
+  // taken; both are halved at the end of every window
+  unsigned long samples;
+  double gets;
+  double expected;
+  model_t models[POLICY_COUNT * SIZE_COUNT];
+  // what the models count their evictions in; they only hold clean entries,
+  // so nothing else of it is used
+  kvs_base_t base;
+};
+
+static int model_new(model_t* model, kvs_base_t* base, int entries) {
+  switch (model->policy) {
+    case KVS_CACHE_FIFO:
+      return (model->fifo = kvs_fifo_new(base, entries)) ? SUCCESS : FAILURE;
+    case KVS_CACHE_CLOCK:
+      return (model->clock = kvs_clock_new(base, entries)) ? SUCCESS
+                                                            : FAILURE;
+    case KVS_CACHE_LRU:
+      return (model->lru = kvs_lru_new(base, entries)) ? SUCCESS : FAILURE;
+    case KVS_CACHE_ARC:
+      return (model->arc = kvs_arc_new(base, entries)) ? SUCCESS : FAILURE;
+    case KVS_CACHE_2Q:
+      return (model->two_q = kvs_2q_new(base, entries)) ? SUCCESS : FAILURE;
+    case KVS_CACHE_TINYLFU:
+      return (model->tinylfu = kvs_tinylfu_new(base, entries)) ? SUCCESS
+                                                                : FAILURE;
+    default:
+      return FAILURE;
+  }
+}
+
+static void model_free(model_t* model) {
+  switch (model->policy) {
+    case KVS_CACHE_FIFO:
+      kvs_fifo_free(&model->fifo);
+      break;
+    case KVS_CACHE_CLOCK:
+      kvs_clock_free(&model->clock);
+      break;
+    case KVS_CACHE_LRU:
+      kvs_lru_free(&model->lru);
+      break;
+    case KVS_CACHE_ARC:
+      kvs_arc_free(&model->arc);
+      break;
+    case KVS_CACHE_2Q:
+      kvs_2q_free(&model->two_q);
+      break;
+    case KVS_CACHE_TINYLFU:
+      kvs_tinylfu_free(&model->tinylfu);
+      break;
+    default:
+      break;
+  }
+}
+
+/**
+ * `model_access` looks `key` up in the model and loads it on a miss,
+ * returning whether it hit.
+ */
+static bool model_access(model_t* model, const char* key) {
+  char value[KVS_VALUE_MAX];
+  int rc = FAILURE;
+  switch (model->policy) {
+    case KVS_CACHE_FIFO:
+      if ((rc = kvs_fifo_get_cached(model->fifo, key, value)) != SUCCESS) {
+        kvs_fifo_load(model->fifo, key, "");
+      }
+      break;
+    case KVS_CACHE_CLOCK:
+      if ((rc = kvs_clock_get_cached(model->clock, key, value)) != SUCCESS) {
+        kvs_clock_load(model->clock, key, "");
+      }
+      break;
+    case KVS_CACHE_LRU:
+      if ((rc = kvs_lru_get_cached(model->lru, key, value)) != SUCCESS) {
+        kvs_lru_load(model->lru, key, "");
+      }
+      break;
+    case KVS_CACHE_ARC:
+      if ((rc = kvs_arc_get_cached(model->arc, key, value)) != SUCCESS) {
+        kvs_arc_load(model->arc, key, "");
+      }
+      break;
+    case KVS_CACHE_2Q:
+      if ((rc = kvs_2q_get_cached(model->two_q, key, value)) != SUCCESS) {
+        kvs_2q_load(model->two_q, key, "");
+      }
+      break;
+    case KVS_CACHE_TINYLFU:
+      if ((rc = kvs_tinylfu_get_cached(model->tinylfu, key, value)) !=
+          SUCCESS) {
+        kvs_tinylfu_load(model->tinylfu, key, "");
+      }
+      break;
+    default:
+      break;
+  }
+  return rc == SUCCESS;
+}
+
+kvs_shadow_t* kvs_shadow_new(int capacity) {
+  kvs_shadow_t* shadow = malloc(sizeof(kvs_shadow_t));
+  if (shadow == NULL) {
+    return NULL;
+  }
+  memset(&shadow->base, 0, sizeof(shadow->base));
+  kvs_metrics_init(&shadow->base.metrics);
+  // as few keys as leave the smallest model its minimum
+  int rate = 1;
+  while (capacity * quarters[0] / 4 / (rate * 2) >= KVS_SHADOW_MIN) {
+    rate *= 2;
+  }
+  shadow->sample_mask = (uint64_t)(rate - 1);
+  shadow->rate = rate;
+  atomic_init(&shadow->requests, 0);
+  shadow->window_start = 0;
+  shadow->samples = 0;
+  shadow->gets = 0;
+  shadow->expected = 0;
+  int count = 0;
+  for (int p = 0; p < POLICY_COUNT; ++p) {
+    for (int s = 0; s < SIZE_COUNT; ++s) {
+      model_t* model = &shadow->models[count];
+      model->policy = policies[p];
+      model->capacity = capacity * quarters[s] / 4;
+      model->hits = 0;
+      int entries = model->capacity / rate;
+      if (model_new(model, &shadow->base, entries > 0 ? entries : 1) !=
+          SUCCESS) {
+        for (int i = 0; i < count; ++i) {
+          model_free(&shadow->models[i]);
+        }
+        free(shadow);
+        return NULL;
+      }
+      count += 1;
+    }
+  }
+  pthread_mutex_init(&shadow->lock, NULL);
+  return shadow;
+}
+
+void kvs_shadow_free(kvs_shadow_t** ptr) {
+  if (ptr && *ptr) {
+    kvs_shadow_t* shadow = *ptr;
+    for (int i = 0; i < POLICY_COUNT * SIZE_COUNT; ++i) {
+      model_free(&shadow->models[i]);
+    }
+    pthread_mutex_destroy(&shadow->lock);
+    free(shadow);
+    *ptr = NULL;
+  }
+}
+
+bool kvs_shadow_access(kvs_shadow_t* shadow, const char* key, bool get) {
+  if (get) {
+    atomic_fetch_add_explicit(&shadow->requests, 1, memory_order_relaxed);
+  }
+  // bits 16 and up, clear of the index slot in the low bits
+  if (((kvs_hash(key) >> 16) & shadow->sample_mask) != 0) {
+    return false;
+  }
+  bool window = false;
+  pthread_mutex_lock(&shadow->lock);
+  for (int i = 0; i < POLICY_COUNT * SIZE_COUNT; ++i) {
+    model_t* model = &shadow->models[i];
+    bool hit = model_access(model, key);
+    if (get) {
+      model->hits += hit;
+    }
+  }
+  if (get) {
+    shadow->gets += 1;
+    if (++shadow->samples % KVS_SHADOW_WINDOW == 0) {
+      unsigned long long requests = atomic_load(&shadow->requests);
+      shadow->expected +=
+          (double)(requests - shadow->window_start) / shadow->rate;
+      shadow->window_start = requests;
+      shadow->gets /= 2;
+      shadow->expected /= 2;
+      for (int i = 0; i < POLICY_COUNT * SIZE_COUNT; ++i) {
+        shadow->models[i].hits /= 2;
+      }
+      window = true;
+    }
+  }
+  pthread_mutex_unlock(&shadow->lock);
+  return window;
+}
+
+int kvs_shadow_curve(kvs_shadow_t* shadow, kvs_mrc_point_t* points,
+                     int max) {
+  int count = 0;
+  pthread_mutex_lock(&shadow->lock);
+  double expected =
+      shadow->expected +
+      (double)(atomic_load(&shadow->requests) - shadow->window_start) /
+          shadow->rate;
+  // as in SHARDS-adj, a sample that took more or fewer GETs than its share
+  // is put down to the hottest keys, which hit at every size, so the
+  // difference is taken off or added to the hits
+  double surplus = shadow->gets - expected;
+  for (int i = 0; i < POLICY_COUNT * SIZE_COUNT && count < max; ++i) {
+    model_t* model = &shadow->models[i];
+    double hit_rate =
+        expected > 0 && shadow->gets > 0
+            ? (model->hits - surplus) / expected
+            : 0;
+    points[count].policy = model->policy;
+    points[count].capacity = model->capacity;
+    points[count].hit_rate =
+        hit_rate < 0 ? 0 : hit_rate > 1 ? 1 : hit_rate;
+    count += 1;
+  }
+  pthread_mutex_unlock(&shadow->lock);
+  return count;
+}
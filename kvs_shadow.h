@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "kvs.h"
+
+/**
+ * `KVS_SHADOW_MIN` is the fewest entries a sampled model holds; fewer would
+ * make its hit rate too noisy to use.
+ */
+#define KVS_SHADOW_MIN 32
+
+/**
+ * `KVS_SHADOW_WINDOW` is how many sampled GETs make up a window of a model.
+ * At the end of each one its hit counts are halved, so its hit rate follows
+ * the last few windows rather than the whole history.
+ */
+#define KVS_SHADOW_WINDOW 4096
+
+/**
+ * `kvs_shadow_t` predicts the hit rate every policy would get at several
+ * capacities, by replaying a sample of the requests against small caches
+ * (see `kvs_mrc`). In the manner of SHARDS, the models see a key only when
+ * its hash falls in a fixed 1/R of the hash space, and each holds 1/R of the
+ * entries of the cache it stands for; R is the largest power of two that
+ * leaves the smallest model `KVS_SHADOW_MIN` entries or more, so most
+ * requests touch no model at all. Each model is a real policy instance
+ * holding empty values, and never reads or writes the store.
+ */
+struct kvs_shadow;
+typedef struct kvs_shadow kvs_shadow_t;
+
+/**
+ * `kvs_shadow_new` models caches of a quarter, half, one, two and four times
+ * `capacity` entries.
+ */
+kvs_shadow_t* kvs_shadow_new(int capacity);
+void kvs_shadow_free(kvs_shadow_t** ptr);
+
+/**
+ * `kvs_shadow_access` replays a request for `key` against the models that
+ * sample it: a `get` counts towards their hit rates, and either kind loads
+ * the key on a miss, as the cache would. It returns true for the call that
+ * completes a window. Calls from several threads are serialized.
+ */
+bool kvs_shadow_access(kvs_shadow_t* shadow, const char* key, bool get);
+
+/**
+ * `kvs_shadow_curve` writes up to `max` points of the predicted curves, by
+ * policy and then by capacity, and returns how many it wrote.
+ */
+int kvs_shadow_curve(kvs_shadow_t* shadow, kvs_mrc_point_t* points, int max);
@@ -0,0 +1,88 @@
+#include "kvs_sketch.h"
+
+#include <stdlib.h>
+
+#define KVS_SKETCH_ROWS 4
+// counters saturate like the 4-bit counters of TinyLFU
+#define KVS_SKETCH_COUNTER_MAX 15
+#define KVS_SKETCH_SAMPLE_FACTOR 10
+
+struct kvs_sketch {
+  size_t mask;
+  long additions;
+  long sample_size;
+  uint8_t* rows[KVS_SKETCH_ROWS];
+  uint8_t* counters;
+};
+
+kvs_sketch_t* kvs_sketch_new(int capacity) {
+  kvs_sketch_t* sketch = malloc(sizeof(kvs_sketch_t));
+  if (!sketch) return NULL;
+
+  size_t width = 64;
+  while (width < (size_t)capacity) {
+    width *= 2;
+  }
+  sketch->counters = calloc(width * KVS_SKETCH_ROWS, sizeof(uint8_t));
+  if (!sketch->counters) {
+    free(sketch);
+    return NULL;
+  }
+  for (int row = 0; row < KVS_SKETCH_ROWS; ++row) {
+    sketch->rows[row] = sketch->counters + row * width;
+  }
+  sketch->mask = width - 1;
+  sketch->additions = 0;
+  sketch->sample_size = (long)width * KVS_SKETCH_SAMPLE_FACTOR;
+  return sketch;
+}
+
+void kvs_sketch_free(kvs_sketch_t** ptr) {
+  if (ptr && *ptr) {
+    free((*ptr)->counters);
+    free(*ptr);
+    *ptr = NULL;
+  }
+}
+
+// each row takes a different 16-bit slice of the hash, remixed so that rows
+// wider than 2^16 still spread
+static size_t sketch_slot(kvs_sketch_t* sketch, uint64_t hash, int row) {
+  uint64_t h = (hash >> (16 * row)) * 0x9e3779b97f4a7c15ULL + hash;
+  return (h ^ (h >> 29)) & sketch->mask;
+}
+
+static void sketch_age(kvs_sketch_t* sketch) {
+  size_t total = (sketch->mask + 1) * KVS_SKETCH_ROWS;
+  for (size_t i = 0; i < total; ++i) {
+    sketch->counters[i] >>= 1;
+  }
+  sketch->additions /= 2;
+}
+
+void kvs_sketch_increment(kvs_sketch_t* sketch, uint64_t hash) {
+  for (int row = 0; row < KVS_SKETCH_ROWS; ++row) {
+    uint8_t* counter = &sketch->rows[row][sketch_slot(sketch, hash, row)];
+    if (*counter < KVS_SKETCH_COUNTER_MAX) {
+      (*counter)++;
+    }
+  }
+  if (++sketch->additions >= sketch->sample_size) {
+    sketch_age(sketch);
+  }
+}
+
+int kvs_sketch_estimate(kvs_sketch_t* sketch, uint64_t hash) {
+  int estimate = KVS_SKETCH_COUNTER_MAX;
+  for (int row = 0; row < KVS_SKETCH_ROWS; ++row) {
+    int count = sketch->rows[row][sketch_slot(sketch, hash, row)];
+    if (count < estimate) {
+      estimate = count;
+    }
+  }
+  return estimate;
+}
+
+size_t kvs_sketch_memory(const kvs_sketch_t* sketch) {
+  return (sketch->mask + 1) * KVS_SKETCH_ROWS;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * `kvs_sketch_t` is a count-min sketch estimating how often each key has been
+ * seen recently. It keeps four rows of small saturating counters and
+ * estimates a key's frequency as the least of its four counters. Once it has
+ * counted ten times as many events as it was sized for, every counter is
+ * halved, so old popularity fades and the sketch follows shifts in the
+ * workload.
+ */
+struct kvs_sketch;
+typedef struct kvs_sketch kvs_sketch_t;
+
+/**
+ * `kvs_sketch_new` creates a sketch sized to tell apart about `capacity`
+ * distinct keys.
+ */
+kvs_sketch_t* kvs_sketch_new(int capacity);
+void kvs_sketch_free(kvs_sketch_t** ptr);
+
+/**
+ * Like the Bloom filter, the sketch takes the 64-bit hash of a key
+ * (`kvs_hash`).
+ */
+void kvs_sketch_increment(kvs_sketch_t* sketch, uint64_t hash);
+int kvs_sketch_estimate(kvs_sketch_t* sketch, uint64_t hash);
+
+/**
+ * `kvs_sketch_memory` returns the bytes taken by the counters.
+ */
+size_t kvs_sketch_memory(const kvs_sketch_t* sketch);
@@ -0,0 +1,121 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "kvs_snapshot.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "constants.h"
+
+#define SNAPSHOT_FILE ".kvs-snapshot"
+#define SNAPSHOT_TEMP ".kvs-snapshot.tmp"
+// the header, which also versions the format
+#define SNAPSHOT_MAGIC "KVSSNAP1"
+#define SNAPSHOT_MAGIC_LENGTH 8
+
+// record flags
+#define SNAPSHOT_REFERENCED 1
+
+struct kvs_snapshot {
+  FILE* file;
+  int dirfd;
+  // whether this snapshot is being created rather than read
+  bool writing;
+  bool failed;
+};
+
+static kvs_snapshot_t* snapshot_new(int dirfd, const char* name, int flags,
+                                    const char* mode) {
+  kvs_snapshot_t* snapshot = malloc(sizeof(kvs_snapshot_t));
+  if (snapshot == NULL) {
+    return NULL;
+  }
+  int fd = openat(dirfd, name, flags | O_CLOEXEC, 0666);
+  snapshot->file = fd >= 0 ? fdopen(fd, mode) : NULL;
+  if (snapshot->file == NULL) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    free(snapshot);
+    return NULL;
+  }
+  snapshot->dirfd = dirfd;
+  snapshot->writing = flags != O_RDONLY;
+  snapshot->failed = false;
+  return snapshot;
+}
+
+kvs_snapshot_t* kvs_snapshot_create(int dirfd) {
+  kvs_snapshot_t* snapshot = snapshot_new(
+      dirfd, SNAPSHOT_TEMP, O_WRONLY | O_CREAT | O_TRUNC, "w");
+  if (snapshot &&
+      fwrite(SNAPSHOT_MAGIC, 1, SNAPSHOT_MAGIC_LENGTH, snapshot->file) !=
+          SNAPSHOT_MAGIC_LENGTH) {
+    snapshot->failed = true;
+  }
+  return snapshot;
+}
+
+int kvs_snapshot_add(kvs_snapshot_t* snapshot, const char* key,
+                     bool referenced) {
+  size_t length = strlen(key);
+  unsigned char header[2] = {referenced ? SNAPSHOT_REFERENCED : 0,
+                             (unsigned char)length};
+  if (length >= KVS_KEY_MAX || fwrite(header, 1, 2, snapshot->file) != 2 ||
+      fwrite(key, 1, length, snapshot->file) != length) {
+    snapshot->failed = true;
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+int kvs_snapshot_commit(kvs_snapshot_t** ptr) {
+  kvs_snapshot_t* snapshot = *ptr;
+  int dirfd = snapshot->dirfd;
+  bool failed = snapshot->failed;
+  failed |= fclose(snapshot->file) != 0;
+  free(snapshot);
+  *ptr = NULL;
+  if (failed || renameat(dirfd, SNAPSHOT_TEMP, dirfd, SNAPSHOT_FILE) != 0) {
+    unlinkat(dirfd, SNAPSHOT_TEMP, 0);
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+kvs_snapshot_t* kvs_snapshot_open(int dirfd) {
+  kvs_snapshot_t* snapshot = snapshot_new(dirfd, SNAPSHOT_FILE, O_RDONLY, "r");
+  char magic[SNAPSHOT_MAGIC_LENGTH];
+  if (snapshot &&
+      (fread(magic, 1, SNAPSHOT_MAGIC_LENGTH, snapshot->file) !=
+           SNAPSHOT_MAGIC_LENGTH ||
+       memcmp(magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LENGTH) != 0)) {
+    kvs_snapshot_free(&snapshot);
+  }
+  return snapshot;
+}
+
+int kvs_snapshot_next(kvs_snapshot_t* snapshot, char* key, bool* referenced) {
+  unsigned char header[2];
+  if (fread(header, 1, 2, snapshot->file) != 2 || header[1] >= KVS_KEY_MAX ||
+      fread(key, 1, header[1], snapshot->file) != header[1]) {
+    return FAILURE;
+  }
+  key[header[1]] = '\0';
+  *referenced = header[0] & SNAPSHOT_REFERENCED;
+  return SUCCESS;
+}
+
+void kvs_snapshot_free(kvs_snapshot_t** ptr) {
+  if (ptr && *ptr) {
+    fclose((*ptr)->file);
+    if ((*ptr)->writing) {
+      unlinkat((*ptr)->dirfd, SNAPSHOT_TEMP, 0);
+    }
+    free(*ptr);
+    *ptr = NULL;
+  }
+}
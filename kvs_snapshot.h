@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * `kvs_snapshot_t` is the file that carries a cache's resident keys across a
+ * restart (see `kvs_config_t.snapshot`). It lists keys only, never values:
+ * those are read back from the store when the snapshot is loaded, so an old
+ * snapshot can cost hits but never return a stale value. After a short
+ * header, each record is a flags byte, a length byte and the key.
+ */
+struct kvs_snapshot;
+typedef struct kvs_snapshot kvs_snapshot_t;
+
+/**
+ * `kvs_snapshot_fn` is how a policy hands its resident keys to a snapshot,
+ * in the order its `restore` function rebuilds them from. `referenced` is
+ * the CLOCK reference bit; other policies pass false.
+ */
+typedef void (*kvs_snapshot_fn)(void* arg, const char* key, bool referenced);
+
+/**
+ * `kvs_snapshot_create` starts a new snapshot in the directory open as
+ * `dirfd`. It is written to a temporary file and only replaces the previous
+ * snapshot in `kvs_snapshot_commit`, so a crash while saving leaves the old
+ * one in place.
+ */
+kvs_snapshot_t* kvs_snapshot_create(int dirfd);
+int kvs_snapshot_add(kvs_snapshot_t* snapshot, const char* key,
+                     bool referenced);
+int kvs_snapshot_commit(kvs_snapshot_t** ptr);
+
+/**
+ * `kvs_snapshot_open` opens the snapshot in the directory open as `dirfd`,
+ * or returns NULL if there is none or it is not a snapshot.
+ */
+kvs_snapshot_t* kvs_snapshot_open(int dirfd);
+
+/**
+ * `kvs_snapshot_next` reads the next key into `key` (`KVS_KEY_MAX` bytes).
+ * It returns FAILURE at the end of the snapshot, or at a truncated record.
+ */
+int kvs_snapshot_next(kvs_snapshot_t* snapshot, char* key, bool* referenced);
+
+/**
+ * `kvs_snapshot_free` closes a snapshot that was opened, or abandons one
+ * being created.
+ */
+void kvs_snapshot_free(kvs_snapshot_t** ptr);
@@ -0,0 +1,172 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "kvs_stats.h"
+
+#include <time.h>
+
+static void histogram_init(kvs_histogram_t* histogram) {
+  for (int i = 0; i < KVS_HISTOGRAM_BUCKETS; ++i) {
+    atomic_init(&histogram->counts[i], 0);
+  }
+  atomic_init(&histogram->total, 0);
+  atomic_init(&histogram->max, 0);
+}
+
+void kvs_metrics_init(kvs_metrics_t* metrics) {
+  for (int i = 0; i < KVS_STATS_LATENCIES; ++i) {
+    histogram_init(&metrics->latencies[i]);
+  }
+  atomic_init(&metrics->evictions, 0);
+  atomic_init(&metrics->dirty_evictions, 0);
+  atomic_init(&metrics->bytes_read, 0);
+  atomic_init(&metrics->bytes_written, 0);
+  atomic_init(&metrics->compressed, 0);
+  atomic_init(&metrics->incompressible, 0);
+  atomic_init(&metrics->value_bytes, 0);
+  atomic_init(&metrics->stored_bytes, 0);
+  atomic_init(&metrics->compress_ns, 0);
+  atomic_init(&metrics->decompress_ns, 0);
+  atomic_init(&metrics->l2_hits, 0);
+  atomic_init(&metrics->l2_writes, 0);
+}
+
+uint64_t kvs_metrics_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bucket_of(uint64_t value) {
+  if (value < KVS_HISTOGRAM_SUB_BUCKETS) {
+    return (int)value;
+  }
+  int magnitude = 4;
+  while (magnitude < 63 && value >> (magnitude + 1)) {
+    magnitude++;
+  }
+  // the 4 bits below the leading one pick the sub-bucket
+  int sub = (int)(value >> (magnitude - 4)) & (KVS_HISTOGRAM_SUB_BUCKETS - 1);
+  int bucket = KVS_HISTOGRAM_SUB_BUCKETS * (magnitude - 3) + sub;
+  return bucket < KVS_HISTOGRAM_BUCKETS ? bucket : KVS_HISTOGRAM_BUCKETS - 1;
+}
+
+static uint64_t bucket_low(int bucket) {
+  if (bucket < KVS_HISTOGRAM_SUB_BUCKETS) {
+    return bucket;
+  }
+  int magnitude = bucket / KVS_HISTOGRAM_SUB_BUCKETS + 3;
+  int sub = bucket % KVS_HISTOGRAM_SUB_BUCKETS;
+  return (uint64_t)(KVS_HISTOGRAM_SUB_BUCKETS + sub) << (magnitude - 4);
+}
+
+static uint64_t bucket_middle(int bucket) {
+  uint64_t low = bucket_low(bucket);
+  if (bucket + 1 >= KVS_HISTOGRAM_BUCKETS) {
+    return low;
+  }
+  return low + (bucket_low(bucket + 1) - low) / 2;
+}
+
+void kvs_metrics_record(kvs_metrics_t* metrics, kvs_stats_latency latency,
+                        uint64_t nanoseconds) {
+  kvs_histogram_t* histogram = &metrics->latencies[latency];
+  atomic_fetch_add_explicit(&histogram->counts[bucket_of(nanoseconds)], 1,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&histogram->total, nanoseconds,
+                            memory_order_relaxed);
+  unsigned long long max =
+      atomic_load_explicit(&histogram->max, memory_order_relaxed);
+  while (nanoseconds > max &&
+         !atomic_compare_exchange_weak_explicit(&histogram->max, &max,
+                                                nanoseconds,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+  }
+}
+
+void kvs_metrics_add(atomic_ullong* counter, uint64_t amount) {
+  atomic_fetch_add_explicit(counter, amount, memory_order_relaxed);
+}
+
+static void summarize(kvs_histogram_t* histogram, kvs_latency_t* latency) {
+  unsigned long long counts[KVS_HISTOGRAM_BUCKETS];
+  uint64_t count = 0;
+  for (int i = 0; i < KVS_HISTOGRAM_BUCKETS; ++i) {
+    counts[i] = atomic_load_explicit(&histogram->counts[i],
+                                     memory_order_relaxed);
+    count += counts[i];
+  }
+  latency->count = count;
+  latency->mean =
+      count ? (double)atomic_load(&histogram->total) / count : 0;
+  latency->max = atomic_load(&histogram->max);
+
+  // ranks of the percentiles, rounded up so that p99 of 100 samples is the
+  // 99th
+  const double fractions[] = {0.5, 0.99, 0.999};
+  uint64_t* results[] = {&latency->p50, &latency->p99, &latency->p999};
+  for (int p = 0; p < 3; ++p) {
+    *results[p] = 0;
+    if (count == 0) {
+      continue;
+    }
+    uint64_t rank = (uint64_t)(fractions[p] * count);
+    if (rank < fractions[p] * count || rank == 0) {
+      rank++;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < KVS_HISTOGRAM_BUCKETS; ++i) {
+      seen += counts[i];
+      if (seen >= rank) {
+        *results[p] = bucket_middle(i);
+        break;
+      }
+    }
+    if (*results[p] > latency->max) {
+      *results[p] = latency->max;
+    }
+  }
+}
+
+void kvs_metrics_snapshot(kvs_metrics_t* metrics, kvs_stats_t* stats) {
+  for (int i = 0; i < KVS_STATS_LATENCIES; ++i) {
+    summarize(&metrics->latencies[i], &stats->latencies[i]);
+  }
+  stats->evictions = atomic_load(&metrics->evictions);
+  stats->dirty_evictions = atomic_load(&metrics->dirty_evictions);
+  stats->bytes_read = atomic_load(&metrics->bytes_read);
+  stats->bytes_written = atomic_load(&metrics->bytes_written);
+
+  stats->compressed = atomic_load(&metrics->compressed);
+  stats->incompressible = atomic_load(&metrics->incompressible);
+  uint64_t value_bytes = atomic_load(&metrics->value_bytes);
+  uint64_t stored_bytes = atomic_load(&metrics->stored_bytes);
+  stats->compression_ratio =
+      stored_bytes ? (double)value_bytes / stored_bytes : 1;
+  uint64_t values = stats->compressed + stats->incompressible;
+  stats->compress_ns =
+      values ? (double)atomic_load(&metrics->compress_ns) / values : 0;
+  uint64_t hits = stats->latencies[KVS_STATS_GET_HIT].count;
+  stats->decompress_ns_per_hit =
+      hits ? (double)atomic_load(&metrics->decompress_ns) / hits : 0;
+  stats->l2_hits = atomic_load(&metrics->l2_hits);
+  stats->l2_writes = atomic_load(&metrics->l2_writes);
+}
+
+const char* kvs_stats_name(kvs_stats_latency latency) {
+  switch (latency) {
+    case KVS_STATS_GET_HIT:
+      return "GET-HIT";
+    case KVS_STATS_GET_MISS:
+      return "GET-MISS";
+    case KVS_STATS_SET:
+      return "SET";
+    case KVS_STATS_WRITE_BACK:
+      return "WRITE-BACK";
+    case KVS_STATS_FLUSH:
+      return "FLUSH";
+    case KVS_STATS_LATENCIES:
+      break;
+  }
+  return "?";
+}
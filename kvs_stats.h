@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * `kvs_stats_latency` names the operations whose latencies are recorded.
+ */
+typedef enum {
+  // a GET served from the cache
+  KVS_STATS_GET_HIT,
+  // a GET that went to the storage layer
+  KVS_STATS_GET_MISS,
+  KVS_STATS_SET,
+  // writing a dirty entry back as it is evicted
+  KVS_STATS_WRITE_BACK,
+  // a whole `kvs_flush`
+  KVS_STATS_FLUSH,
+  KVS_STATS_LATENCIES,
+} kvs_stats_latency;
+
+/**
+ * `KVS_HISTOGRAM_BUCKETS` covers 0 ns to about 18 minutes: the first 16
+ * buckets are 1 ns wide, and every power of two above them is split into 16
+ * buckets, so a bucket is never wider than 1/16 of its lower bound.
+ */
+#define KVS_HISTOGRAM_SUB_BUCKETS 16
+#define KVS_HISTOGRAM_BUCKETS (KVS_HISTOGRAM_SUB_BUCKETS * 37)
+
+/**
+ * `kvs_histogram_t` is a log-linear latency histogram in nanoseconds. Its
+ * counters are atomic, so every thread records into the same histogram
+ * without a lock.
+ */
+typedef struct kvs_histogram {
+  atomic_ullong counts[KVS_HISTOGRAM_BUCKETS];
+  atomic_ullong total;
+  atomic_ullong max;
+} kvs_histogram_t;
+
+/**
+ * `kvs_metrics_t` is the live instrumentation of a store. The storage layer
+ * owns it (see `kvs_base_t.metrics`), so the cache policies, which only know
+ * the storage layer, can record their evictions in it too.
+ */
+typedef struct kvs_metrics {
+  kvs_histogram_t latencies[KVS_STATS_LATENCIES];
+  atomic_ullong evictions;
+  // evictions that had to write the entry back first
+  atomic_ullong dirty_evictions;
+  atomic_ullong bytes_read;
+  atomic_ullong bytes_written;
+  // values a compressing cache stored compressed or, when that did not
+  // save memory, as they were; the bytes given to it and the bytes it kept;
+  // and the time spent compressing and, estimated from a sample, expanding
+  // them (see kvs_arena.h)
+  atomic_ullong compressed;
+  atomic_ullong incompressible;
+  atomic_ullong value_bytes;
+  atomic_ullong stored_bytes;
+  atomic_ullong compress_ns;
+  atomic_ullong decompress_ns;
+  // reads the flash tier answered, and entries copied into it (see
+  // `kvs_base_enable_l2`)
+  atomic_ullong l2_hits;
+  atomic_ullong l2_writes;
+} kvs_metrics_t;
+
+/**
+ * `kvs_latency_t` summarizes one histogram. Percentiles are the midpoints of
+ * their buckets.
+ */
+typedef struct kvs_latency {
+  uint64_t count;
+  double mean;
+  uint64_t p50;
+  uint64_t p99;
+  uint64_t p999;
+  uint64_t max;
+} kvs_latency_t;
+
+/**
+ * `kvs_stats_t` is a snapshot of a store's metrics, filled in by
+ * `kvs_stats` (see kvs.h). The hit rate is that of the GETs.
+ */
+typedef struct kvs_stats {
+  kvs_latency_t latencies[KVS_STATS_LATENCIES];
+  uint64_t gets;
+  uint64_t sets;
+  double hit_rate;
+  uint64_t evictions;
+  uint64_t dirty_evictions;
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint64_t disk_reads;
+  uint64_t disk_writes;
+  int resident;
+  int dirty;
+  // bytes the cache spends on its entries (see `kvs_memory`)
+  size_t memory;
+  // entries reloaded from a snapshot (see `kvs_config_t.snapshot`)
+  int warmed;
+  // entries added to the cache by `kvs_prefetch`
+  int prefetched;
+  // records appended to the write-ahead log, and the syncs that made them
+  // durable
+  uint64_t wal_records;
+  uint64_t wal_syncs;
+  // values stored compressed and values left as they were, with
+  // `kvs_config_t.compress`
+  uint64_t compressed;
+  uint64_t incompressible;
+  // bytes of the values stored over bytes kept for them, 1 without
+  // compression
+  double compression_ratio;
+  // mean nanoseconds spent compressing a value and expanding values per GET
+  // hit
+  double compress_ns;
+  double decompress_ns_per_hit;
+  // the policy in use, and how often `kvs_config_t.auto_policy` changed it
+  const char* policy;
+  int policy_switches;
+  // entries held by the flash tier, and how often it answered a read the
+  // disk would have; all 0 without `kvs_config_t.l2_size`
+  int l2_entries;
+  uint64_t l2_hits;
+  uint64_t l2_writes;
+} kvs_stats_t;
+
+void kvs_metrics_init(kvs_metrics_t* metrics);
+
+/**
+ * `kvs_metrics_now` returns a monotonic timestamp in nanoseconds, the unit
+ * `kvs_metrics_record` takes.
+ */
+uint64_t kvs_metrics_now(void);
+void kvs_metrics_record(kvs_metrics_t* metrics, kvs_stats_latency latency,
+                        uint64_t nanoseconds);
+
+/**
+ * `kvs_metrics_add` bumps one of the counters of `metrics`.
+ */
+void kvs_metrics_add(atomic_ullong* counter, uint64_t amount);
+
+/**
+ * `kvs_metrics_snapshot` fills the latency summaries and counters of
+ * `stats` from `metrics`, leaving the fields only the cache knows (requests,
+ * disk operations, resident and dirty entries, memory) alone.
+ */
+void kvs_metrics_snapshot(kvs_metrics_t* metrics, kvs_stats_t* stats);
+
+/**
+ * `kvs_stats_name` returns the name of a latency, such as "GET-HIT".
+ */
+const char* kvs_stats_name(kvs_stats_latency latency);
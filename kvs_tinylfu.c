@@ -0,0 +1,360 @@
+#include "kvs_tinylfu.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "kvs_arena.h"
+#include "kvs_budget.h"
+#include "kvs_dirty.h"
+#include "kvs_index.h"
+#include "kvs_list.h"
+#include "kvs_pool.h"
+#include "kvs_sketch.h"
+
+// the window holds 1% of the capacity and the protected segment 80% of the
+// rest, the defaults of the W-TinyLFU paper
+#define KVS_TINYLFU_WINDOW_PERCENT 1
+#define KVS_TINYLFU_PROTECTED_PERCENT 80
+
+typedef enum { W_WINDOW, W_PROBATION, W_PROTECTED, W_LISTS } w_list;
+
+typedef struct cache_entry {
+  kvs_entry_t kv;
+  kvs_list_link_t link;
+  w_list list;
+  uint64_t hash;
+} cache_entry_t;
+
+struct kvs_tinylfu {
+  kvs_base_t* kvs_base;
+  int capacity;
+  // bytes the entries and the sketch may take, or 0 to hold `capacity`
+  // entries
+  size_t budget;
+  int window_capacity;
+  int main_capacity;
+  int protected_capacity;
+  kvs_list_t lists[W_LISTS];
+  // one slot more than the capacity: a new entry joins the window before
+  // the window overflow is resolved
+  kvs_pool_t* pool;
+  kvs_arena_t* arena;
+  kvs_index_t* index;
+  kvs_sketch_t* sketch;
+  kvs_dirty_t dirty;
+};
+
+/**
+ * `resize` splits `capacity` entries between the window and the two
+ * segments of the main cache.
+ */
+static void resize(kvs_tinylfu_t* kvs_tinylfu, int capacity) {
+  int window = capacity * KVS_TINYLFU_WINDOW_PERCENT / 100;
+  kvs_tinylfu->window_capacity = window > 0 ? window : 1;
+  kvs_tinylfu->main_capacity = capacity - kvs_tinylfu->window_capacity;
+  kvs_tinylfu->protected_capacity =
+      kvs_tinylfu->main_capacity * KVS_TINYLFU_PROTECTED_PERCENT / 100;
+}
+
+/**
+ * `create` makes a cache of `capacity` entries. Without a `budget` its index
+ * is sized for all of them; with one it starts empty and grows with
+ * the entries, since its bytes are charged to the budget.
+ */
+static kvs_tinylfu_t* create(kvs_base_t* kvs, int capacity,
+                             size_t budget) {
+  kvs_tinylfu_t* kvs_tinylfu = malloc(sizeof(kvs_tinylfu_t));
+  if (!kvs_tinylfu) return NULL;
+
+  kvs_tinylfu->kvs_base = kvs;
+  kvs_tinylfu->capacity = capacity;
+  kvs_tinylfu->budget = budget;
+  resize(kvs_tinylfu, capacity);
+  for (int i = 0; i < W_LISTS; ++i) {
+    kvs_list_init(&kvs_tinylfu->lists[i]);
+  }
+  kvs_tinylfu->pool = kvs_pool_new(sizeof(cache_entry_t), capacity + 1);
+  kvs_tinylfu->arena = kvs_arena_new();
+  kvs_tinylfu->index = kvs_index_new(budget > 0 ? 0 : capacity + 1);
+  kvs_tinylfu->sketch = kvs_sketch_new(capacity);
+  kvs_dirty_init(&kvs_tinylfu->dirty);
+
+  return kvs_tinylfu;
+}
+
+kvs_tinylfu_t* kvs_tinylfu_new(kvs_base_t* kvs, int capacity) {
+  return create(kvs, capacity, 0);
+}
+
+kvs_tinylfu_t* kvs_tinylfu_new_budget(kvs_base_t* kvs, size_t budget) {
+  return create(kvs, kvs_budget_entries(budget, sizeof(cache_entry_t)),
+                budget);
+}
+
+void kvs_tinylfu_enable_compression(kvs_tinylfu_t* kvs_tinylfu) {
+  kvs_arena_enable_compression(kvs_tinylfu->arena,
+                               &kvs_tinylfu->kvs_base->metrics);
+}
+
+void kvs_tinylfu_free(kvs_tinylfu_t** ptr) {
+  if (ptr && *ptr) {
+    kvs_sketch_free(&(*ptr)->sketch);
+    kvs_index_free(&(*ptr)->index);
+    kvs_arena_free(&(*ptr)->arena);
+    kvs_pool_free(&(*ptr)->pool);
+    free(*ptr);
+    *ptr = NULL;
+  }
+}
+
+static int list_size(kvs_tinylfu_t* kvs_tinylfu, w_list list) {
+  return kvs_tinylfu->lists[list].size;
+}
+
+static cache_entry_t* lru_of(kvs_tinylfu_t* kvs_tinylfu, w_list list) {
+  kvs_list_link_t* tail = kvs_tinylfu->lists[list].tail;
+  return tail ? KVS_LIST_ENTRY(tail, cache_entry_t, link) : NULL;
+}
+
+static void move_to(kvs_tinylfu_t* kvs_tinylfu, cache_entry_t* entry,
+                    w_list list) {
+  kvs_list_move(&kvs_tinylfu->lists[entry->list], &kvs_tinylfu->lists[list],
+                &entry->link);
+  entry->list = list;
+}
+
+static int evict(kvs_tinylfu_t* kvs_tinylfu, cache_entry_t* entry) {
+  if (kvs_dirty_evict(&kvs_tinylfu->dirty, kvs_tinylfu->kvs_base,
+                      &entry->kv) != SUCCESS) {
+    return FAILURE;
+  }
+  kvs_list_remove(&kvs_tinylfu->lists[entry->list], &entry->link);
+  kvs_index_remove(kvs_tinylfu->index, entry->kv.key);
+  kvs_arena_release(kvs_tinylfu->arena, entry->kv.key);
+  kvs_arena_release(kvs_tinylfu->arena, entry->kv.value);
+  kvs_pool_release(kvs_tinylfu->pool, entry);
+  return SUCCESS;
+}
+
+static int resident(kvs_tinylfu_t* kvs_tinylfu) {
+  int size = 0;
+  for (int i = 0; i < W_LISTS; ++i) {
+    size += kvs_tinylfu->lists[i].size;
+  }
+  return size;
+}
+
+static bool over_budget(kvs_tinylfu_t* kvs_tinylfu, size_t incoming) {
+  return kvs_budget_over(kvs_tinylfu->budget,
+                         kvs_tinylfu_memory(kvs_tinylfu), incoming);
+}
+
+/**
+ * `duel` evicts one entry: the LRU entry of the window competes with the
+ * main cache's next victim and the one the sketch deems less frequent is
+ * evicted, the winner moving to probation. If the loser cannot be written
+ * back, nothing moves and it returns FAILURE.
+ */
+static int duel(kvs_tinylfu_t* kvs_tinylfu) {
+  cache_entry_t* candidate = lru_of(kvs_tinylfu, W_WINDOW);
+  cache_entry_t* victim = lru_of(kvs_tinylfu, W_PROBATION);
+  if (!victim) {
+    victim = lru_of(kvs_tinylfu, W_PROTECTED);
+  }
+  if (!candidate) {
+    return evict(kvs_tinylfu, victim);
+  }
+  if (victim &&
+      kvs_sketch_estimate(kvs_tinylfu->sketch, candidate->hash) >
+          kvs_sketch_estimate(kvs_tinylfu->sketch, victim->hash)) {
+    if (evict(kvs_tinylfu, victim) != SUCCESS) {
+      return FAILURE;
+    }
+    move_to(kvs_tinylfu, candidate, W_PROBATION);
+    return SUCCESS;
+  }
+  return evict(kvs_tinylfu, candidate);
+}
+
+/**
+ * `overflow_window` moves the LRU entry of an over-full window towards the
+ * main cache. It is admitted outright while the main cache has room;
+ * otherwise the two `duel`.
+ */
+static int overflow_window(kvs_tinylfu_t* kvs_tinylfu) {
+  if (list_size(kvs_tinylfu, W_WINDOW) <= kvs_tinylfu->window_capacity) {
+    return SUCCESS;
+  }
+
+  int main_size = list_size(kvs_tinylfu, W_PROBATION) +
+                  list_size(kvs_tinylfu, W_PROTECTED);
+  if (main_size < kvs_tinylfu->main_capacity) {
+    move_to(kvs_tinylfu, lru_of(kvs_tinylfu, W_WINDOW), W_PROBATION);
+    return SUCCESS;
+  }
+  return duel(kvs_tinylfu);
+}
+
+/**
+ * `fit_budget` settles the cache after an entry grew or arrived: under a
+ * byte budget the segments are resized to the number of entries that fit
+ * at their current average cost, and duels go on while the cache is still
+ * over budget, or until one fails.
+ */
+static int fit_budget(kvs_tinylfu_t* kvs_tinylfu) {
+  if (kvs_tinylfu->budget == 0) {
+    return SUCCESS;
+  }
+  resize(kvs_tinylfu,
+         kvs_budget_capacity(kvs_tinylfu->budget, resident(kvs_tinylfu),
+                             kvs_tinylfu_memory(kvs_tinylfu),
+                             kvs_tinylfu->capacity));
+  while (resident(kvs_tinylfu) > 1 && over_budget(kvs_tinylfu, 0)) {
+    if (duel(kvs_tinylfu) != SUCCESS) {
+      return FAILURE;
+    }
+  }
+  return SUCCESS;
+}
+
+/**
+ * `touch` records a hit: window and protected entries move to the front of
+ * their segment and a probation entry is promoted, demoting the LRU entry of
+ * the protected segment if it is full.
+ */
+static void touch(kvs_tinylfu_t* kvs_tinylfu, cache_entry_t* entry) {
+  kvs_sketch_increment(kvs_tinylfu->sketch, entry->hash);
+  if (entry->list != W_PROBATION) {
+    move_to(kvs_tinylfu, entry, entry->list);
+    return;
+  }
+
+  move_to(kvs_tinylfu, entry, W_PROTECTED);
+  if (list_size(kvs_tinylfu, W_PROTECTED) > kvs_tinylfu->protected_capacity) {
+    move_to(kvs_tinylfu, lru_of(kvs_tinylfu, W_PROTECTED), W_PROBATION);
+  }
+}
+
+static int admit(kvs_tinylfu_t* kvs_tinylfu, const char* key,
+                 const char* value, bool modified) {
+  cache_entry_t* entry = kvs_pool_alloc(kvs_tinylfu->pool);
+  if (!entry) return FAILURE;
+  entry->kv.key = kvs_arena_strdup(kvs_tinylfu->arena, key);
+  entry->kv.value = kvs_arena_pack(kvs_tinylfu->arena, NULL, value);
+  if (!entry->kv.key || !entry->kv.value ||
+      kvs_index_put(kvs_tinylfu->index, entry->kv.key, entry) != SUCCESS) {
+    kvs_arena_release(kvs_tinylfu->arena, entry->kv.key);
+    kvs_arena_release(kvs_tinylfu->arena, entry->kv.value);
+    kvs_pool_release(kvs_tinylfu->pool, entry);
+    return FAILURE;
+  }
+  entry->kv.modified = false;
+  if (modified) {
+    kvs_dirty_mark(&kvs_tinylfu->dirty, &entry->kv);
+  }
+  entry->hash = kvs_hash(key);
+  entry->list = W_WINDOW;
+  kvs_sketch_increment(kvs_tinylfu->sketch, entry->hash);
+  kvs_list_push(&kvs_tinylfu->lists[W_WINDOW], &entry->link);
+  // the entry is in either way; a failed eviction leaves the cache over
+  // its size until the next one succeeds
+  if (overflow_window(kvs_tinylfu) != SUCCESS) {
+    return FAILURE;
+  }
+  return fit_budget(kvs_tinylfu);
+}
+
+int kvs_tinylfu_set(kvs_tinylfu_t* kvs_tinylfu, const char* key,
+                    const char* value) {
+  cache_entry_t* entry = kvs_index_get(kvs_tinylfu->index, key);
+  if (entry) {
+    char* stored =
+        kvs_arena_pack(kvs_tinylfu->arena, entry->kv.value, value);
+    if (!stored) return FAILURE;
+    entry->kv.value = stored;
+    kvs_dirty_mark(&kvs_tinylfu->dirty, &entry->kv);
+    touch(kvs_tinylfu, entry);
+    return fit_budget(kvs_tinylfu);
+  }
+
+  return admit(kvs_tinylfu, key, value, true);
+}
+
+int kvs_tinylfu_get_cached(kvs_tinylfu_t* kvs_tinylfu, const char* key,
+                           char* value) {
+  cache_entry_t* entry = kvs_index_get(kvs_tinylfu->index, key);
+  if (entry) {
+    kvs_arena_read(kvs_tinylfu->arena, entry->kv.value, value);
+    touch(kvs_tinylfu, entry);
+    return SUCCESS;
+  }
+  return FAILURE;
+}
+
+bool kvs_tinylfu_contains(kvs_tinylfu_t* kvs_tinylfu, const char* key) {
+  return kvs_index_get(kvs_tinylfu->index, key) != NULL;
+}
+
+int kvs_tinylfu_peek(kvs_tinylfu_t* kvs_tinylfu, const char* key,
+                     char* value) {
+  cache_entry_t* entry = kvs_index_get(kvs_tinylfu->index, key);
+  if (entry) {
+    kvs_arena_read(kvs_tinylfu->arena, entry->kv.value, value);
+    return SUCCESS;
+  }
+  return FAILURE;
+}
+
+int kvs_tinylfu_load(kvs_tinylfu_t* kvs_tinylfu, const char* key,
+                     char* value) {
+  if (kvs_tinylfu_get_cached(kvs_tinylfu, key, value) == SUCCESS) {
+    return SUCCESS;
+  }
+  return admit(kvs_tinylfu, key, value, false);
+}
+
+int kvs_tinylfu_get(kvs_tinylfu_t* kvs_tinylfu, const char* key, char* value) {
+  if (kvs_tinylfu_get_cached(kvs_tinylfu, key, value) == SUCCESS) {
+    return SUCCESS;
+  }
+
+  int result = kvs_base_get(kvs_tinylfu->kvs_base, key, value);
+  if (result == SUCCESS) {
+    return kvs_tinylfu_load(kvs_tinylfu, key, value);
+  }
+
+  return result;
+}
+
+int kvs_tinylfu_flush(kvs_tinylfu_t* kvs_tinylfu) {
+  return kvs_dirty_flush(&kvs_tinylfu->dirty, kvs_tinylfu->kvs_base);
+}
+
+int kvs_tinylfu_size(kvs_tinylfu_t* kvs_tinylfu) {
+  return resident(kvs_tinylfu);
+}
+
+int kvs_tinylfu_dirty(kvs_tinylfu_t* kvs_tinylfu) {
+  return kvs_tinylfu->dirty.count;
+}
+
+int kvs_tinylfu_take_dirty(kvs_tinylfu_t* kvs_tinylfu, char* key,
+                           char* value) {
+  return kvs_dirty_take(&kvs_tinylfu->dirty, key, value);
+}
+
+void kvs_tinylfu_mark_dirty(kvs_tinylfu_t* kvs_tinylfu, const char* key) {
+  cache_entry_t* entry = kvs_index_get(kvs_tinylfu->index, key);
+  if (entry) {
+    kvs_dirty_mark(&kvs_tinylfu->dirty, &entry->kv);
+  }
+}
+
+size_t kvs_tinylfu_memory(kvs_tinylfu_t* kvs_tinylfu) {
+  return resident(kvs_tinylfu) * sizeof(cache_entry_t) +
+         kvs_arena_used(kvs_tinylfu->arena) +
+         kvs_index_memory(kvs_tinylfu->index) +
+         kvs_sketch_memory(kvs_tinylfu->sketch);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "kvs_base.h"
+
+/**
+ * `kvs_tinylfu_t` is a W-TinyLFU cache. New keys land in a small LRU window;
+ * a key pushed out of the window only enters the main segmented LRU if a
+ * count-min sketch of recent access frequencies (see kvs_sketch.h) rates it
+ * above the entry it would replace. The main cache keeps keys hit again in a
+ * protected segment, so scans and one-hit wonders rarely displace it.
+ */
+struct kvs_tinylfu;
+typedef struct kvs_tinylfu kvs_tinylfu_t;
+
+kvs_tinylfu_t* kvs_tinylfu_new(kvs_base_t* kvs, int capacity);
+
+/**
+ * `kvs_tinylfu_new_budget` creates a cache bounded by `budget` bytes, like
+ * `kvs_lru_new_budget`; the sketch is charged to the budget as well. A new
+ * entry that leaves the cache over budget triggers further duels between the
+ * window and the main cache until it fits.
+ */
+kvs_tinylfu_t* kvs_tinylfu_new_budget(kvs_base_t* kvs, size_t budget);
+
+/**
+ * `kvs_tinylfu_enable_compression` compresses values as
+ * `kvs_lru_enable_compression` does.
+ */
+void kvs_tinylfu_enable_compression(kvs_tinylfu_t* kvs_tinylfu);
+void kvs_tinylfu_free(kvs_tinylfu_t** ptr);
+
+int kvs_tinylfu_set(kvs_tinylfu_t* kvs_tinylfu, const char* key,
+                    const char* value);
+int kvs_tinylfu_get(kvs_tinylfu_t* kvs_tinylfu, const char* key, char* value);
+
+/**
+ * `kvs_tinylfu_get_cached`, `kvs_tinylfu_load`, `kvs_tinylfu_contains` and
+ * `kvs_tinylfu_peek` work like their LRU counterparts (see kvs_lru.h).
+ */
+int kvs_tinylfu_get_cached(kvs_tinylfu_t* kvs_tinylfu, const char* key,
+                           char* value);
+int kvs_tinylfu_load(kvs_tinylfu_t* kvs_tinylfu, const char* key,
+                     char* value);
+bool kvs_tinylfu_contains(kvs_tinylfu_t* kvs_tinylfu, const char* key);
+int kvs_tinylfu_peek(kvs_tinylfu_t* kvs_tinylfu, const char* key,
+                     char* value);
+
+int kvs_tinylfu_flush(kvs_tinylfu_t* kvs_tinylfu);
+
+/**
+ * `kvs_tinylfu_size` returns the number of resident entries.
+ */
+int kvs_tinylfu_size(kvs_tinylfu_t* kvs_tinylfu);
+
+/**
+ * `kvs_tinylfu_dirty` returns the number of modified entries.
+ */
+int kvs_tinylfu_dirty(kvs_tinylfu_t* kvs_tinylfu);
+
+/**
+ * `kvs_tinylfu_take_dirty` and `kvs_tinylfu_mark_dirty` work like their LRU
+ * counterparts (see kvs_lru.h).
+ */
+int kvs_tinylfu_take_dirty(kvs_tinylfu_t* kvs_tinylfu, char* key,
+                           char* value);
+void kvs_tinylfu_mark_dirty(kvs_tinylfu_t* kvs_tinylfu, const char* key);
+
+/**
+ * `kvs_tinylfu_memory` returns the bytes held by the entries and the
+ * frequency sketch.
+ */
+size_t kvs_tinylfu_memory(kvs_tinylfu_t* kvs_tinylfu);
@@ -0,0 +1,270 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "kvs_trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "kvs_index.h"
+#include "kvs_stats.h"
+
+#define TRACE_MAGIC "KVSTRACE"
+#define TRACE_VERSION 1
+// records carry keys rather than hashes
+#define TRACE_KEYS 1
+// bytes collected before they are written out, and bytes read at a time
+#define TRACE_BUFFER (1 << 20)
+#define VARINT_MAX 10
+// the longest record: the kind, the delta, a key with its length, and the
+// value length
+#define RECORD_MAX (1 + VARINT_MAX + VARINT_MAX + KVS_KEY_MAX + VARINT_MAX)
+
+typedef struct trace_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+} trace_header_t;
+
+struct kvs_trace {
+  pthread_mutex_t lock;
+  int fd;
+  bool keys;
+  // a write failed, so nothing more is recorded
+  bool failed;
+  // the time of the last record
+  uint64_t last_ns;
+  char* buffer;
+  size_t length;
+};
+
+static int write_all(int fd, const char* data, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, data, length);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return FAILURE;
+    }
+    data += written;
+    length -= written;
+  }
+  return SUCCESS;
+}
+
+static size_t put_varint(char* p, uint64_t value) {
+  size_t length = 0;
+  for (; value >= 0x80; value >>= 7) {
+    p[length++] = (char)(value | 0x80);
+  }
+  p[length++] = (char)value;
+  return length;
+}
+
+static bool get_varint(const char** p, const char* end, uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+    unsigned char byte = (unsigned char)*(*p)++;
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      return true;
+    }
+  }
+  return false;
+}
+
+kvs_trace_t* kvs_trace_open(const char* path, bool keys) {
+  kvs_trace_t* trace = malloc(sizeof(kvs_trace_t));
+  char* buffer = malloc(TRACE_BUFFER);
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  trace_header_t header = {.version = TRACE_VERSION,
+                           .flags = keys ? TRACE_KEYS : 0};
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  if (trace == NULL || buffer == NULL || fd < 0 ||
+      write_all(fd, (const char*)&header, sizeof(header)) != SUCCESS) {
+    if (fd >= 0) close(fd);
+    free(buffer);
+    free(trace);
+    return NULL;
+  }
+  pthread_mutex_init(&trace->lock, NULL);
+  trace->fd = fd;
+  trace->keys = keys;
+  trace->failed = false;
+  trace->last_ns = kvs_metrics_now();
+  trace->buffer = buffer;
+  trace->length = 0;
+  return trace;
+}
+
+void kvs_trace_free(kvs_trace_t** ptr) {
+  if (ptr && *ptr) {
+    kvs_trace_t* trace = *ptr;
+    if (!trace->failed) {
+      write_all(trace->fd, trace->buffer, trace->length);
+    }
+    close(trace->fd);
+    pthread_mutex_destroy(&trace->lock);
+    free(trace->buffer);
+    free(trace);
+    *ptr = NULL;
+  }
+}
+
+void kvs_trace_record(kvs_trace_t* trace, kvs_trace_kind kind,
+                      const char* key, size_t value_length, uint64_t time_ns) {
+  // hashed before the lock is taken, to keep it short
+  uint64_t hash = !trace->keys && kind != KVS_TRACE_FLUSH ? kvs_hash(key) : 0;
+  pthread_mutex_lock(&trace->lock);
+  if (trace->failed) {
+    pthread_mutex_unlock(&trace->lock);
+    return;
+  }
+  if (trace->length + RECORD_MAX > TRACE_BUFFER) {
+    trace->failed =
+        write_all(trace->fd, trace->buffer, trace->length) != SUCCESS;
+    trace->length = 0;
+  }
+  char* p = trace->buffer + trace->length;
+  *p++ = (char)kind;
+  p += put_varint(p, time_ns > trace->last_ns ? time_ns - trace->last_ns : 0);
+  trace->last_ns = time_ns > trace->last_ns ? time_ns : trace->last_ns;
+  if (kind != KVS_TRACE_FLUSH) {
+    if (trace->keys) {
+      size_t key_length = strlen(key);
+      p += put_varint(p, key_length);
+      memcpy(p, key, key_length);
+      p += key_length;
+    } else {
+      memcpy(p, &hash, sizeof(hash));
+      p += sizeof(hash);
+    }
+    p += put_varint(p, value_length);
+  }
+  trace->length = p - trace->buffer;
+  pthread_mutex_unlock(&trace->lock);
+}
+
+/**
+ * `hash_key` spells `hash` as 16 hex digits, the key a hashed record is
+ * replayed with.
+ */
+static void hash_key(uint64_t hash, char* key) {
+  static const char digits[] = "0123456789abcdef";
+  for (int i = 15; i >= 0; --i, hash >>= 4) {
+    key[i] = digits[hash & 0xf];
+  }
+  key[16] = '\0';
+}
+
+/**
+ * `decode` reads the record at `p` into `op`, spelling its key into `key`,
+ * and returns the bytes it took, or 0 if it runs past `end` or is not a
+ * record.
+ */
+static size_t decode(const char* p, const char* end, bool keys,
+                     kvs_trace_op_t* op, char* key) {
+  const char* start = p;
+  if (p == end || (unsigned char)*p > KVS_TRACE_FLUSH) {
+    return 0;
+  }
+  op->kind = (kvs_trace_kind)*p++;
+  op->key = NULL;
+  op->value_length = 0;
+  if (!get_varint(&p, end, &op->delta_ns)) {
+    return 0;
+  }
+  if (op->kind == KVS_TRACE_FLUSH) {
+    return p - start;
+  }
+  if (keys) {
+    uint64_t key_length;
+    if (!get_varint(&p, end, &key_length) || key_length >= KVS_KEY_MAX ||
+        (uint64_t)(end - p) < key_length) {
+      return 0;
+    }
+    memcpy(key, p, key_length);
+    key[key_length] = '\0';
+    p += key_length;
+  } else {
+    uint64_t hash;
+    if (end - p < (ptrdiff_t)sizeof(hash)) {
+      return 0;
+    }
+    memcpy(&hash, p, sizeof(hash));
+    p += sizeof(hash);
+    hash_key(hash, key);
+  }
+  op->key = key;
+  uint64_t value_length;
+  if (!get_varint(&p, end, &value_length)) {
+    return 0;
+  }
+  op->value_length = value_length;
+  return p - start;
+}
+
+/**
+ * `refill` moves the unread bytes of `buffer` to its front and reads until a
+ * whole record is buffered or the file ends.
+ */
+static int refill(int fd, char* buffer, size_t* start, size_t* end,
+                  bool* eof) {
+  memmove(buffer, buffer + *start, *end - *start);
+  *end -= *start;
+  *start = 0;
+  while (!*eof && *end < RECORD_MAX) {
+    ssize_t got = read(fd, buffer + *end, TRACE_BUFFER - *end);
+    if (got < 0) {
+      if (errno == EINTR) continue;
+      return FAILURE;
+    }
+    *eof = got == 0;
+    *end += got;
+  }
+  return SUCCESS;
+}
+
+long kvs_trace_read(const char* path,
+                    int (*fn)(void* arg, const kvs_trace_op_t* op),
+                    void* arg) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  trace_header_t header;
+  char* buffer = malloc(TRACE_BUFFER);
+  if (buffer == NULL || read(fd, &header, sizeof(header)) != sizeof(header) ||
+      memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != TRACE_VERSION) {
+    free(buffer);
+    close(fd);
+    return -1;
+  }
+  bool keys = header.flags & TRACE_KEYS;
+  char key[KVS_KEY_MAX];
+  kvs_trace_op_t op;
+  long count = 0;
+  size_t start = 0;
+  size_t end = 0;
+  bool eof = false;
+  while (count >= 0) {
+    if (!eof && end - start < RECORD_MAX &&
+        refill(fd, buffer, &start, &end, &eof) != SUCCESS) {
+      count = -1;
+      break;
+    }
+    size_t length = decode(buffer + start, buffer + end, keys, &op, key);
+    if (length == 0) {
+      break;
+    }
+    start += length;
+    count = fn(arg, &op) == SUCCESS ? count + 1 : -1;
+  }
+  free(buffer);
+  close(fd);
+  return count;
+}
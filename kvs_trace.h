@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * `kvs_trace_kind` is the operation a trace record stands for.
+ */
+typedef enum {
+  KVS_TRACE_GET,
+  KVS_TRACE_SET,
+  KVS_TRACE_FLUSH,
+} kvs_trace_kind;
+
+/**
+ * `kvs_trace_op_t` is one record of a trace as `kvs_trace_read` hands it
+ * out. `delta_ns` is the time since the previous record; `value_length` is
+ * the length of the value a SET stored or a GET found, 0 for a GET that
+ * found nothing. A FLUSH has no key.
+ */
+typedef struct kvs_trace_op {
+  kvs_trace_kind kind;
+  uint64_t delta_ns;
+  const char* key;
+  size_t value_length;
+} kvs_trace_op_t;
+
+/**
+ * `kvs_trace_t` records the requests a store serves to a file, so they can
+ * be replayed later against another policy or capacity (see `replay`). A
+ * record takes a few bytes: the kind, the time since the last record as a
+ * varint, the key, and the length of the value as a varint. The key is
+ * either kept as it is or, by default, replaced by its 64-bit hash, which
+ * is shorter and does not reveal it; replaying such a trace turns each hash
+ * back into a distinct key. Records are collected in a buffer and written a
+ * megabyte at a time, so recording costs a lock and a copy per request.
+ */
+struct kvs_trace;
+typedef struct kvs_trace kvs_trace_t;
+
+/**
+ * `kvs_trace_open` creates or truncates the trace file at `path`. With
+ * `keys`, records carry the keys themselves rather than their hashes.
+ */
+kvs_trace_t* kvs_trace_open(const char* path, bool keys);
+
+/**
+ * `kvs_trace_free` writes out what is buffered and closes the file.
+ */
+void kvs_trace_free(kvs_trace_t** ptr);
+
+/**
+ * `kvs_trace_record` appends a record of `kind` for `key`, which is ignored
+ * for a FLUSH, made at `time_ns` (see `kvs_metrics_now`). The store passes
+ * the time its request started, which it has already read, rather than
+ * paying for another read of the clock. It may be called from several
+ * threads at once; a record stamped earlier than the one before it gets a
+ * delta of 0. Once a write fails the trace stops recording rather than
+ * failing requests.
+ */
+void kvs_trace_record(kvs_trace_t* trace, kvs_trace_kind kind,
+                      const char* key, size_t value_length, uint64_t time_ns);
+
+/**
+ * `kvs_trace_read` calls `fn` with every record of the trace at `path`, in
+ * order, and returns the number of records or -1 if the file is not a trace
+ * or `fn` fails. A record cut short at the end of the file, as a crash of
+ * the recording process leaves it, ends the trace.
+ */
+long kvs_trace_read(const char* path,
+                    int (*fn)(void* arg, const kvs_trace_op_t* op),
+                    void* arg);
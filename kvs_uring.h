@@ -0,0 +1,39 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <stdint.h>
+
+/**
+ * `kvs_uring_t` is a minimal io_uring instance driven through the raw system
+ * calls, for the handful of operations the batched write-back needs. It has
+ * no dependency on liburing.
+ */
+struct kvs_uring;
+typedef struct kvs_uring kvs_uring_t;
+
+/**
+ * `kvs_uring_new` sets up a ring with room for `entries` submissions. It
+ * returns NULL if io_uring is unavailable (old kernel, seccomp, sysctl), in
+ * which case callers fall back to plain system calls.
+ */
+kvs_uring_t* kvs_uring_new(unsigned entries);
+void kvs_uring_free(kvs_uring_t** ptr);
+
+/**
+ * `kvs_uring_sqe` returns a zeroed submission entry to fill in, or NULL if the
+ * submission queue is full. Entries are handed to the kernel by
+ * `kvs_uring_submit`.
+ */
+struct io_uring_sqe* kvs_uring_sqe(kvs_uring_t* ring);
+
+/**
+ * `kvs_uring_submit` submits every entry obtained since the last call and
+ * waits until at least `wait` completions are available.
+ */
+int kvs_uring_submit(kvs_uring_t* ring, unsigned wait);
+
+/**
+ * `kvs_uring_complete` pops one completion into `user_data` and `res`. It
+ * returns FAILURE if none is ready.
+ */
+int kvs_uring_complete(kvs_uring_t* ring, uint64_t* user_data, int32_t* res);
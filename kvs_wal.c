@@ -0,0 +1,400 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "kvs_wal.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "constants.h"
+
+#define WAL_PREFIX ".kvs-wal-"
+#define WAL_NAME_MAX 32
+
+typedef struct record_header {
+  // FNV-1a over the lengths, the key and the value
+  uint32_t checksum;
+  uint16_t key_length;
+  uint16_t value_length;
+} record_header_t;
+
+#define RECORD_MAX (sizeof(record_header_t) + KVS_KEY_MAX + KVS_VALUE_MAX)
+
+struct kvs_wal {
+  int dirfd;
+  kvs_wal_durability durability;
+  int interval_ms;
+  pthread_mutex_t lock;
+  // broadcast whenever a sync finishes
+  pthread_cond_t synced_cond;
+  // the file being appended to
+  int fd;
+  unsigned file;
+  // the oldest file not released yet
+  unsigned oldest;
+  // sequence numbers of the last record written and the last one synced
+  uint64_t appended;
+  uint64_t synced;
+  uint64_t syncs;
+  // a sync is running with the lock dropped
+  bool syncing;
+  // a write or sync failed, so nothing later can be promised durable
+  bool failed;
+
+  // the background syncer of `KVS_WAL_BATCH`
+  pthread_t syncer;
+  pthread_cond_t syncer_wake;
+  bool stop;
+};
+
+static uint32_t record_checksum(const char* record, size_t length) {
+  // the checksum field itself is skipped
+  uint32_t hash = 2166136261u;
+  for (size_t i = sizeof(uint32_t); i < length; ++i) {
+    hash ^= (unsigned char)record[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void file_name(unsigned file, char* name) {
+  snprintf(name, WAL_NAME_MAX, WAL_PREFIX "%08u", file);
+}
+
+static int compare_files(const void* a, const void* b) {
+  unsigned x = *(const unsigned*)a;
+  unsigned y = *(const unsigned*)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * `list_files` returns the numbers of the log files in the directory open
+ * as `dirfd`, in order, in a new array.
+ */
+static int list_files(int dirfd, unsigned** files, size_t* count) {
+  *files = NULL;
+  *count = 0;
+  int copy = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  DIR* dir = copy >= 0 ? fdopendir(copy) : NULL;
+  if (!dir) {
+    if (copy >= 0) close(copy);
+    return FAILURE;
+  }
+  size_t capacity = 0;
+  struct dirent* dirent;
+  while ((dirent = readdir(dir)) != NULL) {
+    if (strncmp(dirent->d_name, WAL_PREFIX, strlen(WAL_PREFIX)) != 0) {
+      continue;
+    }
+    if (*count == capacity) {
+      capacity = capacity ? capacity * 2 : 16;
+      unsigned* grown = realloc(*files, capacity * sizeof(unsigned));
+      if (!grown) {
+        free(*files);
+        *files = NULL;
+        closedir(dir);
+        return FAILURE;
+      }
+      *files = grown;
+    }
+    (*files)[(*count)++] =
+        strtoul(dirent->d_name + strlen(WAL_PREFIX), NULL, 10);
+  }
+  closedir(dir);
+  if (*count > 0) {
+    qsort(*files, *count, sizeof(unsigned), compare_files);
+  }
+  return SUCCESS;
+}
+
+/**
+ * `replay_file` calls `fn` with each record of one log file, up to the
+ * first one that is torn or fails its checksum.
+ */
+static long replay_file(int dirfd, unsigned file,
+                        int (*fn)(void* arg, const char* key,
+                                  const char* value),
+                        void* arg) {
+  char name[WAL_NAME_MAX];
+  file_name(file, name);
+  int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+  size_t file_size = st.st_size;
+  char* data = malloc(file_size > 0 ? file_size : 1);
+  if (!data || pread(fd, data, file_size, 0) != (ssize_t)file_size) {
+    free(data);
+    close(fd);
+    return -1;
+  }
+  close(fd);
+
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+  record_header_t header;
+  long count = 0;
+  size_t offset = 0;
+  while (offset + sizeof(header) <= file_size) {
+    memcpy(&header, data + offset, sizeof(header));
+    size_t length = sizeof(header) + header.key_length + header.value_length;
+    if (header.key_length >= KVS_KEY_MAX ||
+        header.value_length >= KVS_VALUE_MAX || offset + length > file_size ||
+        record_checksum(data + offset, length) != header.checksum) {
+      break;
+    }
+    memcpy(key, data + offset + sizeof(header), header.key_length);
+    key[header.key_length] = '\0';
+    memcpy(value, data + offset + sizeof(header) + header.key_length,
+           header.value_length);
+    value[header.value_length] = '\0';
+    if (fn(arg, key, value) != SUCCESS) {
+      free(data);
+      return -1;
+    }
+    count++;
+    offset += length;
+  }
+  free(data);
+  return count;
+}
+
+long kvs_wal_replay(int dirfd,
+                    int (*fn)(void* arg, const char* key, const char* value),
+                    void* arg) {
+  unsigned* files;
+  size_t count;
+  if (list_files(dirfd, &files, &count) != SUCCESS) {
+    return -1;
+  }
+  long records = 0;
+  for (size_t i = 0; i < count && records >= 0; ++i) {
+    long replayed = replay_file(dirfd, files[i], fn, arg);
+    records = replayed >= 0 ? records + replayed : -1;
+  }
+  free(files);
+  return records;
+}
+
+/**
+ * `create_file` creates log file `file` and syncs the directory, so the file
+ * is still there to replay after a crash.
+ */
+static int create_file(int dirfd, unsigned file) {
+  char name[WAL_NAME_MAX];
+  file_name(file, name);
+  int fd = openat(dirfd, name,
+                  O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0666);
+  if (fd >= 0 && fsync(dirfd) != 0) {
+    close(fd);
+    unlinkat(dirfd, name, 0);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * `sync_log` syncs every record written so far. It is called with the lock
+ * held and no sync running, and drops the lock for the sync itself, so SETs
+ * keep appending meanwhile and are picked up by the next one.
+ */
+static void sync_log(kvs_wal_t* wal) {
+  wal->syncing = true;
+  uint64_t target = wal->appended;
+  int fd = wal->fd;
+  pthread_mutex_unlock(&wal->lock);
+  int rc = fdatasync(fd);
+  pthread_mutex_lock(&wal->lock);
+  wal->syncing = false;
+  wal->syncs++;
+  if (rc != 0) {
+    wal->failed = true;
+  } else if (target > wal->synced) {
+    wal->synced = target;
+  }
+  pthread_cond_broadcast(&wal->synced_cond);
+}
+
+static void* syncer_loop(void* arg) {
+  kvs_wal_t* wal = arg;
+  pthread_mutex_lock(&wal->lock);
+  while (!wal->stop) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    long nanoseconds = deadline.tv_nsec + wal->interval_ms * 1000000L;
+    deadline.tv_sec += nanoseconds / 1000000000L;
+    deadline.tv_nsec = nanoseconds % 1000000000L;
+    pthread_cond_timedwait(&wal->syncer_wake, &wal->lock, &deadline);
+    if (!wal->syncing && wal->synced < wal->appended) {
+      sync_log(wal);
+    }
+  }
+  pthread_mutex_unlock(&wal->lock);
+  return NULL;
+}
+
+kvs_wal_t* kvs_wal_open(int dirfd, kvs_wal_durability durability,
+                        int interval_ms) {
+  unsigned* files;
+  size_t count;
+  if (list_files(dirfd, &files, &count) != SUCCESS) {
+    return NULL;
+  }
+  char name[WAL_NAME_MAX];
+  for (size_t i = 0; i < count; ++i) {
+    file_name(files[i], name);
+    unlinkat(dirfd, name, 0);
+  }
+  free(files);
+
+  kvs_wal_t* wal = calloc(1, sizeof(kvs_wal_t));
+  if (!wal) return NULL;
+  wal->dirfd = dirfd;
+  wal->durability = durability;
+  wal->interval_ms = interval_ms > 0 ? interval_ms : 1;
+  wal->file = 1;
+  wal->oldest = 1;
+  wal->fd = create_file(dirfd, wal->file);
+  if (wal->fd < 0) {
+    free(wal);
+    return NULL;
+  }
+  pthread_mutex_init(&wal->lock, NULL);
+  pthread_cond_init(&wal->synced_cond, NULL);
+  pthread_cond_init(&wal->syncer_wake, NULL);
+  // without its syncer, a batched log is synced on every commit instead
+  if (durability == KVS_WAL_BATCH &&
+      pthread_create(&wal->syncer, NULL, syncer_loop, wal) != 0) {
+    wal->durability = KVS_WAL_ALWAYS;
+  }
+  return wal;
+}
+
+void kvs_wal_free(kvs_wal_t** ptr) {
+  kvs_wal_t* wal = *ptr;
+  if (wal->durability == KVS_WAL_BATCH) {
+    pthread_mutex_lock(&wal->lock);
+    wal->stop = true;
+    pthread_cond_signal(&wal->syncer_wake);
+    pthread_mutex_unlock(&wal->lock);
+    pthread_join(wal->syncer, NULL);
+  }
+  fdatasync(wal->fd);
+  close(wal->fd);
+  pthread_cond_destroy(&wal->syncer_wake);
+  pthread_cond_destroy(&wal->synced_cond);
+  pthread_mutex_destroy(&wal->lock);
+  free(wal);
+  *ptr = NULL;
+}
+
+uint64_t kvs_wal_append(kvs_wal_t* wal, const char* key, const char* value) {
+  char record[RECORD_MAX];
+  record_header_t header;
+  size_t key_length = strlen(key);
+  size_t value_length = strlen(value);
+  size_t length = sizeof(header) + key_length + value_length;
+  if (key_length >= KVS_KEY_MAX || value_length >= KVS_VALUE_MAX) {
+    return 0;
+  }
+
+  header.key_length = key_length;
+  header.value_length = value_length;
+  memcpy(record, &header, sizeof(header));
+  memcpy(record + sizeof(header), key, key_length);
+  memcpy(record + sizeof(header) + key_length, value, value_length);
+  header.checksum = record_checksum(record, length);
+  memcpy(record, &header.checksum, sizeof(header.checksum));
+
+  uint64_t sequence = 0;
+  pthread_mutex_lock(&wal->lock);
+  size_t done = 0;
+  while (!wal->failed && done < length) {
+    ssize_t n = write(wal->fd, record + done, length - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      // a torn record would hide every later one from the replay
+      wal->failed = true;
+      break;
+    }
+    done += n;
+  }
+  if (!wal->failed) {
+    sequence = ++wal->appended;
+  }
+  pthread_mutex_unlock(&wal->lock);
+  return sequence;
+}
+
+int kvs_wal_commit(kvs_wal_t* wal, uint64_t sequence) {
+  if (wal->durability != KVS_WAL_ALWAYS) {
+    return SUCCESS;
+  }
+  pthread_mutex_lock(&wal->lock);
+  while (wal->synced < sequence && !wal->failed) {
+    if (wal->syncing) {
+      pthread_cond_wait(&wal->synced_cond, &wal->lock);
+    } else {
+      sync_log(wal);
+    }
+  }
+  int rc = wal->synced >= sequence ? SUCCESS : FAILURE;
+  pthread_mutex_unlock(&wal->lock);
+  return rc;
+}
+
+unsigned kvs_wal_rotate(kvs_wal_t* wal) {
+  pthread_mutex_lock(&wal->lock);
+  while (wal->syncing) {
+    pthread_cond_wait(&wal->synced_cond, &wal->lock);
+  }
+  // a later file must never be more durable than an earlier one
+  if (wal->failed || fdatasync(wal->fd) != 0) {
+    wal->failed = true;
+    pthread_mutex_unlock(&wal->lock);
+    return 0;
+  }
+  wal->synced = wal->appended;
+  wal->syncs++;
+  int fd = create_file(wal->dirfd, wal->file + 1);
+  if (fd < 0) {
+    pthread_mutex_unlock(&wal->lock);
+    return 0;
+  }
+  close(wal->fd);
+  wal->fd = fd;
+  wal->file++;
+  unsigned file = wal->file;
+  pthread_mutex_unlock(&wal->lock);
+  return file;
+}
+
+void kvs_wal_release(kvs_wal_t* wal, unsigned file) {
+  char name[WAL_NAME_MAX];
+  pthread_mutex_lock(&wal->lock);
+  for (; wal->oldest < file; ++wal->oldest) {
+    file_name(wal->oldest, name);
+    unlinkat(wal->dirfd, name, 0);
+  }
+  pthread_mutex_unlock(&wal->lock);
+}
+
+void kvs_wal_counts(kvs_wal_t* wal, uint64_t* records, uint64_t* syncs) {
+  pthread_mutex_lock(&wal->lock);
+  *records = wal->appended;
+  *syncs = wal->syncs;
+  pthread_mutex_unlock(&wal->lock);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * `kvs_wal_durability` is how far a SET's log record has got when the SET
+ * returns.
+ */
+typedef enum {
+  // written to the log file but never synced: it survives a crash of the
+  // process, not of the machine
+  KVS_WAL_NONE,
+  // synced by a background thread every `interval_ms`, so a machine crash
+  // loses at most the last interval
+  KVS_WAL_BATCH,
+  // synced before the SET returns; SETs that arrive while a sync is running
+  // share the next one (group commit)
+  KVS_WAL_ALWAYS,
+} kvs_wal_durability;
+
+/**
+ * `kvs_wal_t` is a write-ahead log of the SETs a cache has not written back
+ * yet, so a crash does not lose its dirty entries. Records go to files named
+ * `.kvs-wal-NNNNNNNN` in the store directory. `kvs_flush` starts a new file
+ * with `kvs_wal_rotate` before writing back and, once the store is synced,
+ * drops the older files with `kvs_wal_release`: they hold nothing the store
+ * does not. Each record carries a checksum, so a record torn by a crash ends
+ * the replay of its file.
+ */
+struct kvs_wal;
+typedef struct kvs_wal kvs_wal_t;
+
+/**
+ * `kvs_wal_replay` calls `fn` with every record left in the store directory
+ * open as `dirfd`, oldest first, and returns the number of records or -1.
+ * Call it, and sync what `fn` wrote, before `kvs_wal_open`, which discards
+ * those records.
+ */
+long kvs_wal_replay(int dirfd,
+                    int (*fn)(void* arg, const char* key, const char* value),
+                    void* arg);
+
+/**
+ * `kvs_wal_open` removes the log files of the directory open as `dirfd` and
+ * starts an empty log.
+ */
+kvs_wal_t* kvs_wal_open(int dirfd, kvs_wal_durability durability,
+                        int interval_ms);
+
+/**
+ * `kvs_wal_free` syncs the log and closes it. The files stay, so whatever
+ * was not flushed is replayed when the store next opens.
+ */
+void kvs_wal_free(kvs_wal_t** ptr);
+
+/**
+ * `kvs_wal_append` writes a record of a SET to the log and returns its
+ * sequence number, or 0 if the key or value is too long for a record or the
+ * write failed. `kvs_wal_commit` then waits until the record is as durable
+ * as the log's `kvs_wal_durability` asks. Appending can be done under a lock
+ * and committing after it is dropped, so other SETs can join the same sync.
+ */
+uint64_t kvs_wal_append(kvs_wal_t* wal, const char* key, const char* value);
+int kvs_wal_commit(kvs_wal_t* wal, uint64_t sequence);
+
+/**
+ * `kvs_wal_rotate` syncs the current log file and starts a new one, and
+ * returns the new file's number, or 0 on failure. `kvs_wal_release` removes
+ * the files older than `file`.
+ */
+unsigned kvs_wal_rotate(kvs_wal_t* wal);
+void kvs_wal_release(kvs_wal_t* wal, unsigned file);
+
+/**
+ * `kvs_wal_counts` returns how many records have been appended and how
+ * many syncs made them durable; their ratio is the mean commit group.
+ */
+void kvs_wal_counts(kvs_wal_t* wal, uint64_t* records, uint64_t* syncs);
@@ -0,0 +1,327 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <err.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench_workload.h"
+#include "kvs.h"
+
+/**
+ * `loadgen` drives a running `kvs_server`: CONNECTIONS connections, each on
+ * its own thread, send a Zipfian mix of GETs and SETs in pipelined batches of
+ * DEPTH requests, and it reports the combined throughput and the latency of
+ * a request, from sending its batch to reading its answer.
+ */
+
+// the longest request line: SET, a key, a space, a value and a newline
+#define REQUEST_MAX (KVS_KEY_MAX + KVS_VALUE_MAX + 8)
+
+typedef struct loadgen_options {
+  const char* path;
+  int port;
+  int connections;
+  int depth;
+  int requests;
+  int keys;
+  int write_percent;
+} loadgen_options_t;
+
+typedef struct loadgen_worker {
+  const loadgen_options_t* options;
+  pthread_t thread;
+  uint64_t seed;
+  int requests;
+  // the latency of each request, in nanoseconds
+  double* latencies;
+  int errors;
+  bool failed;
+} loadgen_worker_t;
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int connect_server(const loadgen_options_t* options) {
+  int fd;
+  if (options->path) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", options->path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 &&
+        connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  } else {
+    struct sockaddr_in address = {.sin_family = AF_INET,
+                                  .sin_port = htons(options->port),
+                                  .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    if (fd >= 0 &&
+        (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) != 0 ||
+         connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0)) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if (fd < 0) {
+    warn("connect");
+  }
+  return fd;
+}
+
+static int send_all(int fd, const char* data, size_t length) {
+  while (length > 0) {
+    ssize_t sent = write(fd, data, length);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return FAILURE;
+    }
+    data += sent;
+    length -= sent;
+  }
+  return SUCCESS;
+}
+
+/**
+ * `read_answers` reads `count` answer lines, storing in `latencies` how long
+ * after `start` each arrived and counting those that are errors.
+ */
+static int read_answers(int fd, int count, double start, double* latencies,
+                        int* errors) {
+  char buffer[65536];
+  size_t length = 0;
+  int answered = 0;
+  while (answered < count) {
+    ssize_t received = read(fd, buffer + length, sizeof(buffer) - length);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return FAILURE;
+    }
+    length += received;
+    double now = now_ns();
+    char* line = buffer;
+    char* newline;
+    while ((newline = memchr(line, '\n', buffer + length - line)) != NULL) {
+      if (answered == count) {
+        return FAILURE;
+      }
+      if (strncmp(line, "ERROR", 5) == 0) {
+        *errors += 1;
+      }
+      if (latencies) {
+        latencies[answered] = now - start;
+      }
+      answered += 1;
+      line = newline + 1;
+    }
+    length = buffer + length - line;
+    if (length == sizeof(buffer)) {
+      return FAILURE;
+    }
+    memmove(buffer, line, length);
+  }
+  return SUCCESS;
+}
+
+static void* loadgen_worker(void* arg) {
+  loadgen_worker_t* worker = arg;
+  const loadgen_options_t* options = worker->options;
+  bench_workload_t workload = {.distribution = BENCH_ZIPF,
+                               .skew = 0.99,
+                               .write_percent = options->write_percent,
+                               .value_min = 20,
+                               .value_max = 20};
+  bench_workload_start(&workload, options->keys, worker->seed);
+  char* batch = malloc((size_t)options->depth * REQUEST_MAX);
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+  int fd = connect_server(options);
+  if (batch == NULL || fd < 0) {
+    worker->failed = true;
+    free(batch);
+    return NULL;
+  }
+
+  for (int done = 0; done < worker->requests;) {
+    int count = worker->requests - done;
+    if (count > options->depth) {
+      count = options->depth;
+    }
+    size_t length = 0;
+    for (int i = 0; i < count; ++i) {
+      bool write;
+      bench_workload_next(&workload, key, value, &write);
+      length += write ? sprintf(batch + length, "SET %s %s\n", key, value)
+                      : sprintf(batch + length, "GET %s\n", key);
+    }
+    double start = now_ns();
+    if (send_all(fd, batch, length) != SUCCESS ||
+        read_answers(fd, count, start, worker->latencies + done,
+                     &worker->errors) != SUCCESS) {
+      worker->failed = true;
+      break;
+    }
+    done += count;
+  }
+  close(fd);
+  free(batch);
+  return NULL;
+}
+
+/**
+ * `preload` sets every key once over a single connection, so the GETs that
+ * follow find a value.
+ */
+static int preload(const loadgen_options_t* options) {
+  const int depth = 64;
+  bench_workload_t workload = {.value_min = 20, .value_max = 20};
+  bench_workload_start(&workload, options->keys, 1);
+  char* batch = malloc((size_t)depth * REQUEST_MAX);
+  char key[KVS_KEY_MAX];
+  char value[KVS_VALUE_MAX];
+  int fd = connect_server(options);
+  int errors = 0;
+  int rc = batch != NULL && fd >= 0 ? SUCCESS : FAILURE;
+  for (int id = 0; rc == SUCCESS && id < options->keys; id += depth) {
+    int count = options->keys - id < depth ? options->keys - id : depth;
+    size_t length = 0;
+    for (int i = 0; i < count; ++i) {
+      bench_workload_key(&workload, id + i, key);
+      bench_workload_value(&workload, value);
+      length += sprintf(batch + length, "SET %s %s\n", key, value);
+    }
+    if (send_all(fd, batch, length) != SUCCESS ||
+        read_answers(fd, count, 0, NULL, &errors) != SUCCESS || errors > 0) {
+      rc = FAILURE;
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  free(batch);
+  return rc;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s (-u PATH | -p PORT) [-c CONNECTIONS] [-d DEPTH] "
+          "[-n REQUESTS] [-k KEYS] [-w WRITE-PERCENT] [-P]\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  loadgen_options_t options = {.connections = 16,
+                               .depth = 1,
+                               .requests = 1000000,
+                               .keys = 100000,
+                               .write_percent = 5};
+  bool load = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "u:p:c:d:n:k:w:P")) != -1) {
+    switch (opt) {
+      case 'u':
+        options.path = optarg;
+        break;
+      case 'p':
+        options.port = atoi(optarg);
+        break;
+      case 'c':
+        options.connections = atoi(optarg);
+        break;
+      case 'd':
+        options.depth = atoi(optarg);
+        break;
+      case 'n':
+        options.requests = atoi(optarg);
+        break;
+      case 'k':
+        options.keys = atoi(optarg);
+        break;
+      case 'w':
+        options.write_percent = atoi(optarg);
+        break;
+      case 'P':
+        load = true;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (optind != argc || (options.path == NULL && options.port <= 0) ||
+      options.connections < 1 || options.depth < 1 ||
+      options.requests < options.connections || options.keys < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (load && preload(&options) != SUCCESS) {
+    fprintf(stderr, "preload failed\n");
+    return 1;
+  }
+
+  int per_connection = options.requests / options.connections;
+  int total = per_connection * options.connections;
+  double* latencies = malloc((size_t)total * sizeof(double));
+  loadgen_worker_t* workers =
+      calloc(options.connections, sizeof(loadgen_worker_t));
+  if (latencies == NULL || workers == NULL) {
+    return 1;
+  }
+  double start = now_ns();
+  for (int i = 0; i < options.connections; ++i) {
+    workers[i].options = &options;
+    workers[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+    workers[i].requests = per_connection;
+    workers[i].latencies = latencies + (size_t)i * per_connection;
+    pthread_create(&workers[i].thread, NULL, loadgen_worker, &workers[i]);
+  }
+  int errors = 0;
+  bool failed = false;
+  for (int i = 0; i < options.connections; ++i) {
+    pthread_join(workers[i].thread, NULL);
+    errors += workers[i].errors;
+    failed |= workers[i].failed;
+  }
+  double elapsed = now_ns() - start;
+  if (failed) {
+    fprintf(stderr, "lost the connection to the server\n");
+    return 1;
+  }
+
+  qsort(latencies, total, sizeof(double), compare_doubles);
+  printf("%11s %6s %12s %10s %10s %10s %8s\n", "CONNECTIONS", "DEPTH",
+         "REQUESTS/S", "P50 NS", "P99 NS", "P999 NS", "ERRORS");
+  printf("%11d %6d %12.0f %10.0f %10.0f %10.0f %8d\n", options.connections,
+         options.depth, total / (elapsed / 1e9), latencies[total / 2],
+         latencies[(size_t)total * 99 / 100],
+         latencies[(size_t)total * 999 / 1000], errors);
+  free(workers);
+  free(latencies);
+  return 0;
+}
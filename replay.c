@@ -0,0 +1,235 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kvs.h"
+#include "kvs_cli.h"
+#include "kvs_index.h"
+
+/**
+ * `replay` feeds a trace recorded with `-T` (see kvs_trace.h) through a
+ * store opened with any policy, capacity and store options, and reports the
+ * hit rate, disk operations and latencies it got. It runs the requests back
+ * to back unless `-x SPEED` asks for the recorded pace, sped up SPEED
+ * times. A trace only says how long each value was, so SETs store filler of
+ * that length; with `-P`, the first time the trace finds a key the replay
+ * has not set, the key is looked up on disk and, if the store lacks it,
+ * written there with such a value before the GET runs, so that a trace can
+ * be replayed into an empty directory. Those reads and writes are left out
+ * of the disk operations reported.
+ */
+
+typedef struct replay {
+  kvs_t* kvs;
+  // 0 to run as fast as possible
+  double speed;
+  bool populate;
+  // with `populate`, the keys already set or checked, each its own copy
+  kvs_index_t* seen;
+  // when the current record is due, in nanoseconds since the start
+  double due;
+  struct timespec start;
+  uint64_t flushes;
+  uint64_t filled;
+  uint64_t filled_bytes;
+  uint64_t checked;
+  uint64_t checked_bytes;
+  char value[KVS_VALUE_MAX];
+  char filler[KVS_VALUE_MAX];
+} replay_t;
+
+/**
+ * `wait_until_due` sleeps until the current record is due. A replay that
+ * falls behind does not sleep until it has caught up.
+ */
+static void wait_until_due(replay_t* replay) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double elapsed = (now.tv_sec - replay->start.tv_sec) * 1e9 +
+                   (now.tv_nsec - replay->start.tv_nsec);
+  if (elapsed >= replay->due) {
+    return;
+  }
+  double ahead = replay->due - elapsed;
+  struct timespec pause = {.tv_sec = (time_t)(ahead / 1e9),
+                           .tv_nsec = (long)(ahead - (time_t)(ahead / 1e9) *
+                                                         1e9)};
+  while (nanosleep(&pause, &pause) != 0 && errno == EINTR) {
+  }
+}
+
+/**
+ * `filler` returns a value of `length` bytes, capped to the longest a value
+ * can be.
+ */
+static const char* filler(replay_t* replay, size_t length) {
+  if (length >= KVS_VALUE_MAX) {
+    length = KVS_VALUE_MAX - 1;
+  }
+  memset(replay->filler, 'v', length);
+  replay->filler[length] = '\0';
+  return replay->filler;
+}
+
+/**
+ * `see` records that the replay has dealt with `key`, and returns whether it
+ * already had.
+ */
+static bool see(replay_t* replay, const char* key) {
+  if (kvs_index_get(replay->seen, key)) {
+    return true;
+  }
+  char* copy = strdup(key);
+  if (copy && kvs_index_put(replay->seen, copy, copy) != SUCCESS) {
+    free(copy);
+  }
+  return false;
+}
+
+static void free_seen(const char* key, void* item, void* arg) { free(item); }
+
+/**
+ * `populate` writes filler for `key` straight to disk if the store lacks
+ * it, the first time the trace finds it. The lookup bypasses the caches,
+ * so a key the store lacks is never cached as empty.
+ */
+static int populate(replay_t* replay, const kvs_trace_op_t* op) {
+  if (see(replay, op->key)) {
+    return SUCCESS;
+  }
+  kvs_base_t* kvs_base = replay->kvs->kvs_base;
+  unsigned long long reads = atomic_load(&kvs_base->get_count);
+  unsigned long long bytes = atomic_load(&kvs_base->metrics.bytes_read);
+  int rc = kvs_base_get(kvs_base, op->key, replay->value);
+  replay->checked += atomic_load(&kvs_base->get_count) - reads;
+  replay->checked_bytes += atomic_load(&kvs_base->metrics.bytes_read) - bytes;
+  if (rc == SUCCESS && replay->value[0] != '\0') {
+    return SUCCESS;
+  }
+  const char* value = filler(replay, op->value_length);
+  if (kvs_base_set(kvs_base, op->key, value) != SUCCESS) {
+    return FAILURE;
+  }
+  replay->filled += 1;
+  replay->filled_bytes += strlen(value);
+  return SUCCESS;
+}
+
+static int replay_op(void* arg, const kvs_trace_op_t* op) {
+  replay_t* replay = arg;
+  if (replay->speed > 0) {
+    replay->due += op->delta_ns / replay->speed;
+    wait_until_due(replay);
+  }
+  switch (op->kind) {
+    case KVS_TRACE_GET:
+      if (replay->populate && op->value_length > 0 &&
+          populate(replay, op) != SUCCESS) {
+        return FAILURE;
+      }
+      // the store answers a key it lacks with an empty value
+      kvs_get(replay->kvs, op->key, replay->value);
+      return SUCCESS;
+    case KVS_TRACE_SET:
+      if (replay->populate) {
+        see(replay, op->key);
+      }
+      // a failed SET is counted by the store like any other
+      kvs_set(replay->kvs, op->key, filler(replay, op->value_length));
+      return SUCCESS;
+    case KVS_TRACE_FLUSH:
+      replay->flushes += 1;
+      kvs_flush(replay->kvs);
+      return SUCCESS;
+  }
+  return FAILURE;
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s " KVS_CLI_USAGE
+          " [-x SPEED] [-P] TRACE DIRECTORY POLICY CAPACITY\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  kvs_config_t config;
+  kvs_config_init(&config, NULL, KVS_CACHE_NONE, 0);
+  replay_t replay = {.speed = 0, .populate = false};
+  int opt;
+  while ((opt = getopt(argc, argv, KVS_CLI_OPTIONS "x:P")) != -1) {
+    if (opt == 'x') {
+      replay.speed = atof(optarg);
+    } else if (opt == 'P') {
+      replay.populate = true;
+    } else if (kvs_cli_option(&config, opt, optarg) != SUCCESS) {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (argc - optind != 4 || replay.speed < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  kvs_cli_store(&config, argv[optind + 1], argv[optind + 2],
+                argv[optind + 3]);
+  replay.kvs = kvs_new_config(&config);
+  if (replay.kvs == NULL) {
+    fprintf(stderr, "kvs_new failed\n");
+    return 1;
+  }
+  if (replay.populate && (replay.seen = kvs_index_new(1024)) == NULL) {
+    fprintf(stderr, "kvs_index_new failed\n");
+    kvs_free(&replay.kvs);
+    return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &replay.start);
+  long count = kvs_trace_read(argv[optind], replay_op, &replay);
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (replay.seen) {
+    kvs_index_for_each(replay.seen, free_seen, NULL);
+    kvs_index_free(&replay.seen);
+  }
+  if (count < 0) {
+    fprintf(stderr, "cannot replay %s\n", argv[optind]);
+    kvs_free(&replay.kvs);
+    return 1;
+  }
+  double seconds = (end.tv_sec - replay.start.tv_sec) +
+                   (end.tv_nsec - replay.start.tv_nsec) / 1e9;
+
+  kvs_stats_t stats;
+  kvs_stats(replay.kvs, &stats);
+  printf("REPLAY: %ld OPERATIONS IN %.3f S (%.0f OPERATIONS/S)\n", count,
+         seconds, seconds > 0 ? count / seconds : 0.0);
+  printf("REPLAY GETS: %llu SETS: %llu FLUSHES: %llu HIT RATE: %.2f%%\n",
+         (unsigned long long)stats.gets, (unsigned long long)stats.sets,
+         (unsigned long long)replay.flushes, stats.hit_rate * 100);
+  printf("REPLAY DISK READS: %llu WRITES: %llu BYTES READ: %llu BYTES "
+         "WRITTEN: %llu FILLED: %llu\n",
+         (unsigned long long)(stats.disk_reads - replay.checked),
+         (unsigned long long)(stats.disk_writes - replay.filled),
+         (unsigned long long)(stats.bytes_read - replay.checked_bytes),
+         (unsigned long long)(stats.bytes_written - replay.filled_bytes),
+         (unsigned long long)replay.filled);
+  for (int i = 0; i < KVS_STATS_LATENCIES; ++i) {
+    kvs_latency_t* latency = &stats.latencies[i];
+    printf("REPLAY %s COUNT: %llu MEAN: %.0f P50: %llu P99: %llu P999: %llu "
+           "MAX: %llu NS\n",
+           kvs_stats_name(i), (unsigned long long)latency->count,
+           latency->mean, (unsigned long long)latency->p50,
+           (unsigned long long)latency->p99,
+           (unsigned long long)latency->p999,
+           (unsigned long long)latency->max);
+  }
+  kvs_free(&replay.kvs);
+  return 0;
+}
@@ -0,0 +1,694 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <err.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "kvs.h"
+#include "kvs_cli.h"
+#include "kvs_dir.h"
+
+/**
+ * `kvs_server` serves one store to many clients over a Unix socket, a
+ * loopback TCP port or both. It speaks the line protocol of `client`, except
+ * that every request gets an answer: a value line for `GET`, one line per key
+ * for `MGET`, `OK` for `SET`, `MSET`, `PREFETCH` and `FLUSH`, the `SCAN`,
+ * `RANGE`, `STATS` or `MRC` lines followed by `END`, or a line starting with
+ * `ERROR`. Clients may pipeline: they can send any number of requests before
+ * reading the answers, which come back in order.
+ *
+ * A few event loops, each a thread with its own epoll instance, share the
+ * listening sockets; a connection stays on the loop that accepted it, and
+ * every loop calls into the same `kvs_t`, whose shard locks keep it
+ * consistent.
+ */
+
+// the most words a request line can hold, and its longest length; the same
+// limits as `client`
+#define WORDS_MAX ((KVS_KEY_MAX + KVS_VALUE_MAX + 128) / 2)
+#define LINE_MAX (WORDS_MAX * 2)
+// bytes read from a socket at a time
+#define READ_SIZE 65536
+// answers a connection may have waiting before the loop stops reading its
+// requests until the client catches up
+#define BACKLOG_MAX (1 << 20)
+#define EVENTS_MAX 64
+
+typedef struct connection {
+  int fd;
+  // bytes read but not yet answered, always less than one line past the last
+  // newline
+  char* in;
+  size_t in_length;
+  // answers not yet sent: `out[out_sent .. out_length)`
+  char* out;
+  size_t out_length;
+  size_t out_capacity;
+  size_t out_sent;
+  // the epoll events the connection is registered for
+  uint32_t events;
+  // close once the answers are sent
+  bool closing;
+  // the other connections of the same loop
+  struct connection* prev;
+  struct connection* next;
+} connection_t;
+
+typedef struct server {
+  kvs_t* kvs;
+  // the listening sockets, or -1; their addresses tell the loops' events
+  // apart from those of connections
+  int unix_fd;
+  int tcp_fd;
+  // an eventfd written once to stop every loop
+  int stop_fd;
+} server_t;
+
+/**
+ * `loop_t` is one event loop: a thread, its epoll instance and the
+ * connections it accepted.
+ */
+typedef struct loop {
+  server_t* server;
+  pthread_t thread;
+  int epoll_fd;
+  connection_t* connections;
+} loop_t;
+
+static connection_t* connection_new(int fd) {
+  connection_t* connection = calloc(1, sizeof(connection_t));
+  if (connection == NULL) {
+    return NULL;
+  }
+  connection->in = malloc(READ_SIZE);
+  if (connection->in == NULL) {
+    free(connection);
+    return NULL;
+  }
+  connection->fd = fd;
+  connection->events = EPOLLIN;
+  return connection;
+}
+
+static void connection_free(loop_t* loop, connection_t** ptr) {
+  if (ptr && *ptr) {
+    connection_t* connection = *ptr;
+    if (connection->prev) {
+      connection->prev->next = connection->next;
+    } else {
+      loop->connections = connection->next;
+    }
+    if (connection->next) {
+      connection->next->prev = connection->prev;
+    }
+    // closing the socket also removes it from the epoll instance
+    close((*ptr)->fd);
+    free((*ptr)->in);
+    free((*ptr)->out);
+    free(*ptr);
+    *ptr = NULL;
+  }
+}
+
+/**
+ * `reply` queues `length` bytes of answer, followed by a newline if
+ * `newline` is set.
+ */
+static int reply(connection_t* connection, const char* data, size_t length,
+                 bool newline) {
+  size_t needed = connection->out_length + length + newline;
+  if (needed > connection->out_capacity) {
+    size_t capacity = connection->out_capacity ? connection->out_capacity
+                                               : READ_SIZE;
+    while (capacity < needed) {
+      capacity *= 2;
+    }
+    char* out = realloc(connection->out, capacity);
+    if (out == NULL) {
+      return FAILURE;
+    }
+    connection->out = out;
+    connection->out_capacity = capacity;
+  }
+  memcpy(connection->out + connection->out_length, data, length);
+  connection->out_length += length;
+  if (newline) {
+    connection->out[connection->out_length++] = '\n';
+  }
+  return SUCCESS;
+}
+
+static int reply_line(connection_t* connection, const char* line) {
+  return reply(connection, line, strlen(line), true);
+}
+
+/**
+ * `split_words` splits `line` in place at every space and stores up to `max`
+ * words in `words`, returning how many it found.
+ */
+static int split_words(char* line, char** words, int max) {
+  int count = 0;
+  char* save;
+  for (char* word = strtok_r(line, " ", &save); word != NULL && count < max;
+       word = strtok_r(NULL, " ", &save)) {
+    words[count++] = word;
+  }
+  return count;
+}
+
+static bool valid_key(const char* key) {
+  // the same keys whatever the backend, so a store can change backends
+  return kvs_dir_valid_key(key);
+}
+
+static int run_get(server_t* server, connection_t* connection, char* key) {
+  char value[KVS_VALUE_MAX];
+  if (!valid_key(key)) {
+    return reply_line(connection, "ERROR invalid key");
+  }
+  if (kvs_get(server->kvs, key, value) != SUCCESS) {
+    return reply_line(connection, "ERROR GET");
+  }
+  return reply_line(connection, value);
+}
+
+static int run_set(server_t* server, connection_t* connection, char* pair) {
+  // the value is the rest of the line, spaces and all
+  char* value = strchr(pair, ' ');
+  if (value == NULL) {
+    return reply_line(connection, "ERROR missing value");
+  }
+  *value++ = '\0';
+  if (!valid_key(pair)) {
+    return reply_line(connection, "ERROR invalid key");
+  }
+  if (strlen(value) >= KVS_VALUE_MAX) {
+    return reply_line(connection, "ERROR value too long");
+  }
+  if (kvs_set(server->kvs, pair, value) != SUCCESS) {
+    return reply_line(connection, "ERROR SET");
+  }
+  return reply_line(connection, "OK");
+}
+
+static int run_mget(server_t* server, connection_t* connection,
+                    char* keys_line) {
+  char* keys[WORDS_MAX];
+  int count = split_words(keys_line, keys, WORDS_MAX);
+  for (int i = 0; i < count; ++i) {
+    if (!valid_key(keys[i])) {
+      return reply_line(connection, "ERROR invalid key");
+    }
+  }
+  if (count == 0) {
+    return SUCCESS;
+  }
+  char* values = malloc((size_t)count * KVS_VALUE_MAX);
+  char* value_ptrs[WORDS_MAX];
+  if (values == NULL) {
+    return FAILURE;
+  }
+  for (int i = 0; i < count; ++i) {
+    value_ptrs[i] = values + (size_t)i * KVS_VALUE_MAX;
+  }
+  int rc;
+  if (kvs_mget(server->kvs, count, (const char**)keys, value_ptrs) !=
+      SUCCESS) {
+    rc = reply_line(connection, "ERROR MGET");
+  } else {
+    rc = SUCCESS;
+    for (int i = 0; rc == SUCCESS && i < count; ++i) {
+      rc = reply_line(connection, value_ptrs[i]);
+    }
+  }
+  free(values);
+  return rc;
+}
+
+static int run_mset(server_t* server, connection_t* connection,
+                    char* pairs_line) {
+  char* words[WORDS_MAX];
+  int count = split_words(pairs_line, words, WORDS_MAX);
+  if (count % 2 != 0) {
+    return reply_line(connection, "ERROR missing value");
+  }
+  const char* keys[WORDS_MAX / 2];
+  const char* values[WORDS_MAX / 2];
+  for (int i = 0; i < count / 2; ++i) {
+    keys[i] = words[2 * i];
+    values[i] = words[2 * i + 1];
+    if (!valid_key(keys[i])) {
+      return reply_line(connection, "ERROR invalid key");
+    }
+    if (strlen(values[i]) >= KVS_VALUE_MAX) {
+      return reply_line(connection, "ERROR value too long");
+    }
+  }
+  if (kvs_mset(server->kvs, count / 2, keys, values) != SUCCESS) {
+    return reply_line(connection, "ERROR MSET");
+  }
+  return reply_line(connection, "OK");
+}
+
+static int run_prefetch(server_t* server, connection_t* connection,
+                        char* keys_line) {
+  char* keys[WORDS_MAX];
+  int count = split_words(keys_line, keys, WORDS_MAX);
+  for (int i = 0; i < count; ++i) {
+    if (!valid_key(keys[i])) {
+      return reply_line(connection, "ERROR invalid key");
+    }
+  }
+  kvs_prefetch(server->kvs, count, (const char**)keys);
+  return reply_line(connection, "OK");
+}
+
+static int reply_entry(void* arg, const char* key, const char* value) {
+  char line[KVS_KEY_MAX + KVS_VALUE_MAX];
+  snprintf(line, sizeof(line), "%s %s", key, value);
+  return reply_line(arg, line);
+}
+
+/**
+ * `run_scan` answers `SCAN` or `RANGE` with a `KEY VALUE` line per key and
+ * then `END`. A scan that fails partway ends with an `ERROR` line instead.
+ */
+static int run_scan(server_t* server, connection_t* connection, bool range,
+                    char* args) {
+  if (kvs_cli_scan(server->kvs, range, args, reply_entry, connection) < 0) {
+    return reply_line(connection, range ? "ERROR RANGE" : "ERROR SCAN");
+  }
+  return reply_line(connection, "END");
+}
+
+/**
+ * `run_report` answers with the lines `print` writes, followed by `END`.
+ */
+static int run_report(server_t* server, connection_t* connection,
+                      void (*print)(FILE*, kvs_t*)) {
+  char* report;
+  size_t length;
+  FILE* out = open_memstream(&report, &length);
+  if (out == NULL) {
+    return FAILURE;
+  }
+  print(out, server->kvs);
+  fprintf(out, "END\n");
+  if (fclose(out) != 0) {
+    return FAILURE;
+  }
+  int rc = reply(connection, report, length, false);
+  free(report);
+  return rc;
+}
+
+/**
+ * `run_command` answers one request line, without its newline. It returns
+ * FAILURE only if the answer cannot be queued.
+ */
+static int run_command(server_t* server, connection_t* connection,
+                       char* line) {
+  if (strncmp(line, "GET ", 4) == 0) {
+    return run_get(server, connection, line + 4);
+  }
+  if (strncmp(line, "SET ", 4) == 0) {
+    return run_set(server, connection, line + 4);
+  }
+  if (strncmp(line, "MGET ", 5) == 0) {
+    return run_mget(server, connection, line + 5);
+  }
+  if (strncmp(line, "MSET ", 5) == 0) {
+    return run_mset(server, connection, line + 5);
+  }
+  if (strcmp(line, "SCAN") == 0 || strncmp(line, "SCAN ", 5) == 0) {
+    return run_scan(server, connection, false, line + 4);
+  }
+  if (strncmp(line, "RANGE ", 6) == 0) {
+    return run_scan(server, connection, true, line + 6);
+  }
+  if (strncmp(line, "PREFETCH ", 9) == 0) {
+    return run_prefetch(server, connection, line + 9);
+  }
+  if (strcmp(line, "STATS") == 0) {
+    return run_report(server, connection, kvs_cli_print_stats);
+  }
+  if (strcmp(line, "MRC") == 0) {
+    return run_report(server, connection, kvs_cli_print_mrc);
+  }
+  if (strcmp(line, "FLUSH") == 0) {
+    return reply_line(connection, kvs_flush(server->kvs) == SUCCESS
+                                      ? "OK"
+                                      : "ERROR FLUSH");
+  }
+  return reply_line(connection, "ERROR unknown command");
+}
+
+/**
+ * `run_lines` answers every complete line in the input buffer and keeps the
+ * partial line that may follow. A line that cannot end within `LINE_MAX`
+ * bytes is refused and the connection closed, since there is no telling
+ * where the next request starts.
+ */
+static int run_lines(server_t* server, connection_t* connection) {
+  char* start = connection->in;
+  char* end = connection->in + connection->in_length;
+  char* newline;
+  while (!connection->closing &&
+         (newline = memchr(start, '\n', end - start)) != NULL) {
+    if (newline - start >= LINE_MAX) {
+      connection->closing = true;
+      break;
+    }
+    *newline = '\0';
+    if (newline > start && newline[-1] == '\r') {
+      newline[-1] = '\0';
+    }
+    if (run_command(server, connection, start) != SUCCESS) {
+      return FAILURE;
+    }
+    start = newline + 1;
+  }
+  connection->in_length = end - start;
+  if (connection->in_length >= LINE_MAX) {
+    connection->closing = true;
+  }
+  if (connection->closing) {
+    connection->in_length = 0;
+    return reply_line(connection, "ERROR line too long");
+  }
+  memmove(connection->in, start, connection->in_length);
+  return SUCCESS;
+}
+
+/**
+ * `send_replies` writes as much of the queued answers as the socket takes.
+ */
+static int send_replies(connection_t* connection) {
+  while (connection->out_sent < connection->out_length) {
+    ssize_t sent = send(connection->fd, connection->out + connection->out_sent,
+                        connection->out_length - connection->out_sent,
+                        MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK ? SUCCESS : FAILURE;
+    }
+    connection->out_sent += sent;
+  }
+  connection->out_sent = 0;
+  connection->out_length = 0;
+  return SUCCESS;
+}
+
+/**
+ * `update_events` registers the connection for what it is waiting on:
+ * requests, room to send its answers, or only the latter while its backlog
+ * is over `BACKLOG_MAX` or it is closing.
+ */
+static int update_events(loop_t* loop, connection_t* connection) {
+  size_t backlog = connection->out_length - connection->out_sent;
+  uint32_t events = 0;
+  if (!connection->closing && backlog < BACKLOG_MAX) {
+    events |= EPOLLIN;
+  }
+  if (backlog > 0) {
+    events |= EPOLLOUT;
+  }
+  if (events == connection->events) {
+    return SUCCESS;
+  }
+  struct epoll_event event = {.events = events, .data.ptr = connection};
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) !=
+      0) {
+    return FAILURE;
+  }
+  connection->events = events;
+  return SUCCESS;
+}
+
+/**
+ * `serve` handles the events of one connection and returns FAILURE once it
+ * should be closed.
+ */
+static int serve(loop_t* loop, connection_t* connection, uint32_t events) {
+  if (events & EPOLLIN) {
+    ssize_t length =
+        read(connection->fd, connection->in + connection->in_length,
+             READ_SIZE - connection->in_length);
+    if (length == 0 || (length < 0 && errno != EAGAIN && errno != EINTR)) {
+      return FAILURE;
+    }
+    if (length > 0) {
+      connection->in_length += length;
+      if (run_lines(loop->server, connection) != SUCCESS) {
+        return FAILURE;
+      }
+    }
+  } else if (events & (EPOLLERR | EPOLLHUP)) {
+    return FAILURE;
+  }
+  if (send_replies(connection) != SUCCESS) {
+    return FAILURE;
+  }
+  if (connection->closing && connection->out_length == 0) {
+    return FAILURE;
+  }
+  return update_events(loop, connection);
+}
+
+static void accept_connections(loop_t* loop, int listen_fd, bool tcp) {
+  for (;;) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      // EAGAIN once another loop took the connection or the queue is empty
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        warn("accept4");
+      }
+      return;
+    }
+    if (tcp) {
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    connection_t* connection = connection_new(fd);
+    if (connection == NULL) {
+      close(fd);
+      continue;
+    }
+    connection->next = loop->connections;
+    if (loop->connections) {
+      loop->connections->prev = connection;
+    }
+    loop->connections = connection;
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = connection};
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+      connection_free(loop, &connection);
+    }
+  }
+}
+
+/**
+ * `watch` adds `fd` to `epoll_fd`, tagged with `tag`. The listening sockets
+ * are watched with EPOLLEXCLUSIVE so a new connection wakes one loop, not
+ * all of them.
+ */
+static int watch(int epoll_fd, int fd, void* tag, uint32_t events) {
+  struct epoll_event event = {.events = events, .data.ptr = tag};
+  return fd < 0 ? SUCCESS : epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+/**
+ * `event_loop` runs one loop until the server stops, then closes the
+ * connections it accepted. Answers still queued are dropped.
+ */
+static void* event_loop(void* arg) {
+  loop_t* loop = arg;
+  server_t* server = loop->server;
+  struct epoll_event events[EVENTS_MAX];
+  bool running = true;
+  while (running) {
+    int count = epoll_wait(loop->epoll_fd, events, EVENTS_MAX, -1);
+    if (count < 0 && errno != EINTR) {
+      err(1, "epoll_wait");
+    }
+    for (int i = 0; i < count; ++i) {
+      void* tag = events[i].data.ptr;
+      if (tag == &server->stop_fd) {
+        running = false;
+      } else if (tag == &server->unix_fd || tag == &server->tcp_fd) {
+        accept_connections(loop, *(int*)tag, tag == &server->tcp_fd);
+      } else {
+        connection_t* connection = tag;
+        if (serve(loop, connection, events[i].events) != SUCCESS) {
+          connection_free(loop, &connection);
+        }
+      }
+    }
+  }
+  while (loop->connections) {
+    connection_t* connection = loop->connections;
+    connection_free(loop, &connection);
+  }
+  return NULL;
+}
+
+static int listen_unix(const char* path) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    warnx("socket path too long: %s", path);
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    warn("socket");
+    return -1;
+  }
+  // a socket file left by a server that did not shut down cleanly
+  unlink(path);
+  if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    warn("%s", path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int listen_tcp(int port) {
+  struct sockaddr_in address = {.sin_family = AF_INET,
+                                .sin_port = htons(port),
+                                .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    warn("socket");
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    warn("port %d", port);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [-u PATH] [-p PORT] [-t THREADS] " KVS_CLI_USAGE
+          " DIRECTORY POLICY CAPACITY\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  kvs_config_t config;
+  kvs_config_init(&config, NULL, KVS_CACHE_NONE, 0);
+  const char* path = NULL;
+  int port = 0;
+  int threads = 4;
+  int opt;
+  while ((opt = getopt(argc, argv, "u:p:t:" KVS_CLI_OPTIONS)) != -1) {
+    switch (opt) {
+      case 'u':
+        path = optarg;
+        break;
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 't':
+        threads = atoi(optarg);
+        break;
+      default:
+        if (kvs_cli_option(&config, opt, optarg) != SUCCESS) {
+          usage(argv[0]);
+          return 1;
+        }
+    }
+  }
+  if (argc - optind != 3 || (path == NULL && port <= 0) || threads < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  kvs_cli_store(&config, argv[optind], argv[optind + 1], argv[optind + 2]);
+
+  // SIGINT and SIGTERM are taken by `sigwait` below, in this thread only: the
+  // loops inherit the mask
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  server_t server = {.unix_fd = -1, .tcp_fd = -1};
+  if ((path && (server.unix_fd = listen_unix(path)) < 0) ||
+      (port > 0 && (server.tcp_fd = listen_tcp(port)) < 0)) {
+    return 1;
+  }
+  server.stop_fd = eventfd(0, EFD_CLOEXEC);
+  server.kvs = kvs_new_config(&config);
+  if (server.stop_fd < 0 || server.kvs == NULL) {
+    fprintf(stderr, "kvs_new failed\n");
+    return 1;
+  }
+
+  loop_t* loops = calloc(threads, sizeof(loop_t));
+  if (loops == NULL) {
+    return 1;
+  }
+  for (int i = 0; i < threads; ++i) {
+    loops[i].server = &server;
+    loops[i].epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    // the stop event is never read, so it wakes every loop
+    if (loops[i].epoll_fd < 0 ||
+        watch(loops[i].epoll_fd, server.unix_fd, &server.unix_fd,
+              EPOLLIN | EPOLLEXCLUSIVE) != SUCCESS ||
+        watch(loops[i].epoll_fd, server.tcp_fd, &server.tcp_fd,
+              EPOLLIN | EPOLLEXCLUSIVE) != SUCCESS ||
+        watch(loops[i].epoll_fd, server.stop_fd, &server.stop_fd, EPOLLIN) !=
+            SUCCESS) {
+      err(1, "epoll");
+    }
+    pthread_create(&loops[i].thread, NULL, event_loop, &loops[i]);
+  }
+
+  int received;
+  sigwait(&signals, &received);
+  uint64_t one = 1;
+  if (write(server.stop_fd, &one, sizeof(one)) != sizeof(one)) {
+    err(1, "eventfd");
+  }
+  for (int i = 0; i < threads; ++i) {
+    pthread_join(loops[i].thread, NULL);
+    close(loops[i].epoll_fd);
+  }
+  free(loops);
+  if (server.unix_fd >= 0) {
+    close(server.unix_fd);
+    unlink(path);
+  }
+  if (server.tcp_fd >= 0) {
+    close(server.tcp_fd);
+  }
+  close(server.stop_fd);
+
+  kvs_flush(server.kvs);
+  kvs_free(&server.kvs);
+  return 0;
+}